@@ -140,7 +140,12 @@ else    % do magic wand in 3d
     
     datasetImage = squeeze(cell2mat(obj.mibModel.getData3D('image', NaN, orient, col_channel, options)));
     waitbar(0.3, wb);
-    selarea = uint8(regiongrowing(datasetImage, dMaxDif, [h, w, z]));
+    % grow in the class of the image and get only the bounding box of the region
+    [selCrop, cropOffset] = regiongrowing(datasetImage, dMaxDif, [h, w, z], 'crop');
+    selarea = zeros(size(datasetImage), 'uint8');
+    selarea(cropOffset(1):cropOffset(1)+size(selCrop,1)-1, cropOffset(2):cropOffset(2)+size(selCrop,2)-1, ...
+        cropOffset(3):cropOffset(3)+size(selCrop,3)-1) = uint8(selCrop);
+    clear selCrop;
     waitbar(0.65, wb);
     % limit to the selected material of the model
     if obj.mibModel.I{obj.mibModel.Id}.fixSelectionToMaterial == 1
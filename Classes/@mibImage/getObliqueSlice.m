@@ -0,0 +1,109 @@
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU General Public License for more details.
+% You should have received a copy of the GNU General Public License
+% along with this program.  If not, see <https://www.gnu.org/licenses/>
+
+% Author: Ilya Belevich, University of Helsinki (ilya.belevich @ helsinki.fi)
+% part of Microscopy Image Browser, http:\\mib.helsinki.fi
+% Date: 19.10.2026
+
+function slice = getObliqueSlice(obj, origin, dirU, dirV, imgSize, options)
+% function slice = getObliqueSlice(obj, origin, dirU, dirV, imgSize, options)
+% Get an oblique slice of the image, a plane with any orientation that is
+% sampled directly from the dataset, without reslicing or transposing it
+%
+% Parameters:
+% origin: [y x z] coordinate of the first pixel of the slice, in pixels
+% dirU: [y x z] step in the dataset between two rows of the slice
+% dirV: [y x z] step in the dataset between two columns of the slice
+% imgSize: [height width] of the slice
+% options: [@em optional], structure with additional parameters
+%       -> .method: [@em optional], interpolation method 'linear' (default), 'cubic' or 'nearest'
+%       -> .t: [@em optional], time point, default the current time point
+%       -> .fillValue: [@em optional], when 0 the points outside the dataset are zero, when NaN (default) the nearest point of the dataset is used; other values are not supported
+%
+% Return values:
+% slice: the slice [height, width, color] in the class of the dataset,
+% slice(i,j,:) is the dataset at origin+(i-1)*dirU+(j-1)*dirV; empty for virtual datasets
+%
+% Without the compiled oblique_slice the slice is interpolated with interpn,
+% which gives the same result for 'linear' and 'nearest'; for 'cubic' it
+% handles the border of the dataset differently, and it uses 'linear' for
+% datasets with fewer than 4 pixels in any dimension
+
+%|
+% @b Examples:
+% @code a = pi/6; u = [cos(a) 0 sin(a)];    // 30 degrees around the x axis @endcode
+% @code slice = obj.mibModel.I{obj.mibModel.Id}.getObliqueSlice([1 1 1], u, [0 1 0], [512 512]);      // call from mibController @endcode
+
+% Updates
+%
+
+slice = [];
+if nargin < 6; options = struct(); end
+if ~isfield(options, 'method'); options.method = 'linear'; end
+if ~isfield(options, 't'); options.t = obj.slices{5}(1); end
+if ~isfield(options, 'fillValue'); options.fillValue = NaN; end
+
+if obj.Virtual.virtual == 1
+    errordlg('Not yet implemented!');
+    return;
+end
+
+if ~isscalar(options.fillValue) || (options.fillValue ~= 0 && ~isnan(options.fillValue))
+    errordlg(sprintf('!!! Error !!!\n\nWrong fill value, please use 0 or NaN'), 'Wrong fill value');
+    return;
+end
+
+methodsList = {'linear', 'cubic', 'nearest'};
+mode = find(strcmp(options.method, methodsList))*2-2 + (options.fillValue == 0);
+if isempty(mode)
+    errordlg(sprintf('!!! Error !!!\n\nWrong interpolation method, please use linear, cubic or nearest'), 'Wrong method');
+    return;
+end
+
+origin = double(origin(:))';
+dirU = double(dirU(:))';
+dirV = double(dirV(:))';
+imgSize = double(imgSize(:))';
+if exist('oblique_slice', 'file') == 3 && ismember(class(obj.img{1}), {'uint8', 'uint16', 'single', 'double'})
+    % the slice is sampled from obj.img{1} in place
+    slice = oblique_slice(obj.img{1}, origin, dirU, dirV, imgSize, mode, options.t);
+    return;
+end
+
+% without the mex file, interpolate every color channel on the grid of the slice
+[iGrid, jGrid] = ndgrid(0:imgSize(1)-1, 0:imgSize(2)-1);
+imgDims = size(obj.img{1});
+imgDims(end+1:4) = 1;
+height = imgDims(1); width = imgDims(2); colors = imgDims(3); depth = imgDims(4);
+yi = origin(1) + iGrid*dirU(1) + jGrid*dirV(1);
+xi = origin(2) + iGrid*dirU(2) + jGrid*dirV(2);
+zi = origin(3) + iGrid*dirU(3) + jGrid*dirV(3);
+if isnan(options.fillValue)
+    yi = min(max(yi, 1), height);
+    xi = min(max(xi, 1), width);
+    zi = min(max(zi, 1), depth);
+end
+if strcmp(options.method, 'cubic') && min([height, width, depth]) < 4; options.method = 'linear'; end
+padDims = 1 + ([height, width, depth] == 1);    % interpn needs two points in every dimension
+if options.fillValue == 0
+    % the copy of a singleton dimension is outside the dataset
+    outside = yi > height | xi > width | zi > depth;
+end
+slice = zeros([imgSize, colors], class(obj.img{1}));   %#ok<ZEROLIKE>
+for colId = 1:colors
+    vol = reshape(obj.img{1}(:,:,colId,:,options.t), [height, width, depth]);
+    vol = repmat(vol, padDims);
+    if ~isa(vol, 'double'); vol = single(vol); end
+    sliceCh = interpn(vol, yi, xi, zi, options.method, 0);
+    if options.fillValue == 0; sliceCh(outside) = 0; end
+    slice(:,:,colId) = sliceCh;
+end
@@ -282,6 +282,8 @@ classdef mibImage < matlab.mixin.Copyable
 
         [lowIn, highIn, lowOut, highOut] = getImAdjustStretchCoef(obj, channel)     % Return image stretching coefficients to be used for imadjust function to stretch contrast of the image
         
+        slice = getObliqueSlice(obj, origin, dirU, dirV, imgSize, options)     % Get an oblique slice of the image, sampled directly from the dataset without reslicing it
+        
         dataset = getPixelIdxList(obj, type, PixelIdxList, options)     % Get dataset from the list of pixel indices
         
         bb = getROIBoundingBox(obj, roiIndex)        % return the bounding box info for the ROI at the current orientation
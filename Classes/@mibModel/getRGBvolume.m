@@ -25,7 +25,9 @@ function imgRGB = getRGBvolume(obj, img, options)
 %                   greyscale volume rendering 'bw', color volume rendering
 %                   'color' and volume rendering with shading 'shaded'
 % @li .Mview -> this 4x4 matrix is the viewing matrix
-%                   defaults to [1 0 0 0;0 1 0 0;0 0 1 0;0 0 0 1]
+%                   defaults to [1 0 0 0;0 1 0 0;0 0 1 0;0 0 0 1], a 4x4xN
+%                   stack of viewing matrices renders N frames in one call,
+%                   only for the 'mip' and 'bw' render types
 % @li .ImageSize -> size of the rendered image, defaults to [400 400]
 % @li .ShearInterp -> interpolation method used in the Shear steps
 %                   of the shearwarp algoritm, nearest or (default) bilinear
@@ -41,9 +43,14 @@ function imgRGB = getRGBvolume(obj, img, options)
 % @li .LightVector -> Light Direction defaults to [0.67 0.33 -0.67]
 % @li .ViewerVector -> View vector X,Y,Z defaults to [0 0 1]
 % @li .ShadingMaterial -> The type of material shading : dull, shiny(default) or metal.
+% @li .NormalCache -> keep the normals of the volume between calls for shaded,
+%                   default false; true keeps 16-bit normals of the last 4
+%                   rendered channels in memory, so that the frames of a
+%                   movie or animation only calculate them once
 %
 % Return values:
-% imgRGB: - RGB image with combined layers, [1:height, 1:width, 1:3]
+% imgRGB: - RGB image with combined layers, [1:height, 1:width, 1:3],
+% or [1:height, 1:width, 1:3, 1:N] for N viewing matrices
 %
 
 % Updates
@@ -62,9 +69,18 @@ else
     colorIndices = colorIndices(1:min(3,numel(colorIndices)));
 end
 
-R = zeros([options.ImageSize(1), options.ImageSize(2)]);
-G = zeros([options.ImageSize(1), options.ImageSize(2)]);
-B = zeros([options.ImageSize(1), options.ImageSize(2)]);
+nFrames = 1;
+if isfield(options, 'Mview'); nFrames = size(options.Mview, 3); end
+if nFrames > 1 && isfield(options, 'RenderType') && ~ismember(options.RenderType, {'mip', 'bw'})
+    % 'color' and 'shaded' render [height, width, 3, N] frames, which can not be combined with the color channels
+    errordlg(sprintf('!!! Error !!!\n\nA stack of viewing matrices can only be rendered with the mip or bw render type'), 'Wrong render type');
+    imgRGB = [];
+    return;
+end
+
+R = zeros([options.ImageSize(1), options.ImageSize(2), 1, nFrames]);
+G = zeros([options.ImageSize(1), options.ImageSize(2), 1, nFrames]);
+B = zeros([options.ImageSize(1), options.ImageSize(2), 1, nFrames]);
 
 % force to change ShearInterp for a single slice
 if size(img, 4) == 1
@@ -75,6 +91,9 @@ for colCh = 1:numel(colorIndices)
     options.imin = currViewPort.min(colorIndices(colCh));
     options.imax = currViewPort.max(colorIndices(colCh));
     imgOut = render(squeeze(img(:,:,colorIndices(colCh),:)), options);
+    if nFrames > 1  % frames of the views, [height, width, N] -> [height, width, 1, N]
+        imgOut = reshape(imgOut, [options.ImageSize(1), options.ImageSize(2), 1, nFrames]);
+    end
     
     %if currViewPort.min(colorIndices(colCh)) ~= 0 || currViewPort.max(colorIndices(colCh)) ~= max_int || currViewPort.gamma(colorIndices(colCh)) ~= 1
     %    imgOut = imadjust(imgOut, [currViewPort.min(colorIndices(colCh))/max_int ...
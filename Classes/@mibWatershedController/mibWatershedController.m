@@ -519,7 +519,7 @@ classdef mibWatershedController  < handle
                         
                         [Dxx, Dyy, Dzz, Dxy, Dxz, Dyz] = Hessian3D(img, eigenSigma);
                         waitbar(0.75, wb, sprintf('Calculation of eigen values...\nPlease wait...'));
-                        [~, ~, Lambda3] = eig3volume(Dxx,Dxy,Dxz,Dyy,Dyz,Dzz);
+                        Lambda3 = eig3volume(Dxx,Dxy,Dxz,Dyy,Dyz,Dzz, 3);
                         minVal = min(min(min(Lambda3)));
                         maxVal = max(max(max(Lambda3)));
                         img = uint8((Lambda3-minVal)/(maxVal-minVal)*255);
@@ -532,9 +532,9 @@ classdef mibWatershedController  < handle
                         invertImage = 0;
                     elseif gradientSw == 0 && eigenSw == 1
                         waitbar(0.45, wb, sprintf('Calculating Hessian 3D...\nPlease wait...'));
-                        [Dxx, Dyy, Dzz, Dxy, Dxz, Dyz] = Hessian3D(double(img), eigenSigma);
+                        [Dxx, Dyy, Dzz, Dxy, Dxz, Dyz] = Hessian3D(img, eigenSigma);
                         waitbar(0.75, wb, sprintf('Calculation of eigen values...\nPlease wait...'));
-                        [~, ~, Lambda3] = eig3volume(Dxx,Dxy,Dxz,Dyy,Dyz,Dzz);
+                        Lambda3 = eig3volume(Dxx,Dxy,Dxz,Dyy,Dyz,Dzz, 3);
                         minVal = min(min(min(Lambda3)));
                         maxVal = max(max(max(Lambda3)));
                         img = uint8((Lambda3-minVal)/(maxVal-minVal)*255);
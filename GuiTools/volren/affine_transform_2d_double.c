@@ -1,5 +1,6 @@
 #include "mex.h"
 #include "math.h"
+#include "string.h"
 #include "image_interpolation.h"
 
 /*   undef needed for LCC compiler  */
@@ -15,10 +16,11 @@
  Affine transformation function (Rotation, Translation, Resize)
  This function transforms a volume with a 3x3 transformation matrix 
 
- Iout=affine_transform_2d_double(Iin,Minv,mode,ImagSize)
+ Iout=affine_transform_2d_double(Iin,Minv,mode,ImagSize,Class)
 
  inputs,
-   Iin: The color or greyscale 2D input image
+   Iin: The color or greyscale 2D input image, of class double, single,
+        uint8 or uint16
    Minv: The (inverse) 3x3 transformation matrix
    mode: If 0: linear interpolation and outside pixels set to nearest pixel
             1: linear interpolation and outside pixels set to zero
@@ -28,9 +30,15 @@
 			5: nearest interpolation and outside pixels set to zero
   (optional) 
 	ImageSize: Size of output imgage
+    Class: 'double' for a double output image, the interpolated values are
+           then not rounded
+
+ Iface=affine_transform_2d_double('interface') returns 2 for this
+ interface, older builds only take double images.
 
  output,
-   Iout: The transformed image
+   Iout: The transformed image, of the same class as Iin (integer classes
+         are rounded and clamped), or double
 
  example,
    % Read image
@@ -42,214 +50,225 @@
    % Show the image
    figure, imshow(Iout);
 
+ The image is read in its own class, with the row kernels of
+ image_interpolation.c, the coordinates are stepped along every output
+ row. The output image is divided in blocks of rows, one contiguous block per
+ thread. The worker threads are created at the first call and kept until
+ the mex file is cleared, every call only wakes them up, so rendering
+ many slices or frames does not create threads every time.
+
  Function is written by D.Kroon University of Twente (June 2009)
  
  Update: 20.04.2016, Ilya Belevich replace maxNumCompThreads with feature("Numcores")
 */
 
-#ifdef _WIN32
-  unsigned __stdcall transformvolume_gray(double **Args) {
-#else
-  void transformvolume_gray(double **Args) {
-#endif
-    double *Isize_d, *A, *Iin, *Iout, *ThreadID, *moded, *Jsize_d;
-    int Isize[3]={0,0,0};
-	int Jsize[3]={0,0,0};
+/* The transformation of one call */
+typedef struct {
+    const void *Iin;
+    void *Iout;
+    int itype;
+    int otype;
+    double A[9];
+    int Isize[3];
+    int Jsize[3];
+    int mode;
+} TransformJob;
+
+/* Store a row of interpolated values in the output image, in its class,
+ * integer classes are rounded and clamped as in Matlab */
+static void store_row(TransformJob *J, double *row, int n, size_t index) {
+    int x;
+    double v;
+    switch(J->otype) {
+        case IMAGE_SINGLE:
+            for (x=0; x<n; x++) { ((float *)J->Iout)[index+x]=(float)row[x]; }
+            break;
+        case IMAGE_UINT8:
+            for (x=0; x<n; x++) {
+                v=row[x]+0.5; if(v<0) { v=0; } if(v>255) { v=255; }
+                ((unsigned char *)J->Iout)[index+x]=(unsigned char)v;
+            }
+            break;
+        case IMAGE_UINT16:
+            for (x=0; x<n; x++) {
+                v=row[x]+0.5; if(v<0) { v=0; } if(v>65535) { v=65535; }
+                ((unsigned short *)J->Iout)[index+x]=(unsigned short)v;
+            }
+            break;
+        default:
+            for (x=0; x<n; x++) { ((double *)J->Iout)[index+x]=row[x]; }
+            break;
+    }
+}
+
+/* Transform a contiguous block of rows of the output image, block ThreadID
+ * of Nthreads, every color channel is interpolated as a gray image */
+static void transform_block(TransformJob *J, int ThreadID, int Nthreads) {
 	double Imean[2]={0,0};
 	double Jmean[2]={0,0};
-    int mode=0;
-    int x,y;
-	double *Nthreadsd;
-    int Nthreads;
+    int y, y0, y1, rgb;
+    double *A=J->A, *row, Tx, Ty;
+    size_t esize, nin=(size_t)J->Isize[0]*J->Isize[1], nout=(size_t)J->Jsize[0]*J->Jsize[1];
+    const char *Iin;
 
-    /* Location of pixel which will be come the current pixel */
-    double Tlocalx;
-    double Tlocaly;
-    
-    /* X,Y,Z coordinates of current pixel */
-    double xd,yd;
+    switch(J->itype) {
+        case IMAGE_SINGLE: esize=sizeof(float); break;
+        case IMAGE_UINT8: esize=sizeof(unsigned char); break;
+        case IMAGE_UINT16: esize=sizeof(unsigned short); break;
+        default: esize=sizeof(double); break;
+    }
 
-	/* Parts of location calculation */
-	double compa0, compa1, compb0, compb1;
-	
-    /* Variables to store 1D index */
-    int indexI;
-    
-    /* Cubic and outside black booleans */
-    bool black, cubic;
-    
-    /* Multiple threads, one does the odd the other even indexes */
-    int ThreadOffset;
-    /* int start; */
-    /* int end;; */
-    
-    Isize_d=Args[0];
-   	Jsize_d=Args[1];
-	A=Args[2];
-    Iin=Args[3];
-    Iout=Args[4];
-    ThreadID=Args[5];
-    moded=Args[6]; mode=(int) moded[0];
-    Nthreadsd=Args[7];  Nthreads=(int)Nthreadsd[0];
-  
 	/* Center of the image */
-	Imean[0]=Isize_d[0]/2;	Imean[1]=Isize_d[1]/2;  
-    Jmean[0]=Jsize_d[0]/2;	Jmean[1]=Jsize_d[1]/2; 
-                    
-    black = true;
-    cubic = false;
-    if(mode==0||mode==2){ black = false; } else { black = true; }
-    if(mode==0||mode==1){ cubic = false; } else { cubic = true; }
-    
-    
-    Isize[0] = (int)Isize_d[0]; 
-    Isize[1] = (int)Isize_d[1]; 
-    Isize[2] = (int)Isize_d[2]; 
-	
-	Jsize[0] = (int)Jsize_d[0]; 
-    Jsize[1] = (int)Jsize_d[1]; 
-    Jsize[2] = (int)Jsize_d[2]; 
-	    
-    ThreadOffset=(int) ThreadID[0];
-	
-	compb0= A[2] + Imean[0];
-	compb1= A[5] + Imean[1];
+	Imean[0]=J->Isize[0]/2.0;	Imean[1]=J->Isize[1]/2.0;  
+    Jmean[0]=J->Jsize[0]/2.0;	Jmean[1]=J->Jsize[1]/2.0; 
 
-    /*  Loop through all image pixel coordinates */
-    for (y=ThreadOffset; y<Jsize[1]; y=y+Nthreads)
+    row=(double *)malloc(J->Jsize[0]*sizeof(double));
+    y0=(J->Jsize[1]*ThreadID)/Nthreads;
+    y1=(J->Jsize[1]*(ThreadID+1))/Nthreads;
+    for (y=y0; y<y1; y++)
     {
-		yd=(double)y-Jmean[1];
-		compa0 = A[1] *yd + compb0;
-		compa1 = A[4] *yd + compb1;
-
-        for (x=0; x<Jsize[0]; x++)
+        /* Location of the first pixel of the row, the next pixels are
+         * A[0], A[3] further */
+        Tx = A[0]*(-Jmean[0]) + A[1]*((double)y-Jmean[1]) + A[2] + Imean[0];
+        Ty = A[3]*(-Jmean[0]) + A[4]*((double)y-Jmean[1]) + A[5] + Imean[1];
+        for (rgb=0; rgb<J->Isize[2]; rgb++)
         {
-            xd=(double)x-Jmean[0];
-            Tlocalx =  A[0] * xd + compa0;
-            Tlocaly =  A[3] * xd + compa1;
-
-            /* Set the current pixel value */
-            indexI=mindex2(x,y,Jsize[0]);
-            
-            /* interpolate the intensities */
-            Iout[indexI]=interpolate_2d_double_gray(Tlocalx, Tlocaly, Isize, Iin,cubic,black); 
+            Iin=(const char *)J->Iin+rgb*nin*esize;
+            interpolate_2d_row(row, J->Jsize[0], Tx, Ty, A[0], A[3], J->Isize, Iin, J->itype, J->mode);
+            store_row(J, row, J->Jsize[0], rgb*nout+(size_t)y*J->Jsize[0]);
         }
     }
-   
-    /*  explicit end thread, helps to ensure proper recovery of resources allocated for the thread */
-    #ifdef _WIN32
-	_endthreadex( 0 );
-    return 0;
-	#else
-	pthread_exit(NULL);
-	#endif
+    free(row);
 }
 
+/* The persistent worker threads, pool_nworkers threads do the first blocks
+ * of rows and the calling thread does the last block */
+static int pool_created=0;
+static int pool_nworkers=0;
+static int pool_quit=0;
+static int *pool_ids=NULL;
+static TransformJob pool_job;
 #ifdef _WIN32
-  unsigned __stdcall transformvolume_color(double **Args) {
+    static HANDLE *pool_list=NULL;
+    static HANDLE *pool_start=NULL;
+    static HANDLE pool_finish;
+    static volatile LONG pool_busy=0;
 #else
-  void transformvolume_color(double **Args) {
+    static pthread_t *pool_list=NULL;
+    static pthread_mutex_t pool_lock=PTHREAD_MUTEX_INITIALIZER;
+    static pthread_cond_t pool_start=PTHREAD_COND_INITIALIZER;
+    static pthread_cond_t pool_finish=PTHREAD_COND_INITIALIZER;
+    static int pool_generation=0;
+    static int pool_busy=0;
 #endif
-    double *Isize_d, *A, *Iin, *Iout, *ThreadID, *moded, *Jsize_d;
-    int Isize[3]={0,0,0};
-	int Jsize[3]={0,0,0};
-	double Imean[2]={0,0};
-	double Jmean[2]={0,0};
-    int mode=0;
-    int x,y;
-	double *Nthreadsd;
-    int Nthreads;
 
-    /* Location of pixel which will be come the current pixel */
-    double Tlocalx;
-    double Tlocaly;
-    
-    /* X,Y,Z coordinates of current pixel */
-    double xd,yd;
+#ifdef _WIN32
+  unsigned __stdcall pool_worker(int *ThreadID) {
+    while(1) {
+        WaitForSingleObject(pool_start[*ThreadID], INFINITE);
+        if(pool_quit) { break; }
+        transform_block(&pool_job, *ThreadID, pool_nworkers+1);
+        if(InterlockedDecrement(&pool_busy)==0) { SetEvent(pool_finish); }
+    }
+	_endthreadex( 0 );
+    return 0;
+  }
+#else
+  void pool_worker(int *ThreadID) {
+    /* pool_create starts the generations at zero, a job can be posted
+     * before this thread runs */
+    int generation=0;
+    pthread_mutex_lock(&pool_lock);
+    while(1) {
+        while((pool_generation==generation)&&!pool_quit) { pthread_cond_wait(&pool_start, &pool_lock); }
+        if(pool_quit) { break; }
+        generation=pool_generation;
+        pthread_mutex_unlock(&pool_lock);
+        transform_block(&pool_job, *ThreadID, pool_nworkers+1);
+        pthread_mutex_lock(&pool_lock);
+        pool_busy--;
+        if(pool_busy==0) { pthread_cond_signal(&pool_finish); }
+    }
+    pthread_mutex_unlock(&pool_lock);
+	pthread_exit(NULL);
+  }
+#endif
 
-	/* Parts of location calculation */
-	double compa0, compa1, compb0, compb1;
-	
-    /* loop throught the colors r,g,b */
-    int rgb=0;
-            
-    /* Variables to store 1D index */
-    int indexI;
-    
-    /* Current voxel/pixel */
-    double Ipixel[3]={0,0,0};
-    
-    /* Cubic and outside black booleans */
-    bool black, cubic;
-    
-    /* Multiple threads, one does the odd the other even indexes */
-    int ThreadOffset;
-    /* int start; */
-    /* int end;; */
-    
-    Isize_d=Args[0];
-    Jsize_d=Args[1];
-	A=Args[2];
-    Iin=Args[3];
-    Iout=Args[4];
-    ThreadID=Args[5];
-    moded=Args[6]; mode=(int) moded[0];
-    Nthreadsd=Args[7];  Nthreads=(int)Nthreadsd[0];
-	
-	/* Center of the image */
-	Imean[0]=Isize_d[0]/2;	Imean[1]=Isize_d[1]/2;  
-    Jmean[0]=Jsize_d[0]/2;	Jmean[1]=Jsize_d[1]/2; 
-        
-    black = true;
-    cubic = false;
-    if(mode==0||mode==2){ black = false; } else { black = true; }
-    if(mode==0||mode==1){ cubic = false; } else { cubic = true; }
-    
-    Isize[0] = (int)Isize_d[0]; 
-    Isize[1] = (int)Isize_d[1]; 
-    Isize[2] = (int)Isize_d[2]; 
-    
-    Jsize[0] = (int)Jsize_d[0]; 
-    Jsize[1] = (int)Jsize_d[1]; 
-    Jsize[2] = (int)Jsize_d[2]; 
-	
-    ThreadOffset=(int) ThreadID[0];
-	
-	compb0= A[2] + Imean[0];
-	compb1= A[5] + Imean[1];
+/* Stop and join the worker threads, when the mex file is cleared */
+static void pool_shutdown(void) {
+    int i;
+    if(!pool_created) { return; }
+	#ifdef _WIN32
+        pool_quit=1;
+        for (i=0; i<pool_nworkers; i++) { SetEvent(pool_start[i]); }
+		for (i=0; i<pool_nworkers; i++) { WaitForSingleObject(pool_list[i], INFINITE); }
+		for (i=0; i<pool_nworkers; i++) { CloseHandle(pool_list[i]); CloseHandle(pool_start[i]); }
+        CloseHandle(pool_finish);
+        free(pool_start);
+	#else
+        pthread_mutex_lock(&pool_lock);
+        pool_quit=1;
+        pthread_cond_broadcast(&pool_start);
+        pthread_mutex_unlock(&pool_lock);
+		for (i=0; i<pool_nworkers; i++) { pthread_join(pool_list[i],NULL); }
+	#endif
+    free(pool_list);
+    free(pool_ids);
+    pool_quit=0;
+    pool_nworkers=0;
+    pool_created=0;
+}
 
-    
-    /*  Loop through all image pixel coordinates */
-    for (y=ThreadOffset; y<Jsize[1]; y=y+Nthreads)
+/* Create the worker threads, Nthreads-1 workers and the calling thread */
+static void pool_create(int Nthreads) {
+    int i;
+    pool_nworkers=Nthreads-1;
+    pool_ids=(int *)malloc((pool_nworkers+1)*sizeof(int));
+	#ifdef _WIN32
+		pool_list = (HANDLE*)malloc((pool_nworkers+1)* sizeof( HANDLE ));
+		pool_start = (HANDLE*)malloc((pool_nworkers+1)* sizeof( HANDLE ));
+        pool_finish = CreateEvent(NULL, FALSE, FALSE, NULL);
+    #else
+		pool_list = (pthread_t*)malloc((pool_nworkers+1)* sizeof( pthread_t ));
+        pool_generation=0;
+	#endif
+    for (i=0; i<pool_nworkers; i++)
     {
-		yd=(double)y-Jmean[1];
-		compa0 = A[1] *yd + compb0;
-		compa1 = A[4] *yd + compb1;
-
-        for (x=0; x<Jsize[0]; x++)
-        {
-            xd=(double)x-Jmean[0];
-            Tlocalx =  A[0] * xd + compa0;
-            Tlocaly =  A[3] * xd + compa1;
-
-            /* interpolate the intensities */
-            interpolate_2d_double_color(Ipixel,Tlocalx, Tlocaly, Isize, Iin,cubic,black); 
-            
-            /* Set the current pixel value */
-            indexI=mindex2(x,y,Jsize[0]);
-            for (rgb=0; rgb<3; rgb++)
-            {
-                Iout[indexI+rgb*Jsize[0]*Jsize[1]]=Ipixel[rgb];
-            }
-        }
+        pool_ids[i]=i;
+		#ifdef _WIN32
+            pool_start[i] = CreateEvent(NULL, FALSE, FALSE, NULL);
+			pool_list[i] = (HANDLE)_beginthreadex( NULL, 0, &pool_worker, &pool_ids[i] , 0, NULL );
+		#else
+			pthread_create ((pthread_t*)&pool_list[i], NULL, (void *) &pool_worker, &pool_ids[i]);
+		#endif
     }
-   
-    /*  explicit end thread, helps to ensure proper recovery of resources allocated for the thread */
-    #ifdef _WIN32
-	_endthreadex( 0 );
-    return 0;
+    pool_created=1;
+    mexAtExit(pool_shutdown);
+}
+
+/* Transform the image with the worker threads and the calling thread */
+static void pool_run(TransformJob *J) {
+	#ifdef _WIN32
+        int i;
+	#endif
+    if(pool_nworkers==0) { transform_block(J, 0, 1); return; }
+	#ifdef _WIN32
+        pool_job=*J;
+        pool_busy=pool_nworkers;
+        for (i=0; i<pool_nworkers; i++) { SetEvent(pool_start[i]); }
+        transform_block(J, pool_nworkers, pool_nworkers+1);
+        WaitForSingleObject(pool_finish, INFINITE);
 	#else
-	pthread_exit(NULL);
+        pthread_mutex_lock(&pool_lock);
+        pool_job=*J;
+        pool_busy=pool_nworkers;
+        pool_generation++;
+        pthread_cond_broadcast(&pool_start);
+        pthread_mutex_unlock(&pool_lock);
+        transform_block(J, pool_nworkers, pool_nworkers+1);
+        pthread_mutex_lock(&pool_lock);
+        while(pool_busy>0) { pthread_cond_wait(&pool_finish, &pool_lock); }
+        pthread_mutex_unlock(&pool_lock);
 	#endif
 }
 
@@ -257,169 +276,105 @@
 void mexFunction( int nlhs, mxArray *plhs[],
                   int nrhs, const mxArray *prhs[] )
 {
-    /* Ox and Oy are the grid points */
-    /* Zo is the input image */
-    /* Zi is the transformed image */
-    /* nx and ny are the number of grid points (inside the image) */
-    double *Iin, *Iout, *M, *moded;
+    double *M;
     mxArray *matlabCallOut[1]={0};
-    //mxArray *matlabCallIn[1]={0};     // commented by Ilya Belevich
-    mxArray *matlabCallIn[1]={mxCreateString("Numcores")};  // added by Ilya Belevich
-    
-    double *Nthreadsd;
+    mxArray *matlabCallIn[1]={0};
     int Nthreads;
-            
-    /* double pointer array to store all needed function variables) */
-    double ***ThreadArgs;
-    double **ThreadArgs1;
-    
-	/* Handles to the worker threads */
-	#ifdef _WIN32
-		HANDLE *ThreadList; 
-    #else
-		pthread_t *ThreadList;
-	#endif
-    
-    /* ID of Threads */
-    double **ThreadID;              
-    double *ThreadID1;
     
-    /* Transformation matrix */
-    double A[9]={0,0,0,0,0,0,0,0,0};
-
-    /* Loop variable  */
-    int i;
+    /* The transformation */
+    TransformJob J;
     
     /* Size of input image */
-    double Isize_d[3]={0,0,0};
-	double Jsize_d[3]={0,0,0};
     int Jdimsc[3]={0,0,0};
     const mwSize *dims;
 	double *Jdims;
+    mxClassID oclass;
+    char str[16];
+
+  /* Report the interface (classes and the Class input), older builds of
+     the mex file error out */
+  if((nrhs==1)&&mxIsChar(prhs[0])) {
+    plhs[0]=mxCreateDoubleScalar(2);
+    return;
+  }
 
   /* Check for proper number of arguments. */
-  if(nrhs<3) {
-    mexErrMsgTxt("3 or 4 inputs are required.");
+  if((nrhs<3)||(nrhs>5)) {
+    mexErrMsgTxt("3 to 5 inputs are required.");
   } else if(nlhs!=1) {
     mexErrMsgTxt("One output required");
   }
   
+  /* The image class */
+  switch(mxGetClassID(prhs[0])) {
+      case mxDOUBLE_CLASS: J.itype=IMAGE_DOUBLE; break;
+      case mxSINGLE_CLASS: J.itype=IMAGE_SINGLE; break;
+      case mxUINT8_CLASS: J.itype=IMAGE_UINT8; break;
+      case mxUINT16_CLASS: J.itype=IMAGE_UINT16; break;
+      default: mexErrMsgTxt("Image must be of class double, single, uint8 or uint16");
+  }
+  J.otype=J.itype;
+  if(nrhs==5) {
+      if(!mxIsChar(prhs[4])||(mxGetString(prhs[4], str, 16)!=0)||(strcmp(str, "double")!=0)) {
+          mexErrMsgTxt("Class must be 'double'");
+      }
+      J.otype=IMAGE_DOUBLE;
+  }
+  
   /* Get the sizes of the image */
   dims = mxGetDimensions(prhs[0]);   
-  Isize_d[0] = (double)dims[0]; Isize_d[1] = (double)dims[1]; 
+  J.Isize[0] = (int)dims[0]; J.Isize[1] = (int)dims[1]; 
   /* Detect if color image */
-  if(mxGetNumberOfDimensions(prhs[0])>2) { Isize_d[2]=(double)3; } else { Isize_d[2]=1; }
+  if(mxGetNumberOfDimensions(prhs[0])>2) { J.Isize[2]=3; } else { J.Isize[2]=1; }
   
   /* Get output image size */
-  if(nrhs==4)
+  if(nrhs>=4)
   {
 	Jdims = mxGetPr(prhs[3]);
-    Jsize_d[0] = (double)Jdims[0]; 
-	Jsize_d[1] = (double)Jdims[1]; 
-    if(Isize_d[2]>0) { Jsize_d[2]=Isize_d[2];  }
+    J.Jsize[0] = (int)Jdims[0]; 
+	J.Jsize[1] = (int)Jdims[1]; 
   }
   else
   {
-    Jsize_d[0] = Isize_d[0]; 
-	Jsize_d[1] = Isize_d[1]; 
-    if(Isize_d[2]>0) { Jsize_d[2]=Isize_d[2];  }
+    J.Jsize[0] = J.Isize[0]; 
+	J.Jsize[1] = J.Isize[1]; 
   }   
+  J.Jsize[2]=J.Isize[2];
    
   /* Create output array */
-  Jdimsc[0]=(int)Jsize_d[0];
-  Jdimsc[1]=(int)Jsize_d[1];
-  Jdimsc[2]=(int)Jsize_d[2];
+  oclass=(J.otype==IMAGE_DOUBLE) ? mxDOUBLE_CLASS : mxGetClassID(prhs[0]);
+  Jdimsc[0]=J.Jsize[0];
+  Jdimsc[1]=J.Jsize[1];
+  Jdimsc[2]=J.Jsize[2];
       
-  if(Isize_d[2]>1) {
-      plhs[0] = mxCreateNumericArray(3, Jdimsc, mxDOUBLE_CLASS, mxREAL);
+  if(J.Isize[2]>1) {
+      plhs[0] = mxCreateNumericArray(3, Jdimsc, oclass, mxREAL);
   }
   else  {
-      plhs[0] = mxCreateNumericArray(2, Jdimsc, mxDOUBLE_CLASS, mxREAL);
+      plhs[0] = mxCreateNumericArray(2, Jdimsc, oclass, mxREAL);
   }
           
   /* Assign pointers to each input. */
-  Iin=mxGetPr(prhs[0]);
+  J.Iin=mxGetData(prhs[0]);
+  J.Iout=mxGetData(plhs[0]);
   M=mxGetPr(prhs[1]);
-  moded=mxGetPr(prhs[2]);
+  J.mode=(int)mxGetScalar(prhs[2]);
  
-  A[0] = M[mindex2(0,0,3)]; A[1] = M[mindex2(0,1,3)]; A[2] = M[mindex2(0,2,3)]; 
-  A[3] = M[mindex2(1,0,3)]; A[4] = M[mindex2(1,1,3)]; A[5] = M[mindex2(1,2,3)]; 
-  A[6] = M[mindex2(2,0,3)]; A[7] = M[mindex2(2,1,3)]; A[8] = M[mindex2(2,2,3)]; 
-  
-	//mexCallMATLAB(1, matlabCallOut, 0, matlabCallIn, "maxNumCompThreads"); // commented by Ilya Belevich
-    mexCallMATLAB(1, matlabCallOut, 1, matlabCallIn, "feature"); // feature('Numcores') added by Ilya Belevich
-    Nthreadsd=mxGetPr(matlabCallOut[0]);
-	Nthreads=(int)Nthreadsd[0];
-    
-    /* Reserve room for handles of threads in ThreadList  */
-	#ifdef _WIN32
-		ThreadList = (HANDLE*)malloc(Nthreads* sizeof( HANDLE ));
-    #else
-		ThreadList = (pthread_t*)malloc(Nthreads* sizeof( pthread_t ));
-	#endif
-	
-	ThreadID = (double **)malloc( Nthreads* sizeof(double *) );
-	ThreadArgs = (double ***)malloc( Nthreads* sizeof(double **) );
-	
-  
-  /* Assign pointer to output. */
-  Iout = mxGetPr(plhs[0]);
+  J.A[0] = M[mindex2(0,0,3)]; J.A[1] = M[mindex2(0,1,3)]; J.A[2] = M[mindex2(0,2,3)]; 
+  J.A[3] = M[mindex2(1,0,3)]; J.A[4] = M[mindex2(1,1,3)]; J.A[5] = M[mindex2(1,2,3)]; 
+  J.A[6] = M[mindex2(2,0,3)]; J.A[7] = M[mindex2(2,1,3)]; J.A[8] = M[mindex2(2,2,3)]; 
   
-  for (i=0; i<Nthreads; i++)
+  /* Start the worker threads at the first call, feature('Numcores') */
+  if(!pool_created)
   {
-    /*  Make Thread ID  */
-    ThreadID1= (double *)malloc( 1* sizeof(double) );
-    ThreadID1[0]=i;
-    ThreadID[i]=ThreadID1;  
-    
-	/*  Make Thread Structure  */
-    ThreadArgs1 = (double **)malloc( 9* sizeof( double * ) );  
-	ThreadArgs1[0]=Isize_d;
-	ThreadArgs1[1]=Jsize_d;
-    ThreadArgs1[2]=A;
-	ThreadArgs1[3]=Iin;
-	ThreadArgs1[4]=Iout;
-	ThreadArgs1[5]=ThreadID[i];
-	ThreadArgs1[6]=moded;
-	ThreadArgs1[7]=Nthreadsd;
-	
-	/* Start a Thread  */
-	ThreadArgs[i]=ThreadArgs1;
-    if(Isize_d[2]>1) {
-		#ifdef _WIN32
-			ThreadList[i] = (HANDLE)_beginthreadex( NULL, 0, &transformvolume_color, ThreadArgs[i] , 0, NULL );
-		#else
-			pthread_create ((pthread_t*)&ThreadList[i], NULL, (void *) &transformvolume_color, ThreadArgs[i]);
-		#endif
-    }
-    else
-    {
-		#ifdef _WIN32
-			ThreadList[i] = (HANDLE)_beginthreadex( NULL, 0, &transformvolume_gray, ThreadArgs[i] , 0, NULL );
-		#else
-			pthread_create ((pthread_t*)&ThreadList[i], NULL, (void *) &transformvolume_gray, ThreadArgs[i]);
-		#endif
-    }
-  }
-   
-	#ifdef _WIN32
-		for (i=0; i<Nthreads; i++) { WaitForSingleObject(ThreadList[i], INFINITE); }
-		for (i=0; i<Nthreads; i++) { CloseHandle( ThreadList[i] ); }
-	#else
-		for (i=0; i<Nthreads; i++) { pthread_join(ThreadList[i],NULL); }
-	#endif
-
-
-  for (i=0; i<Nthreads; i++) 
-  { 
-    free(ThreadArgs[i]);
-    free(ThreadID[i]);
+    matlabCallIn[0]=mxCreateString("Numcores");
+    mexCallMATLAB(1, matlabCallOut, 1, matlabCallIn, "feature");
+	Nthreads=(int)mxGetScalar(matlabCallOut[0]);
+    mxDestroyArray(matlabCallIn[0]);
+    mxDestroyArray(matlabCallOut[0]);
+    if(Nthreads<1) { Nthreads=1; }
+    pool_create(Nthreads);
   }
-
-  free(ThreadArgs);
-  free(ThreadID );
-  free(ThreadList);
-
+  
+  pool_run(&J);
 }
-        
-
@@ -0,0 +1,261 @@
+#include "mex.h"
+#include "math.h"
+#include "image_interpolation.h"
+
+/*   undef needed for LCC compiler  */
+#undef EXTERN_C
+#ifdef _WIN32
+	#include <windows.h>
+	#include <process.h>
+#else
+	#include <pthread.h>
+#endif
+
+/*
+ Affine transformation function (Rotation, Translation, Resize) of a volume
+ This function transforms a volume with a 4x4 transformation matrix
+
+ Iout=affine_transform_3d_double(Iin,M,mode,Box)
+
+ inputs,
+   Iin: The greyscale 3D input volume, of class double, single, uint8 or
+        uint16
+   M: The 4x4 transformation matrix from the output voxel coordinates to
+      the input voxel coordinates, [y x z 1]' in Matlab (1 based) voxel
+      coordinates: Iout(y,x,z) = Iin(M*[y x z 1]')
+   mode: If 0: linear interpolation and outside pixels set to nearest pixel
+            1: linear interpolation and outside pixels set to zero
+            2: cubic interpolation and outsite pixels set to nearest pixel
+            3: cubic interpolation and outside pixels set to zero
+            4: nearest interpolation and outsite pixels set to nearest pixel
+            5: nearest interpolation and outside pixels set to zero
+  (optional)
+    Box: The part of the output volume which is calculated, a 3x2 matrix
+         [y1 y2; x1 x2; z1 z2] of output voxel coordinates, default
+         [1 size(Iin,1); 1 size(Iin,2); 1 size(Iin,3)]
+
+ output,
+   Iout: The transformed volume of size diff(Box,1,2)'+1, of the same class
+         as Iin (integer classes are rounded and clamped)
+
+ example,
+   % Resize a volume to 2x in z, linear interpolation
+   V=uint8(rand(64,64,32)*255);
+   M=[1 0 0 0; 0 1 0 0; 0 0 0.5 0.5; 0 0 0 1];
+   Iout=affine_transform_3d_double(V,M,0,[1 64; 1 64; 1 64]);
+
+ A large output volume can be calculated in slabs of z slices with Box,
+ with only the input slices the slab needs (shift M with the first input
+ slice). The volume is read in its own class, with the 3D row kernels of
+ image_interpolation.c, the coordinates are stepped along every output
+ row. The output slices are divided over feature('Numcores') threads, one
+ contiguous block of slices per thread.
+
+ Function is written by D.Kroon University of Twente (June 2009)
+*/
+
+/* The transformation of one call */
+typedef struct {
+    const void *Iin;
+    void *Iout;
+    int itype;
+    double A[12];
+    int Isize[3];
+    int Jsize[3];
+    int Jstart[3];
+    int mode;
+    int ThreadID;
+    int Nthreads;
+} TransformArgs;
+
+/* Store a row of interpolated values in the output volume, in its class,
+ * integer classes are rounded and clamped as in Matlab */
+static void store_row(TransformArgs *J, double *row, int n, size_t index) {
+    int x;
+    double v;
+    switch(J->itype) {
+        case IMAGE_SINGLE:
+            for (x=0; x<n; x++) { ((float *)J->Iout)[index+x]=(float)row[x]; }
+            break;
+        case IMAGE_UINT8:
+            for (x=0; x<n; x++) {
+                v=row[x]+0.5; if(v<0) { v=0; } if(v>255) { v=255; }
+                ((unsigned char *)J->Iout)[index+x]=(unsigned char)v;
+            }
+            break;
+        case IMAGE_UINT16:
+            for (x=0; x<n; x++) {
+                v=row[x]+0.5; if(v<0) { v=0; } if(v>65535) { v=65535; }
+                ((unsigned short *)J->Iout)[index+x]=(unsigned short)v;
+            }
+            break;
+        default:
+            for (x=0; x<n; x++) { ((double *)J->Iout)[index+x]=row[x]; }
+            break;
+    }
+}
+
+/* Transform a contiguous block of slices of the output volume */
+#ifdef _WIN32
+  unsigned __stdcall transform_slab(TransformArgs *J) {
+#else
+  void transform_slab(TransformArgs *J) {
+#endif
+    int y, z, z0, z1;
+    double *A=J->A, *row, T[3], d[3], qx, qy, qz;
+
+    /* Step along an output row, the first column of M */
+    d[0]=A[0]; d[1]=A[4]; d[2]=A[8];
+
+    row=(double *)malloc(J->Jsize[0]*sizeof(double));
+    z0=(J->Jsize[2]*J->ThreadID)/J->Nthreads;
+    z1=(J->Jsize[2]*(J->ThreadID+1))/J->Nthreads;
+    for (z=z0; z<z1; z++)
+    {
+        for (y=0; y<J->Jsize[1]; y++)
+        {
+            /* Location of the first voxel of the row, in 0 based input
+             * voxel coordinates */
+            qx=(double)J->Jstart[0]; qy=(double)(J->Jstart[1]+y); qz=(double)(J->Jstart[2]+z);
+            T[0] = A[0]*qx + A[1]*qy + A[2]*qz + A[3] - 1;
+            T[1] = A[4]*qx + A[5]*qy + A[6]*qz + A[7] - 1;
+            T[2] = A[8]*qx + A[9]*qy + A[10]*qz + A[11] - 1;
+            interpolate_3d_row(row, J->Jsize[0], T, d, J->Isize, (size_t)J->Isize[0]*J->Isize[1], J->Iin, J->itype, J->mode);
+            store_row(J, row, J->Jsize[0], ((size_t)z*J->Jsize[1]+y)*J->Jsize[0]);
+        }
+    }
+    free(row);
+
+    /*  explicit end thread, helps to ensure proper recovery of resources allocated for the thread */
+	#ifdef _WIN32
+	_endthreadex( 0 );
+    return 0;
+	#else
+	pthread_exit(NULL);
+	#endif
+}
+
+/* The matlab mex function */
+void mexFunction( int nlhs, mxArray *plhs[],
+                  int nrhs, const mxArray *prhs[] )
+{
+    double *M, *Box;
+    mxArray *matlabCallOut[1]={0};
+    mxArray *matlabCallIn[1]={0};
+    int Nthreads, i, itype=IMAGE_DOUBLE;
+    mwSize Jdimsc[3];
+    const mwSize *dims;
+    TransformArgs *ThreadArgs;
+    #ifdef _WIN32
+		HANDLE *ThreadList;
+	#else
+		pthread_t *ThreadList;
+	#endif
+
+  /* Check for proper number of arguments. */
+  if(nrhs<3) {
+    mexErrMsgTxt("3 or 4 inputs are required.");
+  } else if(nlhs!=1) {
+    mexErrMsgTxt("One output required");
+  }
+
+  /* The volume class */
+  switch(mxGetClassID(prhs[0])) {
+      case mxDOUBLE_CLASS: itype=IMAGE_DOUBLE; break;
+      case mxSINGLE_CLASS: itype=IMAGE_SINGLE; break;
+      case mxUINT8_CLASS: itype=IMAGE_UINT8; break;
+      case mxUINT16_CLASS: itype=IMAGE_UINT16; break;
+      default: mexErrMsgTxt("Volume must be of class double, single, uint8 or uint16");
+  }
+  if(mxGetNumberOfDimensions(prhs[0])>3) {
+    mexErrMsgTxt("Volume must be 3D, transform color channels one by one");
+  }
+  if((mxGetClassID(prhs[1])!=mxDOUBLE_CLASS)||(mxGetNumberOfElements(prhs[1])!=16)) {
+    mexErrMsgTxt("Transformation matrix must be a 4x4 double matrix");
+  }
+
+  /* Size of the input volume */
+  dims = mxGetDimensions(prhs[0]);
+  Jdimsc[0] = dims[0]; Jdimsc[1] = dims[1];
+  Jdimsc[2] = (mxGetNumberOfDimensions(prhs[0])>2) ? dims[2] : 1;
+
+  /* Output box, default the size of the input volume */
+  if(nrhs>3)
+  {
+    if((mxGetClassID(prhs[3])!=mxDOUBLE_CLASS)||(mxGetNumberOfElements(prhs[3])!=6)) {
+        mexErrMsgTxt("Box must be a 3x2 double matrix [y1 y2; x1 x2; z1 z2]");
+    }
+    Box=mxGetPr(prhs[3]);
+    for (i=0; i<3; i++)
+    {
+        if(Box[i+3]<Box[i]) { mexErrMsgTxt("Box must have y2>=y1, x2>=x1 and z2>=z1"); }
+    }
+  }
+  else
+  {
+    Box=NULL;
+  }
+
+  /* Number of threads, feature('Numcores') */
+  matlabCallIn[0]=mxCreateString("Numcores");
+  mexCallMATLAB(1, matlabCallOut, 1, matlabCallIn, "feature");
+  Nthreads=(int)mxGetScalar(matlabCallOut[0]);
+  mxDestroyArray(matlabCallIn[0]);
+  mxDestroyArray(matlabCallOut[0]);
+  if(Nthreads<1) { Nthreads=1; }
+
+  ThreadArgs = (TransformArgs*)malloc(Nthreads* sizeof(TransformArgs));
+  ThreadArgs[0].Isize[0]=(int)Jdimsc[0]; ThreadArgs[0].Isize[1]=(int)Jdimsc[1]; ThreadArgs[0].Isize[2]=(int)Jdimsc[2];
+  for (i=0; i<3; i++)
+  {
+    if(Box!=NULL) {
+        ThreadArgs[0].Jstart[i]=(int)Box[i];
+        ThreadArgs[0].Jsize[i]=(int)Box[i+3]-(int)Box[i]+1;
+    } else {
+        ThreadArgs[0].Jstart[i]=1;
+        ThreadArgs[0].Jsize[i]=ThreadArgs[0].Isize[i];
+    }
+    Jdimsc[i]=ThreadArgs[0].Jsize[i];
+  }
+
+  /* Create output array */
+  plhs[0] = mxCreateNumericArray(3, Jdimsc, mxGetClassID(prhs[0]), mxREAL);
+
+  /* Assign pointers to each input, M in row order */
+  M=mxGetPr(prhs[1]);
+  ThreadArgs[0].Iin=mxGetData(prhs[0]);
+  ThreadArgs[0].Iout=mxGetData(plhs[0]);
+  ThreadArgs[0].itype=itype;
+  ThreadArgs[0].mode=(int)mxGetScalar(prhs[2]);
+  for (i=0; i<12; i++) { ThreadArgs[0].A[i]=M[mindex2(i/4,i%4,4)]; }
+
+  if(Nthreads>ThreadArgs[0].Jsize[2]) { Nthreads=ThreadArgs[0].Jsize[2]; }
+
+  #ifdef _WIN32
+	ThreadList = (HANDLE*)malloc(Nthreads* sizeof( HANDLE ));
+  #else
+	ThreadList = (pthread_t*)malloc(Nthreads* sizeof( pthread_t ));
+  #endif
+
+  for (i=0; i<Nthreads; i++)
+  {
+    ThreadArgs[i]=ThreadArgs[0];
+    ThreadArgs[i].ThreadID=i;
+    ThreadArgs[i].Nthreads=Nthreads;
+    #ifdef _WIN32
+        ThreadList[i] = (HANDLE)_beginthreadex( NULL, 0, &transform_slab, &ThreadArgs[i] , 0, NULL );
+    #else
+        pthread_create ((pthread_t*)&ThreadList[i], NULL, (void *) &transform_slab, &ThreadArgs[i]);
+    #endif
+  }
+
+  #ifdef _WIN32
+	for (i=0; i<Nthreads; i++) { WaitForSingleObject(ThreadList[i], INFINITE); }
+	for (i=0; i<Nthreads; i++) { CloseHandle( ThreadList[i] ); }
+  #else
+	for (i=0; i<Nthreads; i++) { pthread_join(ThreadList[i],NULL); }
+  #endif
+
+  free(ThreadArgs);
+  free(ThreadList);
+}
@@ -1,4 +1,5 @@
 #include "math.h"
+#include <stddef.h>
 #include "image_interpolation.h"
 
 /* Image and Volume interpolation 
@@ -1072,12 +1073,42 @@ float interpolate_3d_float_gray(float Tlocalx, float Tlocaly, float Tlocalz, int
     return Ipixel;
 }
 
+/* Row interpolation kernels for double, single, uint8 and uint16 images */
+#define ITYPE double
+#define IFUNC(name) name##_double
+#include "image_interpolation_row.h"
+#undef ITYPE
+#undef IFUNC
+#define ITYPE float
+#define IFUNC(name) name##_single
+#include "image_interpolation_row.h"
+#undef ITYPE
+#undef IFUNC
+#define ITYPE unsigned char
+#define IFUNC(name) name##_uint8
+#include "image_interpolation_row.h"
+#undef ITYPE
+#undef IFUNC
+#define ITYPE unsigned short
+#define IFUNC(name) name##_uint16
+#include "image_interpolation_row.h"
+#undef ITYPE
+#undef IFUNC
 
+void interpolate_2d_row(double *Iout, int n, double Tx, double Ty, double dx, double dy, int *Isize, const void *Iin, int itype, int mode) {
+    switch(itype) {
+        case IMAGE_SINGLE: interpolate_2d_row_single(Iout, n, Tx, Ty, dx, dy, Isize, (const float *)Iin, mode); break;
+        case IMAGE_UINT8: interpolate_2d_row_uint8(Iout, n, Tx, Ty, dx, dy, Isize, (const unsigned char *)Iin, mode); break;
+        case IMAGE_UINT16: interpolate_2d_row_uint16(Iout, n, Tx, Ty, dx, dy, Isize, (const unsigned short *)Iin, mode); break;
+        default: interpolate_2d_row_double(Iout, n, Tx, Ty, dx, dy, Isize, (const double *)Iin, mode); break;
+    }
+}
 
-
-
-
-
-
-
-
+void interpolate_3d_row(double *Iout, int n, const double *T, const double *d, int *Isize, size_t sxy, const void *Iin, int itype, int mode) {
+    switch(itype) {
+        case IMAGE_SINGLE: interpolate_3d_row_single(Iout, n, T, d, Isize, sxy, (const float *)Iin, mode); break;
+        case IMAGE_UINT8: interpolate_3d_row_uint8(Iout, n, T, d, Isize, sxy, (const unsigned char *)Iin, mode); break;
+        case IMAGE_UINT16: interpolate_3d_row_uint16(Iout, n, T, d, Isize, sxy, (const unsigned short *)Iin, mode); break;
+        default: interpolate_3d_row_double(Iout, n, T, d, Isize, sxy, (const double *)Iin, mode); break;
+    }
+}
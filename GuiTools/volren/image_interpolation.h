@@ -58,6 +58,18 @@ void interpolate_2d_double_color(double *Ipixel, double Tlocalx, double Tlocaly,
 double interpolate_3d_double_gray(double Tlocalx, double Tlocaly, double Tlocalz, int *Isize, double *Iin,int cubic,int black);
 float interpolate_3d_float_gray(float Tlocalx, float Tlocaly, float Tlocalz, int *Isize, float *Iin,int cubic,int black);
 
+/* Classes of the row interpolation */
+#define IMAGE_DOUBLE 0
+#define IMAGE_SINGLE 1
+#define IMAGE_UINT8 2
+#define IMAGE_UINT16 3
 
+/* Interpolate a row of n pixels at (Tx+i*dx, Ty+i*dy) from a 2D image of
+ * class itype, mode as affine_transform_2d_double (0..5) */
+void interpolate_2d_row(double *Iout, int n, double Tx, double Ty, double dx, double dy, int *Isize, const void *Iin, int itype, int mode);
 
 
+/* Interpolate a row of n voxels at T+i*d from a 3D volume of class itype,
+ * with sxy elements between two slices, mode as affine_transform_3d_double
+ * (0..5) */
+void interpolate_3d_row(double *Iout, int n, const double *T, const double *d, int *Isize, size_t sxy, const void *Iin, int itype, int mode);
@@ -0,0 +1,332 @@
+/* Row interpolation kernels for 2D and 3D images of one class, included by
+ * image_interpolation.c once for every class, with
+ *
+ *   ITYPE         the c type of the image
+ *   IFUNC(name)   the function name with the class suffix
+ *
+ * A row of output pixels is interpolated at (Tx+i*dx, Ty+i*dy), the
+ * coordinates are stepped along the row instead of transformed for every
+ * pixel. Pixels of which the whole neighborhood is inside the image are
+ * read directly, only the pixels near the border are clamped or set to
+ * zero. Linear and cubic give the same values as interpolate_2d_double_gray
+ * and interpolate_3d_double_gray, nearest rounds as image_interpolation.m.
+ * The 3D kernels index the volume with size_t, volumes can be larger than
+ * 2^31 voxels, and take the distance between two slices (sxy), so one
+ * color channel of a [y x c z] dataset can be read in place.
+ *
+ * Function is written by D.Kroon University of Twente (June 2009)
+ */
+
+static __inline double IFUNC(linear_pixel)(double Tlocalx, double Tlocaly, int *Isize, const ITYPE *Iin, int black) {
+    int xBas0, xBas1, yBas0, yBas1;
+    double perc[4], color[4]={0, 0, 0, 0};
+    double xCom, yCom, xComi, yComi, fTlocalx, fTlocaly;
+    const ITYPE *p;
+
+    fTlocalx = floor(Tlocalx); fTlocaly = floor(Tlocaly);
+    xBas0=(int) fTlocalx; yBas0=(int) fTlocaly;
+    xBas1=xBas0+1; yBas1=yBas0+1;
+    xCom=Tlocalx-fTlocalx; yCom=Tlocaly-fTlocaly;
+    xComi=(1-xCom); yComi=(1-yCom);
+    perc[0]=xComi * yComi; perc[1]=xComi * yCom; perc[2]=xCom * yComi; perc[3]=xCom * yCom;
+
+    if((xBas0>=0)&&(yBas0>=0)&&(xBas1<Isize[0])&&(yBas1<Isize[1])) {
+        /* Inside the image */
+        p=Iin+yBas0*Isize[0]+xBas0;
+        return (double)p[0]*perc[0]+(double)p[Isize[0]]*perc[1]+(double)p[1]*perc[2]+(double)p[Isize[0]+1]*perc[3];
+    }
+    if(black) {
+        if((xBas0>=0)&&(xBas0<Isize[0])) {
+            if((yBas0>=0)&&(yBas0<Isize[1])) { color[0]=(double)Iin[yBas0*Isize[0]+xBas0]; }
+            if((yBas1>=0)&&(yBas1<Isize[1])) { color[1]=(double)Iin[yBas1*Isize[0]+xBas0]; }
+        }
+        if((xBas1>=0)&&(xBas1<Isize[0])) {
+            if((yBas0>=0)&&(yBas0<Isize[1])) { color[2]=(double)Iin[yBas0*Isize[0]+xBas1]; }
+            if((yBas1>=0)&&(yBas1<Isize[1])) { color[3]=(double)Iin[yBas1*Isize[0]+xBas1]; }
+        }
+    }
+    else {
+        if(xBas0<0) { xBas0=0; if(xBas1<0) { xBas1=0; }}
+        if(yBas0<0) { yBas0=0; if(yBas1<0) { yBas1=0; }}
+        if(xBas1>(Isize[0]-1)) { xBas1=Isize[0]-1; if(xBas0>(Isize[0]-1)) { xBas0=Isize[0]-1; }}
+        if(yBas1>(Isize[1]-1)) { yBas1=Isize[1]-1; if(yBas0>(Isize[1]-1)) { yBas0=Isize[1]-1; }}
+        color[0]=(double)Iin[yBas0*Isize[0]+xBas0];
+        color[1]=(double)Iin[yBas1*Isize[0]+xBas0];
+        color[2]=(double)Iin[yBas0*Isize[0]+xBas1];
+        color[3]=(double)Iin[yBas1*Isize[0]+xBas1];
+    }
+    return color[0]*perc[0]+color[1]*perc[1]+color[2]*perc[2]+color[3]*perc[3];
+}
+
+static __inline double IFUNC(cubic_pixel)(double Tlocalx, double Tlocaly, int *Isize, const ITYPE *Iin, int black) {
+    double fTlocalx, fTlocaly, tx, ty, Ipixel=0, Ipixelx;
+    double vector_tx[4], vector_ty[4], vector_qx[4], vector_qy[4], v[4];
+    int xBas0, yBas0, xn[4], yn[4], i, j, b;
+    const ITYPE *p;
+
+    fTlocalx = floor(Tlocalx); fTlocaly = floor(Tlocaly);
+    xBas0=(int) fTlocalx; yBas0=(int) fTlocaly;
+    tx=Tlocalx-fTlocalx; ty=Tlocaly-fTlocaly;
+
+    vector_tx[0]= 0.5; vector_tx[1]= 0.5*tx; vector_tx[2]= 0.5*pow2(tx); vector_tx[3]= 0.5*pow3(tx);
+    vector_ty[0]= 0.5; vector_ty[1]= 0.5*ty; vector_ty[2]= 0.5*pow2(ty); vector_ty[3]= 0.5*pow3(ty);
+    vector_qx[0]= -1.0*vector_tx[1]+2.0*vector_tx[2]-1.0*vector_tx[3];
+    vector_qx[1]= 2.0*vector_tx[0]-5.0*vector_tx[2]+3.0*vector_tx[3];
+    vector_qx[2]= 1.0*vector_tx[1]+4.0*vector_tx[2]-3.0*vector_tx[3];
+    vector_qx[3]= -1.0*vector_tx[2]+1.0*vector_tx[3];
+    vector_qy[0]= -1.0*vector_ty[1]+2.0*vector_ty[2]-1.0*vector_ty[3];
+    vector_qy[1]= 2.0*vector_ty[0]-5.0*vector_ty[2]+3.0*vector_ty[3];
+    vector_qy[2]= 1.0*vector_ty[1]+4.0*vector_ty[2]-3.0*vector_ty[3];
+    vector_qy[3]= -1.0*vector_ty[2]+1.0*vector_ty[3];
+
+    if((xBas0>=1)&&(yBas0>=1)&&(xBas0+2<Isize[0])&&(yBas0+2<Isize[1])) {
+        /* Inside the image */
+        p=Iin+(yBas0-1)*Isize[0]+xBas0-1;
+        for(i=0; i<4; i++) {
+            Ipixelx =vector_qx[0]*(double)p[0];
+            Ipixelx+=vector_qx[1]*(double)p[1];
+            Ipixelx+=vector_qx[2]*(double)p[2];
+            Ipixelx+=vector_qx[3]*(double)p[3];
+            Ipixel+= vector_qy[i]*Ipixelx;
+            p+=Isize[0];
+        }
+        return Ipixel;
+    }
+
+    xn[0]=xBas0-1; xn[1]=xBas0; xn[2]=xBas0+1; xn[3]=xBas0+2;
+    yn[0]=yBas0-1; yn[1]=yBas0; yn[2]=yBas0+1; yn[3]=yBas0+2;
+    if(black) {
+        for(i=0; i<4; i++) {
+            Ipixelx=0;
+            if((yn[i]>=0)&&(yn[i]<Isize[1])) {
+                for(j=0; j<4; j++) {
+                    if((xn[j]>=0)&&(xn[j]<Isize[0])) { Ipixelx+=vector_qx[j]*(double)Iin[yn[i]*Isize[0]+xn[j]]; }
+                }
+            }
+            Ipixel+= vector_qy[i]*Ipixelx;
+        }
+        return Ipixel;
+    }
+    if(xn[0]<0) { xn[0]=0;if(xn[1]<0) { xn[1]=0;if(xn[2]<0) { xn[2]=0; if(xn[3]<0) { xn[3]=0; }}}}
+    if(yn[0]<0) { yn[0]=0;if(yn[1]<0) { yn[1]=0;if(yn[2]<0) { yn[2]=0; if(yn[3]<0) { yn[3]=0; }}}}
+    b=Isize[0]-1;
+    if(xn[3]>b) { xn[3]=b;if(xn[2]>b) { xn[2]=b;if(xn[1]>b) { xn[1]=b; if(xn[0]>b) { xn[0]=b; }}}}
+    b=Isize[1]-1;
+    if(yn[3]>b) { yn[3]=b;if(yn[2]>b) { yn[2]=b;if(yn[1]>b) { yn[1]=b; if(yn[0]>b) { yn[0]=b; }}}}
+    for(i=0; i<4; i++) {
+        for(j=0; j<4; j++) { v[j]=(double)Iin[yn[i]*Isize[0]+xn[j]]; }
+        Ipixelx =vector_qx[0]*v[0];
+        Ipixelx+=vector_qx[1]*v[1];
+        Ipixelx+=vector_qx[2]*v[2];
+        Ipixelx+=vector_qx[3]*v[3];
+        Ipixel+= vector_qy[i]*Ipixelx;
+    }
+    return Ipixel;
+}
+
+static __inline double IFUNC(nearest_pixel)(double Tlocalx, double Tlocaly, int *Isize, const ITYPE *Iin, int black) {
+    /* Round half away from zero, as round() in Matlab */
+    int xBas0=(Tlocalx>=0) ? (int)floor(Tlocalx+0.5) : -(int)floor(-Tlocalx+0.5);
+    int yBas0=(Tlocaly>=0) ? (int)floor(Tlocaly+0.5) : -(int)floor(-Tlocaly+0.5);
+    if((xBas0<0)||(yBas0<0)||(xBas0>(Isize[0]-1))||(yBas0>(Isize[1]-1))) {
+        if(black) { return 0; }
+        if(xBas0<0) { xBas0=0; }
+        if(yBas0<0) { yBas0=0; }
+        if(xBas0>(Isize[0]-1)) { xBas0=Isize[0]-1; }
+        if(yBas0>(Isize[1]-1)) { yBas0=Isize[1]-1; }
+    }
+    return (double)Iin[yBas0*Isize[0]+xBas0];
+}
+
+static void IFUNC(interpolate_2d_row)(double *Iout, int n, double Tx, double Ty, double dx, double dy, int *Isize, const ITYPE *Iin, int mode) {
+    int i, black=!((mode==0)||(mode==2)||(mode==4));
+    switch(mode) {
+        case 0: case 1:
+            for(i=0; i<n; i++, Tx+=dx, Ty+=dy) { Iout[i]=IFUNC(linear_pixel)(Tx, Ty, Isize, Iin, black); }
+            break;
+        case 2: case 3:
+            for(i=0; i<n; i++, Tx+=dx, Ty+=dy) { Iout[i]=IFUNC(cubic_pixel)(Tx, Ty, Isize, Iin, black); }
+            break;
+        default:
+            for(i=0; i<n; i++, Tx+=dx, Ty+=dy) { Iout[i]=IFUNC(nearest_pixel)(Tx, Ty, Isize, Iin, black); }
+            break;
+    }
+}
+
+static __inline double IFUNC(linear_voxel)(double Tlocalx, double Tlocaly, double Tlocalz, int *Isize, size_t sxy, const ITYPE *Iin, int black) {
+    int xBas[2], yBas[2], zBas[2], i, j, k;
+    size_t sx=(size_t)Isize[0];
+    double perc[8], color[8]={0, 0, 0, 0, 0, 0, 0, 0};
+    double xCom, yCom, zCom, xComi, yComi, zComi, fTlocalx, fTlocaly, fTlocalz;
+    const ITYPE *p;
+
+    fTlocalx=floor(Tlocalx); fTlocaly=floor(Tlocaly); fTlocalz=floor(Tlocalz);
+    xBas[0]=(int) fTlocalx; yBas[0]=(int) fTlocaly; zBas[0]=(int) fTlocalz;
+    xBas[1]=xBas[0]+1; yBas[1]=yBas[0]+1; zBas[1]=zBas[0]+1;
+    xCom=Tlocalx-fTlocalx; yCom=Tlocaly-fTlocaly; zCom=Tlocalz-fTlocalz;
+    xComi=(1-xCom); yComi=(1-yCom); zComi=(1-zCom);
+    perc[0]=xComi * yComi; perc[1]=perc[0] * zCom; perc[0]=perc[0] * zComi;
+    perc[2]=xComi * yCom;  perc[3]=perc[2] * zCom; perc[2]=perc[2] * zComi;
+    perc[4]=xCom * yComi;  perc[5]=perc[4] * zCom; perc[4]=perc[4] * zComi;
+    perc[6]=xCom * yCom;   perc[7]=perc[6] * zCom; perc[6]=perc[6] * zComi;
+
+    if((xBas[0]>=0)&&(yBas[0]>=0)&&(zBas[0]>=0)&&(xBas[1]<Isize[0])&&(yBas[1]<Isize[1])&&(zBas[1]<Isize[2])) {
+        /* Inside the volume */
+        p=Iin+(size_t)zBas[0]*sxy+(size_t)yBas[0]*sx+xBas[0];
+        color[0]=(double)p[0];    color[1]=(double)p[sxy];
+        color[2]=(double)p[sx];   color[3]=(double)p[sx+sxy];
+        color[4]=(double)p[1];    color[5]=(double)p[1+sxy];
+        color[6]=(double)p[1+sx]; color[7]=(double)p[1+sx+sxy];
+    }
+    else if(black) {
+        for(i=0; i<2; i++) {
+            if((xBas[i]<0)||(xBas[i]>=Isize[0])) { continue; }
+            for(j=0; j<2; j++) {
+                if((yBas[j]<0)||(yBas[j]>=Isize[1])) { continue; }
+                for(k=0; k<2; k++) {
+                    if((zBas[k]<0)||(zBas[k]>=Isize[2])) { continue; }
+                    color[i*4+j*2+k]=(double)Iin[(size_t)zBas[k]*sxy+(size_t)yBas[j]*sx+xBas[i]];
+                }
+            }
+        }
+    }
+    else {
+        if(xBas[0]<0) { xBas[0]=0; if(xBas[1]<0) { xBas[1]=0; }}
+        if(yBas[0]<0) { yBas[0]=0; if(yBas[1]<0) { yBas[1]=0; }}
+        if(zBas[0]<0) { zBas[0]=0; if(zBas[1]<0) { zBas[1]=0; }}
+        if(xBas[1]>(Isize[0]-1)) { xBas[1]=Isize[0]-1; if(xBas[0]>(Isize[0]-1)) { xBas[0]=Isize[0]-1; }}
+        if(yBas[1]>(Isize[1]-1)) { yBas[1]=Isize[1]-1; if(yBas[0]>(Isize[1]-1)) { yBas[0]=Isize[1]-1; }}
+        if(zBas[1]>(Isize[2]-1)) { zBas[1]=Isize[2]-1; if(zBas[0]>(Isize[2]-1)) { zBas[0]=Isize[2]-1; }}
+        for(i=0; i<2; i++) {
+            for(j=0; j<2; j++) {
+                for(k=0; k<2; k++) {
+                    color[i*4+j*2+k]=(double)Iin[(size_t)zBas[k]*sxy+(size_t)yBas[j]*sx+xBas[i]];
+                }
+            }
+        }
+    }
+    return color[0]*perc[0]+color[1]*perc[1]+color[2]*perc[2]+color[3]*perc[3]+color[4]*perc[4]+color[5]*perc[5]+color[6]*perc[6]+color[7]*perc[7];
+}
+
+static __inline double IFUNC(cubic_voxel)(double Tlocalx, double Tlocaly, double Tlocalz, int *Isize, size_t sxy, const ITYPE *Iin, int black) {
+    double fTlocalx, fTlocaly, fTlocalz, tx, ty, tz, Ipixelx, Ipixelxy, Ipixelxyz=0;
+    double vector_tx[4], vector_ty[4], vector_tz[4], vector_qx[4], vector_qy[4], vector_qz[4];
+    int xBas0, yBas0, zBas0, xn[4], yn[4], zn[4], i, j, k, b, inside;
+    size_t sx=(size_t)Isize[0];
+    const ITYPE *p;
+
+    fTlocalx = floor(Tlocalx); fTlocaly = floor(Tlocaly); fTlocalz = floor(Tlocalz);
+    xBas0=(int) fTlocalx; yBas0=(int) fTlocaly; zBas0=(int) fTlocalz;
+    tx=Tlocalx-fTlocalx; ty=Tlocaly-fTlocaly; tz=Tlocalz-fTlocalz;
+
+    vector_tx[0]= 0.5; vector_tx[1]= 0.5*tx; vector_tx[2]= 0.5*pow2(tx); vector_tx[3]= 0.5*pow3(tx);
+    vector_ty[0]= 0.5; vector_ty[1]= 0.5*ty; vector_ty[2]= 0.5*pow2(ty); vector_ty[3]= 0.5*pow3(ty);
+    vector_tz[0]= 0.5; vector_tz[1]= 0.5*tz; vector_tz[2]= 0.5*pow2(tz); vector_tz[3]= 0.5*pow3(tz);
+    vector_qx[0]= -1.0*vector_tx[1]+2.0*vector_tx[2]-1.0*vector_tx[3];
+    vector_qx[1]= 2.0*vector_tx[0]-5.0*vector_tx[2]+3.0*vector_tx[3];
+    vector_qx[2]= 1.0*vector_tx[1]+4.0*vector_tx[2]-3.0*vector_tx[3];
+    vector_qx[3]= -1.0*vector_tx[2]+1.0*vector_tx[3];
+    vector_qy[0]= -1.0*vector_ty[1]+2.0*vector_ty[2]-1.0*vector_ty[3];
+    vector_qy[1]= 2.0*vector_ty[0]-5.0*vector_ty[2]+3.0*vector_ty[3];
+    vector_qy[2]= 1.0*vector_ty[1]+4.0*vector_ty[2]-3.0*vector_ty[3];
+    vector_qy[3]= -1.0*vector_ty[2]+1.0*vector_ty[3];
+    vector_qz[0]= -1.0*vector_tz[1]+2.0*vector_tz[2]-1.0*vector_tz[3];
+    vector_qz[1]= 2.0*vector_tz[0]-5.0*vector_tz[2]+3.0*vector_tz[3];
+    vector_qz[2]= 1.0*vector_tz[1]+4.0*vector_tz[2]-3.0*vector_tz[3];
+    vector_qz[3]= -1.0*vector_tz[2]+1.0*vector_tz[3];
+
+    inside=(xBas0>=1)&&(yBas0>=1)&&(zBas0>=1)&&(xBas0+2<Isize[0])&&(yBas0+2<Isize[1])&&(zBas0+2<Isize[2]);
+    if(inside) {
+        /* Inside the volume */
+        for(k=0; k<4; k++) {
+            Ipixelxy=0;
+            p=Iin+(size_t)(zBas0-1+k)*sxy+(size_t)(yBas0-1)*sx+xBas0-1;
+            for(j=0; j<4; j++) {
+                Ipixelx =vector_qx[0]*(double)p[0];
+                Ipixelx+=vector_qx[1]*(double)p[1];
+                Ipixelx+=vector_qx[2]*(double)p[2];
+                Ipixelx+=vector_qx[3]*(double)p[3];
+                Ipixelxy+= vector_qy[j]*Ipixelx;
+                p+=sx;
+            }
+            Ipixelxyz+= vector_qz[k]*Ipixelxy;
+        }
+        return Ipixelxyz;
+    }
+
+    xn[0]=xBas0-1; xn[1]=xBas0; xn[2]=xBas0+1; xn[3]=xBas0+2;
+    yn[0]=yBas0-1; yn[1]=yBas0; yn[2]=yBas0+1; yn[3]=yBas0+2;
+    zn[0]=zBas0-1; zn[1]=zBas0; zn[2]=zBas0+1; zn[3]=zBas0+2;
+    if(black) {
+        for(k=0; k<4; k++) {
+            if((zn[k]<0)||(zn[k]>=Isize[2])) { continue; }
+            Ipixelxy=0;
+            for(j=0; j<4; j++) {
+                Ipixelx=0;
+                if((yn[j]>=0)&&(yn[j]<Isize[1])) {
+                    for(i=0; i<4; i++) {
+                        if((xn[i]>=0)&&(xn[i]<Isize[0])) { Ipixelx+=vector_qx[i]*(double)Iin[(size_t)zn[k]*sxy+(size_t)yn[j]*sx+xn[i]]; }
+                    }
+                }
+                Ipixelxy+= vector_qy[j]*Ipixelx;
+            }
+            Ipixelxyz+= vector_qz[k]*Ipixelxy;
+        }
+        return Ipixelxyz;
+    }
+    if(xn[0]<0) { xn[0]=0;if(xn[1]<0) { xn[1]=0;if(xn[2]<0) { xn[2]=0; if(xn[3]<0) { xn[3]=0; }}}}
+    if(yn[0]<0) { yn[0]=0;if(yn[1]<0) { yn[1]=0;if(yn[2]<0) { yn[2]=0; if(yn[3]<0) { yn[3]=0; }}}}
+    if(zn[0]<0) { zn[0]=0;if(zn[1]<0) { zn[1]=0;if(zn[2]<0) { zn[2]=0; if(zn[3]<0) { zn[3]=0; }}}}
+    b=Isize[0]-1;
+    if(xn[3]>b) { xn[3]=b;if(xn[2]>b) { xn[2]=b;if(xn[1]>b) { xn[1]=b; if(xn[0]>b) { xn[0]=b; }}}}
+    b=Isize[1]-1;
+    if(yn[3]>b) { yn[3]=b;if(yn[2]>b) { yn[2]=b;if(yn[1]>b) { yn[1]=b; if(yn[0]>b) { yn[0]=b; }}}}
+    b=Isize[2]-1;
+    if(zn[3]>b) { zn[3]=b;if(zn[2]>b) { zn[2]=b;if(zn[1]>b) { zn[1]=b; if(zn[0]>b) { zn[0]=b; }}}}
+    for(k=0; k<4; k++) {
+        Ipixelxy=0;
+        for(j=0; j<4; j++) {
+            p=Iin+(size_t)zn[k]*sxy+(size_t)yn[j]*sx;
+            Ipixelx =vector_qx[0]*(double)p[xn[0]];
+            Ipixelx+=vector_qx[1]*(double)p[xn[1]];
+            Ipixelx+=vector_qx[2]*(double)p[xn[2]];
+            Ipixelx+=vector_qx[3]*(double)p[xn[3]];
+            Ipixelxy+= vector_qy[j]*Ipixelx;
+        }
+        Ipixelxyz+= vector_qz[k]*Ipixelxy;
+    }
+    return Ipixelxyz;
+}
+
+static __inline double IFUNC(nearest_voxel)(double Tlocalx, double Tlocaly, double Tlocalz, int *Isize, size_t sxy, const ITYPE *Iin, int black) {
+    /* Round half away from zero, as round() in Matlab */
+    int xBas0=(Tlocalx>=0) ? (int)floor(Tlocalx+0.5) : -(int)floor(-Tlocalx+0.5);
+    int yBas0=(Tlocaly>=0) ? (int)floor(Tlocaly+0.5) : -(int)floor(-Tlocaly+0.5);
+    int zBas0=(Tlocalz>=0) ? (int)floor(Tlocalz+0.5) : -(int)floor(-Tlocalz+0.5);
+    if((xBas0<0)||(yBas0<0)||(zBas0<0)||(xBas0>(Isize[0]-1))||(yBas0>(Isize[1]-1))||(zBas0>(Isize[2]-1))) {
+        if(black) { return 0; }
+        if(xBas0<0) { xBas0=0; }
+        if(yBas0<0) { yBas0=0; }
+        if(zBas0<0) { zBas0=0; }
+        if(xBas0>(Isize[0]-1)) { xBas0=Isize[0]-1; }
+        if(yBas0>(Isize[1]-1)) { yBas0=Isize[1]-1; }
+        if(zBas0>(Isize[2]-1)) { zBas0=Isize[2]-1; }
+    }
+    return (double)Iin[(size_t)zBas0*sxy+(size_t)yBas0*Isize[0]+xBas0];
+}
+
+static void IFUNC(interpolate_3d_row)(double *Iout, int n, const double *T, const double *d, int *Isize, size_t sxy, const ITYPE *Iin, int mode) {
+    int i, black=!((mode==0)||(mode==2)||(mode==4));
+    double Tx=T[0], Ty=T[1], Tz=T[2];
+    switch(mode) {
+        case 0: case 1:
+            for(i=0; i<n; i++, Tx+=d[0], Ty+=d[1], Tz+=d[2]) { Iout[i]=IFUNC(linear_voxel)(Tx, Ty, Tz, Isize, sxy, Iin, black); }
+            break;
+        case 2: case 3:
+            for(i=0; i<n; i++, Tx+=d[0], Ty+=d[1], Tz+=d[2]) { Iout[i]=IFUNC(cubic_voxel)(Tx, Ty, Tz, Isize, sxy, Iin, black); }
+            break;
+        default:
+            for(i=0; i<n; i++, Tx+=d[0], Ty+=d[1], Tz+=d[2]) { Iout[i]=IFUNC(nearest_voxel)(Tx, Ty, Tz, Isize, sxy, Iin, black); }
+            break;
+    }
+}
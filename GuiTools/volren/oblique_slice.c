@@ -0,0 +1,268 @@
+#include "mex.h"
+#include "math.h"
+#include "image_interpolation.h"
+
+/*   undef needed for LCC compiler  */
+#undef EXTERN_C
+#ifdef _WIN32
+	#include <windows.h>
+	#include <process.h>
+#else
+	#include <pthread.h>
+#endif
+
+/*
+ Oblique slice of a dataset, a plane with any orientation sampled from the
+ volume without reslicing or transposing the dataset
+
+ Iout=oblique_slice(I,origin,u,v,ImageSize,mode,t)
+
+ inputs,
+   I: The dataset in the MIB order [y x c z t], of class double, single,
+      uint8 or uint16, as mibImage.img{1}; a [y x z] volume is given as
+      reshape(V, [size(V,1) size(V,2) 1 size(V,3)])
+   origin: The [y x z] voxel coordinate (1 based) of the pixel Iout(1,1)
+   u: The [y x z] step in the volume from Iout(i,j) to Iout(i+1,j)
+   v: The [y x z] step in the volume from Iout(i,j) to Iout(i,j+1)
+   ImageSize: The size [height width] of the output slice
+   mode: If 0: linear interpolation and outside pixels set to nearest pixel
+            1: linear interpolation and outside pixels set to zero
+            2: cubic interpolation and outsite pixels set to nearest pixel
+            3: cubic interpolation and outside pixels set to zero
+            4: nearest interpolation and outsite pixels set to nearest pixel
+            5: nearest interpolation and outside pixels set to zero
+  (optional)
+   t: The time point, default 1
+
+ output,
+   Iout: The slice [height width c], of the same class as I (integer
+         classes are rounded and clamped),
+         Iout(i,j,c) = I(origin+(i-1)*u+(j-1)*v, c, t)
+
+ example,
+   % slice at 30 degrees around the x axis through the center of V
+   V=uint8(rand(128,128,64)*255);
+   a=30/180*pi; u=[cos(a) 0 sin(a)];
+   Iout=oblique_slice(reshape(V,[128 128 1 64]),[64.5 1 32.5]-63.5*u,...
+        u,[0 1 0],[128 128],0);
+
+ The color channels are read in place, in the class of the dataset, with
+ the 3D row kernels of image_interpolation.c. The slice is divided in tiles
+ of TILE x TILE pixels, so the voxels that neighboring rows of the slice
+ share stay in the cache, and the tiles are divided over
+ feature('Numcores') threads.
+
+ Function is written by D.Kroon University of Twente (June 2009)
+*/
+
+#define TILE 64
+
+/* The slice of one call */
+typedef struct {
+    const void *Iin;
+    void *Iout;
+    int itype;
+    int Isize[3];
+    int colors;
+    size_t sxy;
+    double O[3];
+    double U[3];
+    double V[3];
+    int Jsize[2];
+    int mode;
+    int ThreadID;
+    int Nthreads;
+} SliceArgs;
+
+/* Store a row of interpolated values in the output slice, in its class,
+ * integer classes are rounded and clamped as in Matlab */
+static void store_row(SliceArgs *S, double *row, int n, size_t index) {
+    int x;
+    double v;
+    switch(S->itype) {
+        case IMAGE_SINGLE:
+            for (x=0; x<n; x++) { ((float *)S->Iout)[index+x]=(float)row[x]; }
+            break;
+        case IMAGE_UINT8:
+            for (x=0; x<n; x++) {
+                v=row[x]+0.5; if(v<0) { v=0; } if(v>255) { v=255; }
+                ((unsigned char *)S->Iout)[index+x]=(unsigned char)v;
+            }
+            break;
+        case IMAGE_UINT16:
+            for (x=0; x<n; x++) {
+                v=row[x]+0.5; if(v<0) { v=0; } if(v>65535) { v=65535; }
+                ((unsigned short *)S->Iout)[index+x]=(unsigned short)v;
+            }
+            break;
+        default:
+            for (x=0; x<n; x++) { ((double *)S->Iout)[index+x]=row[x]; }
+            break;
+    }
+}
+
+/* Sample the tiles ThreadID, ThreadID+Nthreads, ... of the slice */
+#ifdef _WIN32
+  unsigned __stdcall slice_tiles(SliceArgs *S) {
+#else
+  void slice_tiles(SliceArgs *S) {
+#endif
+    int ntilesx, ntilesy, tile, x0, y0, n, y, y1, c, k;
+    double row[TILE], T[3];
+    size_t esize, ncolor=(size_t)S->Isize[0]*S->Isize[1], nout=(size_t)S->Jsize[0]*S->Jsize[1];
+    const char *Iin;
+
+    switch(S->itype) {
+        case IMAGE_SINGLE: esize=sizeof(float); break;
+        case IMAGE_UINT8: esize=sizeof(unsigned char); break;
+        case IMAGE_UINT16: esize=sizeof(unsigned short); break;
+        default: esize=sizeof(double); break;
+    }
+
+    ntilesx=(S->Jsize[0]+TILE-1)/TILE;
+    ntilesy=(S->Jsize[1]+TILE-1)/TILE;
+    for (tile=S->ThreadID; tile<ntilesx*ntilesy; tile+=S->Nthreads)
+    {
+        x0=(tile%ntilesx)*TILE;
+        y0=(tile/ntilesx)*TILE;
+        n=(S->Jsize[0]-x0<TILE) ? S->Jsize[0]-x0 : TILE;
+        y1=(S->Jsize[1]-y0<TILE) ? S->Jsize[1] : y0+TILE;
+        for (y=y0; y<y1; y++)
+        {
+            /* Location of the first pixel of the tile row, in 0 based
+             * voxel coordinates */
+            for (k=0; k<3; k++) { T[k]=S->O[k]-1+x0*S->U[k]+y*S->V[k]; }
+            for (c=0; c<S->colors; c++)
+            {
+                Iin=(const char *)S->Iin+c*ncolor*esize;
+                interpolate_3d_row(row, n, T, S->U, S->Isize, S->sxy, Iin, S->itype, S->mode);
+                store_row(S, row, n, c*nout+(size_t)y*S->Jsize[0]+x0);
+            }
+        }
+    }
+
+    /*  explicit end thread, helps to ensure proper recovery of resources allocated for the thread */
+	#ifdef _WIN32
+	_endthreadex( 0 );
+    return 0;
+	#else
+	pthread_exit(NULL);
+	#endif
+}
+
+/* Read a 3 element double vector */
+static void get_vector(const mxArray *A, double *v, const char *msg) {
+    int k;
+    if((mxGetClassID(A)!=mxDOUBLE_CLASS)||(mxGetNumberOfElements(A)!=3)) { mexErrMsgTxt(msg); }
+    for (k=0; k<3; k++) { v[k]=mxGetPr(A)[k]; }
+}
+
+/* The matlab mex function */
+void mexFunction( int nlhs, mxArray *plhs[],
+                  int nrhs, const mxArray *prhs[] )
+{
+    mxArray *matlabCallOut[1]={0};
+    mxArray *matlabCallIn[1]={0};
+    int Nthreads, ndims, i, t=1, ntiles;
+    mwSize Jdimsc[3];
+    const mwSize *dims;
+    double *Jdims;
+    SliceArgs S, *ThreadArgs;
+    #ifdef _WIN32
+		HANDLE *ThreadList;
+	#else
+		pthread_t *ThreadList;
+	#endif
+
+  /* Check for proper number of arguments. */
+  if(nrhs<6) {
+    mexErrMsgTxt("6 or 7 inputs are required.");
+  } else if(nlhs!=1) {
+    mexErrMsgTxt("One output required");
+  }
+
+  /* The dataset class */
+  switch(mxGetClassID(prhs[0])) {
+      case mxDOUBLE_CLASS: S.itype=IMAGE_DOUBLE; break;
+      case mxSINGLE_CLASS: S.itype=IMAGE_SINGLE; break;
+      case mxUINT8_CLASS: S.itype=IMAGE_UINT8; break;
+      case mxUINT16_CLASS: S.itype=IMAGE_UINT16; break;
+      default: mexErrMsgTxt("Dataset must be of class double, single, uint8 or uint16");
+  }
+
+  /* Size of the dataset [y x c z t] */
+  dims = mxGetDimensions(prhs[0]);
+  ndims = (int)mxGetNumberOfDimensions(prhs[0]);
+  S.Isize[0] = (int)dims[0];
+  S.Isize[1] = (int)dims[1];
+  S.colors = (ndims>2) ? (int)dims[2] : 1;
+  S.Isize[2] = (ndims>3) ? (int)dims[3] : 1;
+  S.sxy = (size_t)S.Isize[0]*S.Isize[1]*S.colors;
+  if(nrhs>6) { t=(int)mxGetScalar(prhs[6]); }
+  if((t<1)||(t>((ndims>4) ? (int)dims[4] : 1))) {
+    mexErrMsgTxt("Time point is outside the dataset");
+  }
+
+  /* The plane */
+  get_vector(prhs[1], S.O, "Origin must be a [y x z] double vector");
+  get_vector(prhs[2], S.U, "u must be a [y x z] double vector");
+  get_vector(prhs[3], S.V, "v must be a [y x z] double vector");
+  if((mxGetClassID(prhs[4])!=mxDOUBLE_CLASS)||(mxGetNumberOfElements(prhs[4])!=2)) {
+    mexErrMsgTxt("ImageSize must be a [height width] double vector");
+  }
+  Jdims = mxGetPr(prhs[4]);
+  S.Jsize[0] = (int)Jdims[0];
+  S.Jsize[1] = (int)Jdims[1];
+  if((S.Jsize[0]<0)||(S.Jsize[1]<0)) {
+    mexErrMsgTxt("ImageSize must not be negative");
+  }
+  S.mode=(int)mxGetScalar(prhs[5]);
+
+  /* Create output array */
+  Jdimsc[0]=S.Jsize[0];
+  Jdimsc[1]=S.Jsize[1];
+  Jdimsc[2]=S.colors;
+  plhs[0] = mxCreateNumericArray((S.colors>1) ? 3 : 2, Jdimsc, mxGetClassID(prhs[0]), mxREAL);
+  S.Iin=(const char *)mxGetData(prhs[0])+(size_t)(t-1)*S.sxy*S.Isize[2]*mxGetElementSize(prhs[0]);
+  S.Iout=mxGetData(plhs[0]);
+  ntiles=((S.Jsize[0]+TILE-1)/TILE)*((S.Jsize[1]+TILE-1)/TILE);
+  if(ntiles==0) { return; }
+
+  /* Number of threads, feature('Numcores') */
+  matlabCallIn[0]=mxCreateString("Numcores");
+  mexCallMATLAB(1, matlabCallOut, 1, matlabCallIn, "feature");
+  Nthreads=(int)mxGetScalar(matlabCallOut[0]);
+  mxDestroyArray(matlabCallIn[0]);
+  mxDestroyArray(matlabCallOut[0]);
+  if(Nthreads>ntiles) { Nthreads=ntiles; }
+  if(Nthreads<1) { Nthreads=1; }
+
+  #ifdef _WIN32
+	ThreadList = (HANDLE*)malloc(Nthreads* sizeof( HANDLE ));
+  #else
+	ThreadList = (pthread_t*)malloc(Nthreads* sizeof( pthread_t ));
+  #endif
+  ThreadArgs = (SliceArgs*)malloc(Nthreads* sizeof(SliceArgs));
+
+  for (i=0; i<Nthreads; i++)
+  {
+    ThreadArgs[i]=S;
+    ThreadArgs[i].ThreadID=i;
+    ThreadArgs[i].Nthreads=Nthreads;
+    #ifdef _WIN32
+        ThreadList[i] = (HANDLE)_beginthreadex( NULL, 0, &slice_tiles, &ThreadArgs[i] , 0, NULL );
+    #else
+        pthread_create ((pthread_t*)&ThreadList[i], NULL, (void *) &slice_tiles, &ThreadArgs[i]);
+    #endif
+  }
+
+  #ifdef _WIN32
+	for (i=0; i<Nthreads; i++) { WaitForSingleObject(ThreadList[i], INFINITE); }
+	for (i=0; i<Nthreads; i++) { CloseHandle( ThreadList[i] ); }
+  #else
+	for (i=0; i<Nthreads; i++) { pthread_join(ThreadList[i],NULL); }
+  #endif
+
+  free(ThreadArgs);
+  free(ThreadList);
+}
@@ -5,7 +5,8 @@ function render_image = render(volume,options)
 % I = RENDER(VOLUME,OPTIONS);
 %
 % outputs,
-%  I: The rendered image
+%  I: The rendered image, or [ImageSize N] frames (with color [ImageSize 3
+%     N]) for N view matrices
 % 
 % inputs,
 %  VOLUME : Input image volume (Data of type double has short render 
@@ -21,7 +22,10 @@ function render_image = render(volume,options)
 %                   bilinear
 %    OPTIONS.ImageSize : Size of the rendered image, defaults to [400 400]
 %    OPTIONS.Mview : This 4x4 matrix is the viewing matrix
-%                   defaults to [1 0 0 0;0 1 0 0;0 0 1 0;0 0 0 1]
+%                   defaults to [1 0 0 0;0 1 0 0;0 0 1 0;0 0 0 1]. A 4x4xN
+%                   stack renders N frames of the same volume in one call,
+%                   with render_shearwarp the frames are rendered in
+%                   parallel
 %    OPTIONS.AlphaTable : This Nx1 table is linear interpolated such that
 %    every
 %                   voxel intensity gets a specific alpha (transparency)
@@ -33,6 +37,15 @@ function render_image = render(volume,options)
 %    OPTIONS.ViewerVector : View vector X,Y,Z defaults to [0 0 1]
 %    OPTIONS.ShadingMaterial : The type of material shading : dull,
 %                   shiny(default) or metal.
+%    OPTIONS.NormalCache : Keep 16-bit packed normals of the last 4 volumes
+%                   between renders for shaded, they are only calculated
+%                   again when the volume changes (default false, only with
+%                   render_shearwarp)
+%    OPTIONS.Accelerate : Skip bricks of the volume with zero opacity and
+%                   stop pixels which are opaque, for bw, color and shaded
+%                   (default false, only with render_shearwarp)
+%    OPTIONS.OpacityThreshold : Opacity at which a pixel is opaque
+%                   (default 0.99)
 %
 % Optional parameters to speed up rendering:
 %    OPTIONS.VolumeX, OPTIONS.VolumeY : Dimensions shifted Voxel volumes,
@@ -40,13 +53,19 @@ function render_image = render(volume,options)
 %                       OPTIONS.VolumeX=shiftdim(OPTIONS.Volume,1);
 %                       OPTIONS.VolumeY=shiftdim(OPTIONS.Volume,2);
 %    OPTIONS.Normals : The normalized gradient of the voxel volume
-%                   Must be used like:
+%                   (double), or the packed normals made with
+%                   render_shearwarp(OPTIONS.Volume,'normals'), must be
+%                   used like:
 %                   [fy,fx,fz]=gradient(OPTIONS.Volume);
 %                   flength=sqrt(fx.^2+fy.^2+fz.^2)+1e-6;
 %                   OPTIONS.Normals=zeros([size(fx) 3]);
 %                   OPTIONS.Normals(:,:,:,1)=fx./flength;
 %                   OPTIONS.Normals(:,:,:,2)=fy./flength;
 %                   OPTIONS.Normals(:,:,:,3)=fz./flength;
+%    OPTIONS.Bricks : The min/max of the 8x8x8 bricks of the volume for
+%                   OPTIONS.Accelerate, for multiple renders of the same
+%                   volume, must be used like:
+%                   OPTIONS.Bricks=render_shearwarp(OPTIONS.Volume,'bricks');
 %    
 % example,
 %   %Add paths
@@ -70,6 +89,10 @@ function render_image = render(volume,options)
 %   I = render(V,options);
 %   imshow(I);
 %
+% When render_shearwarp is compiled the shear, composite and warp steps
+% run in c with multiple threads, directly on the volume class, otherwise
+% the MATLAB shear() and warp() below are used.
+%
 % Function is written by D.Kroon University of Twente (April 2009)
 
 %% Set the default options
@@ -91,7 +114,11 @@ defaultoptions=struct( ...
     'ViewerVector',[0 0 1], ...
     'SliceSelected', 1, ...
     'ColorSlice', false, ...
-    'ShadingMaterial','shiny');
+    'ShadingMaterial','shiny', ...
+    'NormalCache', false, ...
+    'Accelerate', false, ...
+    'OpacityThreshold', 0.99, ...
+    'Bricks', []);
 
 %% Check the input options
 if(~exist('options','var')), 
@@ -112,7 +139,7 @@ if(exist('volume','var')); data.Volume=volume; end
 
 %% If black
 if(strcmp(data.RenderType,'black'))
-    render_image = zeros(data.ImageSize);
+    render_image = zeros([data.ImageSize size(data.Mview,3)]);
     return
 end
 
@@ -144,12 +171,78 @@ if(~isempty(data.ColorTable))
     data.ColorTable_r=data.ColorTable(:,1); data.ColorTable_g=data.ColorTable(:,2); data.ColorTable_b=data.ColorTable(:,3);
 end   
 
+%% A list of views, one frame for every view matrix
+if(size(data.Mview,3)>1)
+    render_image = render_views(data);
+    return
+end
+
 %% If no 3D but slice render do slicerender
 if((length(data.RenderType)>5)&&strcmp(data.RenderType(1:5),'slice')) 
     render_image = render_slice(data);
     return
 end
 
+render_image = render_view(data);
+
+%% Shear-warp rendering of one view
+function Iout=render_view(data)
+data=setup_view(data);
+if(native_render(data))
+    % Shear, composite and warp in one multithreaded c call
+    data=native_fields(data);
+    Iout = render_shearwarp(data.Volume,data);
+    return
+end
+
+%% Create Shear (intimidate) buffer
+switch data.RenderType
+    case {'mip'}
+        data.Ibuffer=zeros([data.Ibuffer_sizex data.Ibuffer_sizey])+data.imin;
+    case {'bw'}
+        data.Ibuffer=zeros([data.Ibuffer_sizex data.Ibuffer_sizey]);
+    otherwise
+        data.Ibuffer=zeros([data.Ibuffer_sizex data.Ibuffer_sizey 3]);
+end
+data = shear(data);
+data = warp(data);
+Iout = data.Iout;
+
+%% Rendering of a list of views
+function Iout=render_views(data)
+% Frame i is rendered with the view matrix Mview(:,:,i), the output is
+% [ImageSize nviews] or [ImageSize 3 nviews]. With render_shearwarp only
+% the matrices of every view are made here, and all frames are rendered in
+% parallel in one c call, into one output array.
+Mviews=data.Mview;
+nviews=size(Mviews,3);
+slicerender=(length(data.RenderType)>5)&&strcmp(data.RenderType(1:5),'slice');
+if(~slicerender&&native_render(data))
+    viewfields={'c','Mshearinv','Mwarp','AlphaTable','LightVector2','ViewerVector2'};
+    for i=nviews:-1:1
+        dview=data; dview.Mview=Mviews(:,:,i);
+        dview=native_fields(setup_view(dview));
+        for j=1:length(viewfields)
+            if(isfield(dview,viewfields{j})), views(i).(viewfields{j})=dview.(viewfields{j}); end
+        end
+    end
+    Iout = render_shearwarp(data.Volume,dview,views);
+    return
+end
+for i=1:nviews
+    data.Mview=Mviews(:,:,i);
+    if(slicerender)
+        I=render_slice(data);
+    else
+        I=render_view(data);
+    end
+    if(i==1), Iout=zeros(numel(I),nviews); end
+    Iout(:,i)=I(:);
+end
+Iout=reshape(Iout,[size(I) nviews]);
+
+%% Shear and Warp matrices, buffer size, alpha correction and shading of a view
+function data=setup_view(data)
 %% Calculate the Shear and Warp Matrices
 if(ndims(data.Volume)==2)
     sizes=[size(data.Volume) 1];
@@ -163,25 +256,15 @@ data.Mshearinv=inv(data.Mshear);
 %% Store Volume sizes
 data.Iin_sizex=size(data.Volume,1); data.Iin_sizey=size(data.Volume,2); data.Iin_sizez=size(data.Volume,3);
 
-%% Create Shear (intimidate) buffer
+%% Size of the Shear (intimidate) buffer
 data.Ibuffer_sizex=ceil(1.7321*max(size(data.Volume))+1);
 data.Ibuffer_sizey=data.Ibuffer_sizex;
-switch data.RenderType
-    case {'mip'}
-        data.Ibuffer=zeros([data.Ibuffer_sizex data.Ibuffer_sizey])+data.imin;
-    case {'bw'}
-        data.Ibuffer=zeros([data.Ibuffer_sizex data.Ibuffer_sizey]);
-    otherwise
-        data.Ibuffer=zeros([data.Ibuffer_sizex data.Ibuffer_sizey 3]);
-end
 
 %% Adjust alpha table by voxel length because of rotation and volume size
 lengthcor=sqrt(1+data.Mshearinv(1,3)^2+data.Mshearinv(2,3)^2)*mean(size(data.Volume))/100;
 data.AlphaTable=1 - (1-data.AlphaTable).^(1/lengthcor);
 data.AlphaTable(data.AlphaTable<0)=0; data.AlphaTable(data.AlphaTable>1)=1;
 
-
-
 %% Shading type -> Phong values
 switch lower(data.ShadingMaterial)
     case {'shiny'}
@@ -198,23 +281,40 @@ end
 data.LightVector=[data.LightVector(:);0]; data.LightVector=data.LightVector./sqrt(sum(data.LightVector(1:3).^2));
 data.ViewerVector=[data.ViewerVector(:);0]; data.ViewerVector=data.ViewerVector./sqrt(sum(data.ViewerVector(1:3).^2));
 
-%% Shear Rendering
-data = shear(data);
-data = warp(data);
-render_image = data.Iout;
+%% True if the shear-warp steps can be done by the render_shearwarp mex file
+function t=native_render(data)
+t=exist('render_shearwarp','file')==3&&any(strcmp(class(data.Volume),{'uint8','uint16','uint32','int8','int16','int32','single','double'}));
+
+%% True if the compiled affine_transform_2d_double reads the slice in its own
+%% class, older builds of the mex file only take double images
+function t=native_warp(Iin)
+t=false;
+if(exist('affine_transform_2d_double','file')==3&&any(strcmp(class(Iin),{'uint8','uint16','single'})))
+    try
+        t=affine_transform_2d_double('interface')>=2;
+    catch
+    end
+end
+
+%% Warp matrix and shading vectors in volume coordinates, for render_shearwarp
+function data=native_fields(data)
+[data.Mwarp,data.WarpMode]=warpMatrix(data);
+if(strcmp(data.RenderType,'shaded'))
+    [data.LightVector2,data.ViewerVector2]=shadingVectors(data);
+end
 
 %% Slice rendering
 function Iout=render_slice(data)
 switch (data.RenderType)
     case {'slicex'}
-        Iin=(double(squeeze(data.Volume(data.SliceSelected,:,:,:)))-data.imin)/data.imaxmin;
+        Iin=squeeze(data.Volume(data.SliceSelected,:,:,:));
         M=[data.Mview(1,2) data.Mview(1,3) data.Mview(1,4); data.Mview(2,2) data.Mview(2,3) data.Mview(2,4); 0 0 1];
        % Rotate 90
     case {'slicey'}
-        Iin=(double(squeeze(data.Volume(:,data.SliceSelected,:,:)))-data.imin)/data.imaxmin;
+        Iin=squeeze(data.Volume(:,data.SliceSelected,:,:));
         M=[data.Mview(1,1) data.Mview(1,3) data.Mview(1,4); data.Mview(2,1) data.Mview(2,3) data.Mview(2,4); 0 0 1];     % Rotate 90
     case {'slicez'}
-        Iin=(double(squeeze(data.Volume(:,:,data.SliceSelected,:)))-data.imin)/data.imaxmin;
+        Iin=squeeze(data.Volume(:,:,data.SliceSelected,:));
         M=[data.Mview(1,1) data.Mview(1,2) data.Mview(1,4); data.Mview(2,1) data.Mview(2,2) data.Mview(2,4); 0 0 1];
 end
 
@@ -229,7 +329,21 @@ switch(data.WarpInterp)
     otherwise, wi=1;
 end
 
-Ibuffer=affine_transform_2d_double(Iin,M,wi,data.ImageSize);
+% The compiled warp reads uint8, uint16 and single slices in their own class,
+% into a double image which is not rounded, the (smaller) output image is
+% converted to the range [0 1]. The pixels outside the slice are zero after
+% the conversion, as when the slice is converted first, because imin is
+% only subtracted with the interpolation weight which falls inside the slice
+if(native_warp(Iin))
+    Ibuffer=affine_transform_2d_double(Iin,M,wi,data.ImageSize,'double');
+    if(data.imin~=0)
+        Ibuffer=Ibuffer-data.imin*affine_transform_2d_double(ones(size(Iin),'uint8'),M,wi,data.ImageSize,'double');
+    end
+    Ibuffer=Ibuffer/data.imaxmin;
+else
+    Iin=(double(Iin)-data.imin)/data.imaxmin;
+    Ibuffer=affine_transform_2d_double(Iin,M,wi,data.ImageSize);
+end
         
 if(data.ColorSlice)
     Ibuffer(Ibuffer<0)=0; Ibuffer(Ibuffer>1)=1;
@@ -814,10 +928,7 @@ function data=updatebuffer_SHADED(data)
     end
 
     % Rotate the light and view vector
-    data.LightVector2=data.Mview\data.LightVector;
-    data.LightVector2=data.LightVector2./sqrt(sum(data.LightVector2(1:3).^2));
-    data.ViewerVector2=data.Mview\data.ViewerVector;
-    data.ViewerVector2=data.ViewerVector2./sqrt(sum(data.ViewerVector2(1:3).^2));
+    [data.LightVector2,data.ViewerVector2]=shadingVectors(data);
 
     Ia=1;
     
@@ -851,8 +962,20 @@ function data=updatebuffer_SHADED(data)
     data.Ibuffer(data.px,data.py,2)=alphaimage_inv.*data.Ibuffer(data.px,data.py,2)+alphaimage.*(data.ColorTable_g(indexColor).*Ipar(:,:,1)+Ipar(:,:,2));
     data.Ibuffer(data.px,data.py,3)=alphaimage_inv.*data.Ibuffer(data.px,data.py,3)+alphaimage.*(data.ColorTable_b(indexColor).*Ipar(:,:,1)+Ipar(:,:,2));
 
+function [LightVector2,ViewerVector2]=shadingVectors(data)
+% Rotate the light and view vector to volume coordinates
+LightVector2=data.Mview\data.LightVector;
+LightVector2=LightVector2./sqrt(sum(LightVector2(1:3).^2));
+ViewerVector2=data.Mview\data.ViewerVector;
+ViewerVector2=ViewerVector2./sqrt(sum(ViewerVector2(1:3).^2));
+
 function data=warp(data)  
 % This function warp,  will warp the shear rendered buffer image
+[M,wi]=warpMatrix(data);
+data.Iout=affine_transform_2d_double(data.Ibuffer,M,wi,data.ImageSize);
+
+function [M,wi]=warpMatrix(data)
+% Affine matrix and interpolation mode of the warp step
 
 % Make Affine matrix
 M=zeros(3,3);
@@ -870,7 +993,6 @@ switch(data.WarpInterp)
     case 'bilinear', wi=1;
     otherwise, wi=1;
 end
-data.Iout=affine_transform_2d_double(data.Ibuffer,M,wi,data.ImageSize);
 
 function [Mshear,Mwarp2D,c]=makeShearWarpMatrix(Mview,sizes)
 % Function MAKESHEARWARPMATRIX splits a View Matrix in to
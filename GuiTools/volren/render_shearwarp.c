@@ -0,0 +1,1057 @@
+#include "mex.h"
+#include "math.h"
+#include "string.h"
+#include "image_interpolation.h"
+
+/*   undef needed for LCC compiler  */
+#undef EXTERN_C
+#ifdef _WIN32
+	#include <windows.h>
+	#include <process.h>
+#else
+	#include <pthread.h>
+#endif
+
+/*
+ Shear-warp volume rendering, the shear, composite and warp steps of
+ render.m in one call
+
+ Iout=render_shearwarp(Volume,data)
+
+ inputs,
+   Volume: The 2D or 3D volume, of class uint8, uint16, uint32, int8,
+           int16, int32, single or double. The voxels are read in their
+           own class, no double copy of the volume is made.
+   data: The render structure prepared by render.m, with the fields
+     RenderType : 'mip', 'bw', 'color' or 'shaded'
+     ShearInterp : 'bilinear' or 'nearest'
+     WarpMode : Interpolation mode of the warp, as affine_transform_2d_double
+     ImageSize : Size of the rendered image
+     c : The principal viewing axis 1..6 (from makeShearWarpMatrix)
+     Mshearinv : The 4x4 inverse shear matrix
+     Mwarp : The 3x3 (inverse) warp matrix
+     Ibuffer_sizex : Size of the (square) intermediate shear image
+     imin, imaxmin : Intensity offset and range
+     AlphaTable : Nx1 alpha table, already corrected for the voxel length
+     ColorTable : Nx3 color table (color and shaded)
+     LightVector2, ViewerVector2 : Light and viewer vector in volume
+                   coordinates (shaded)
+     material : The 4 Phong material values (shaded)
+     Normals : Empty, the [size(Volume) 3] normal volume, or the packed
+               normals (shaded)
+     NormalCache : (optional) true to keep the packed normals of the
+               volume between calls, when Normals is empty (shaded)
+     Accelerate : (optional) true for empty space skipping and early ray
+                  termination (bw, color and shaded)
+     OpacityThreshold : Rays stop when their opacity reaches this value
+     Bricks : (optional) Empty, or the brick min/max of the volume
+
+ output,
+   Iout: The rendered image, [ImageSize] or [ImageSize 3] for color and
+         shaded
+
+ Iout=render_shearwarp(Volume,data,views)
+
+   Renders a frame for every element of the structure array views, which
+   has the fields of data which depend on the view: c, Mshearinv, Mwarp,
+   AlphaTable and LightVector2, ViewerVector2 (shaded). The output is
+   [ImageSize nviews] or [ImageSize 3 nviews]. The volume, normals and
+   bricks are prepared once, and the frames are divided over the threads,
+   every thread renders whole frames with its own intermediate image,
+   directly into the output array.
+
+ Normals=render_shearwarp(Volume,'normals')
+
+   Returns the uint16 packed normals of the volume, for data.Normals. A
+   normal is stored as an octahedral mapping with 8 bits per coordinate
+   (about 0.5 degree), which is decoded with a lookup table.
+
+ Bricks=render_shearwarp(Volume,'bricks')
+
+   Returns the [nx ny nz 2] minimum and maximum of the 8x8x8 voxel bricks
+   of the volume, for data.Bricks, it only has to be made once per volume.
+
+ The intermediate image is divided in blocks of rows over the threads,
+ every thread composites all slices of the volume in its own rows, and
+ the warp is divided in blocks of rows of the output image. The result is
+ the same as the MATLAB shear() and warp() functions in render.m, except
+ that the normals of integer volumes are calculated with signed
+ differences.
+
+ With NormalCache the packed normals are made once, with all threads, and
+ kept in one of 4 slots, found by a hash of the class, size and contents of
+ the volume. The least recently used slot is replaced by a new volume, and
+ all are freed when the mex file is cleared. The color channels of a frame
+ each keep their own normals, so the shading of the next frames of the same
+ volumes only needs a lookup per sample.
+
+ With Accelerate the slices are composited front to back. Bricks, and
+ coarse blocks of 4x4x4 bricks, in which the alpha table is zero for every
+ intensity between the brick min and max are skipped, which does not
+ change the result. Pixels stop when their accumulated opacity reaches
+ OpacityThreshold, which only leaves out the last 1-OpacityThreshold of
+ their color.
+
+ Function is written by D.Kroon University of Twente (April 2009),
+ shear step ported to c from render.m
+*/
+
+#define RENDER_MIP 0
+#define RENDER_BW 1
+#define RENDER_COLOR 2
+#define RENDER_SHADED 3
+
+/* Bricks of 8x8x8 voxels, and coarse bricks of 4x4x4 bricks */
+#define BRICK_SHIFT 3
+#define BRICK1_SHIFT 5
+
+typedef struct RenderArgs_s {
+    /* The volume */
+    const void *V;
+    mxClassID cls;
+    int esize;
+    int vsize[3];
+    const double *Normals;
+    const unsigned short *Npacked;
+    unsigned short *Nout;
+    unsigned long long *hash;
+    /* Shear */
+    int c;
+    int type;
+    int bilinear;
+    double shear[2];
+    int bsize;
+    double *Ibuffer;
+    double imin;
+    double imaxmin;
+    const double *AlphaTable;
+    int nalpha;
+    const double *ColorTable;
+    int ncolor;
+    double L[3];
+    double W[3];
+    double material[4];
+    /* Empty space skipping and early ray termination */
+    int accelerate;
+    double tmin;
+    double *Tbuf;
+    int *alive;
+    double *Bricks;
+    int nb0[3];
+    int nb1[3];
+    unsigned char *empty0;
+    unsigned char *empty1;
+    /* Warp */
+    double A[6];
+    int warpmode;
+    int osize[3];
+    double *Iout;
+    /* A list of views, rendered as whole frames per thread */
+    struct RenderArgs_s *views;
+    int nviews;
+    int ThreadID;
+    int Nthreads;
+} RenderArgs;
+
+/* Voxel as double, from the volume in its own class */
+static __inline double voxel(const void *V, mxClassID cls, size_t i) {
+    switch(cls) {
+        case mxUINT8_CLASS: return (double)((const unsigned char *)V)[i];
+        case mxUINT16_CLASS: return (double)((const unsigned short *)V)[i];
+        case mxUINT32_CLASS: return (double)((const unsigned int *)V)[i];
+        case mxINT8_CLASS: return (double)((const signed char *)V)[i];
+        case mxINT16_CLASS: return (double)((const short *)V)[i];
+        case mxINT32_CLASS: return (double)((const int *)V)[i];
+        case mxSINGLE_CLASS: return (double)((const float *)V)[i];
+        default: return ((const double *)V)[i];
+    }
+}
+
+/* Round half away from zero as Matlab, and clamp to a table index */
+static __inline int table_index(double v, int n) {
+    int i=(v>=0) ? (int)floor(v+0.5) : -(int)floor(-v+0.5);
+    if(i<0) { i=0; }
+    if(i>(n-1)) { i=n-1; }
+    return i;
+}
+
+/* Packed normals, octahedral mapping of the unit normal to 2x8 bits, the
+ * code NORMAL_ZERO is a zero normal (a flat part of the volume) */
+#define NORMAL_ZERO 65535
+static double normal_lut[65536][3];
+static int normal_lut_done=0;
+
+static unsigned short pack_normal(double *N) {
+    double l=fabs(N[0])+fabs(N[1])+fabs(N[2]), u, v, t;
+    int iu, iv;
+    if(l<1e-3) { return NORMAL_ZERO; }
+    u=N[0]/l; v=N[1]/l;
+    if(N[2]<0) {
+        t=u;
+        u=(1-fabs(v))*((t>=0) ? 1 : -1);
+        v=(1-fabs(t))*((v>=0) ? 1 : -1);
+    }
+    iu=(int)floor((u+1)*127+0.5); iv=(int)floor((v+1)*127+0.5);
+    return (unsigned short)(iu+255*iv);
+}
+
+static void make_normal_lut(void) {
+    int code, d;
+    double u, v, t, N[3], l;
+    if(normal_lut_done) { return; }
+    for(code=0; code<65536; code++) {
+        if(code>=255*255) { normal_lut[code][0]=0; normal_lut[code][1]=0; normal_lut[code][2]=0; continue; }
+        u=(code%255)/127.0-1; v=(code/255)/127.0-1;
+        N[2]=1-fabs(u)-fabs(v);
+        if(N[2]<0) {
+            t=u;
+            u=(1-fabs(v))*((t>=0) ? 1 : -1);
+            v=(1-fabs(t))*((v>=0) ? 1 : -1);
+        }
+        N[0]=u; N[1]=v;
+        l=sqrt(N[0]*N[0]+N[1]*N[1]+N[2]*N[2]);
+        for(d=0; d<3; d++) { normal_lut[code][d]=N[d]/l; }
+    }
+    normal_lut_done=1;
+}
+
+/* Normal of voxel p from the forward differences, as returnnormal() in render.m */
+static void voxel_normal(RenderArgs *R, int *p, double *N) {
+    int p1[3], p2[3], d;
+    size_t i1, s[3];
+    double S[3], nlength;
+
+    s[0]=1; s[1]=(size_t)R->vsize[0]; s[2]=(size_t)R->vsize[0]*R->vsize[1];
+    if(R->Normals!=NULL) {
+        i1=p[0]*s[0]+p[1]*s[1]+p[2]*s[2];
+        for(d=0; d<3; d++) { N[d]=R->Normals[i1+d*s[2]*R->vsize[2]]; }
+        return;
+    }
+    if(R->Npacked!=NULL) {
+        i1=p[0]*s[0]+p[1]*s[1]+p[2]*s[2];
+        for(d=0; d<3; d++) { N[d]=normal_lut[R->Npacked[i1]][d]; }
+        return;
+    }
+    for(d=0; d<3; d++) {
+        p1[d]=p[d]; p2[d]=p[d]+1;
+        if(p2[d]>(R->vsize[d]-1)) { p1[d]=p[d]-1; p2[d]=R->vsize[d]-1; }
+        if(p1[d]<0) { p1[d]=0; p2[d]=0; }
+    }
+    i1=p1[0]*s[0]+p1[1]*s[1]+p1[2]*s[2];
+    for(d=0; d<3; d++) {
+        S[d]=voxel(R->V, R->cls, i1+(p2[d]-p1[d])*s[d])-voxel(R->V, R->cls, i1);
+    }
+    nlength=sqrt(S[0]*S[0]+S[1]*S[1]+S[2]*S[2])+0.000001;
+    for(d=0; d<3; d++) { N[d]=S[d]/nlength; }
+}
+
+/* Opacity of a sample, and its color in col, as updatebuffer_BW/COLOR/SHADED
+ * in render.m. The color is not calculated for zero opacity */
+static __inline double classify(RenderArgs *R, double intensity, int *p, double betaA, double betaC, double *col) {
+    int indexAlpha, indexColor, ic;
+    double alpha, N[3], Id, Rv[3], Is, Ipar1, Ipar2;
+
+    if(R->type==RENDER_BW) {
+        if(R->imin!=0) { intensity=intensity-R->imin; }
+        if(R->imaxmin!=1) { intensity=intensity/R->imaxmin; }
+        col[0]=intensity;
+        return R->AlphaTable[table_index(intensity*betaA, R->nalpha)];
+    }
+    if(R->imin!=0) { intensity=intensity-R->imin; }
+    indexAlpha=table_index(intensity*betaA, R->nalpha);
+    alpha=R->AlphaTable[indexAlpha];
+    if(alpha==0) { return 0; }
+    indexColor=(betaA!=betaC) ? table_index(intensity*betaC, R->ncolor) : indexAlpha;
+    if(R->type==RENDER_COLOR) {
+        for(ic=0; ic<3; ic++) { col[ic]=R->ColorTable[indexColor+ic*R->ncolor]; }
+        return alpha;
+    }
+    voxel_normal(R, p, N);
+    Id=N[0]*R->L[0]+N[1]*R->L[1]+N[2]*R->L[2];
+    /* R = 2.0*dot(N,L)*N - L; */
+    Rv[0]=2*Id*N[0]-R->L[0]; Rv[1]=2*Id*N[1]-R->L[1]; Rv[2]=2*Id*N[2]-R->L[2];
+    Is=-(Rv[0]*R->W[0]+Rv[1]*R->W[1]+Rv[2]*R->W[2]);
+    /* No spectacular highlights on "shadow" part */
+    if(Id<0) { Is=0; }
+    Is=pow(Is, R->material[3]);
+    Ipar1=R->material[0]+R->material[1]*Id;
+    Ipar2=R->material[2]*Is;
+    for(ic=0; ic<3; ic++) { col[ic]=R->ColorTable[indexColor+ic*R->ncolor]*Ipar1+Ipar2; }
+    return alpha;
+}
+
+/* Position in the alpha table of an intensity, before rounding */
+static __inline double alpha_position(RenderArgs *R, double intensity) {
+    if(R->type==RENDER_BW) {
+        if(R->imin!=0) { intensity=intensity-R->imin; }
+        if(R->imaxmin!=1) { intensity=intensity/R->imaxmin; }
+        return intensity*(R->nalpha-1);
+    }
+    return (intensity-R->imin)*((R->nalpha-1)/R->imaxmin);
+}
+
+/* Composite all slices of the volume in a block of rows of the shear buffer */
+static void shear_block(RenderArgs *R) {
+    int B=R->bsize, BB=R->bsize*R->bsize;
+    int da, db, dz, na, nb, nz;
+    size_t sa, sb, sz, stride[3];
+    int q0, q1, zi, z, q, px, x0, x1, y0, y1, xdfloor, ydfloor;
+    int pxstart, pxend, pystart, pyend, qlo, qhi, pxlo, pxhi, ib, ic, nch;
+    int p[3], s0[3], s1[3], zb0=0, zb1=0, yb0=0, yb1=0;
+    double xd, yd, xCom, yCom, perc[4], intensity, alpha, T, col[3], *buf;
+    double betaA=0, betaC=0;
+
+    /* Axes of the volume which become the x, y and depth of a slice */
+    switch(R->c) {
+        case 1: case 4: da=1; db=2; dz=0; break;
+        case 2: case 5: da=2; db=0; dz=1; break;
+        default: da=0; db=1; dz=2; break;
+    }
+    stride[0]=1; stride[1]=(size_t)R->vsize[0]; stride[2]=(size_t)R->vsize[0]*R->vsize[1];
+    na=R->vsize[da]; nb=R->vsize[db]; nz=R->vsize[dz];
+    sa=stride[da]; sb=stride[db]; sz=stride[dz];
+    s0[0]=1; s0[1]=R->nb0[0]; s0[2]=R->nb0[0]*R->nb0[1];
+    s1[0]=1; s1[1]=R->nb1[0]; s1[2]=R->nb1[0]*R->nb1[1];
+
+    /* The block of buffer rows of this thread */
+    q0=(B*R->ThreadID)/R->Nthreads;
+    q1=(B*(R->ThreadID+1))/R->Nthreads;
+
+    buf=R->Ibuffer;
+    nch=(R->type>=RENDER_COLOR) ? 3 : 1;
+    if(R->type==RENDER_MIP) {
+        for(q=q0; q<q1; q++) { for(px=0; px<B; px++) { buf[px+q*B]=R->imin; } }
+    }
+    if(R->type==RENDER_BW) {
+        betaA=R->nalpha-1;
+    }
+    if((R->type==RENDER_COLOR)||(R->type==RENDER_SHADED)) {
+        betaA=(R->nalpha-1)/R->imaxmin;
+        betaC=(R->ncolor-1)/R->imaxmin;
+    }
+    if(R->accelerate) {
+        for(q=q0; q<q1; q++) {
+            for(px=0; px<B; px++) { R->Tbuf[px+q*B]=1; }
+            R->alive[q]=B;
+        }
+    }
+
+    /* Back to front through the slices, or front to back with early ray termination */
+    for(zi=0; zi<nz; zi++) {
+        z=((R->c<=3)!=(R->accelerate!=0)) ? zi : nz-1-zi;
+
+        /* Offset calculation */
+        xd=(-B/2.0)+R->shear[0]*(z-nz/2.0)+na/2.0;
+        yd=(-B/2.0)+R->shear[1]*(z-nz/2.0)+nb/2.0;
+        xdfloor=(int)floor(xd); ydfloor=(int)floor(yd);
+        xCom=xd-xdfloor; yCom=yd-ydfloor;
+        perc[0]=(1-xCom)*(1-yCom); perc[1]=(1-xCom)*yCom; perc[2]=xCom*(1-yCom); perc[3]=xCom*yCom;
+
+        /* The part of the buffer covered by the slice, a single pixel if empty */
+        pystart=-ydfloor; if(pystart<0) { pystart=0; }
+        pyend=nb-ydfloor; if(pyend>B) { pyend=B; }
+        pxstart=-xdfloor; if(pxstart<0) { pxstart=0; }
+        pxend=na-xdfloor; if(pxend>B) { pxend=B; }
+        qhi=pyend-2; if(qhi<pystart) { qhi=pystart; }
+        pxhi=pxend-2; if(pxhi<pxstart) { pxhi=pxstart; }
+        if((pystart>=B)||(pxstart>=B)) { continue; }
+        if(((qhi+ydfloor)>(nb-1))||((pxhi+xdfloor)>(na-1))) { continue; }
+        qlo=(pystart>q0) ? pystart : q0;
+        pxlo=pxstart;
+        if(R->accelerate) { zb0=(z>>BRICK_SHIFT)*s0[dz]; zb1=(z>>BRICK1_SHIFT)*s1[dz]; }
+
+        for(q=qlo; (q<=qhi)&&(q<q1); q++) {
+            if(R->accelerate) {
+                if(R->alive[q]==0) { continue; }
+                yb0=zb0+((q+ydfloor)>>BRICK_SHIFT)*s0[db];
+                yb1=zb1+((q+ydfloor)>>BRICK1_SHIFT)*s1[db];
+            }
+            y0=q+ydfloor; y1=(q==qhi) ? y0 : y0+1;
+            px=pxlo;
+            while(px<=pxhi) {
+                x0=px+xdfloor; x1=(px==pxhi) ? x0 : x0+1;
+                ib=px+q*B;
+                if(R->accelerate) {
+                    /* Skip bricks which have zero opacity, and opaque pixels */
+                    if(R->empty1[yb1+(x0>>BRICK1_SHIFT)*s1[da]]) {
+                        px=(((x0>>BRICK1_SHIFT)+1)<<BRICK1_SHIFT)-xdfloor; continue;
+                    }
+                    if(R->empty0[yb0+(x0>>BRICK_SHIFT)*s0[da]]) {
+                        px=(((x0>>BRICK_SHIFT)+1)<<BRICK_SHIFT)-xdfloor; continue;
+                    }
+                    if(R->Tbuf[ib]<R->tmin) { px++; continue; }
+                }
+                if(R->bilinear) {
+                    intensity=voxel(R->V, R->cls, x0*sa+y0*sb+z*sz)*perc[0]
+                             +voxel(R->V, R->cls, x0*sa+y1*sb+z*sz)*perc[1]
+                             +voxel(R->V, R->cls, x1*sa+y0*sb+z*sz)*perc[2]
+                             +voxel(R->V, R->cls, x1*sa+y1*sb+z*sz)*perc[3];
+                }
+                else {
+                    intensity=voxel(R->V, R->cls, x0*sa+y0*sb+z*sz);
+                }
+                px++;
+
+                if(R->type==RENDER_MIP) {
+                    if(intensity>buf[ib]) { buf[ib]=intensity; }
+                    continue;
+                }
+                p[da]=x0; p[db]=y0; p[dz]=z;
+                alpha=classify(R, intensity, p, betaA, betaC, col);
+                if(alpha==0) { continue; }
+                if(R->accelerate) {
+                    T=R->Tbuf[ib];
+                    for(ic=0; ic<nch; ic++) { buf[ib+ic*BB]+=T*alpha*col[ic]; }
+                    T*=1-alpha;
+                    R->Tbuf[ib]=T;
+                    if(T<R->tmin) { R->alive[q]--; }
+                }
+                else {
+                    for(ic=0; ic<nch; ic++) { buf[ib+ic*BB]=(1-alpha)*buf[ib+ic*BB]+alpha*col[ic]; }
+                }
+            }
+        }
+    }
+
+    if(R->type==RENDER_MIP) {
+        for(q=q0; q<q1; q++) {
+            for(px=0; px<B; px++) {
+                if(R->imin!=0) { buf[px+q*B]=buf[px+q*B]-R->imin; }
+                buf[px+q*B]=buf[px+q*B]/R->imaxmin;
+            }
+        }
+    }
+}
+
+#ifdef _WIN32
+  unsigned __stdcall shear_rows(RenderArgs *R) {
+#else
+  void shear_rows(RenderArgs *R) {
+#endif
+    shear_block(R);
+
+    /*  explicit end thread, helps to ensure proper recovery of resources allocated for the thread */
+    #ifdef _WIN32
+	_endthreadex( 0 );
+    return 0;
+	#else
+	pthread_exit(NULL);
+	#endif
+}
+
+/* Minimum and maximum of the voxels of a slab of bricks, every brick
+ * includes the first voxel of the next brick, the bilinear footprint */
+#ifdef _WIN32
+  unsigned __stdcall brick_minmax(RenderArgs *R) {
+#else
+  void brick_minmax(RenderArgs *R) {
+#endif
+    int b[3], lo[3], hi[3], x, y, z, d, ind, nbricks;
+    size_t vind;
+    double v, vmin, vmax;
+    int z0=(R->nb0[2]*R->ThreadID)/R->Nthreads;
+    int z1=(R->nb0[2]*(R->ThreadID+1))/R->Nthreads;
+
+    nbricks=R->nb0[0]*R->nb0[1]*R->nb0[2];
+    for(b[2]=z0; b[2]<z1; b[2]++) {
+        for(b[1]=0; b[1]<R->nb0[1]; b[1]++) {
+            for(b[0]=0; b[0]<R->nb0[0]; b[0]++) {
+                for(d=0; d<3; d++) {
+                    lo[d]=b[d]<<BRICK_SHIFT; hi[d]=lo[d]+(1<<BRICK_SHIFT);
+                    if(hi[d]>(R->vsize[d]-1)) { hi[d]=R->vsize[d]-1; }
+                }
+                vmin=voxel(R->V, R->cls, lo[0]+(size_t)lo[1]*R->vsize[0]+(size_t)lo[2]*R->vsize[0]*R->vsize[1]); vmax=vmin;
+                for(z=lo[2]; z<=hi[2]; z++) {
+                    for(y=lo[1]; y<=hi[1]; y++) {
+                        vind=lo[0]+(size_t)y*R->vsize[0]+(size_t)z*R->vsize[0]*R->vsize[1];
+                        for(x=lo[0]; x<=hi[0]; x++) {
+                            v=voxel(R->V, R->cls, vind++);
+                            if(v<vmin) { vmin=v; }
+                            if(v>vmax) { vmax=v; }
+                        }
+                    }
+                }
+                ind=b[0]+b[1]*R->nb0[0]+b[2]*R->nb0[0]*R->nb0[1];
+                R->Bricks[ind]=vmin;
+                R->Bricks[ind+nbricks]=vmax;
+            }
+        }
+    }
+
+    /*  explicit end thread, helps to ensure proper recovery of resources allocated for the thread */
+    #ifdef _WIN32
+	_endthreadex( 0 );
+    return 0;
+	#else
+	pthread_exit(NULL);
+	#endif
+}
+
+/* Packed normals of a slab of slices of the volume */
+#ifdef _WIN32
+  unsigned __stdcall normals_slab(RenderArgs *R) {
+#else
+  void normals_slab(RenderArgs *R) {
+#endif
+    int p[3];
+    size_t ind;
+    double N[3];
+    int z0=(R->vsize[2]*R->ThreadID)/R->Nthreads;
+    int z1=(R->vsize[2]*(R->ThreadID+1))/R->Nthreads;
+
+    for(p[2]=z0; p[2]<z1; p[2]++) {
+        for(p[1]=0; p[1]<R->vsize[1]; p[1]++) {
+            ind=(size_t)p[1]*R->vsize[0]+(size_t)p[2]*R->vsize[0]*R->vsize[1];
+            for(p[0]=0; p[0]<R->vsize[0]; p[0]++) {
+                voxel_normal(R, p, N);
+                R->Nout[ind++]=pack_normal(N);
+            }
+        }
+    }
+
+    /*  explicit end thread, helps to ensure proper recovery of resources allocated for the thread */
+    #ifdef _WIN32
+	_endthreadex( 0 );
+    return 0;
+	#else
+	pthread_exit(NULL);
+	#endif
+}
+
+/* Hash of blocks of HASH_BLOCK bytes of the volume, to detect a changed volume */
+#define HASH_BLOCK 1048576
+#ifdef _WIN32
+  unsigned __stdcall hash_blocks(RenderArgs *R) {
+#else
+  void hash_blocks(RenderArgs *R) {
+#endif
+    size_t nbytes=(size_t)R->vsize[0]*R->vsize[1]*R->vsize[2]*R->esize;
+    size_t nblocks=(nbytes+HASH_BLOCK-1)/HASH_BLOCK, b, i, iend;
+    size_t b0=(nblocks*R->ThreadID)/R->Nthreads;
+    size_t b1=(nblocks*(R->ThreadID+1))/R->Nthreads;
+    const unsigned char *data=(const unsigned char *)R->V;
+    unsigned long long h, w;
+
+    for(b=b0; b<b1; b++) {
+        h=14695981039346656037ULL;
+        iend=(b+1)*HASH_BLOCK; if(iend>nbytes) { iend=nbytes; }
+        for(i=b*HASH_BLOCK; i+8<=iend; i+=8) {
+            memcpy(&w, data+i, 8);
+            h=(h^w)*1099511628211ULL;
+            h^=h>>32;
+        }
+        for(; i<iend; i++) { h=(h^data[i])*1099511628211ULL; }
+        R->hash[b]=h;
+    }
+
+    /*  explicit end thread, helps to ensure proper recovery of resources allocated for the thread */
+    #ifdef _WIN32
+	_endthreadex( 0 );
+    return 0;
+	#else
+	pthread_exit(NULL);
+	#endif
+}
+
+/* Mark the bricks in which every sample has zero opacity, and the coarse
+ * bricks of 4x4x4 bricks which are all empty */
+static void empty_bricks(RenderArgs *R) {
+    int i, lo, hi, nbricks, b[3], d, *nonzero;
+
+    nonzero=(int *)malloc((R->nalpha+1)*sizeof(int));
+    nonzero[0]=0;
+    for(i=0; i<R->nalpha; i++) { nonzero[i+1]=nonzero[i]+(R->AlphaTable[i]!=0); }
+
+    nbricks=R->nb0[0]*R->nb0[1]*R->nb0[2];
+    for(i=0; i<R->nb1[0]*R->nb1[1]*R->nb1[2]; i++) { R->empty1[i]=1; }
+    for(i=0; i<nbricks; i++) {
+        /* One table entry margin for the rounding of interpolated values */
+        lo=table_index(alpha_position(R, R->Bricks[i]), R->nalpha)-1; if(lo<0) { lo=0; }
+        hi=table_index(alpha_position(R, R->Bricks[i+nbricks]), R->nalpha)+1; if(hi>(R->nalpha-1)) { hi=R->nalpha-1; }
+        R->empty0[i]=(nonzero[hi+1]-nonzero[lo])==0;
+        if(!R->empty0[i]) {
+            b[0]=i%R->nb0[0]; b[1]=(i/R->nb0[0])%R->nb0[1]; b[2]=i/(R->nb0[0]*R->nb0[1]);
+            for(d=0; d<3; d++) { b[d]=b[d]>>(BRICK1_SHIFT-BRICK_SHIFT); }
+            R->empty1[b[0]+b[1]*R->nb1[0]+b[2]*R->nb1[0]*R->nb1[1]]=0;
+        }
+    }
+    free(nonzero);
+}
+
+/* Warp a block of rows of the output image, as affine_transform_2d_double */
+static void warp_block(RenderArgs *R) {
+    int Isize[3], x, y, y0, y1, rgb, black, cubic;
+    double Imean[2], Jmean[2], xd, yd, Tlocalx, Tlocaly, compa0, compa1, compb0, compb1;
+    double Ipixel[3]={0,0,0};
+    double *A=R->A;
+
+    Isize[0]=R->bsize; Isize[1]=R->bsize; Isize[2]=(R->type>=RENDER_COLOR) ? 3 : 1;
+    Imean[0]=Isize[0]/2.0; Imean[1]=Isize[1]/2.0;
+    Jmean[0]=R->osize[0]/2.0; Jmean[1]=R->osize[1]/2.0;
+    black=!((R->warpmode==0)||(R->warpmode==2));
+    cubic=!((R->warpmode==0)||(R->warpmode==1));
+
+    compb0=A[2]+Imean[0];
+    compb1=A[5]+Imean[1];
+
+    y0=(R->osize[1]*R->ThreadID)/R->Nthreads;
+    y1=(R->osize[1]*(R->ThreadID+1))/R->Nthreads;
+    for(y=y0; y<y1; y++) {
+        yd=(double)y-Jmean[1];
+        compa0=A[1]*yd+compb0;
+        compa1=A[4]*yd+compb1;
+        for(x=0; x<R->osize[0]; x++) {
+            xd=(double)x-Jmean[0];
+            Tlocalx=A[0]*xd+compa0;
+            Tlocaly=A[3]*xd+compa1;
+            if(Isize[2]>1) {
+                interpolate_2d_double_color(Ipixel, Tlocalx, Tlocaly, Isize, R->Ibuffer, cubic, black);
+                for(rgb=0; rgb<3; rgb++) {
+                    R->Iout[mindex2(x, y, R->osize[0])+rgb*R->osize[0]*R->osize[1]]=Ipixel[rgb];
+                }
+            }
+            else {
+                R->Iout[mindex2(x, y, R->osize[0])]=interpolate_2d_double_gray(Tlocalx, Tlocaly, Isize, R->Ibuffer, cubic, black);
+            }
+        }
+    }
+}
+
+#ifdef _WIN32
+  unsigned __stdcall warp_rows(RenderArgs *R) {
+#else
+  void warp_rows(RenderArgs *R) {
+#endif
+    warp_block(R);
+
+    /*  explicit end thread, helps to ensure proper recovery of resources allocated for the thread */
+    #ifdef _WIN32
+	_endthreadex( 0 );
+    return 0;
+	#else
+	pthread_exit(NULL);
+	#endif
+}
+
+/* Render whole frames of the list of views, frame f by thread f modulo
+ * Nthreads, with the shear buffers of this thread */
+#ifdef _WIN32
+  unsigned __stdcall render_views(RenderArgs *R) {
+#else
+  void render_views(RenderArgs *R) {
+#endif
+    RenderArgs F;
+    int f, nbuffer=R->bsize*R->bsize*((R->type>=RENDER_COLOR) ? 3 : 1);
+    size_t nframe=(size_t)R->osize[0]*R->osize[1]*((R->type>=RENDER_COLOR) ? 3 : 1);
+
+    for(f=R->ThreadID; f<R->nviews; f+=R->Nthreads) {
+        F=R->views[f];
+        F.Ibuffer=R->Ibuffer; F.Tbuf=R->Tbuf; F.alive=R->alive;
+        F.empty0=R->empty0; F.empty1=R->empty1; F.Bricks=R->Bricks;
+        F.Iout=R->Iout+f*nframe;
+        F.ThreadID=0; F.Nthreads=1;
+        memset(F.Ibuffer, 0, nbuffer*sizeof(double));
+        if(F.accelerate) { empty_bricks(&F); }
+        shear_block(&F);
+        warp_block(&F);
+    }
+
+    /*  explicit end thread, helps to ensure proper recovery of resources allocated for the thread */
+    #ifdef _WIN32
+	_endthreadex( 0 );
+    return 0;
+	#else
+	pthread_exit(NULL);
+	#endif
+}
+
+/* Get a field of element i of the render structure, with an error if it is missing */
+static const mxArray *getfield(const mxArray *data, mwIndex i, const char *name) {
+    const mxArray *field=mxGetField(data, i, name);
+    if(field==NULL) {
+        mexPrintf("Missing field %s\n", name);
+        mexErrMsgTxt("The render structure is incomplete");
+    }
+    return field;
+}
+
+#define THREAD_SHEAR 0
+#define THREAD_WARP 1
+#define THREAD_BRICKS 2
+#define THREAD_NORMALS 3
+#define THREAD_HASH 4
+#define THREAD_VIEWS 5
+
+/* Run a thread function over all threads */
+static void run_threads(RenderArgs *ThreadArgs, int Nthreads, int fn) {
+    int i;
+	#ifdef _WIN32
+		HANDLE *ThreadList = (HANDLE*)malloc(Nthreads* sizeof( HANDLE ));
+        unsigned (__stdcall *func)(RenderArgs *);
+    #else
+		pthread_t *ThreadList = (pthread_t*)malloc(Nthreads* sizeof( pthread_t ));
+        void (*func)(RenderArgs *);
+	#endif
+
+    switch(fn) {
+        case THREAD_WARP: func=&warp_rows; break;
+        case THREAD_BRICKS: func=&brick_minmax; break;
+        case THREAD_NORMALS: func=&normals_slab; break;
+        case THREAD_HASH: func=&hash_blocks; break;
+        case THREAD_VIEWS: func=&render_views; break;
+        default: func=&shear_rows; break;
+    }
+    for (i=0; i<Nthreads; i++) {
+		#ifdef _WIN32
+            ThreadList[i] = (HANDLE)_beginthreadex( NULL, 0, func, &ThreadArgs[i] , 0, NULL );
+		#else
+            pthread_create ((pthread_t*)&ThreadList[i], NULL, (void *) func, &ThreadArgs[i]);
+		#endif
+    }
+
+	#ifdef _WIN32
+		for (i=0; i<Nthreads; i++) { WaitForSingleObject(ThreadList[i], INFINITE); }
+		for (i=0; i<Nthreads; i++) { CloseHandle( ThreadList[i] ); }
+	#else
+		for (i=0; i<Nthreads; i++) { pthread_join(ThreadList[i],NULL); }
+	#endif
+    free(ThreadList);
+}
+
+/* Number of threads, feature('Numcores') */
+static int number_of_threads(void) {
+    int Nthreads;
+    mxArray *matlabCallOut[1]={0};
+    mxArray *matlabCallIn[1]={0};
+    matlabCallIn[0]=mxCreateString("Numcores");
+    mexCallMATLAB(1, matlabCallOut, 1, matlabCallIn, "feature");
+    Nthreads=(int)mxGetScalar(matlabCallOut[0]);
+    mxDestroyArray(matlabCallIn[0]);
+    mxDestroyArray(matlabCallOut[0]);
+    if(Nthreads<1) { Nthreads=1; }
+    return Nthreads;
+}
+
+/* Copy the arguments to every thread */
+static RenderArgs *thread_args(RenderArgs *R, int Nthreads) {
+    int i;
+    RenderArgs *ThreadArgs=(RenderArgs *)malloc(Nthreads*sizeof(RenderArgs));
+    for (i=0; i<Nthreads; i++) {
+        ThreadArgs[i]=*R;
+        ThreadArgs[i].ThreadID=i;
+        ThreadArgs[i].Nthreads=Nthreads;
+    }
+    return ThreadArgs;
+}
+
+/* Packed normals of the last shaded volumes, kept between calls. Every
+   slot holds one volume, so the color channels of a frame, which are
+   rendered one after another, do not evict each other */
+#define NCACHE 4
+typedef struct {
+    unsigned short *normals;
+    int size[3];
+    mxClassID cls;
+    unsigned long long hash;
+    unsigned long long used;
+} NormalCache;
+static NormalCache cache[NCACHE];
+static unsigned long long cache_clock=0;
+
+static void free_cache(void) {
+    int i;
+    for(i=0; i<NCACHE; i++) {
+        if(cache[i].normals!=NULL) { free(cache[i].normals); }
+        cache[i].normals=NULL;
+    }
+}
+
+/* Packed normals of the volume, calculated with all threads */
+static void packed_normals(RenderArgs *R, int Nthreads, unsigned short *Nout) {
+    RenderArgs *ThreadArgs;
+    if(Nthreads>R->vsize[2]) { Nthreads=R->vsize[2]; }
+    R->Nout=Nout;
+    ThreadArgs=thread_args(R, Nthreads);
+    run_threads(ThreadArgs, Nthreads, THREAD_NORMALS);
+    free(ThreadArgs);
+    R->Nout=NULL;
+}
+
+/* Hash of the class, size and contents of the volume */
+static unsigned long long volume_hash(RenderArgs *R, int Nthreads) {
+    RenderArgs *ThreadArgs;
+    size_t nbytes=(size_t)R->vsize[0]*R->vsize[1]*R->vsize[2]*R->esize;
+    size_t nblocks=(nbytes+HASH_BLOCK-1)/HASH_BLOCK, b;
+    unsigned long long h=14695981039346656037ULL;
+    int d;
+
+    R->hash=(unsigned long long *)malloc((nblocks+1)*sizeof(unsigned long long));
+    if((size_t)Nthreads>nblocks) { Nthreads=(int)nblocks; }
+    if(Nthreads<1) { Nthreads=1; }
+    ThreadArgs=thread_args(R, Nthreads);
+    run_threads(ThreadArgs, Nthreads, THREAD_HASH);
+    free(ThreadArgs);
+    for(b=0; b<nblocks; b++) { h=(h^R->hash[b])*1099511628211ULL; }
+    for(d=0; d<3; d++) { h=(h^(unsigned long long)R->vsize[d])*1099511628211ULL; }
+    h=(h^(unsigned long long)R->cls)*1099511628211ULL;
+    free(R->hash);
+    R->hash=NULL;
+    return h;
+}
+
+/* The packed normals of the volume from the cache, they are made in the
+   least recently used slot if the volume is not in the cache */
+static const unsigned short *cached_normals(RenderArgs *R, int Nthreads) {
+    unsigned long long h=volume_hash(R, Nthreads);
+    int i, j=0;
+    for(i=0; i<NCACHE; i++) {
+        if((cache[i].normals!=NULL)&&(cache[i].hash==h)&&(cache[i].cls==R->cls)&&
+           (cache[i].size[0]==R->vsize[0])&&(cache[i].size[1]==R->vsize[1])&&(cache[i].size[2]==R->vsize[2])) {
+            cache[i].used=++cache_clock;
+            return cache[i].normals;
+        }
+        if(cache[i].used<cache[j].used) { j=i; }
+    }
+    if(cache[j].normals!=NULL) { free(cache[j].normals); }
+    cache[j].normals=(unsigned short *)malloc((size_t)R->vsize[0]*R->vsize[1]*R->vsize[2]*sizeof(unsigned short));
+    if(cache[j].normals==NULL) { mexErrMsgTxt("Out of memory for the normal cache"); }
+    packed_normals(R, Nthreads, cache[j].normals);
+    cache[j].hash=h; cache[j].cls=R->cls;
+    for(i=0; i<3; i++) { cache[j].size[i]=R->vsize[i]; }
+    cache[j].used=++cache_clock;
+    mexAtExit(free_cache);
+    return cache[j].normals;
+}
+
+/* The fields of element i of a structure which depend on the view */
+static void view_fields(const mxArray *data, mwIndex i, RenderArgs *R) {
+    const mxArray *field;
+    double *M;
+    int d;
+    R->c=(int)mxGetScalar(getfield(data, i, "c"));
+    M=mxGetPr(getfield(data, i, "Mshearinv"));
+    R->shear[0]=M[mindex2(0, 2, 4)]; R->shear[1]=M[mindex2(1, 2, 4)];
+    M=mxGetPr(getfield(data, i, "Mwarp"));
+    R->A[0]=M[mindex2(0,0,3)]; R->A[1]=M[mindex2(0,1,3)]; R->A[2]=M[mindex2(0,2,3)];
+    R->A[3]=M[mindex2(1,0,3)]; R->A[4]=M[mindex2(1,1,3)]; R->A[5]=M[mindex2(1,2,3)];
+    if(R->type!=RENDER_MIP) {
+        field=getfield(data, i, "AlphaTable");
+        R->AlphaTable=mxGetPr(field); R->nalpha=(int)mxGetNumberOfElements(field);
+        if(R->nalpha<1) { mexErrMsgTxt("AlphaTable is empty"); }
+    }
+    if(R->type==RENDER_SHADED) {
+        M=mxGetPr(getfield(data, i, "LightVector2")); for(d=0; d<3; d++) { R->L[d]=M[d]; }
+        M=mxGetPr(getfield(data, i, "ViewerVector2")); for(d=0; d<3; d++) { R->W[d]=M[d]; }
+    }
+}
+
+/* The matlab mex function */
+void mexFunction( int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[] )
+{
+    const mxArray *data, *field;
+    const mwSize *dims;
+    mwSize odims[4];
+    RenderArgs R, *ThreadArgs;
+    char str[32];
+    double *M;
+    int i, d, Nthreads, nbuffer, nbricks, nviews, nbuf;
+    double *Bricks=NULL;
+
+    /* Check for proper number of arguments. */
+    if((nrhs!=2)&&(nrhs!=3)) {
+        mexErrMsgTxt("2 or 3 inputs are required (Volume, data, views).");
+    } else if(nlhs!=1) {
+        mexErrMsgTxt("One output required");
+    }
+    if(mxGetNumberOfDimensions(prhs[0])>3) { mexErrMsgTxt("Volume must be 2D or 3D"); }
+    switch(mxGetClassID(prhs[0])) {
+        case mxUINT8_CLASS: case mxUINT16_CLASS: case mxUINT32_CLASS:
+        case mxINT8_CLASS: case mxINT16_CLASS: case mxINT32_CLASS:
+        case mxSINGLE_CLASS: case mxDOUBLE_CLASS: break;
+        default: mexErrMsgTxt("Volume class is not supported");
+    }
+
+    memset(&R, 0, sizeof(RenderArgs));
+    R.V=mxGetData(prhs[0]);
+    R.cls=mxGetClassID(prhs[0]);
+    R.esize=(int)mxGetElementSize(prhs[0]);
+    dims=mxGetDimensions(prhs[0]);
+    R.vsize[0]=(int)dims[0]; R.vsize[1]=(int)dims[1];
+    R.vsize[2]=(mxGetNumberOfDimensions(prhs[0])>2) ? (int)dims[2] : 1;
+    for(d=0; d<3; d++) {
+        R.nb0[d]=((R.vsize[d]-1)>>BRICK_SHIFT)+1;
+        R.nb1[d]=((R.vsize[d]-1)>>BRICK1_SHIFT)+1;
+    }
+    nbricks=R.nb0[0]*R.nb0[1]*R.nb0[2];
+    Nthreads=number_of_threads();
+
+    /* Bricks=render_shearwarp(Volume,'bricks'), the min/max of the bricks */
+    /* Normals=render_shearwarp(Volume,'normals'), the packed normals */
+    if(mxIsChar(prhs[1])) {
+        mxGetString(prhs[1], str, 31);
+        if(strcmp(str, "normals")==0) {
+            plhs[0]=mxCreateNumericArray(mxGetNumberOfDimensions(prhs[0]), dims, mxUINT16_CLASS, mxREAL);
+            packed_normals(&R, Nthreads, (unsigned short *)mxGetData(plhs[0]));
+            return;
+        }
+        if(strcmp(str, "bricks")!=0) { mexErrMsgTxt("Unknown command"); }
+        odims[0]=R.nb0[0]; odims[1]=R.nb0[1]; odims[2]=R.nb0[2]; odims[3]=2;
+        plhs[0]=mxCreateNumericArray(4, odims, mxDOUBLE_CLASS, mxREAL);
+        R.Bricks=mxGetPr(plhs[0]);
+        if(Nthreads>R.nb0[2]) { Nthreads=R.nb0[2]; }
+        ThreadArgs=thread_args(&R, Nthreads);
+        run_threads(ThreadArgs, Nthreads, THREAD_BRICKS);
+        free(ThreadArgs);
+        return;
+    }
+    if(!mxIsStruct(prhs[1])) { mexErrMsgTxt("data must be a structure"); }
+    data=prhs[1];
+
+    /* The render options */
+    mxGetString(getfield(data, 0, "RenderType"), str, 31);
+    if(strcmp(str, "mip")==0) { R.type=RENDER_MIP; }
+    else if(strcmp(str, "bw")==0) { R.type=RENDER_BW; }
+    else if(strcmp(str, "color")==0) { R.type=RENDER_COLOR; }
+    else if(strcmp(str, "shaded")==0) { R.type=RENDER_SHADED; }
+    else { mexErrMsgTxt("Unknown RenderType"); }
+    mxGetString(getfield(data, 0, "ShearInterp"), str, 31);
+    R.bilinear=(strcmp(str, "bilinear")==0);
+    R.warpmode=(int)mxGetScalar(getfield(data, 0, "WarpMode"));
+    R.bsize=(int)mxGetScalar(getfield(data, 0, "Ibuffer_sizex"));
+    R.imin=mxGetScalar(getfield(data, 0, "imin"));
+    R.imaxmin=mxGetScalar(getfield(data, 0, "imaxmin"));
+    M=mxGetPr(getfield(data, 0, "ImageSize"));
+    R.osize[0]=(int)M[0]; R.osize[1]=(int)M[1];
+    view_fields(data, 0, &R);
+    if((R.type==RENDER_COLOR)||(R.type==RENDER_SHADED)) {
+        field=getfield(data, 0, "ColorTable");
+        if(mxGetN(field)!=3) { mexErrMsgTxt("ColorTable must be Nx3"); }
+        R.ColorTable=mxGetPr(field); R.ncolor=(int)mxGetM(field);
+    }
+    if(R.type==RENDER_SHADED) {
+        M=mxGetPr(getfield(data, 0, "material")); for(i=0; i<4; i++) { R.material[i]=M[i]; }
+        make_normal_lut();
+        field=getfield(data, 0, "Normals");
+        if(!mxIsEmpty(field)) {
+            if((mxGetClassID(field)==mxUINT16_CLASS)&&(mxGetNumberOfElements(field)==(size_t)R.vsize[0]*R.vsize[1]*R.vsize[2])) {
+                R.Npacked=(const unsigned short *)mxGetData(field);
+            }
+            else if((mxGetClassID(field)==mxDOUBLE_CLASS)&&(mxGetNumberOfElements(field)==(size_t)R.vsize[0]*R.vsize[1]*R.vsize[2]*3)) {
+                R.Normals=mxGetPr(field);
+            }
+            else {
+                mexErrMsgTxt("Normals must be a double [size(Volume) 3] array, or packed normals");
+            }
+        }
+        else {
+            field=mxGetField(data, 0, "NormalCache");
+            if((field!=NULL)&&!mxIsEmpty(field)&&(mxGetScalar(field)!=0)) {
+                R.Npacked=cached_normals(&R, Nthreads);
+            }
+        }
+    }
+
+    /* Empty space skipping and early ray termination, not for mip */
+    field=mxGetField(data, 0, "Accelerate");
+    if((field!=NULL)&&!mxIsEmpty(field)&&(R.type!=RENDER_MIP)) { R.accelerate=(mxGetScalar(field)!=0); }
+    if(R.accelerate) {
+        field=getfield(data, 0, "OpacityThreshold");
+        R.tmin=1-mxGetScalar(field);
+        field=mxGetField(data, 0, "Bricks");
+        if((field!=NULL)&&!mxIsEmpty(field)) {
+            if((mxGetClassID(field)!=mxDOUBLE_CLASS)||(mxGetNumberOfElements(field)!=(size_t)nbricks*2)) {
+                mexErrMsgTxt("Bricks must be made with render_shearwarp(Volume,'bricks')");
+            }
+            R.Bricks=mxGetPr(field);
+        }
+    }
+
+    /* The views, every view is a copy of the render options with its own
+     * shear and warp matrices, alpha table and shading vectors */
+    nviews=1;
+    if(nrhs==3) {
+        if(!mxIsStruct(prhs[2])) { mexErrMsgTxt("views must be a structure"); }
+        nviews=(int)mxGetNumberOfElements(prhs[2]);
+        if(nviews<1) { mexErrMsgTxt("views is empty"); }
+        if(nviews==1) {
+            view_fields(prhs[2], 0, &R);
+        }
+        else {
+            R.views=(RenderArgs *)malloc(nviews*sizeof(RenderArgs));
+            for(i=0; i<nviews; i++) {
+                R.views[i]=R;
+                view_fields(prhs[2], i, &R.views[i]);
+            }
+            R.nviews=nviews;
+        }
+    }
+
+    /* The brick min/max, if not given */
+    if(R.accelerate&&(R.Bricks==NULL)) {
+        R.Bricks=(double *)malloc(nbricks*2*sizeof(double));
+        ThreadArgs=thread_args(&R, (Nthreads<R.nb0[2]) ? Nthreads : R.nb0[2]);
+        run_threads(ThreadArgs, (Nthreads<R.nb0[2]) ? Nthreads : R.nb0[2], THREAD_BRICKS);
+        free(ThreadArgs);
+        Bricks=R.Bricks;
+    }
+
+    /* Create output array, [ImageSize nviews] or [ImageSize 3 nviews] */
+    odims[0]=R.osize[0]; odims[1]=R.osize[1];
+    if(R.type>=RENDER_COLOR) {
+        odims[2]=3; odims[3]=nviews;
+        plhs[0]=mxCreateNumericArray((nviews>1) ? 4 : 3, odims, mxDOUBLE_CLASS, mxREAL);
+    }
+    else {
+        odims[2]=nviews;
+        plhs[0]=mxCreateNumericArray((nviews>1) ? 3 : 2, odims, mxDOUBLE_CLASS, mxREAL);
+    }
+    R.Iout=mxGetPr(plhs[0]);
+
+    /* Every thread renders whole frames, or every thread renders a block of
+     * rows of one frame, with the intermediate shear image and the
+     * acceleration buffers of every thread */
+    nbuffer=R.bsize*R.bsize*((R.type>=RENDER_COLOR) ? 3 : 1);
+    if(nviews>1) {
+        if(Nthreads>nviews) { Nthreads=nviews; }
+        nbuf=Nthreads;
+    }
+    else {
+        nbuf=1;
+    }
+    ThreadArgs=thread_args(&R, Nthreads);
+    for(i=0; i<nbuf; i++) {
+        ThreadArgs[i].Ibuffer=(double *)calloc(nbuffer, sizeof(double));
+        if(R.accelerate) {
+            ThreadArgs[i].Tbuf=(double *)malloc(R.bsize*R.bsize*sizeof(double));
+            ThreadArgs[i].alive=(int *)malloc(R.bsize*sizeof(int));
+            ThreadArgs[i].empty0=(unsigned char *)malloc(nbricks);
+            ThreadArgs[i].empty1=(unsigned char *)malloc(R.nb1[0]*R.nb1[1]*R.nb1[2]);
+        }
+    }
+    if(nviews>1) {
+        run_threads(ThreadArgs, Nthreads, THREAD_VIEWS);
+    }
+    else {
+        /* The bricks with zero opacity, then shear and composite, and warp
+         * the intermediate image */
+        for(i=1; i<Nthreads; i++) {
+            ThreadArgs[i].Ibuffer=ThreadArgs[0].Ibuffer; ThreadArgs[i].Tbuf=ThreadArgs[0].Tbuf;
+            ThreadArgs[i].alive=ThreadArgs[0].alive;
+            ThreadArgs[i].empty0=ThreadArgs[0].empty0; ThreadArgs[i].empty1=ThreadArgs[0].empty1;
+        }
+        if(R.accelerate) { empty_bricks(&ThreadArgs[0]); }
+        run_threads(ThreadArgs, Nthreads, THREAD_SHEAR);
+        run_threads(ThreadArgs, Nthreads, THREAD_WARP);
+    }
+
+    for(i=0; i<nbuf; i++) {
+        free(ThreadArgs[i].Ibuffer);
+        if(R.accelerate) {
+            free(ThreadArgs[i].Tbuf); free(ThreadArgs[i].alive);
+            free(ThreadArgs[i].empty0); free(ThreadArgs[i].empty1);
+        }
+    }
+    free(ThreadArgs);
+    if(R.views!=NULL) { free(R.views); }
+    if(Bricks!=NULL) { free(Bricks); }
+}
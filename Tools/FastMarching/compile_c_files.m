@@ -13,4 +13,6 @@ cd('shortestpath');
 clear rk4
 %mex('rk4.c');
 mex rk4.c -v;
+clear rk4path
+mex rk4path.c -v;
 cd('..')
@@ -1,7 +1,6 @@
 #define eps 2.2204460492503131e-16
 #define doublemax 1e50
 #define INF 2e50
-#define listINF 2.345e50
 #ifndef min
 #define min(a,b)        ((a) < (b) ? (a): (b))
 #endif
@@ -73,8 +72,6 @@ __inline int mindex3(int x, int y, int z, int sizx, int sizy) { return x+y*sizx+
 __inline bool IsFinite(double x) { return (x <= doublemax  && x >= -doublemax ); }
 __inline bool IsInf(double x)    { return (x >= doublemax ); }
 
-__inline bool IsListInf(double x){ return (x == listINF ); }
-
 
 __inline bool isntfrozen3d(int i, int j, int k, int *dims, bool *Frozen) {
 
@@ -85,215 +82,249 @@ __inline bool isfrozen3d(int i, int j, int k, int *dims, bool *Frozen) {
     return (i>=0)&&(j>=0)&&(k>=0)&&(i<dims[0])&&(j<dims[1])&&(k<dims[2])&&(Frozen[mindex3(i, j, k, dims[0], dims[1])]==1);
 }
 
-int p2x(int x) /* 2^x */
-{
-/*    return pow(2,x); */
-    int y=1;
-    int p2x[16] ={1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, 32768};
-    while(x>15) { x=x-15; y=y*32768; }
-    return y*p2x[x];
-}
+/* The narrow band is an indexed 4-ary min-heap. For every heap slot it stores the
+ * distance and the voxel index, the heap slot of a voxel is kept in the distance
+ * image itself (slot), which is only read back for not frozen voxels. This gives
+ * an O(log n) decrease-key without a search for the voxel */
+typedef struct {
+    double *val;
+    int *vox;
+    double *slot;
+    int length;
+    int capacity;
+} nbheap;
 
-void show_list(double **listval, int *listprop) {
-    int z, k;
-    for(z=0;z<listprop[1]; z++) {
-        for(k=0;k<p2x(z+1); k++) {
-            if((z>0)&&(listval[z-1][(int)floor(k/2)]>listval[z][k])) {
-                printf("*%15.5f", listval[z][k]);
-            }
-            else {
-                printf(" %15.5f", listval[z][k]);
-            }
-        }
-        printf("\n");
-    }
+/* Capacity estimate of the narrow band, a few times the largest cross section.
+ * The heap grows if this is not enough */
+int heap_capacity(int *dims, int ndims, int nsources) {
+    double c;
+    if(ndims==2) { c=4.0*(dims[0]+dims[1]); }
+    else { c=2.0*((double)dims[0]*dims[1]+(double)dims[1]*dims[2]+(double)dims[0]*dims[2]); }
+    c+=6.0*nsources+1024;
+    if(ndims==2) { c=min(c, (double)dims[0]*dims[1]); }
+    else { c=min(c, (double)dims[0]*dims[1]*dims[2]); }
+    return (int)c+1;
 }
 
-void initialize_list(double ** listval, int *listprop) {
-    /* Loop variables */
-    int i;
-    /* Current Length, Orde and Current Max Length */
-    listprop[0]=0; listprop[1]=1; listprop[2]=2;
-    /* Make first orde storage of 2 values */
-    listval[0]=(double*)malloc(2 * sizeof(double));
-    /* Initialize on infinite */
-    for(i=0;i<2;i++) { listval[0][i]=listINF; }
+void heap_init(nbheap *h, int capacity, double *slot) {
+    h->capacity=capacity;
+    h->length=0;
+    h->slot=slot;
+    h->val=(double *)malloc(capacity*sizeof(double));
+    h->vox=(int *)malloc(capacity*sizeof(int));
 }
 
-
-void destroy_list(double ** listval, int *listprop) {
-    /* Loop variables */
-    int i, list_orde;
-    /* Get list orde */
-    list_orde=listprop[1];
-    /* Free memory */
-    for(i=0;i<list_orde;i++) { free(listval[i]); }
-    free(listval);
-    free(listprop);
+void heap_destroy(nbheap *h) {
+    free(h->val);
+    free(h->vox);
 }
 
-void list_add(double ** listval, int *listprop, double val) {
-    /* List parameters */
-    int list_length, list_orde, list_lengthmax;
-    /* Loop variable */
-    int i, j;
-    /* Temporary list location */
-    int listp;
-    /* Get list parameters */
-    list_length=listprop[0]; list_orde=listprop[1]; list_lengthmax=listprop[2];
-    /* If list is full expand list */
-    if(list_length==list_lengthmax) {
-        list_lengthmax=list_lengthmax*2;
-        for (i=list_orde; i>0; i--) {
-            listval[i]=listval[i-1];
-            listval[i] = (double *)realloc(listval[i], p2x(i+1)*sizeof(double));
-            for(j=p2x(i); j<p2x(i+1); j++) { listval[i][j]=listINF;  }
-        }
-        listval[0]=(double *)malloc(2*sizeof(double));
-        listval[0][0]=min(listval[1][0], listval[1][1]);
-        listval[0][1]=listINF;
-        list_orde++;
+/* Move the hole at slot s up until the value v fits, then place voxel vox in it */
+__inline void heap_up(nbheap *h, int s, int vox, double v) {
+    int p;
+    while(s>0) {
+        p=(s-1)>>2;
+        if(h->val[p]<=v) { break; }
+        h->val[s]=h->val[p]; h->vox[s]=h->vox[p]; h->slot[h->vox[s]]=s;
+        s=p;
     }
-    /* Add a value to the list */
-    listp=list_length;
-    list_length++;
-    listval[list_orde-1][listp]=val;
-    /* Update the links minimum */
-    for (i=list_orde-1; i>0; i--) {
-        listp=(int)floor(((double)listp)/2);
-        if(val<listval[i-1][listp]) { listval[i-1][listp]=val; } else { break; }
+    h->val[s]=v; h->vox[s]=vox; h->slot[vox]=s;
+}
+
+/* Move the hole at slot s down until the value v fits, then place voxel vox in it */
+__inline void heap_down(nbheap *h, int s, int vox, double v) {
+    int c, ce, m;
+    double vm;
+    while(true) {
+        c=4*s+1;
+        if(c>=h->length) { break; }
+        ce=min(c+4, h->length);
+        m=c; vm=h->val[c];
+        for(c=c+1; c<ce; c++) { if(h->val[c]<vm) { m=c; vm=h->val[c]; } }
+        if(vm>=v) { break; }
+        h->val[s]=vm; h->vox[s]=h->vox[m]; h->slot[h->vox[s]]=s;
+        s=m;
     }
-    /* Set list parameters */
-    listprop[0]=list_length; listprop[1]=list_orde; listprop[2]=list_lengthmax;
+    h->val[s]=v; h->vox[s]=vox; h->slot[vox]=s;
 }
 
-int list_minimum(double ** listval, int *listprop) {
-    /* List parameters */
-    int list_length, list_orde, list_lengthmax;
-    /* Loop variable */
-    int i;
-    /* Temporary list location */
-    int listp;
-    /* Index of Minimum */
-    int minindex;
-    /* Get list parameters */
-    list_length=listprop[0]; list_orde=listprop[1]; list_lengthmax=listprop[2];
-    /* Follow the minimum through the binary tree */
-    listp=0;
-    for(i=0;i<(list_orde-1);i++) {
-        
-        /* <= ????? */ 
-        if(listval[i][listp]<=listval[i][listp+1]) { listp=listp*2; } else { listp=(listp+1)*2; }
+void heap_push(nbheap *h, int vox, double v) {
+    if(h->length==h->capacity) {
+        h->capacity*=2;
+        h->val=(double *)realloc(h->val, h->capacity*sizeof(double));
+        h->vox=(int *)realloc(h->vox, h->capacity*sizeof(int));
     }
-    i=list_orde-1;
-    if(listval[i][listp]<=listval[i][listp+1]){minindex=listp; } else { minindex=listp+1; }
-    return minindex;
+    h->length++;
+    heap_up(h, h->length-1, vox, v);
 }
-void list_remove(double ** listval, int *listprop, int index) {
-    /* List parameters */
-    int list_length, list_orde, list_lengthmax;
-    /* Loop variable */
-    int i;
-    /* Temp index */
-    int index2;
-    double val;
-    double valmin;
-    /* Get list parameters */
-    list_length=listprop[0];
-    list_orde=listprop[1];
-    list_lengthmax=listprop[2];
-    /* Temporary store current value */
-    val=listval[list_orde-1][index];
-    valmin=listINF;
-    /* Replace value by infinite */
-    listval[list_orde-1][index]=listINF;
-    /* Follow the binary tree to replace value by minimum values from */
-    /** the other values in the binary tree. */
-
-    i=list_orde-1;
-    while(true) {
-        if((index%2)==0) { index2=index+1; } else { index2=index-1; }
-        if(val<listval[i][index2]) {
-            index=(int)floor(((double)index2)/2.0);
-            if(listval[i][index2]<valmin) { valmin=listval[i][index2]; }
-			if(i==0) { break; }
-            listval[i-1][index]=valmin;
-            i--; if(i==0) { break; }
-        }
-        else { break; }
+
+/* Lower the distance of a voxel which is already in the narrow band, returns
+ * true if the new distance is lower */
+__inline bool heap_decrease(nbheap *h, int vox, double v) {
+    int s=(int)h->slot[vox];
+    if(v<h->val[s]) { heap_up(h, s, vox, v); return true; }
+    return false;
+}
+
+/* Remove the voxel with the smallest distance, returns its voxel index */
+int heap_pop(nbheap *h, double *v) {
+    int vox=h->vox[0];
+    *v=h->val[0];
+    h->length--;
+    if(h->length>0) { heap_down(h, 0, h->vox[h->length], h->val[h->length]); }
+    return vox;
+}
+
+/* Speed image in its own class, the speed is F*scale+offset */
+typedef struct {
+    void *data;
+    mxClassID cls;
+    double scale;
+    double offset;
+} speedimage;
+
+__inline double get_speed(speedimage *F, int index) {
+    double v;
+    switch(F->cls) {
+        case mxSINGLE_CLASS: v=((float *)F->data)[index]; break;
+        case mxUINT8_CLASS: v=((unsigned char *)F->data)[index]; break;
+        case mxUINT16_CLASS: v=((unsigned short *)F->data)[index]; break;
+        default: v=((double *)F->data)[index]; break;
     }
+    return v*F->scale+F->offset;
+}
+
+/* Options to stop the marching before the whole image is processed */
+typedef struct {
+    /* Sorted voxel indices of the stop points, and how many are not yet frozen */
+    int *stop;
+    int nstop;
+    int nstopleft;
+    /* Region to which the marching is limited, 0 based [min max] per dimension */
+    bool usebox;
+    int box[6];
+    double maxtime;
+    /* Solver of msfm3d, 0: fast marching, 1: block parallel fast iterative method */
+    int solver;
+    double tolerance;
+} marchoptions;
+
+int compare_int(const void *a, const void *b) {
+    return (*(const int *)a > *(const int *)b) - (*(const int *)a < *(const int *)b);
 }
 
-void list_remove_replace(double ** listval, int *listprop, int index) {
-    /* List parameters */
-    int list_length, list_orde, list_lengthmax;
-    /* Loop variable */
-    int i, listp;
-    /* Temporary store value */
-    double val;
-    int templ;
-    /* Get list parameters */
-    list_length=listprop[0];
-    list_orde=listprop[1];
-    list_lengthmax=listprop[2];
-    /* Remove the value */
-    list_remove(listval, listprop, index);
-    /* Replace the removed value by the last in the list. (if it was */
-    /* not already the last value) */
-    if(index<(list_length-1)) {
-        /* Temporary store last value in the list */
-        val=listval[list_orde-1][list_length-1];
-        /* Remove last value in the list */
-        list_remove(listval, listprop, list_length-1);
-        /* Add a value to the list */
-        listp=index;
-        listval[list_orde-1][index]=val;
-        /* Update the links minimum */
-        for (i=(list_orde-1); i>0; i--) {
-            listp=(int)floor(((double)listp)/2);
-            if(val<listval[i-1][listp]) { listval[i-1][listp]=val; } else {  break; }
+/* Read the options struct (StopPoints, BoundingBox, MaxTime, SpeedScale,
+ * SpeedOffset, Solver and Tolerance) of msfm2d and msfm3d */
+void read_march_options(const mxArray *opt, int ndims, int *dims, marchoptions *mo, speedimage *F) {
+    mxArray *field;
+    double *P;
+    char solver[16];
+    int q, d, n, c, index;
+    
+    mo->stop=NULL; mo->nstop=0; mo->nstopleft=0;
+    mo->usebox=false;
+    for(d=0; d<3; d++) { mo->box[d*2]=0; mo->box[d*2+1]=(d<ndims) ? dims[d]-1 : 0; }
+    mo->maxtime=INF;
+    mo->solver=0;
+    mo->tolerance=1e-10;
+    if(opt==NULL) { return; }
+    if(!mxIsStruct(opt)) {
+        mexErrMsgTxt("Options must be a struct");
+    }
+    
+    field=mxGetField(opt, 0, "StopPoints");
+    if((field!=NULL)&&(!mxIsEmpty(field))) {
+        if((mxGetClassID(field)!=mxDOUBLE_CLASS)||(mxGetM(field)!=(size_t)ndims)) {
+            mexErrMsgTxt("StopPoints must be a double matrix with the same size as SourcePoints");
+        }
+        n=(int)mxGetN(field);
+        P=mxGetPr(field);
+        mo->stop=(int *)malloc(n*sizeof(int));
+        for(q=0; q<n; q++) {
+            index=0;
+            for(d=ndims-1; d>=0; d--) {
+                c=(int)P[q*ndims+d]-1;
+                if((c<0)||(c>=dims[d])) {
+                    free(mo->stop);
+                    mexErrMsgTxt("StopPoints must be inside the image");
+                }
+                index=index*dims[d]+c;
+            }
+            mo->stop[q]=index;
         }
+        /* Sort and remove duplicates */
+        qsort(mo->stop, n, sizeof(int), compare_int);
+        mo->nstop=0;
+        for(q=0; q<n; q++) { if((q==0)||(mo->stop[q]!=mo->stop[mo->nstop-1])) { mo->stop[mo->nstop++]=mo->stop[q]; } }
+        mo->nstopleft=mo->nstop;
     }
-    /* List is now shorter */
-    list_length--;
-    /* Remove trunk of binary tree  / Free memory if list becomes shorter */
-    if(list_orde>2&&IsListInf(listval[0][1])) {
-        list_orde--;
-        list_lengthmax=list_lengthmax/2;
-        /* Remove trunk array */
-        free(listval[0]);
-        /* Move the other arrays one up */
-        templ=2;
-        for (i=0; i<list_orde; i++) {
-            listval[i]=listval[i+1];
-            /* Resize arrays to their new shorter size */
-            listval[i] = (double *)realloc(listval[i], templ*sizeof(double));
-            templ*=2;
+    
+    field=mxGetField(opt, 0, "BoundingBox");
+    if((field!=NULL)&&(!mxIsEmpty(field))) {
+        if((mxGetClassID(field)!=mxDOUBLE_CLASS)||(mxGetNumberOfElements(field)!=(size_t)(2*ndims))) {
+            if(mo->stop!=NULL) { free(mo->stop); }
+            mexErrMsgTxt("BoundingBox must be a double [min max] pair for every dimension");
+        }
+        P=mxGetPr(field);
+        mo->usebox=true;
+        for(d=0; d<ndims; d++) {
+            mo->box[d*2]=max((int)P[d*2]-1, 0);
+            mo->box[d*2+1]=min((int)P[d*2+1]-1, dims[d]-1);
+            if(mo->box[d*2]>mo->box[d*2+1]) {
+                if(mo->stop!=NULL) { free(mo->stop); }
+                mexErrMsgTxt("BoundingBox must have min<=max and overlap the image in every dimension");
+            }
         }
     }
-    /* Set list parameters */
-    listprop[0]=list_length; listprop[1]=list_orde; listprop[2]=list_lengthmax;
+    
+    field=mxGetField(opt, 0, "MaxTime");
+    if((field!=NULL)&&(!mxIsEmpty(field))) { mo->maxtime=mxGetScalar(field); }
+    field=mxGetField(opt, 0, "SpeedScale");
+    if((field!=NULL)&&(!mxIsEmpty(field))) { F->scale=mxGetScalar(field); }
+    field=mxGetField(opt, 0, "SpeedOffset");
+    if((field!=NULL)&&(!mxIsEmpty(field))) { F->offset=mxGetScalar(field); }
+    field=mxGetField(opt, 0, "Solver");
+    if((field!=NULL)&&(mxIsChar(field))) {
+        mxGetString(field, solver, 16);
+        if(strcmp(solver, "fim")==0) { mo->solver=1; }
+        else if(strcmp(solver, "fmm")!=0) {
+            if(mo->stop!=NULL) { free(mo->stop); }
+            mexErrMsgTxt("Solver must be 'fmm' or 'fim'");
+        }
+    }
+    field=mxGetField(opt, 0, "Tolerance");
+    if((field!=NULL)&&(!mxIsEmpty(field))) { mo->tolerance=mxGetScalar(field); }
 }
 
-void listupdate(double **listval, int *listprop, int index, double val) {
-    /* List parameters */
-    int list_length, list_orde, list_lengthmax;
-    /* loop variable */
-    int i, listp;
-    /* Get list parameters */
-    list_length=listprop[0];
-    list_orde=listprop[1];
-    list_lengthmax=listprop[2];
-    /* Add a value to the list */
-    listp=index;
-    listval[list_orde-1][index]=val;
-    /* Update the links minimum */
-    for (i=(list_orde-1); i>0; i--) {
-        listp=(int)floor(((double)listp)/2);
-        if(val<listval[i-1][listp]) { listval[i-1][listp]=val; } else { break; }
+/* Error out when a source point is outside the BoundingBox, the marching
+ * would not start and every pixel would be Inf */
+void check_sources_in_box(double *SourcePoints, int nsource, int ndims, marchoptions *mo) {
+    int s, d, c;
+    if(!mo->usebox) { return; }
+    for(s=0; s<nsource; s++) {
+        for(d=0; d<ndims; d++) {
+            c=(int)SourcePoints[s*ndims+d]-1;
+            if((c<mo->box[d*2])||(c>mo->box[d*2+1])) {
+                if(mo->stop!=NULL) { free(mo->stop); }
+                mexErrMsgTxt("SourcePoints must be inside the BoundingBox");
+            }
+        }
     }
-    /* Set list parameters */
-    listprop[0]=list_length; listprop[1]=list_orde; listprop[2]=list_lengthmax;
+}
+
+/* Returns true if a just frozen voxel was the last stop point */
+__inline bool last_stop_point(marchoptions *mo, int index) {
+    if(mo->nstop==0) { return false; }
+    if(bsearch(&index, mo->stop, mo->nstop, sizeof(int), compare_int)!=NULL) { mo->nstopleft--; }
+    return mo->nstopleft==0;
+}
+
+__inline bool inbox2d(int i, int j, marchoptions *mo) {
+    return (!mo->usebox)||((i>=mo->box[0])&&(i<=mo->box[1])&&(j>=mo->box[2])&&(j<=mo->box[3]));
+}
+
+__inline bool inbox3d(int i, int j, int k, marchoptions *mo) {
+    return (!mo->usebox)||((i>=mo->box[0])&&(i<=mo->box[1])&&(j>=mo->box[2])&&(j<=mo->box[3])&&(k>=mo->box[4])&&(k<=mo->box[5]));
 }
 
 __inline int mindex2(int x, int y, int sizx) { return x+y*sizx; }    
@@ -306,3 +337,28 @@ __inline bool isfrozen2d(int i, int j, int *dims, bool *Frozen)
 {
     return (i>=0)&&(j>=0)&&(i<dims[0])&&(j<dims[1])&&(Frozen[i+j*dims[0]]==1);
 }
+
+/* Source index of the frozen direct neighbour with the lowest distance */
+unsigned int upwind_label2d(int x, int y, int *dims, double *T, bool *Frozen, unsigned int *L) {
+    int ne[8]={-1, 1, 0, 0, 0, 0, -1, 1};
+    int k, index, best=-1;
+    for(k=0; k<4; k++) {
+        if(isfrozen2d(x+ne[k], y+ne[k+4], dims, Frozen)) {
+            index=mindex2(x+ne[k], y+ne[k+4], dims[0]);
+            if((best<0)||(T[index]<T[best])) { best=index; }
+        }
+    }
+    return (best<0) ? 0 : L[best];
+}
+
+unsigned int upwind_label3d(int x, int y, int z, int *dims, double *T, bool *Frozen, unsigned int *L) {
+    int ne[18]={-1,  0,  0, 1, 0, 0, 0, -1,  0, 0, 1, 0, 0,  0, -1, 0, 0, 1};
+    int w, index, best=-1;
+    for(w=0; w<6; w++) {
+        if(isfrozen3d(x+ne[w], y+ne[w+6], z+ne[w+12], dims, Frozen)) {
+            index=mindex3(x+ne[w], y+ne[w+6], z+ne[w+12], dims[0], dims[1]);
+            if((best<0)||(T[index]<T[best])) { best=index; }
+        }
+    }
+    return (best<0) ? 0 : L[best];
+}
@@ -1,5 +1,6 @@
 #include "mex.h"
 #include "math.h"
+#include "string.h"
 #include "common.c"
 
 /*
@@ -9,16 +10,33 @@
  *distances by using second order derivatives and cross neighbours.
  *
  *T=msfm2d(F, SourcePoints, UseSecond, UseCross)
+ *T=msfm2d(F, SourcePoints, UseSecond, UseCross, Options)
+ *[T,Y,L]=msfm2d(F, SourcePoints, UseSecond, UseCross, Options)
  *
  *inputs,
- *  F: The speed image
+ *  F: The speed image, class double, single, uint8 or uint16
  *  SourcePoints : A list of starting points [2 x N] (distance zero)
  *  UseSecond : Boolean Set to true if not only first but also second
  *               order derivatives are used (default)
  *  UseCross: Boolean Set to true if also cross neighbours
  *               are used (default)
+ *  Options: (optional) struct to stop the marching early, with the fields
+ *     .StopPoints : [2 x M] points, the marching stops when all are reached
+ *     .BoundingBox : [min1 max1 min2 max2], the marching is limited to
+ *               this region of the image
+ *     .MaxTime : the marching stops at this distance
+ *     .SpeedScale, .SpeedOffset : the speed is F*SpeedScale+SpeedOffset
+ *               (default 1 and 0)
  *outputs,
- *  T : Image with distance from SourcePoints to all pixels
+ *  T : Image with distance from SourcePoints to all pixels, when Options
+ *      is given pixels which are not reached are Inf
+ *  Y : Euclidian distance from SourcePoints to all pixels (augmented
+ *      fast marching, used by skeletonize)
+ *  L : (uint32) Index of the source point which reached the pixel first,
+ *      a geodesic Voronoi partition of the image, 0 if not reached
+ *
+ *Iface=msfm2d('interface') returns 2 for this interface (Options and L),
+ *older builds of the mex file error out
  *
  *Function is written by D.Kroon University of Twente (June 2009)
  */
@@ -203,7 +221,11 @@ double CalculateDistance(double *T, double Fij, int *dims, int i, int j, bool us
 void mexFunction( int nlhs, mxArray *plhs[],
         int nrhs, const mxArray *prhs[] ) {
     /* The input variables */
-    double *F, *SourcePoints;
+    speedimage F;
+    double *SourcePoints;
+    
+    /* Early stop of the marching */
+    marchoptions mo;
     bool *useseconda, *usecrossa;
     bool usesecond=true;
     bool usecross=true;
@@ -214,6 +236,9 @@ void mexFunction( int nlhs, mxArray *plhs[],
     /* Euclidian distance image */
     double *Y;
     
+    /* Index of the source point which reached a pixel first */
+    unsigned int *L=NULL;
+    
     /* Current distance values */
     double Tt, Ty;
     
@@ -234,16 +259,8 @@ void mexFunction( int nlhs, mxArray *plhs[],
     /* Number of pixels in image */
     int npixels;
     
-    /* Neighbour list */
-    int neg_free;
-    int neg_pos;
-    double *neg_listv;
-    double *neg_listx;
-    double *neg_listy;
-    double *neg_listo;
-    
-    int *listprop;
-    double **listval;
+    /* Narrow band */
+    nbheap band;
     
     /* Neighbours 4x2 */
     int ne[8]={-1, 1, 0, 0, 0, 0, -1, 1};
@@ -255,21 +272,28 @@ void mexFunction( int nlhs, mxArray *plhs[],
     int x, y, i, j;
     
     /* Index */
-    int IJ_index, XY_index, index;
+    int IJ_index, XY_index;
+    
+    /* Report the interface, so that msfm.m can detect an older build */
+    if((nrhs==1)&&mxIsChar(prhs[0])) {
+        plhs[0]=mxCreateDoubleScalar(2);
+        return;
+    }
     
     /* Check for proper number of input and output arguments. */
     if(nrhs<3) {
-        mexErrMsgTxt("2 to 4 inputs are required.");
+        mexErrMsgTxt("3 to 5 inputs are required.");
     }
     if(nlhs==1) { Ed=0; }
-    else if (nlhs==2) { Ed=1; }
+    else if ((nlhs==2)||(nlhs==3)) { Ed=1; }
     else {
-        mexErrMsgTxt("One or Two outputs required");
+        mexErrMsgTxt("One to three outputs required");
     }
     
     /* Check data input types  */
-    if(mxGetClassID(prhs[0])!=mxDOUBLE_CLASS) {
-        mexErrMsgTxt("Speed image must be of class double");
+    F.cls=mxGetClassID(prhs[0]);
+    if((F.cls!=mxDOUBLE_CLASS)&&(F.cls!=mxSINGLE_CLASS)&&(F.cls!=mxUINT8_CLASS)&&(F.cls!=mxUINT16_CLASS)) {
+        mexErrMsgTxt("Speed image must be of class double, single, uint8 or uint16");
     }
     if(mxGetClassID(prhs[1])!=mxDOUBLE_CLASS) {
         mexErrMsgTxt("SourcePoints must be of class double");
@@ -281,6 +305,9 @@ void mexFunction( int nlhs, mxArray *plhs[],
     if((nrhs>3)&&(mxGetClassID(prhs[3])!= mxLOGICAL_CLASS)) {
         mexErrMsgTxt("UseCross must be of class boolean / logical");
     }
+    if((nrhs>4)&&(!mxIsStruct(prhs[4]))) {
+        mexErrMsgTxt("Options must be a struct");
+    }
         
     /* Get the sizes of the input image */
     if(mxGetNumberOfDimensions(prhs[0])==2) {
@@ -302,10 +329,16 @@ void mexFunction( int nlhs, mxArray *plhs[],
     
     
     /* Get pointers/data from  to each input. */
-    F=(double*)mxGetPr(prhs[0]);
+    F.data=mxGetData(prhs[0]); F.scale=1; F.offset=0;
     SourcePoints=(double*)mxGetPr(prhs[1]);
     if(nrhs>2){ useseconda = (bool*)mxGetPr(prhs[2]); usesecond=useseconda[0];}
     if(nrhs>3){ usecrossa = (bool*)mxGetPr(prhs[3]); usecross=usecrossa[0];}
+    read_march_options((nrhs>4) ? prhs[4] : NULL, 2, dims, &mo, &F);
+    if(mo.solver==1) {
+        if(mo.stop!=NULL) { free(mo.stop); }
+        mexErrMsgTxt("The fim solver is only available in msfm3d");
+    }
+    check_sources_in_box(SourcePoints, (int)dims_sp[1], 2, &mo);
     
     /* Create the distance output array */
     plhs[0] = mxCreateNumericArray(2, dims, mxDOUBLE_CLASS, mxREAL);
@@ -317,6 +350,10 @@ void mexFunction( int nlhs, mxArray *plhs[],
         plhs[1] = mxCreateNumericArray(2, dims, mxDOUBLE_CLASS, mxREAL);
         Y= mxGetPr(plhs[1]);
     }
+    if(nlhs>2) {
+        plhs[2] = mxCreateNumericArray(2, dims, mxUINT32_CLASS, mxREAL);
+        L= (unsigned int*)mxGetData(plhs[2]);
+    }
     
     /* Pixels which are processed and have a final distance are frozen */
     Frozen = (bool*)malloc( npixels* sizeof(bool) );
@@ -326,23 +363,9 @@ void mexFunction( int nlhs, mxArray *plhs[],
     for(q=0;q<npixels;q++){Y[q]=-1;}
     }
     
-    /*Free memory to store neighbours of the (segmented) region */
-    neg_free = 100000;
-    neg_pos=0;
-    neg_listx = (double *)malloc( neg_free*sizeof(double) );
-    neg_listy = (double *)malloc( neg_free*sizeof(double) );
-    if(Ed) {
-        neg_listo = (double *)malloc( neg_free*sizeof(double) );
-        for(q=0;q<neg_free;q++) { neg_listo[q]=0; }
-    }
-    
-    /* List parameters array */
-    listprop=(int*)malloc(3* sizeof(int));
-    /* Make jagged list to store a maximum of 2^64 values */
-    listval= (double **)malloc( 64* sizeof(double *) );
-    /* Initialize parameter list */
-    initialize_list(listval, listprop);
-    neg_listv=listval[listprop[1]-1];
+    /* Narrow band heap, the distance image T stores the heap slot of the */
+    /* narrow band pixels */
+    heap_init(&band, heap_capacity(dims, 2, dims_sp[1]), T);
     
     /*(There are 3 pixel classes:
      *  - frozen (processed)
@@ -362,6 +385,8 @@ void mexFunction( int nlhs, mxArray *plhs[],
         Frozen[XY_index]=1;
         T[XY_index]=0;
         if(Ed) { Y[XY_index]=0; }
+        if(L!=NULL) { L[XY_index]=z+1; }
+        last_stop_point(&mo, XY_index);
     }
     
     for (z=0; z<dims_sp[1]; z++) {
@@ -378,39 +403,17 @@ void mexFunction( int nlhs, mxArray *plhs[],
             
             /*Check if current neighbour is not yet frozen and inside the
              *picture  */
-            if(isntfrozen2d(i, j, dims, Frozen)) {
-                Tt=(1/(max(F[IJ_index],eps)));
+            if(isntfrozen2d(i, j, dims, Frozen)&&inbox2d(i, j, &mo)) {
+                Tt=(1/(max(get_speed(&F, IJ_index),eps)));
 					
                 Ty=1;
                 /*Update distance in neigbour list or add to neigbour list */
-                if(T[IJ_index]>0) {
-                    if(neg_listv[(int)T[IJ_index]]>Tt) {
-                        listupdate(listval, listprop, (int)T[IJ_index], Tt);
-                    }
-                    if(Ed)
-                    {
-                        neg_listo[(int)T[IJ_index]]=min(neg_listo[(int)T[IJ_index]],Ty);
-                    }
+                if(T[IJ_index]>-1) {
+                    heap_decrease(&band, IJ_index, Tt);
                 }
                 else {
-                    /*If running out of memory at a new block  */
-                    if(neg_pos>=neg_free) {
-                        neg_free+=100000;
-                        neg_listx = (double *)realloc(neg_listx, neg_free*sizeof(double) );
-                        neg_listy = (double *)realloc(neg_listy, neg_free*sizeof(double) );
-                        if(Ed) {
-                            neg_listo = (double *)realloc(neg_listo, neg_free*sizeof(double) );
-                        }
-                    }
-                    list_add(listval, listprop, Tt);
-                    neg_listv=listval[listprop[1]-1];
-                    neg_listx[neg_pos]=i;
-                    neg_listy[neg_pos]=j;
-                    if(Ed){
-                        neg_listo[neg_pos]=Ty;
-                    }
-                    T[IJ_index]=neg_pos;
-                    neg_pos++;
+                    heap_push(&band, IJ_index, Tt);
+                    if(Ed) { Y[IJ_index]=Ty; }
                 }
             }
         }
@@ -419,32 +422,21 @@ void mexFunction( int nlhs, mxArray *plhs[],
     for (itt=0; itt<npixels; itt++) {
         /*Get the pixel from narrow list (boundary list) with smallest
          *distance value and set it to current pixel location  */
-        index=list_minimum(listval, listprop);
-        neg_listv=listval[listprop[1]-1];
+        if((band.length==0)||((mo.nstop>0)&&(mo.nstopleft==0))) { break; }
+        XY_index=heap_pop(&band, &Tt);
  		
         /* Stop if pixel distance is infinite (all pixels are processed)  */
-        if(IsInf(neg_listv[index])) {  break; }
-        x=(int)neg_listx[index]; y=(int)neg_listy[index];
+        if(IsInf(Tt)) {  break; }
+        /* Stop if the maximum time is reached */
+        if(Tt>mo.maxtime) { break; }
+        x=XY_index%dims[0]; y=XY_index/dims[0];
         
-        XY_index=x+y*dims[0];
         Frozen[XY_index]=1;
-        T[XY_index]=neg_listv[index];
-        if(Ed) { Y[XY_index]=neg_listo[index]; }
-      
-     
-        /*Remove min value by replacing it with the last value in the array  */
-        list_remove_replace(listval, listprop, index) ;
-        neg_listv=listval[listprop[1]-1];
-        if(index<(neg_pos-1)) {
-            neg_listx[index]=neg_listx[neg_pos-1];
-            neg_listy[index]=neg_listy[neg_pos-1];
-            if(Ed){
-                neg_listo[index]=neg_listo[neg_pos-1];
-            }
-            T[(int)(neg_listx[index]+neg_listy[index]*dims[0])]=index;
-        }
-        neg_pos =neg_pos-1;
-       
+        T[XY_index]=Tt;
+        /* The pixel gets the source index of its upwind (lowest) frozen neighbour */
+        if(L!=NULL) { L[XY_index]=upwind_label2d(x, y, dims, T, Frozen, L); }
+        /* Stop if all stop points are frozen */
+        if(last_stop_point(&mo, XY_index)) { break; }
     
         /*Loop through all 4 neighbours of current pixel  */
         for (k=0;k<4;k++) {
@@ -455,56 +447,38 @@ void mexFunction( int nlhs, mxArray *plhs[],
 
             /*Check if current neighbour is not yet frozen and inside the  */
             /*picture  */
-            if(isntfrozen2d(i, j, dims, Frozen)) {
+            if(isntfrozen2d(i, j, dims, Frozen)&&inbox2d(i, j, &mo)) {
 				
-                Tt=CalculateDistance(T, F[IJ_index], dims, i, j, usesecond, usecross, Frozen);
+                Tt=CalculateDistance(T, get_speed(&F, IJ_index), dims, i, j, usesecond, usecross, Frozen);
 				        
 				if(Ed) {
                     Ty=CalculateDistance(Y, 1, dims, i, j, usesecond, usecross, Frozen);
                 }
 
                 /*Update distance in neigbour list or add to neigbour list */
-                IJ_index=i+j*dims[0];
-                if((T[IJ_index]>-1)&&T[IJ_index]<=listprop[0]) {
-                    if(neg_listv[(int)T[IJ_index]]>Tt) {
-                        listupdate(listval, listprop,    (int)T[IJ_index], Tt);
-                    }
-                    if(Ed)
-                    {
-                        neg_listo[neg_pos]=min(neg_listo[neg_pos],Ty);
-                    }
+                if(T[IJ_index]>-1) {
+                    heap_decrease(&band, IJ_index, Tt);
                 }
                 else {
-                    /*If running out of memory at a new block */
-                    if(neg_pos>=neg_free) {
-                        neg_free+=100000;
-                        neg_listx = (double *)realloc(neg_listx, neg_free*sizeof(double) );
-                        neg_listy = (double *)realloc(neg_listy, neg_free*sizeof(double) );
-                        if(Ed) {
-                            neg_listo = (double *)realloc(neg_listo, neg_free*sizeof(double) );
-                        }
-                    }
-                    list_add(listval, listprop, Tt);
-                    neg_listv=listval[listprop[1]-1];
-                    neg_listx[neg_pos]=i; neg_listy[neg_pos]=j;
-                    if(Ed) {
-                        neg_listo[neg_pos]=Ty;
-                    }
-                    T[IJ_index]=neg_pos;
-                    neg_pos++;
+                    heap_push(&band, IJ_index, Tt);
+                    /* Euclidian distance of a narrow band pixel, it is */
+                    /* only read back once the pixel is frozen */
+                    if(Ed) { Y[IJ_index]=Ty; }
                 }
             }
         }
         
     }
-    /* Free memory */
-    /* Destroy parameter list */
-    destroy_list(listval, listprop);
-    free(neg_listx);
-    free(neg_listy);
-    if(Ed) {
-        free(neg_listo);
+    /* Pixels which are not reached when the marching stopped early */
+    if(nrhs>4) {
+        for(q=0;q<npixels;q++) {
+            if(Frozen[q]==0) { T[q]=mxGetInf(); if(Ed) { Y[q]=mxGetInf(); } if(L!=NULL) { L[q]=0; } }
+        }
     }
+    
+    /* Free memory */
+    heap_destroy(&band);
+    if(mo.stop!=NULL) { free(mo.stop); }
     free(Frozen);
 }
 
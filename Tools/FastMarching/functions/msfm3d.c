@@ -1,25 +1,80 @@
 #include "mex.h"
 #include "math.h"
+#include "string.h"
+
+/*   undef needed for LCC compiler  */
+#undef EXTERN_C
+#ifdef _WIN32
+	#include <windows.h>
+	#include <process.h>
+#else
+	#include <pthread.h>
+#endif
+
 #include "common.c"
 
+/* Block size and maximum number of sweeps per block of the fast iterative method */
+#define FIMBLOCK 8
+#define FIMSWEEPS 4
+
+/* Compile with -DMSFM_PADDED to read the frozen distances in the distance
+ * update from a padded copy of the volume, in which the border and the not
+ * frozen voxels are INF, so no bounds or frozen checks are needed. The copy
+ * (and a second one for the euclidean distance) costs a full extra volume of
+ * memory, so the default is the bounds checked update on T itself. Add
+ * -DMSFM_SINGLE to store the padded copy in single precision (halves the
+ * stencil memory traffic, the first order distances are then accurate to
+ * about 1e-7, the cross stencils amplify this rounding near ties as they do
+ * for any small change of the speed image) */
+#if defined(MSFM_SINGLE)
+typedef float stencil_t;
+#else
+typedef double stencil_t;
+#endif
+#define PAD 2
+
 /*This function MSFM3D calculates the shortest distance from a list of */
 /*points to all other pixels in an image, using the */
 /*Multistencil Fast Marching Method (MSFM). This method gives more accurate */
 /*distances by using second order derivatives and cross neighbours. */
 /* */
 /*T=msfm3d(F, SourcePoints, UseSecond, UseCross) */
+/*T=msfm3d(F, SourcePoints, UseSecond, UseCross, Options) */
+/*[T,Y,L]=msfm3d(F, SourcePoints, UseSecond, UseCross, Options) */
 /* */
 /*inputs, */
 /*   F: The 3D speed image. The speed function must always be larger */
 /*			than zero (min value 1e-8), otherwise some regions will */
 /*			never be reached because the time will go to infinity.  */
+/*          Class double, single, uint8 or uint16 */
 /*  SourcePoints : A list of starting points [3 x N] (distance zero) */
 /*  UseSecond : Boolean Set to true if not only first but also second */
 /*               order derivatives are used (default) */
 /*  UseCross: Boolean Set to true if also cross neighbours */
 /*               are used (default) */
+/*  Options: (optional) struct to stop the marching early, with the fields */
+/*     .StopPoints : [3 x M] points, the marching stops when all are reached */
+/*     .BoundingBox : [min1 max1 min2 max2 min3 max3], the marching is */
+/*               limited to this region of the volume */
+/*     .MaxTime : the marching stops at this distance */
+/*     .SpeedScale, .SpeedOffset : the speed is F*SpeedScale+SpeedOffset */
+/*               (default 1 and 0) */
+/*     .Solver : 'fmm' (default) or 'fim', the block parallel fast */
+/*               iterative method. It uses the first order stencil */
+/*               (UseSecond and UseCross are ignored), only returns T, */
+/*               and can not be combined with StopPoints, BoundingBox */
+/*               and MaxTime */
+/*     .Tolerance : relative convergence tolerance of 'fim' (1e-10) */
 /*outputs, */
-/*  T : Image with distance from SourcePoints to all pixels */
+/*  T : Image with distance from SourcePoints to all pixels, when Options */
+/*      is given voxels which are not reached are Inf */
+/*  Y : Euclidian distance from SourcePoints to all pixels (augmented */
+/*      fast marching, used by skeletonize) */
+/*  L : (uint32) Index of the source point which reached the voxel first, */
+/*      a geodesic Voronoi partition of the volume, 0 if not reached */
+/* */
+/*Iface=msfm3d('interface') returns 2 for this interface (Options and L), */
+/*older builds of the mex file error out */
 
 /* */
 /*Function is written by D.Kroon University of Twente (June 2009) */
@@ -292,11 +347,281 @@ double CalculateDistance(double *T, double Fijk, int *dims, int i, int j, int k,
     return Tt;
 }
 
+#ifdef MSFM_PADDED
+/* The 13 directions of the stencils, and the direction of each of the 18 */
+/* derivatives (3 per stencil) used in CalculateDistance */
+static const int stencil_dir[13][3]={{1, 0, 0}, {0, 1, 0}, {0, 0, 1}, {0, 1, 1}, {0, 1, -1}, {1, 0, -1}, {1, 0, 1},
+                                     {1, 1, 0}, {1, -1, 0}, {1, 1, -1}, {1, -1, -1}, {1, 1, 1}, {1, -1, 1}};
+static const int stencil_slot[18]={0, 1, 2, 0, 3, 4, 1, 5, 6, 2, 7, 8, 6, 9, 10, 5, 11, 12};
+
+/* Index offsets of the stencil directions in the padded volume */
+void padded_offsets(int *off, int *pdims) {
+    int d;
+    for(d=0; d<13; d++) {
+        off[d]=stencil_dir[d][0]+stencil_dir[d][1]*pdims[0]+stencil_dir[d][2]*pdims[0]*pdims[1];
+    }
+}
+
+/* Same as CalculateDistance, but Tp is the padded volume with the frozen */
+/* distances, and p the padded index of the voxel */
+double CalculateDistancePadded(stencil_t *Tp, double Fijk, int p, int *off, bool usesecond, bool usecross) {
+    /* Derivatives per direction and per stencil derivative */
+    double Td[13], Td2[13], Tm[18], Tm2[18];
+    int Od[13], Order[18];
+    double Coeff[3], ansroot[2]={0, 0};
+    double Tm1, Tp1, Tt, Tt2, rhs;
+    int d, q, t, ndir, nslot;
+    
+    /* Stencil constants */
+    static const double G1[18]={1, 1, 1, 1, 0.5, 0.5, 1, 0.5, 0.5, 1, 0.5, 0.5, 0.5, 0.3333333333333, 0.3333333333333, 0.5, 0.3333333333333, 0.3333333333333};
+    static const double G2[18]={2.250, 2.250, 2.250, 2.250, 1.125, 1.125, 2.250, 1.125, 1.125, 2.250, 1.125, 1.125, 1.125, 0.750, 0.750, 1.125, 0.750, 0.750};
+    
+    ndir=(usecross) ? 13 : 3;
+    nslot=(usecross) ? 18 : 3;
+    
+    /*Get the first and second order derivatives in every direction */
+    for(d=0; d<ndir; d++) {
+        Tm1=Tp[p-off[d]]; Tp1=Tp[p+off[d]];
+        Td[d]=min(Tm1, Tp1); Od[d]=(IsFinite(Td[d])) ? 1 : 0; Td2[d]=0;
+        if(usesecond) {
+            Td2[d]=second_derivative(Tm1, Tp[p-2*off[d]], Tp1, Tp[p+2*off[d]]);
+            if(IsInf(Td2[d])) { Td2[d]=0; } else { Od[d]=2; }
+        }
+    }
+    for(t=0; t<nslot; t++) {
+        d=stencil_slot[t]; Tm[t]=Td[d]; Tm2[t]=Td2[d]; Order[t]=Od[d];
+    }
+    
+    /*Calculate the distance using x and y direction */
+    rhs=-1/(max(pow2(Fijk), eps));
+    Coeff[0]=0; Coeff[1]=0; Coeff[2]=rhs;
+    for(q=0; q<nslot/3; q++) {
+        if(q>0) { Coeff[2]+=rhs; }
+        for (t=q*3; t<((q+1)*3); t++) {
+            switch(Order[t]) {
+                case 1:
+                    Coeff[0]+=G1[t]; Coeff[1]+=-2.0*Tm[t]*G1[t]; Coeff[2]+=pow2(Tm[t])*G1[t];
+                    break;
+                case 2:
+                    Coeff[0]+=G2[t]; Coeff[1]+=-2.0*Tm2[t]*G2[t]; Coeff[2]+=pow2(Tm2[t])*G2[t];
+                    break;
+            }
+        }
+        if(q==0) {
+            roots(Coeff, ansroot);
+            Tt=max(ansroot[0], ansroot[1]);
+        }
+        /*Select maximum root solution and minimum distance value of both stensils */
+        else if(Coeff[0]>0) { roots(Coeff, ansroot); Tt2=max(ansroot[0], ansroot[1]); Tt=min(Tt, Tt2); }
+    }
+    
+    /*Upwind condition check, current distance must be larger */
+    /*then direct neighbours used in solution */
+    for(q=0; q<nslot; q++) { if(IsFinite(Tm[q])&&(Tt<Tm[q])) { Tt=Tm[minarray(Tm, nslot)]+(1/(max(Fijk,eps)));}}
+    
+    return Tt;
+}
+#endif
+
+/* Fast iterative method (Jeong and Whitaker), the volume is split in blocks of
+ * FIMBLOCK^3 voxels. Every iteration the active blocks are updated in parallel
+ * with a few Gauss-Seidel sweeps of the first order upwind (Godunov) update;
+ * blocks which changed stay active and activate their 6 neighbour blocks. The
+ * distances only decrease, so reading a neighbour block while another thread
+ * updates it only delays convergence */
+typedef struct {
+    double *T;
+    speedimage *F;
+    int *dims;
+    int *nblocks;
+    int *active;
+    int nactive;
+    unsigned char *changed;
+    double tolerance;
+    int ThreadID;
+    int Nthreads;
+} FimArgs;
+
+/* First order upwind update of voxel (i,j,k) from all its neighbours */
+static __inline double fim_update(double *T, double Fijk, int *dims, int i, int j, int k) {
+    int index=mindex3(i, j, k, dims[0], dims[1]);
+    int sx=1, sy=dims[0], sz=dims[0]*dims[1];
+    double a, b, c, t, rhs, sum;
+
+    a=INF; b=INF; c=INF;
+    if(i>0) { a=T[index-sx]; } if((i<dims[0]-1)&&(T[index+sx]<a)) { a=T[index+sx]; }
+    if(j>0) { b=T[index-sy]; } if((j<dims[1]-1)&&(T[index+sy]<b)) { b=T[index+sy]; }
+    if(k>0) { c=T[index-sz]; } if((k<dims[2]-1)&&(T[index+sz]<c)) { c=T[index+sz]; }
+    /* Sort a <= b <= c */
+    if(b<a) { t=a; a=b; b=t; }
+    if(c<b) { t=b; b=c; c=t; }
+    if(b<a) { t=a; a=b; b=t; }
+    if(!IsFinite(a)) { return INF; }
+
+    rhs=1/(max(pow2(Fijk),eps));
+    t=a+sqrt(rhs);
+    if(t>b) {
+        t=0.5*(a+b+sqrt(max(2*rhs-pow2(a-b), 0)));
+        if(t>c) {
+            sum=a+b+c;
+            t=(sum+sqrt(max(pow2(sum)-3*(a*a+b*b+c*c-rhs), 0)))/3;
+        }
+    }
+    return t;
+}
+
+/* Sweeps over one block, returns 1 if a distance in the block changed */
+int fim_block(FimArgs *Args, int block) {
+    int *dims=Args->dims, *nb=Args->nblocks;
+    int bx, by, bz, i, j, k, s, index, changed=0, sweepchanged;
+    int i0, i1, j0, j1, k0, k1;
+    double Tnew, Told;
+
+    bx=block%nb[0]; by=(block/nb[0])%nb[1]; bz=block/(nb[0]*nb[1]);
+    i0=bx*FIMBLOCK; i1=min(i0+FIMBLOCK, dims[0]);
+    j0=by*FIMBLOCK; j1=min(j0+FIMBLOCK, dims[1]);
+    k0=bz*FIMBLOCK; k1=min(k0+FIMBLOCK, dims[2]);
+    for(s=0; s<FIMSWEEPS; s++) {
+        sweepchanged=0;
+        for(k=k0; k<k1; k++) {
+            for(j=j0; j<j1; j++) {
+                for(i=i0; i<i1; i++) {
+                    index=mindex3(i, j, k, dims[0], dims[1]);
+                    Told=Args->T[index];
+                    if(Told==0) { continue; }
+                    Tnew=fim_update(Args->T, get_speed(Args->F, index), dims, i, j, k);
+                    if(Tnew<Told*(1-Args->tolerance)) { Args->T[index]=Tnew; sweepchanged=1; }
+                }
+            }
+        }
+        if(!sweepchanged) { break; }
+        changed=1;
+    }
+    return changed;
+}
+
+#ifdef _WIN32
+  unsigned __stdcall fim_thread(FimArgs *Args) {
+#else
+  void fim_thread(FimArgs *Args) {
+#endif
+    int a, a0, a1;
+    a0=(Args->nactive*Args->ThreadID)/Args->Nthreads;
+    a1=(Args->nactive*(Args->ThreadID+1))/Args->Nthreads;
+    for(a=a0; a<a1; a++) {
+        Args->changed[Args->active[a]]=(unsigned char)fim_block(Args, Args->active[a]);
+    }
+    #ifdef _WIN32
+	_endthreadex( 0 );
+    return 0;
+	#else
+	pthread_exit(NULL);
+	#endif
+}
+
+void fim3d(double *T, speedimage *F, int *dims, double *SourcePoints, int nsource, double tolerance, int Nthreads) {
+    int nblocks[3], nb, s, q, b, bx, by, bz, w, nactive, nnext;
+    int x, y, z;
+    int *active, *next;
+    unsigned char *changed, *marked;
+    int ne[18]={-1,  0,  0, 1, 0, 0, 0, -1,  0, 0, 1, 0, 0,  0, -1, 0, 0, 1};
+    FimArgs *ThreadArgs;
+	#ifdef _WIN32
+		HANDLE *ThreadList;
+    #else
+		pthread_t *ThreadList;
+	#endif
+
+    for(q=0; q<3; q++) { nblocks[q]=(dims[q]+FIMBLOCK-1)/FIMBLOCK; }
+    nb=nblocks[0]*nblocks[1]*nblocks[2];
+    active=(int *)malloc(nb*sizeof(int));
+    next=(int *)malloc(nb*sizeof(int));
+    changed=(unsigned char *)malloc(nb);
+    marked=(unsigned char *)malloc(nb);
+    for(b=0; b<nb; b++) { marked[b]=0; changed[b]=0; }
+    for(q=0; q<dims[0]*dims[1]*dims[2]; q++) { T[q]=INF; }
+
+    /* The blocks of the source points are the first active blocks */
+    nactive=0;
+    for(s=0; s<nsource; s++) {
+        x=(int)SourcePoints[0+s*3]-1; y=(int)SourcePoints[1+s*3]-1; z=(int)SourcePoints[2+s*3]-1;
+        T[mindex3(x, y, z, dims[0], dims[1])]=0;
+        b=mindex3(x/FIMBLOCK, y/FIMBLOCK, z/FIMBLOCK, nblocks[0], nblocks[1]);
+        for(w=-1; w<6; w++) {
+            if(w>=0) {
+                bx=x/FIMBLOCK+ne[w]; by=y/FIMBLOCK+ne[w+6]; bz=z/FIMBLOCK+ne[w+12];
+                if((bx<0)||(by<0)||(bz<0)||(bx>=nblocks[0])||(by>=nblocks[1])||(bz>=nblocks[2])) { continue; }
+                b=mindex3(bx, by, bz, nblocks[0], nblocks[1]);
+            }
+            if(!marked[b]) { marked[b]=1; active[nactive++]=b; }
+        }
+    }
+
+	#ifdef _WIN32
+		ThreadList = (HANDLE*)malloc(Nthreads* sizeof( HANDLE ));
+    #else
+		ThreadList = (pthread_t*)malloc(Nthreads* sizeof( pthread_t ));
+	#endif
+    ThreadArgs = (FimArgs *)malloc(Nthreads* sizeof( FimArgs ));
+
+    while(nactive>0) {
+        for(q=0; q<nactive; q++) { marked[active[q]]=0; }
+        for (q=0; q<Nthreads; q++) {
+            ThreadArgs[q].T=T; ThreadArgs[q].F=F; ThreadArgs[q].dims=dims;
+            ThreadArgs[q].nblocks=nblocks; ThreadArgs[q].active=active; ThreadArgs[q].nactive=nactive;
+            ThreadArgs[q].changed=changed; ThreadArgs[q].tolerance=tolerance;
+            ThreadArgs[q].ThreadID=q; ThreadArgs[q].Nthreads=Nthreads;
+            #ifdef _WIN32
+                ThreadList[q] = (HANDLE)_beginthreadex( NULL, 0, &fim_thread, &ThreadArgs[q] , 0, NULL );
+            #else
+                pthread_create ((pthread_t*)&ThreadList[q], NULL, (void *) &fim_thread, &ThreadArgs[q]);
+            #endif
+        }
+        #ifdef _WIN32
+            for (q=0; q<Nthreads; q++) { WaitForSingleObject(ThreadList[q], INFINITE); }
+            for (q=0; q<Nthreads; q++) { CloseHandle( ThreadList[q] ); }
+        #else
+            for (q=0; q<Nthreads; q++) { pthread_join(ThreadList[q],NULL); }
+        #endif
+
+        /* Changed blocks and their neighbours are active in the next iteration */
+        nnext=0;
+        for(q=0; q<nactive; q++) {
+            b=active[q];
+            if(!changed[b]) { continue; }
+            bx=b%nblocks[0]; by=(b/nblocks[0])%nblocks[1]; bz=b/(nblocks[0]*nblocks[1]);
+            if(!marked[b]) { marked[b]=1; next[nnext++]=b; }
+            for(w=0; w<6; w++) {
+                x=bx+ne[w]; y=by+ne[w+6]; z=bz+ne[w+12];
+                if((x<0)||(y<0)||(z<0)||(x>=nblocks[0])||(y>=nblocks[1])||(z>=nblocks[2])) { continue; }
+                s=mindex3(x, y, z, nblocks[0], nblocks[1]);
+                if(!marked[s]) { marked[s]=1; next[nnext++]=s; }
+            }
+        }
+        for(q=0; q<nnext; q++) { active[q]=next[q]; }
+        nactive=nnext;
+    }
+
+    /* Voxels which are never reached */
+    for(q=0; q<dims[0]*dims[1]*dims[2]; q++) { if(!IsFinite(T[q])) { T[q]=mxGetInf(); } }
+
+    free(ThreadArgs);
+    free(ThreadList);
+    free(active);
+    free(next);
+    free(changed);
+    free(marked);
+}
+
 /* The matlab mex function */
 void mexFunction( int nlhs, mxArray *plhs[],
         int nrhs, const mxArray *prhs[] ) {
     /* The input variables */
-    double *F, *SourcePoints;
+    speedimage F;
+    double *SourcePoints;
+    
+    /* Early stop of the marching */
+    marchoptions mo;
     bool *useseconda, *usecrossa;
     bool usesecond=true;
     bool usecross=true;
@@ -307,6 +632,9 @@ void mexFunction( int nlhs, mxArray *plhs[],
     /* Euclidian distance image */
     double *Y;
     
+    /* Index of the source point which reached a pixel first */
+    unsigned int *L=NULL;
+    
     /* Current distance values */
     double Tt, Ty;
     
@@ -327,17 +655,8 @@ void mexFunction( int nlhs, mxArray *plhs[],
     /* Number of pixels in image */
     int npixels;
     
-    /* Neighbour list */
-    int neg_free;
-    int neg_pos;
-    double *neg_listv;
-    double *neg_listx;
-    double *neg_listy;
-    double *neg_listz;
-    double *neg_listo;
-    
-    int *listprop;
-    double **listval;
+    /* Narrow band */
+    nbheap band;
     
     /* Neighbours 6x3 */
     int ne[18]={-1,  0,  0, 1, 0, 0, 0, -1,  0, 0, 1, 0, 0,  0, -1, 0, 0, 1};
@@ -345,25 +664,43 @@ void mexFunction( int nlhs, mxArray *plhs[],
     /* Loop variables */
     int s, w, itt, q;
     
+#ifdef MSFM_PADDED
+    /* Padded copies of the frozen distances, and the stencil offsets */
+    stencil_t *Tp, *Yp=NULL;
+    int pdims[3], off[13], pn;
+#endif
+    
+    /* Number of threads of the fim solver */
+    int Nthreads;
+    mxArray *matlabCallOut[1]={0};
+    mxArray *matlabCallIn[1]={0};
+    
     /* Current location */
     int x, y, z, i, j, k;
     
     /* Index */
-    int IJK_index, XYZ_index, index;
+    int IJK_index, XYZ_index;
+    
+    /* Report the interface, so that msfm.m can detect an older build */
+    if((nrhs==1)&&mxIsChar(prhs[0])) {
+        plhs[0]=mxCreateDoubleScalar(2);
+        return;
+    }
     
     /* Check for proper number of input and output arguments. */
     if(nrhs<3) {
-        mexErrMsgTxt("2 to 4 inputs are required.");
+        mexErrMsgTxt("3 to 5 inputs are required.");
     }
     if(nlhs==1) { Ed=0; }
-    else if (nlhs==2) { Ed=1; }
+    else if ((nlhs==2)||(nlhs==3)) { Ed=1; }
     else {
-        mexErrMsgTxt("One or Two outputs required");
+        mexErrMsgTxt("One to three outputs required");
     }
     
     /* Check data input types /* */
-    if(mxGetClassID(prhs[0])!=mxDOUBLE_CLASS) {
-        mexErrMsgTxt("Speed image must be of class double");
+    F.cls=mxGetClassID(prhs[0]);
+    if((F.cls!=mxDOUBLE_CLASS)&&(F.cls!=mxSINGLE_CLASS)&&(F.cls!=mxUINT8_CLASS)&&(F.cls!=mxUINT16_CLASS)) {
+        mexErrMsgTxt("Speed image must be of class double, single, uint8 or uint16");
     }
     if(mxGetClassID(prhs[1])!=mxDOUBLE_CLASS) {
         mexErrMsgTxt("SourcePoints must be of class double");
@@ -376,6 +713,9 @@ void mexFunction( int nlhs, mxArray *plhs[],
     if((nrhs>3)&&(mxGetClassID(prhs[3])!= mxLOGICAL_CLASS)) {
         mexErrMsgTxt("UseCross must be of class boolean / logical");
     }
+    if((nrhs>4)&&(!mxIsStruct(prhs[4]))) {
+        mexErrMsgTxt("Options must be a struct");
+    }
     
     /* Get the sizes of the input image volume */
     if(mxGetNumberOfDimensions(prhs[0])==3) {
@@ -396,10 +736,35 @@ void mexFunction( int nlhs, mxArray *plhs[],
     dims_sp[0]=dims_sp_c[0]; dims_sp[1]=dims_sp_c[1]; dims_sp[2]=dims_sp_c[2];
     
     /* Get pointers/data from  to each input. */
-    F=(double*)mxGetPr(prhs[0]);
+    F.data=mxGetData(prhs[0]); F.scale=1; F.offset=0;
     SourcePoints=(double*)mxGetPr(prhs[1]);
     if(nrhs>2){ useseconda = (bool*)mxGetPr(prhs[2]); usesecond=useseconda[0];}
     if(nrhs>3){ usecrossa = (bool*)mxGetPr(prhs[3]); usecross=usecrossa[0];}
+    read_march_options((nrhs>4) ? prhs[4] : NULL, 3, dims, &mo, &F);
+    
+    if(mo.solver==1) {
+        /* Fast iterative method, only the distance output */
+        if(mo.stop!=NULL) { free(mo.stop); }
+        if(nlhs>1) { mexErrMsgTxt("The fim solver only returns the distance T"); }
+        if((mo.nstop>0)||mo.usebox||IsFinite(mo.maxtime)) {
+            mexErrMsgTxt("The fim solver can not be combined with StopPoints, BoundingBox or MaxTime");
+        }
+        for (s=0; s<dims_sp[1]; s++) {
+            x=(int)SourcePoints[0+s*3]-1; y=(int)SourcePoints[1+s*3]-1; z=(int)SourcePoints[2+s*3]-1;
+            if((x<0)||(y<0)||(z<0)||(x>=dims[0])||(y>=dims[1])||(z>=dims[2])) {
+                mexErrMsgTxt("SourcePoints must be inside the speed image");
+            }
+        }
+        matlabCallIn[0]=mxCreateString("Numcores");
+        mexCallMATLAB(1, matlabCallOut, 1, matlabCallIn, "feature");
+        Nthreads=(int)mxGetScalar(matlabCallOut[0]);
+        if(Nthreads<1) { Nthreads=1; }
+        mxDestroyArray(matlabCallIn[0]); mxDestroyArray(matlabCallOut[0]);
+        plhs[0] = mxCreateNumericArray(3, dims, mxDOUBLE_CLASS, mxREAL);
+        fim3d(mxGetPr(plhs[0]), &F, dims, SourcePoints, dims_sp[1], mo.tolerance, Nthreads);
+        return;
+    }
+    check_sources_in_box(SourcePoints, (int)dims_sp[1], 3, &mo);
     
     /* Create the distance output array */
     plhs[0] = mxCreateNumericArray(3, dims, mxDOUBLE_CLASS, mxREAL);
@@ -411,6 +776,10 @@ void mexFunction( int nlhs, mxArray *plhs[],
         plhs[1] = mxCreateNumericArray(3, dims, mxDOUBLE_CLASS, mxREAL);
         Y= mxGetPr(plhs[1]);
     }
+    if(nlhs>2) {
+        plhs[2] = mxCreateNumericArray(3, dims, mxUINT32_CLASS, mxREAL);
+        L= (unsigned int*)mxGetData(plhs[2]);
+    }
     
     /* Pixels which are processed and have a final distance are frozen */
     Frozen = (bool*)malloc( npixels* sizeof(bool) );
@@ -418,28 +787,22 @@ void mexFunction( int nlhs, mxArray *plhs[],
     if(Ed) {
         for(q=0;q<npixels;q++){Y[q]=-1;}
     }
-    
-    
-    /*Free memory to store neighbours of the (segmented) region */
-    neg_free = 100000;
-    neg_pos=0;
-    
-    neg_listx = (double *)malloc( neg_free*sizeof(double) );
-    neg_listy = (double *)malloc( neg_free*sizeof(double) );
-    neg_listz = (double *)malloc( neg_free*sizeof(double) );
+#ifdef MSFM_PADDED
+    pdims[0]=dims[0]+2*PAD; pdims[1]=dims[1]+2*PAD; pdims[2]=dims[2]+2*PAD;
+    pn=pdims[0]*pdims[1]*pdims[2];
+    padded_offsets(off, pdims);
+    Tp=(stencil_t*)malloc(pn*sizeof(stencil_t));
+    for(q=0;q<pn;q++){Tp[q]=(stencil_t)INF;}
     if(Ed) {
-        neg_listo = (double *)malloc( neg_free*sizeof(double) );
-        for(q=0;q<neg_free;q++) { neg_listo[q]=0; }
+        Yp=(stencil_t*)malloc(pn*sizeof(stencil_t));
+        for(q=0;q<pn;q++){Yp[q]=(stencil_t)INF;}
     }
+#endif
     
-    /* List parameters array */
-    listprop=(int*)malloc(3* sizeof(int));
-    /* Make jagged list to store a maximum of 2^64 values */
-    listval= (double **)malloc( 64* sizeof(double *) );
     
-    /* Initialize parameter list */
-    initialize_list(listval, listprop);
-    neg_listv=listval[listprop[1]-1];
+    /* Narrow band heap, the distance image T stores the heap slot of the */
+    /* narrow band voxels */
+    heap_init(&band, heap_capacity(dims, 3, dims_sp[1]), T);
     
     
     /*(There are 3 pixel classes: */
@@ -459,6 +822,12 @@ void mexFunction( int nlhs, mxArray *plhs[],
         Frozen[XYZ_index]=1;
         T[XYZ_index]=0;
         if(Ed) { Y[XYZ_index]=0; }
+#ifdef MSFM_PADDED
+        Tp[mindex3(x+PAD, y+PAD, z+PAD, pdims[0], pdims[1])]=0;
+        if(Ed) { Yp[mindex3(x+PAD, y+PAD, z+PAD, pdims[0], pdims[1])]=0; }
+#endif
+        if(L!=NULL) { L[XYZ_index]=s+1; }
+        last_stop_point(&mo, XYZ_index);
     }
     
     for (s=0; s<dims_sp[1]; s++) {
@@ -481,32 +850,15 @@ void mexFunction( int nlhs, mxArray *plhs[],
             /*Check if current neighbour is not yet frozen and inside the */
             
             /*picture */
-            if(isntfrozen3d(i, j, k, dims, Frozen)) {
-                Tt=(1/(max(F[IJK_index],eps)));
+            if(isntfrozen3d(i, j, k, dims, Frozen)&&inbox3d(i, j, k, &mo)) {
+                Tt=(1/(max(get_speed(&F, IJK_index),eps)));
                 /*Update distance in neigbour list or add to neigbour list */
-                if(T[IJK_index]>0) {
-                    if(neg_listv[(int)T[IJK_index]]>Tt) {
-                        listupdate(listval, listprop, (int)T[IJK_index], Tt);
-                    }
+                if(T[IJK_index]>-1) {
+                    heap_decrease(&band, IJK_index, Tt);
                 }
                 else {
-                    /*If running out of memory at a new block */
-                    if(neg_pos>=neg_free) {
-                        neg_free+=100000;
-                        neg_listx = (double *)realloc(neg_listx, neg_free*sizeof(double) );
-                        neg_listy = (double *)realloc(neg_listy, neg_free*sizeof(double) );
-                        neg_listz = (double *)realloc(neg_listz, neg_free*sizeof(double) );
-                        if(Ed) {
-                            neg_listo = (double *)realloc(neg_listo, neg_free*sizeof(double) );
-                        }
-                    }
-                    list_add(listval, listprop, Tt);
-                    neg_listv=listval[listprop[1]-1];
-                    neg_listx[neg_pos]=i;
-                    neg_listy[neg_pos]=j;
-                    neg_listz[neg_pos]=k;
-                    T[IJK_index]=neg_pos;
-                    neg_pos++;
+                    heap_push(&band, IJK_index, Tt);
+                    if(Ed) { Y[IJK_index]=0; }
                 }
             }
         }
@@ -516,31 +868,24 @@ void mexFunction( int nlhs, mxArray *plhs[],
     for (itt=0; itt<(npixels); itt++) /* */ {
         /*Get the pixel from narrow list (boundary list) with smallest */
         /*distance value and set it to current pixel location */
-        index=list_minimum(listval, listprop);
-        neg_listv=listval[listprop[1]-1];
+        if((band.length==0)||((mo.nstop>0)&&(mo.nstopleft==0))) { break; }
+        XYZ_index=heap_pop(&band, &Tt);
         /* Stop if pixel distance is infinite (all pixels are processed) */
-        if(IsInf(neg_listv[index])) { break; }
+        if(IsInf(Tt)) { break; }
+        /* Stop if the maximum time is reached */
+        if(Tt>mo.maxtime) { break; }
         
-        /*index=minarray(neg_listv, neg_pos); */
-        x=(int)neg_listx[index]; y=(int)neg_listy[index]; z=(int)neg_listz[index];
-        XYZ_index=mindex3(x, y, z, dims[0], dims[1]);
+        x=XYZ_index%dims[0]; y=(XYZ_index/dims[0])%dims[1]; z=XYZ_index/(dims[0]*dims[1]);
         Frozen[XYZ_index]=1;
-        T[XYZ_index]=neg_listv[index];
-        if(Ed) { Y[XYZ_index]=neg_listo[index]; }
-        
-        /*Remove min value by replacing it with the last value in the array */
-        list_remove_replace(listval, listprop, index) ;
-        neg_listv=listval[listprop[1]-1];
-        if(index<(neg_pos-1)) {
-            neg_listx[index]=neg_listx[neg_pos-1];
-            neg_listy[index]=neg_listy[neg_pos-1];
-            neg_listz[index]=neg_listz[neg_pos-1];
-            if(Ed){
-                neg_listo[index]=neg_listo[neg_pos-1];
-            }
-            T[(int)mindex3((int)neg_listx[index], (int)neg_listy[index], (int)neg_listz[index], dims[0], dims[1])]=index;
-        }
-        neg_pos =neg_pos-1;
+        T[XYZ_index]=Tt;
+#ifdef MSFM_PADDED
+        Tp[mindex3(x+PAD, y+PAD, z+PAD, pdims[0], pdims[1])]=(stencil_t)Tt;
+        if(Ed) { Yp[mindex3(x+PAD, y+PAD, z+PAD, pdims[0], pdims[1])]=(stencil_t)Y[XYZ_index]; }
+#endif
+        /* The voxel gets the source index of its upwind (lowest) frozen neighbour */
+        if(L!=NULL) { L[XYZ_index]=upwind_label3d(x, y, z, dims, T, Frozen, L); }
+        /* Stop if all stop points are frozen */
+        if(last_stop_point(&mo, XYZ_index)) { break; }
         
         /*Loop through all 6 neighbours of current pixel */
         for (w=0;w<6;w++) {
@@ -550,51 +895,49 @@ void mexFunction( int nlhs, mxArray *plhs[],
             
             /*Check if current neighbour is not yet frozen and inside the */
             /*picture */
-            if(isntfrozen3d(i, j, k, dims, Frozen)) {
-                Tt=CalculateDistance(T, F[IJK_index], dims, i, j, k, usesecond, usecross, Frozen);
+            if(isntfrozen3d(i, j, k, dims, Frozen)&&inbox3d(i, j, k, &mo)) {
+#ifdef MSFM_PADDED
+                q=mindex3(i+PAD, j+PAD, k+PAD, pdims[0], pdims[1]);
+                Tt=CalculateDistancePadded(Tp, get_speed(&F, IJK_index), q, off, usesecond, usecross);
+                if(Ed) {
+                    Ty=CalculateDistancePadded(Yp, 1, q, off, usesecond, usecross);
+                }
+#else
+                Tt=CalculateDistance(T, get_speed(&F, IJK_index), dims, i, j, k, usesecond, usecross, Frozen);
                 if(Ed) {
                     Ty=CalculateDistance(Y, 1, dims, i, j, k, usesecond, usecross, Frozen);
                 }
+#endif
                 
                 /*Update distance in neigbour list or add to neigbour list */
-                IJK_index=mindex3(i, j, k, dims[0], dims[1]);
-                if((T[IJK_index]>-1)&&T[IJK_index]<=listprop[0]) {
-                    if(neg_listv[(int)T[IJK_index]]>Tt) {
-                        listupdate(listval, listprop, (int)T[IJK_index], Tt);
-                    }
+                if(T[IJK_index]>-1) {
+                    heap_decrease(&band, IJK_index, Tt);
                 }
                 else {
-                    /*If running out of memory at a new block */
-                    if(neg_pos>=neg_free) {
-                        neg_free+=100000;
-                        neg_listx = (double *)realloc(neg_listx, neg_free*sizeof(double) );
-                        neg_listy = (double *)realloc(neg_listy, neg_free*sizeof(double) );
-                        neg_listz = (double *)realloc(neg_listz, neg_free*sizeof(double) );
-                        if(Ed) {
-                            neg_listo = (double *)realloc(neg_listo, neg_free*sizeof(double) );
-                        }
-                    }
-                    list_add(listval, listprop, Tt);
-                    neg_listv=listval[listprop[1]-1];
-                    neg_listx[neg_pos]=i; neg_listy[neg_pos]=j; neg_listz[neg_pos]=k;
-                    if(Ed) {
-                        neg_listo[neg_pos]=Ty;
-                    }
-                    
-                    T[IJK_index]=neg_pos;
-                    neg_pos++;
+                    heap_push(&band, IJK_index, Tt);
+                    /* Euclidian distance of a narrow band voxel, it is */
+                    /* only read back once the voxel is frozen */
+                    if(Ed) { Y[IJK_index]=Ty; }
                 }
             }
         }
         
     }
+    /* Pixels which are not reached when the marching stopped early */
+    if(nrhs>4) {
+        for(q=0;q<npixels;q++) {
+            if(Frozen[q]==0) { T[q]=mxGetInf(); if(Ed) { Y[q]=mxGetInf(); } if(L!=NULL) { L[q]=0; } }
+        }
+    }
+    
     /* Free memory */
-    /* Destroy parameter list */
-    destroy_list(listval, listprop);
-    free(neg_listx);
-    free(neg_listy);
-    free(neg_listz);
+    heap_destroy(&band);
+    if(mo.stop!=NULL) { free(mo.stop); }
     free(Frozen);
+#ifdef MSFM_PADDED
+    free(Tp);
+    if(Ed) { free(Yp); }
+#endif
 }
 
 
@@ -1,10 +1,12 @@
-function [T, Y]=msfm(F, SourcePoints, UseSecond, UseCross)
+function [T, Y, L]=msfm(F, SourcePoints, UseSecond, UseCross, Options)
 % This function MSFM calculates the shortest distance from a list of
 % points to all other pixels in an image volume, using the  
 % Multistencil Fast Marching Method (MSFM). This method gives more accurate 
 % distances by using second order derivatives and cross neighbours.
 % 
 %   [T,Y]=msfm(F, SourcePoints, UseSecond, UseCross)
+%   [T,Y]=msfm(F, SourcePoints, UseSecond, UseCross, Options)
+%   [T,Y,L]=msfm(F, SourcePoints, UseSecond, UseCross, Options)
 %
 % inputs,
 %   F: The 2D or 3D speed image. The speed function must always be larger
@@ -15,10 +17,27 @@ function [T, Y]=msfm(F, SourcePoints, UseSecond, UseCross)
 %                order derivatives are used (default)
 %   UseCross : Boolean Set to true if also cross neighbours 
 %                are used (default)
+%   Options : (optional) struct to stop the marching early, with the fields
+%       .StopPoints : [2 x M] or [3 x M] points, the marching stops when
+%                all of them are reached
+%       .BoundingBox : [min1 max1 min2 max2 (min3 max3)], the marching is
+%                limited to this region, which must contain SourcePoints
+%       .MaxTime : the marching stops at this distance
+%       .SpeedScale, .SpeedOffset : the speed is F*SpeedScale+SpeedOffset
+%                (default 1 and 0), so that F can be given as uint8,
+%                uint16 or single image without a double copy
+%       .Solver : 'fmm' (default) or 'fim' (3D only), the block parallel
+%                fast iterative method, first order only (UseSecond and
+%                UseCross are ignored), returns only T, can not be
+%                combined with StopPoints, BoundingBox and MaxTime
+%       .Tolerance : convergence tolerance of 'fim' (default 1e-10)
+%       Pixels which are not reached are Inf in T and Y
 % outputs,
 %   T : Image with distance from SourcePoints to all pixels
 %   Y : Image for augmented fastmarching with, euclidian distance from 
 %       SourcePoints to all pixels. (Used by skeletonize method)
+%   L : (uint32) index of the source point which reached the pixel first,
+%       a geodesic Voronoi partition computed in the same pass (mex only)
 %
 % Note:
 %   Run compile_c_files.m to allow 3D fast marching and for cpu-effective 
@@ -96,7 +115,45 @@ end
 
 if(nargin<3), UseSecond=false; end
 if(nargin<4), UseCross=false; end
-if(nargout>1)
+if(size(F,3)>1), mexName = 'msfm3d'; else, mexName = 'msfm2d'; end
+useMex = mex_interface(mexName);
+if(nargin>4)
+    if useMex
+        if(nargout>2)
+            [T,Y,L]=feval(mexName, F, SourcePoints, UseSecond, UseCross, Options);
+        elseif(nargout>1)
+            [T,Y]=feval(mexName, F, SourcePoints, UseSecond, UseCross, Options);
+        else
+            T=feval(mexName, F, SourcePoints, UseSecond, UseCross, Options);
+            Y = NaN;
+        end
+        return;
+    end
+    % the Matlab version of msfm2d and older builds of the mex files only
+    % support the speed options
+    stopFields = {'StopPoints', 'BoundingBox', 'MaxTime'};
+    for i=1:numel(stopFields)
+        if isfield(Options, stopFields{i}) && ~isempty(Options.(stopFields{i}))
+            error('msfm:options', 'Options.%s needs a recent build of the %s mex file, run compile_c_files.m', stopFields{i}, mexName);
+        end
+    end
+    if isfield(Options, 'Solver') && ~strcmp(Options.Solver, 'fmm')
+        error('msfm:options', 'Options.Solver needs a recent build of the %s mex file, run compile_c_files.m', mexName);
+    end
+    F = double(F);
+    if isfield(Options, 'SpeedScale'), F = F*Options.SpeedScale; end
+    if isfield(Options, 'SpeedOffset'), F = F+Options.SpeedOffset; end
+end
+if(nargout>2) && ~useMex
+    error('msfm:output', 'L needs a recent build of the %s mex file, run compile_c_files.m', mexName);
+end
+if(nargout>2)
+    if(size(F,3)>1)
+        [T,Y,L]=msfm3d(F, SourcePoints, UseSecond, UseCross);
+    else
+        [T,Y,L]=msfm2d(F, SourcePoints, UseSecond, UseCross);
+    end
+elseif(nargout>1)
     if(size(F,3)>1)
         [T,Y]=msfm3d(F, SourcePoints, UseSecond, UseCross);        
     else
@@ -111,6 +168,17 @@ else
     Y = NaN;
 end
 
+function t=mex_interface(mexName)
+% True if the compiled mex file takes Options and returns L, older builds
+% do not know the interface query
+t=false;
+if exist(mexName, 'file') == 3
+    try
+        t = feval(mexName, 'interface') >= 2;
+    catch
+    end
+end
+
 function add_function_paths()
 try
     functionname='msfm.m';
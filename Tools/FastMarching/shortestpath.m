@@ -13,7 +13,8 @@ function ShortestLine=shortestpath(DistanceMap,StartPoint,SourcePoint,Stepsize,M
 % output,
 %   ShortestLine: M x 2 or M x 3 array with the Shortest Path
 %
-% Note, first compile the rk4 c-code with compile_c_files
+% Note, first compile the rk4 and rk4path c-code with compile_c_files,
+%   with rk4path the rk4 method traces the whole path in one mex call
 %   
 % Example,
 %   % Load a maze image
@@ -39,6 +40,13 @@ if(~exist('Stepsize','var')), Stepsize=0.5; end
 if(~exist('SourcePoint','var')), SourcePoint=[]; end
 if(~exist('Method','var')), Method='rk4'; end
 
+% Trace the whole path in one call, the gradients are only calculated
+% around the path
+if strcmpi(Method, 'rk4') && exist('rk4path', 'file') == 3 && isa(DistanceMap, 'double')
+    ShortestLine=rk4path(DistanceMap, double(StartPoint(:)), double(SourcePoint), double(Stepsize));
+    return;
+end
+
 % Calculate gradient of DistanceMap
 if(ndims(DistanceMap)==2) % Select 2D or 3D
     [Fy,Fx] = pointmin(DistanceMap);
@@ -0,0 +1,260 @@
+#include "mex.h"
+#include "math.h"
+#include "string.h"
+
+/* RK4PATH traces the whole shortest path from a start point to the source
+ * point(s) with Runge-Kutta 4 in a 2D or 3D distance map, in one call.
+ *
+ * ShortestLine = RK4PATH(DistanceMap, StartPoint, SourcePoint, StepSize);
+ *
+ * inputs :
+ *      DistanceMap: 2D or 3D distance map (from msfm2d or msfm3d), class double
+ *      StartPoint: 2D or 3D start location of the path
+ *      SourcePoint: [2 x N] or [3 x N] end points of the path, can be empty
+ *      Stepsize : The stepsize
+ *
+ * outputs :
+ *      ShortestLine : M x 2 or M x 3 array with the shortest path
+ *
+ * This gives the same path as shortestpath.m with the rk4 method, but the
+ * gradient field (the direction to the lowest neighbour, as pointmin.m) is
+ * only calculated for the pixels around the path, and kept in a small cache,
+ * instead of for the whole image.
+ *
+ * Based on rk4.c written by D.Kroon University of Twente (July 2008)
+ */
+
+/* Number of pixels of which the gradient is cached, must be a power of 2 */
+#define CACHE 4096
+
+typedef struct {
+    double *T;
+    int dims[3];
+    int ndims;
+    /* Neighbours of a pixel with their normalized direction */
+    int nne;
+    int ne[26][3];
+    double D[26][3];
+    /* Direct mapped gradient cache */
+    int key[CACHE];
+    double grad[CACHE][3];
+} tracer;
+
+static void init_tracer(tracer *tr, double *T, const mwSize *dims, int ndims) {
+    int a, b, c, n, d;
+    double l;
+    tr->T=T; tr->ndims=ndims;
+    tr->dims[0]=dims[0]; tr->dims[1]=dims[1]; tr->dims[2]=(ndims==3) ? dims[2] : 1;
+    /* Same neighbour order as pointmin.m, the first lowest neighbour is used */
+    n=0;
+    for(a=-1; a<=1; a++) {
+        for(b=-1; b<=1; b++) {
+            for(c=-1; c<=1; c++) {
+                if((ndims==2)&&(c!=0)) { continue; }
+                if((a==0)&&(b==0)&&(c==0)) { continue; }
+                tr->ne[n][0]=a; tr->ne[n][1]=b; tr->ne[n][2]=c;
+                l=sqrt((double)(a*a+b*b+c*c));
+                tr->D[n][0]=a/l; tr->D[n][1]=b/l; tr->D[n][2]=c/l;
+                n++;
+            }
+        }
+    }
+    tr->nne=n;
+    for(d=0; d<CACHE; d++) { tr->key[d]=-1; }
+}
+
+/* Gradient of the distance map at pixel (x,y,z), minus the direction to the
+ * neighbour with the lowest distance, or zero at a local minimum */
+static double *pixel_gradient(tracer *tr, int x, int y, int z) {
+    int index=x+tr->dims[0]*(y+tr->dims[1]*z);
+    int slot=index&(CACHE-1);
+    int n, i, j, k, best;
+    double Tmin, Tn;
+    double *g=tr->grad[slot];
+
+    if(tr->key[slot]==index) { return g; }
+    Tmin=tr->T[index]; best=-1;
+    for(n=0; n<tr->nne; n++) {
+        i=x+tr->ne[n][0]; j=y+tr->ne[n][1]; k=z+tr->ne[n][2];
+        if((i<0)||(j<0)||(k<0)||(i>=tr->dims[0])||(j>=tr->dims[1])||(k>=tr->dims[2])) { continue; }
+        Tn=tr->T[i+tr->dims[0]*(j+tr->dims[1]*k)];
+        if(Tn<Tmin) { Tmin=Tn; best=n; }
+    }
+    if(best<0) { g[0]=0; g[1]=0; g[2]=0; }
+    else { g[0]=-tr->D[best][0]; g[1]=-tr->D[best][1]; g[2]=-tr->D[best][2]; }
+    tr->key[slot]=index;
+    return g;
+}
+
+/* Linear interpolation of the gradient, sticks to the image boundary as rk4.c */
+static void interpgrad(tracer *tr, double *Ireturn, double *point) {
+    int Bas0[3], Bas1[3], d, c, corner[3];
+    double Com[3], perc, *g;
+
+    for(d=0; d<3; d++) {
+        if(d<tr->ndims) {
+            Bas0[d]=(int)floor(point[d]); Bas1[d]=Bas0[d]+1;
+            Com[d]=point[d]-floor(point[d]);
+            if(Bas0[d]<0) { Bas0[d]=0; if(Bas1[d]<0) { Bas1[d]=0; }}
+            if(Bas1[d]>(tr->dims[d]-1)) { Bas1[d]=tr->dims[d]-1; if(Bas0[d]>(tr->dims[d]-1)) { Bas0[d]=tr->dims[d]-1; }}
+        }
+        else {
+            Bas0[d]=0; Bas1[d]=0; Com[d]=0;
+        }
+        Ireturn[d]=0;
+    }
+    for(c=0; c<(1<<tr->ndims); c++) {
+        perc=1;
+        for(d=0; d<tr->ndims; d++) {
+            if(c&(1<<d)) { corner[d]=Bas1[d]; perc*=Com[d]; }
+            else { corner[d]=Bas0[d]; perc*=1-Com[d]; }
+        }
+        if(tr->ndims==2) { corner[2]=0; }
+        g=pixel_gradient(tr, corner[0], corner[1], corner[2]);
+        for(d=0; d<tr->ndims; d++) { Ireturn[d]+=g[d]*perc; }
+    }
+}
+
+static int checkBounds(tracer *tr, double *point) {
+    int d;
+    for(d=0; d<tr->ndims; d++) {
+        if((point[d]<0)||(point[d]>(tr->dims[d]-1))) { return false; }
+    }
+    return true;
+}
+
+/* One step of the RK4 algorithm, returns false if the path leaves the image */
+static int RK4STEP(tracer *tr, double *startPoint, double *nextPoint, double stepSize) {
+    double k[4][3];
+    double tempPoint[3];
+    double tempnorm;
+    double f[4]={0.5, 0.5, 1, 0};
+    int s, d;
+
+    for(d=0; d<3; d++) { tempPoint[d]=startPoint[d]; }
+    for(s=0; s<4; s++) {
+        interpgrad(tr, k[s], tempPoint);
+        tempnorm=0;
+        for(d=0; d<tr->ndims; d++) { tempnorm+=k[s][d]*k[s][d]; }
+        tempnorm=sqrt(tempnorm);
+        for(d=0; d<tr->ndims; d++) { k[s][d]=k[s][d]*stepSize/tempnorm; }
+        if(s==3) { break; }
+        for(d=0; d<tr->ndims; d++) { tempPoint[d]=startPoint[d]-k[s][d]*f[s]; }
+        /* Check the if are still inside the domain */
+        if(!checkBounds(tr, tempPoint)) { return false; }
+    }
+
+    /* Calculate final point */
+    for(d=0; d<tr->ndims; d++) {
+        nextPoint[d]=startPoint[d]-(k[0][d]+k[1][d]*2.0+k[2][d]*2.0+k[3][d])/6.0;
+    }
+    return checkBounds(tr, nextPoint);
+}
+
+void mexFunction( int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[] ) {
+    tracer *tr;
+    int ndims, nsource, d, n, nfree, q, ind;
+    double *SourcePoint, *line, *out;
+    double StartPoint[3]={0, 0, 0}, EndPoint[3]={0, 0, 0};
+    double stepSize, DistancetoEnd, dist, Movement;
+
+    /* Check for proper number of input and output arguments. */
+    if(nrhs!=4) { mexErrMsgTxt("4 inputs are required."); }
+    if(nlhs>1) { mexErrMsgTxt("One output required"); }
+    for(q=0; q<4; q++) {
+        if(mxGetClassID(prhs[q])!=mxDOUBLE_CLASS) { mexErrMsgTxt("inputs must be of class double"); }
+    }
+    ndims=mxGetNumberOfDimensions(prhs[0]);
+    if((ndims!=2)&&(ndims!=3)) { mexErrMsgTxt("DistanceMap must be 2D or 3D"); }
+    if(mxGetNumberOfElements(prhs[1])!=(size_t)ndims) { mexErrMsgTxt("StartPoint must have the dimension of the DistanceMap"); }
+    nsource=0;
+    if(!mxIsEmpty(prhs[2])) {
+        if(mxGetM(prhs[2])!=(size_t)ndims) { mexErrMsgTxt("SourcePoint must be a 2xN or 3xN matrix"); }
+        nsource=mxGetN(prhs[2]);
+    }
+    SourcePoint=mxGetPr(prhs[2]);
+    stepSize=mxGetScalar(prhs[3]);
+
+    tr=(tracer *)malloc(sizeof(tracer));
+    init_tracer(tr, mxGetPr(prhs[0]), mxGetDimensions(prhs[0]), ndims);
+
+    /* Matlab coordinates are 1 based */
+    for(d=0; d<ndims; d++) { StartPoint[d]=mxGetPr(prhs[1])[d]-1.0; }
+
+    nfree=10000; n=0;
+    line=(double *)malloc(nfree*3*sizeof(double));
+    DistancetoEnd=mxGetInf();
+    while(true) {
+        /* Calculate the next point using runge kutta */
+        if(!RK4STEP(tr, StartPoint, EndPoint, stepSize)) {
+            /* Out of the image */
+            break;
+        }
+        if(EndPoint[0]!=EndPoint[0]) {
+            /* Local minimum of the distance map, jump to the source point */
+            if(nsource==0) { break; }
+            ind=0; dist=mxGetInf();
+            for(q=0; q<nsource; q++) {
+                DistancetoEnd=0;
+                for(d=0; d<ndims; d++) { DistancetoEnd+=(SourcePoint[q*ndims+d]-1.0-StartPoint[d])*(SourcePoint[q*ndims+d]-1.0-StartPoint[d]); }
+                if(DistancetoEnd<dist) { dist=DistancetoEnd; ind=q; }
+            }
+            for(d=0; d<ndims; d++) { EndPoint[d]=SourcePoint[ind*ndims+d]-1.0; }
+        }
+
+        /* Calculate the distance to the end point */
+        DistancetoEnd=mxGetInf(); ind=0;
+        for(q=0; q<nsource; q++) {
+            dist=0;
+            for(d=0; d<ndims; d++) { dist+=(SourcePoint[q*ndims+d]-1.0-EndPoint[d])*(SourcePoint[q*ndims+d]-1.0-EndPoint[d]); }
+            dist=sqrt(dist);
+            if(dist<DistancetoEnd) { DistancetoEnd=dist; ind=q; }
+        }
+
+        /* Calculate the movement between current point and point 10 itterations back */
+        if(n>10) {
+            Movement=0;
+            for(d=0; d<ndims; d++) { Movement+=(EndPoint[d]-line[(n-11)*3+d])*(EndPoint[d]-line[(n-11)*3+d]); }
+            Movement=sqrt(Movement);
+        }
+        else {
+            Movement=stepSize+1;
+        }
+
+        /* Stop if we have not moved for 10 itterations */
+        if(Movement<stepSize) { break; }
+
+        /* Add a new block of memory if full */
+        if(n+2>nfree) {
+            nfree+=10000;
+            line=(double *)realloc(line, nfree*3*sizeof(double));
+        }
+
+        /* Add current point to the shortest line array */
+        for(d=0; d<ndims; d++) { line[n*3+d]=EndPoint[d]; }
+        n++;
+
+        if(DistancetoEnd<stepSize) {
+            /* Add (Last) Source point to the shortest line array */
+            for(d=0; d<ndims; d++) { line[n*3+d]=SourcePoint[ind*ndims+d]-1.0; }
+            n++;
+            break;
+        }
+
+        /* Current point is next Starting Point */
+        for(d=0; d<ndims; d++) { StartPoint[d]=EndPoint[d]; }
+    }
+
+    if((DistancetoEnd>1)&&(nsource>0)) {
+        mexPrintf("The shortest path trace did not finish at the source point\n");
+    }
+
+    /* Create the output array, with 1 based coordinates */
+    plhs[0]=mxCreateDoubleMatrix(n, ndims, mxREAL);
+    out=mxGetPr(plhs[0]);
+    for(q=0; q<n; q++) {
+        for(d=0; d<ndims; d++) { out[q+d*n]=line[q*3+d]+1.0; }
+    }
+    free(line);
+    free(tr);
+}
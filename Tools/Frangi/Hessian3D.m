@@ -13,10 +13,31 @@ function [Dxx, Dyy, Dzz, Dxy, Dxz, Dyz] = Hessian3D(Volume,Sigma)
 % outputs,
 %   Dxx, Dyy, Dzz, Dxy, Dxz, Dyz: The 2nd derivatives
 %
+% When Hessian3D_mex.c is compiled and Sigma>0, the derivatives are
+% calculated natively in single with derivative-of-gaussian filters, the
+% outputs are double for a double volume and single for the other classes.
+% Compile with: mex Hessian3D_mex.c -v
+% Without the mex file volumes of integer classes are converted to double
+%
 % Function is written by D.Kroon University of Twente (June 2009)
 % defaults
 if nargin < 2, Sigma = 1; end
 
+if Sigma > 0 && exist('Hessian3D_mex', 'file') == 3 && ...
+        (isa(Volume, 'double') || isa(Volume, 'single') || isa(Volume, 'uint8') || isa(Volume, 'uint16'))
+    % the mex file only returns the requested outputs
+    D = cell(1, 6);
+    [D{1:max(nargout, 1)}] = Hessian3D_mex(Volume, Sigma);
+    if isa(Volume, 'double')    % keep the class of the output of FrangiFilter3D
+        D = cellfun(@double, D, 'UniformOutput', false);
+    end
+    [Dxx, Dyy, Dzz, Dxy, Dxz, Dyz] = D{:};
+    return;
+end
+
+% the gradients of integer volumes are calculated in double
+if ~isa(Volume, 'double') && ~isa(Volume, 'single'); Volume = double(Volume); end
+
 if(Sigma>0)
     F=imgaussian(Volume,Sigma);
 else
@@ -0,0 +1,403 @@
+#include "mex.h"
+#include "math.h"
+#include "string.h"
+#ifndef min
+#define min(a,b)        ((a) < (b) ? (a): (b))
+#endif
+#ifndef max
+#define max(a,b)        ((a) > (b) ? (a): (b))
+#endif
+#define clamp(a, b1, b2) min(max(a, b1), b2);
+
+/*   undef needed for LCC compiler  */
+#undef EXTERN_C
+#ifdef _WIN32
+	#include <windows.h>
+	#include <process.h>
+#else
+	#include <pthread.h>
+#endif
+
+/* SIMD versions of the convolution, selected at compile time; SSE2 is always
+   available on 64-bit x86, AVX needs e.g.: mex CFLAGS='$CFLAGS -mavx' Hessian3D_mex.c */
+#if defined(__AVX__)
+	#define IMG_USE_AVX
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP>=2))
+	#define IMG_USE_SSE2
+#endif
+#if defined(IMG_USE_AVX)
+	#include <immintrin.h>
+#elif defined(IMG_USE_SSE2)
+	#include <emmintrin.h>
+#endif
+
+/* Number of neighbouring pixels which are filtered together in the z direction */
+#define CHUNK 256
+
+/*
+ This function Hessian3D_mex calculates the 2nd order derivatives of a
+ gaussian smoothed volume, with separable derivative-of-gaussian filters.
+ It gives the same outputs as Hessian3D.m, but all six components are
+ computed in one native pass without full size temporary volumes:
+   1) every z-slice is filtered in x and y with the gaussian (g), its first (g')
+      and second (g'') derivative, the six filtered slices are written
+      directly into the output volumes (threads split over z-slabs)
+   2) every output volume is filtered in place in the z direction with g, g'
+      or g'' (threads split over contiguous runs of xy-pixels)
+ The peak memory is the input volume plus the six single outputs.
+
+ [Dxx, Dyy, Dzz, Dxy, Dxz, Dyz] = Hessian3D_mex(I,Sigma,SIZE)
+
+ inputs,
+   I : The image volume, class double, single, uint8 or uint16
+   Sigma : The sigma of the gaussian kernel used, larger than zero
+   SIZE: (optional) Kernel size (single value) (default: sigma*6)
+
+ outputs,
+   Dxx, Dyy, Dzz, Dxy, Dxz, Dyz: The 2nd derivatives, class single
+
+ note, compile the code with: mex Hessian3D_mex.c -v
+
+ The borders are replicated, as in imgaussian
+*/
+
+typedef struct {
+    const void *I;          /* input volume */
+    mxClassID classI;       /* class of the input volume */
+    float *D[6];            /* outputs: Dxx, Dyy, Dzz, Dxy, Dxz, Dyz */
+    float *H[3];            /* kernels: g, g', g'' */
+    int lengthH;
+    int sizeI[3];
+    int pass;               /* 0: x and y direction, 1: z direction */
+    int ThreadID;
+    int Nthreads;
+} HessianArgs;
+
+/*
+ Convolution of n neighbouring output values with a symmetric (sym=1, H[i]==H[lengthH-1-i])
+ or anti-symmetric (sym=-1, H[i]==-H[lengthH-1-i]) kernel, the taps are folded so that
+ only (lengthH+1)/2 multiplies are needed per output value. Tap i of output j is found
+ at P[j+i*step], step is 1 for a padded row and the buffer width for the other directions
+*/
+void convolve_folded_float(const float *P, size_t step, float *out, int n, const float *H, int lengthH, int sym) {
+    int j=0, i, hks;
+    const float *Pl, *Pr;
+    float sum;
+    hks=(lengthH-1)/2;
+    if(sym>0) {
+#if defined(IMG_USE_AVX)
+        for(; j<=(n-8); j+=8) {
+            __m256 acc=_mm256_mul_ps(_mm256_set1_ps(H[hks]), _mm256_loadu_ps(&P[j+hks*step]));
+            for(i=0; i<hks; i++) {
+                Pl=&P[j+i*step]; Pr=&P[j+(lengthH-1-i)*step];
+                acc=_mm256_add_ps(acc, _mm256_mul_ps(_mm256_set1_ps(H[i]), _mm256_add_ps(_mm256_loadu_ps(Pl), _mm256_loadu_ps(Pr))));
+            }
+            _mm256_storeu_ps(&out[j], acc);
+        }
+#endif
+#if defined(IMG_USE_SSE2)
+        for(; j<=(n-4); j+=4) {
+            __m128 acc=_mm_mul_ps(_mm_set1_ps(H[hks]), _mm_loadu_ps(&P[j+hks*step]));
+            for(i=0; i<hks; i++) {
+                Pl=&P[j+i*step]; Pr=&P[j+(lengthH-1-i)*step];
+                acc=_mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(H[i]), _mm_add_ps(_mm_loadu_ps(Pl), _mm_loadu_ps(Pr))));
+            }
+            _mm_storeu_ps(&out[j], acc);
+        }
+#endif
+        for(; j<n; j++) {
+            sum=H[hks]*P[j+hks*step];
+            for(i=0; i<hks; i++) { sum+=H[i]*(P[j+i*step]+P[j+(lengthH-1-i)*step]); }
+            out[j]=sum;
+        }
+    }
+    else {
+        /* the centre tap of an anti-symmetric kernel is zero */
+#if defined(IMG_USE_AVX)
+        for(; j<=(n-8); j+=8) {
+            __m256 acc=_mm256_setzero_ps();
+            for(i=0; i<hks; i++) {
+                Pl=&P[j+i*step]; Pr=&P[j+(lengthH-1-i)*step];
+                acc=_mm256_add_ps(acc, _mm256_mul_ps(_mm256_set1_ps(H[i]), _mm256_sub_ps(_mm256_loadu_ps(Pl), _mm256_loadu_ps(Pr))));
+            }
+            _mm256_storeu_ps(&out[j], acc);
+        }
+#endif
+#if defined(IMG_USE_SSE2)
+        for(; j<=(n-4); j+=4) {
+            __m128 acc=_mm_setzero_ps();
+            for(i=0; i<hks; i++) {
+                Pl=&P[j+i*step]; Pr=&P[j+(lengthH-1-i)*step];
+                acc=_mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(H[i]), _mm_sub_ps(_mm_loadu_ps(Pl), _mm_loadu_ps(Pr))));
+            }
+            _mm_storeu_ps(&out[j], acc);
+        }
+#endif
+        for(; j<n; j++) {
+            sum=0;
+            for(i=0; i<hks; i++) { sum+=H[i]*(P[j+i*step]-P[j+(lengthH-1-i)*step]); }
+            out[j]=sum;
+        }
+    }
+}
+
+void load_row_float(const void *I, mxClassID classI, size_t offset, int length, float *R) {
+    /* Copy one row of the input volume into a float buffer */
+    int x;
+    switch(classI) {
+        case mxDOUBLE_CLASS:
+            for(x=0; x<length; x++) { R[x]=(float)((const double *)I)[offset+x]; } break;
+        case mxSINGLE_CLASS:
+            memcpy(R, &((const float *)I)[offset], length*sizeof(float)); break;
+        case mxUINT8_CLASS:
+            for(x=0; x<length; x++) { R[x]=(float)((const unsigned char *)I)[offset+x]; } break;
+        case mxUINT16_CLASS:
+            for(x=0; x<length; x++) { R[x]=(float)((const unsigned short *)I)[offset+x]; } break;
+        default:
+            break;
+    }
+}
+
+void replicate_borders(float *P, int length, size_t step, int width, int hks) {
+    /* P points at the first of length+2*hks lines of width values, the first and last
+       hks lines are set to the first and last line of the data */
+    int k;
+    for(k=0; k<hks; k++) {
+        memcpy(&P[(size_t)k*step], &P[(size_t)hks*step], width*sizeof(float));
+        memcpy(&P[(size_t)(length+hks+k)*step], &P[(size_t)(length+hks-1)*step], width*sizeof(float));
+    }
+}
+
+void hessian_slices(HessianArgs *Args) {
+    /* Filter a block of z-slices in the x and y directions */
+    int y, z, z_start, z_end, hks, lengthH, sx, sy;
+    size_t nslice, offset;
+    float *R, *X0, *X1, *X2, **H, **D;
+
+    sx=Args->sizeI[0]; sy=Args->sizeI[1];
+    nslice=(size_t)sx*sy;
+    lengthH=Args->lengthH; hks=(lengthH-1)/2;
+    H=Args->H; D=Args->D;
+
+    /* Padded row buffer and the three x filtered slices with padding rows in y */
+    R=(float *)malloc((sx+2*hks)*sizeof(float));
+    X0=(float *)malloc((size_t)(sy+2*hks)*sx*sizeof(float));
+    X1=(float *)malloc((size_t)(sy+2*hks)*sx*sizeof(float));
+    X2=(float *)malloc((size_t)(sy+2*hks)*sx*sizeof(float));
+
+    z_start=(int)(((size_t)Args->sizeI[2]*Args->ThreadID)/Args->Nthreads);
+    z_end=(int)(((size_t)Args->sizeI[2]*(Args->ThreadID+1))/Args->Nthreads);
+    for(z=z_start; z<z_end; z++) {
+        /* x direction, g, g' and g'' */
+        for(y=0; y<sy; y++) {
+            load_row_float(Args->I, Args->classI, z*nslice+(size_t)y*sx, sx, &R[hks]);
+            replicate_borders(R, sx, 1, 1, hks);
+            offset=(size_t)(y+hks)*sx;
+            convolve_folded_float(R, 1, &X0[offset], sx, H[0], lengthH, 1);
+            convolve_folded_float(R, 1, &X1[offset], sx, H[1], lengthH, -1);
+            convolve_folded_float(R, 1, &X2[offset], sx, H[2], lengthH, 1);
+        }
+        replicate_borders(X0, sy, sx, sx, hks);
+        replicate_borders(X1, sy, sx, sx, hks);
+        replicate_borders(X2, sy, sx, sx, hks);
+
+        /* y direction, written into the output slices */
+        offset=z*nslice;
+        for(y=0; y<sy; y++) {
+            convolve_folded_float(&X2[(size_t)y*sx], sx, &D[0][offset+(size_t)y*sx], sx, H[0], lengthH, 1);     /* Dxx: g''x gy */
+            convolve_folded_float(&X0[(size_t)y*sx], sx, &D[1][offset+(size_t)y*sx], sx, H[2], lengthH, 1);     /* Dyy: gx g''y */
+            convolve_folded_float(&X0[(size_t)y*sx], sx, &D[2][offset+(size_t)y*sx], sx, H[0], lengthH, 1);     /* Dzz: gx gy */
+            convolve_folded_float(&X1[(size_t)y*sx], sx, &D[3][offset+(size_t)y*sx], sx, H[1], lengthH, -1);    /* Dxy: g'x g'y */
+            convolve_folded_float(&X1[(size_t)y*sx], sx, &D[4][offset+(size_t)y*sx], sx, H[0], lengthH, 1);     /* Dxz: g'x gy */
+            convolve_folded_float(&X0[(size_t)y*sx], sx, &D[5][offset+(size_t)y*sx], sx, H[1], lengthH, -1);    /* Dyz: gx g'y */
+        }
+    }
+
+    free(R); free(X0); free(X1); free(X2);
+}
+
+void hessian_zdirection(HessianArgs *Args) {
+    /* Filter runs of CHUNK xy-pixels of all outputs in place in the z direction */
+    /* z kernel for Dxx, Dyy, Dzz, Dxy, Dxz, Dyz */
+    static const int zkernel[6]={0, 0, 2, 0, 1, 1};
+    int k, ks, c, width, hks, lengthH, sz, nchunks, item, item_start, item_end;
+    size_t nslice, x0;
+    float *B, *J;
+
+    sz=Args->sizeI[2];
+    nslice=(size_t)Args->sizeI[0]*Args->sizeI[1];
+    lengthH=Args->lengthH; hks=(lengthH-1)/2;
+    nchunks=(int)((nslice+CHUNK-1)/CHUNK);
+    B=(float *)malloc((size_t)(sz+2*hks)*CHUNK*sizeof(float));
+
+    item_start=(int)(((size_t)nchunks*Args->ThreadID)/Args->Nthreads);
+    item_end=(int)(((size_t)nchunks*(Args->ThreadID+1))/Args->Nthreads);
+    for(item=item_start; item<item_end; item++) {
+        x0=(size_t)item*CHUNK;
+        width=(int)min(CHUNK, nslice-x0);
+        for(c=0; c<6; c++) {
+            J=&Args->D[c][x0];
+            for(k=-hks; k<(sz+hks); k++) {
+                ks=clamp(k, 0, sz-1);
+                memcpy(&B[(size_t)(k+hks)*width], &J[(size_t)ks*nslice], width*sizeof(float));
+            }
+            for(k=0; k<sz; k++) {
+                convolve_folded_float(&B[(size_t)k*width], width, &J[(size_t)k*nslice], width,
+                    Args->H[zkernel[c]], lengthH, (zkernel[c]==1) ? -1 : 1);
+            }
+        }
+    }
+    free(B);
+}
+
+#ifdef _WIN32
+  unsigned __stdcall hessian_thread(HessianArgs *Args) {
+#else
+  void hessian_thread(HessianArgs *Args) {
+#endif
+    if(Args->pass==0) { hessian_slices(Args); } else { hessian_zdirection(Args); }
+
+    /*  explicit end thread, helps to ensure proper recovery of resources allocated for the thread */
+    #ifdef _WIN32
+	_endthreadex( 0 );
+    return 0;
+	#else
+	pthread_exit(NULL);
+	#endif
+}
+
+void make_kernels(double sigma, double kernel_size, float **H, int *lengthH) {
+    /* Gaussian kernel and its first and second derivative, in correlation order.
+       The derivative kernels are normalized so that they are exact for
+       linear (g') and quadratic (g'') signals */
+    int i, hks;
+    double x, *G, totalG=0, total1=0, total2=0, total2x=0;
+
+	if(kernel_size<1) { kernel_size=1; }
+    hks=(int)ceil(kernel_size/2);
+    if(hks<1) { hks=1; }
+    lengthH[0]=2*hks+1;
+    G=(double *)malloc(lengthH[0]*sizeof(double));
+    for(i=0; i<3; i++) { H[i]=(float *)malloc(lengthH[0]*sizeof(float)); }
+    for(i=0; i<lengthH[0]; i++) { x=i-hks; G[i]=exp(-((x*x)/(2*(sigma*sigma)))); totalG+=G[i]; }
+    for(i=0; i<lengthH[0]; i++) { G[i]/=totalG; }
+    for(i=0; i<lengthH[0]; i++) {
+        x=i-hks;
+        total1+=x*x*G[i]/(sigma*sigma);
+        total2+=(x*x/(sigma*sigma)-1)*G[i]/(sigma*sigma);
+    }
+    for(i=0; i<lengthH[0]; i++) {
+        x=i-hks;
+        /* remove the DC component of g'' */
+        total2x+=0.5*x*x*((x*x/(sigma*sigma)-1)*G[i]/(sigma*sigma)-total2*G[i]);
+    }
+    for(i=0; i<lengthH[0]; i++) {
+        x=i-hks;
+        H[0][i]=(float)G[i];
+        H[1][i]=(float)(x*G[i]/(sigma*sigma)/total1);
+        H[2][i]=(float)(((x*x/(sigma*sigma)-1)*G[i]/(sigma*sigma)-total2*G[i])/total2x);
+    }
+    free(G);
+}
+
+void mexFunction( int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[] ) {
+    double sigma, kernel_size;
+    const mwSize *dimsI_const;
+    mwSize dimsI[3];
+    int ndimsI, i, pass;
+    float *H[3];
+    int lengthH;
+    HessianArgs *ThreadArgs;
+    /* The six outputs, only the requested ones are returned in plhs */
+    mxArray *D[6];
+    /* Number of threads, from feature('Numcores') */
+    mxArray *matlabCallOut[1]={0};
+    mxArray *matlabCallIn[1]={0};
+    int Nthreads;
+	/* Handles to the worker threads */
+	#ifdef _WIN32
+		HANDLE *ThreadList;
+    #else
+		pthread_t *ThreadList;
+	#endif
+
+    /* Check number of inputs */
+    if(nrhs<2) { mexErrMsgTxt("2 input variables are required, 1 optional."); }
+    if(nlhs>6) { mexErrMsgTxt("Up to six outputs are returned."); }
+
+    if(!mxIsDouble(prhs[0])&&!mxIsSingle(prhs[0])&&!mxIsUint8(prhs[0])&&!mxIsUint16(prhs[0])) {
+        mexErrMsgTxt("Image must be of type Double, Single, Uint8 or Uint16");
+    }
+
+    /* Check input image dimensions */
+    ndimsI=mxGetNumberOfDimensions(prhs[0]);
+    if(ndimsI>3) { mexErrMsgTxt("Image must be 2D or 3D"); }
+    dimsI_const = mxGetDimensions(prhs[0]);
+    dimsI[0]=dimsI_const[0]; dimsI[1]=dimsI_const[1]; dimsI[2]=(ndimsI>2) ? dimsI_const[2] : 1;
+
+    sigma=mxGetScalar(prhs[1]);
+    if(sigma<=0) { mexErrMsgTxt("Sigma must be larger than zero, use Hessian3D.m for sigma 0"); }
+    if(nrhs>2) { kernel_size=mxGetScalar(prhs[2]); } else { kernel_size=sigma*6; }
+
+    /* Create the outputs */
+    ThreadArgs=(HessianArgs *)malloc(sizeof(HessianArgs));
+    for(i=0; i<6; i++) {
+        D[i] = mxCreateNumericArray(ndimsI, dimsI, mxSINGLE_CLASS, mxREAL);
+        ThreadArgs[0].D[i]=(float *)mxGetData(D[i]);
+    }
+    for(i=0; i<max(nlhs,1); i++) { plhs[i]=D[i]; }
+    if(mxGetNumberOfElements(prhs[0])==0) {
+        free(ThreadArgs);
+        for(i=max(nlhs,1); i<6; i++) { mxDestroyArray(D[i]); }
+        return;
+    }
+
+    make_kernels(sigma, kernel_size, H, &lengthH);
+
+    /* Get the number of threads */
+    matlabCallIn[0]=mxCreateString("Numcores");
+    mexCallMATLAB(1, matlabCallOut, 1, matlabCallIn, "feature");
+    Nthreads=(int)mxGetScalar(matlabCallOut[0]);
+    if(Nthreads<1) { Nthreads=1; }
+    mxDestroyArray(matlabCallIn[0]);
+    mxDestroyArray(matlabCallOut[0]);
+
+	#ifdef _WIN32
+		ThreadList = (HANDLE*)malloc(Nthreads* sizeof( HANDLE ));
+    #else
+		ThreadList = (pthread_t*)malloc(Nthreads* sizeof( pthread_t ));
+	#endif
+    ThreadArgs=(HessianArgs *)realloc(ThreadArgs, Nthreads*sizeof(HessianArgs));
+
+    for(pass=0; pass<2; pass++) {
+        for (i=0; i<Nthreads; i++) {
+            ThreadArgs[i].I=mxGetData(prhs[0]);
+            ThreadArgs[i].classI=mxGetClassID(prhs[0]);
+            memcpy(ThreadArgs[i].D, ThreadArgs[0].D, 6*sizeof(float *));
+            ThreadArgs[i].H[0]=H[0]; ThreadArgs[i].H[1]=H[1]; ThreadArgs[i].H[2]=H[2];
+            ThreadArgs[i].lengthH=lengthH;
+            ThreadArgs[i].sizeI[0]=(int)dimsI[0]; ThreadArgs[i].sizeI[1]=(int)dimsI[1]; ThreadArgs[i].sizeI[2]=(int)dimsI[2];
+            ThreadArgs[i].pass=pass;
+            ThreadArgs[i].ThreadID=i; ThreadArgs[i].Nthreads=Nthreads;
+            #ifdef _WIN32
+                ThreadList[i] = (HANDLE)_beginthreadex( NULL, 0, &hessian_thread, &ThreadArgs[i] , 0, NULL );
+            #else
+                pthread_create ((pthread_t*)&ThreadList[i], NULL, (void *) &hessian_thread, &ThreadArgs[i]);
+            #endif
+        }
+        #ifdef _WIN32
+            for (i=0; i<Nthreads; i++) { WaitForSingleObject(ThreadList[i], INFINITE); }
+            for (i=0; i<Nthreads; i++) { CloseHandle( ThreadList[i] ); }
+        #else
+            for (i=0; i<Nthreads; i++) { pthread_join(ThreadList[i],NULL); }
+        #endif
+    }
+
+    free(ThreadArgs);
+    free(ThreadList);
+    for(i=0; i<3; i++) { free(H[i]); }
+
+    /* Outputs which were not requested */
+    for(i=max(nlhs,1); i<6; i++) { mxDestroyArray(D[i]); }
+}
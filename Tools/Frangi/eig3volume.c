@@ -1,363 +1,401 @@
 #include "mex.h"
 #include "math.h"
-#ifdef MAX
-#undef MAX
+#include "string.h"
+
+/*   undef needed for LCC compiler  */
+#undef EXTERN_C
+#ifdef _WIN32
+	#include <windows.h>
+	#include <process.h>
+#else
+	#include <pthread.h>
 #endif
-#define MAX(a, b) ((a)>(b)?(a):(b))
-#define n 3
 
-/* This function
+/* Number of voxels which are processed together, as arrays, by the eigen solver */
+#define BLOCK 256
+
+/* This function eig3volume calculates the eigen values (and the eigen vector
+ * of the smallest eigen value) of the symmetric 3x3 Hessian matrix of every voxel
  *
+ * [Lambda1,Lambda2,Lambda3,Vx,Vy,Vz]=eig3volume(Dxx,Dxy,Dxz,Dyy,Dyz,Dzz)
+ * [Lambda1,Lambda2,Lambda3]=eig3volume(Dxx,Dxy,Dxz,Dyy,Dyz,Dzz)
+ * LambdaK=eig3volume(Dxx,Dxy,Dxz,Dyy,Dyz,Dzz,K)
  *
+ * inputs,
+ *   Dxx,Dxy,Dxz,Dyy,Dyz,Dzz: The Hessian components, class double or single
+ *   K: (optional) only return the eigen value K (1, 2 or 3), without
+ *      allocating the other outputs; it is taken directly from the
+ *      trigonometric roots, close eigen values are less accurate (about
+ *      sqrt(eps) relative to the spread of the eigen values)
  *
+ * outputs,
+ *   Lambda1,Lambda2,Lambda3: The eigen values, sorted by absolute value
+ *      |Lambda1| <= |Lambda2| <= |Lambda3|
+ *   Vx,Vy,Vz: The eigen vector of Lambda1 (the direction of a vessel),
+ *      it is only calculated when six outputs are requested
+ *
+ * The eigen values are calculated analytically: the trigonometric solution of the
+ * characteristic cubic gives the best separated eigen value, the other two follow
+ * from the 2x2 matrix in the plane orthogonal to its eigen vector. This is done in
+ * double precision for single and double input.
+ * The voxels are processed in blocks of BLOCK voxels: the invariants (and for K the
+ * roots and the sorting) are branch free loops over the block, which the compiler
+ * can vectorize, the acos/cos/sin and the eigen vector solve are scalar. The volume
+ * is split over feature('Numcores') threads
  */
 
-/* Eigen decomposition code for symmetric 3x3 matrices, copied from the public
- * domain Java Matrix library JAMA. */
-static double hypot2(double x, double y) { return sqrt(x*x+y*y); }
-
-__inline double absd(double val){ if(val>0){ return val;} else { return -val;} };
-
-/* Symmetric Householder reduction to tridiagonal form. */
-static void tred2(double V[n][n], double d[n], double e[n]) {
-    
-/*  This is derived from the Algol procedures tred2 by */
-/*  Bowdler, Martin, Reinsch, and Wilkinson, Handbook for */
-/*  Auto. Comp., Vol.ii-Linear Algebra, and the corresponding */
-/*  Fortran subroutine in EISPACK. */
-    int i, j, k;
-    double scale;
-    double f, g, h;
-    double hh;
-    for (j = 0; j < n; j++) {d[j] = V[n-1][j]; }
-    
-    /* Householder reduction to tridiagonal form. */
-    
-    for (i = n-1; i > 0; i--) {
-        /* Scale to avoid under/overflow. */
-        scale = 0.0;
-        h = 0.0;
-        for (k = 0; k < i; k++) { scale = scale + fabs(d[k]); }
-        if (scale == 0.0) {
-            e[i] = d[i-1];
-            for (j = 0; j < i; j++) { d[j] = V[i-1][j]; V[i][j] = 0.0;  V[j][i] = 0.0; }
-        } else {
-            
-            /* Generate Householder vector. */
-            
-            for (k = 0; k < i; k++) { d[k] /= scale; h += d[k] * d[k]; }
-            f = d[i-1];
-            g = sqrt(h);
-            if (f > 0) { g = -g; }
-            e[i] = scale * g;
-            h = h - f * g;
-            d[i-1] = f - g;
-            for (j = 0; j < i; j++) { e[j] = 0.0; }
-            
-            /* Apply similarity transformation to remaining columns. */
-            
-            for (j = 0; j < i; j++) {
-                f = d[j];
-                V[j][i] = f;
-                g = e[j] + V[j][j] * f;
-                for (k = j+1; k <= i-1; k++) { g += V[k][j] * d[k]; e[k] += V[k][j] * f; }
-                e[j] = g;
-            }
-            f = 0.0;
-            for (j = 0; j < i; j++) { e[j] /= h; f += e[j] * d[j]; }
-            hh = f / (h + h);
-            for (j = 0; j < i; j++) { e[j] -= hh * d[j]; }
-            for (j = 0; j < i; j++) {
-                f = d[j]; g = e[j];
-                for (k = j; k <= i-1; k++) { V[k][j] -= (f * e[k] + g * d[k]); }
-                d[j] = V[i-1][j];
-                V[i][j] = 0.0;
-            }
-        }
-        d[i] = h;
+typedef struct {
+    const void *D[6];       /* inputs: Dxx, Dxy, Dxz, Dyy, Dyz, Dzz */
+    void *Lambda[3];        /* outputs: Lambda1, Lambda2, Lambda3 (NULL if not requested) */
+    void *V[3];             /* outputs: Vx, Vy, Vz (NULL if not requested) */
+    int isSingle;
+    int valuesOnly;         /* only eigen values, without the eigen vector refinement */
+    size_t npixels;
+    int ThreadID;
+    int Nthreads;
+} EigArgs;
+
+static void eigen_vector(double a00, double a01, double a02, double a11, double a12, double a22, double lambda, double *v) {
+    /* Eigen vector of a symmetric 3x3 matrix for the eigen value lambda, from the
+       largest cross product of two rows of (A - lambda*I) */
+    double r0[3], r1[3], r2[3], c[3][3], nc[3], len, fro2;
+    int k, kmax;
+    r0[0]=a00-lambda; r0[1]=a01;        r0[2]=a02;
+    r1[0]=a01;        r1[1]=a11-lambda; r1[2]=a12;
+    r2[0]=a02;        r2[1]=a12;        r2[2]=a22-lambda;
+    c[0][0]=r0[1]*r1[2]-r0[2]*r1[1]; c[0][1]=r0[2]*r1[0]-r0[0]*r1[2]; c[0][2]=r0[0]*r1[1]-r0[1]*r1[0];
+    c[1][0]=r0[1]*r2[2]-r0[2]*r2[1]; c[1][1]=r0[2]*r2[0]-r0[0]*r2[2]; c[1][2]=r0[0]*r2[1]-r0[1]*r2[0];
+    c[2][0]=r1[1]*r2[2]-r1[2]*r2[1]; c[2][1]=r1[2]*r2[0]-r1[0]*r2[2]; c[2][2]=r1[0]*r2[1]-r1[1]*r2[0];
+    kmax=0;
+    for(k=0; k<3; k++) {
+        nc[k]=c[k][0]*c[k][0]+c[k][1]*c[k][1]+c[k][2]*c[k][2];
+        if(nc[k]>nc[kmax]) { kmax=k; }
     }
-    
-    /* Accumulate transformations. */
-    
-    for (i = 0; i < n-1; i++) {
-        V[n-1][i] = V[i][i];
-        V[i][i] = 1.0;
-        h = d[i+1];
-        if (h != 0.0) {
-            for (k = 0; k <= i; k++) { d[k] = V[k][i+1] / h;}
-            for (j = 0; j <= i; j++) {
-                g = 0.0;
-                for (k = 0; k <= i; k++) { g += V[k][i+1] * V[k][j]; }
-                for (k = 0; k <= i; k++) { V[k][j] -= g * d[k]; }
-            }
-        }
-        for (k = 0; k <= i; k++) { V[k][i+1] = 0.0;}
+    fro2=r0[0]*r0[0]+r1[1]*r1[1]+r2[2]*r2[2]+2*(a01*a01+a02*a02+a12*a12);
+    if(nc[kmax]>1e-20*fro2*fro2) {
+        len=sqrt(nc[kmax]);
+        v[0]=c[kmax][0]/len; v[1]=c[kmax][1]/len; v[2]=c[kmax][2]/len;
+        return;
+    }
+    /* Repeated eigen value, (A - lambda*I) has rank 1 or 0: take a vector
+       perpendicular to its largest row */
+    nc[0]=r0[0]*r0[0]+r0[1]*r0[1]+r0[2]*r0[2];
+    nc[1]=r1[0]*r1[0]+r1[1]*r1[1]+r1[2]*r1[2];
+    nc[2]=r2[0]*r2[0]+r2[1]*r2[1]+r2[2]*r2[2];
+    if(nc[1]>nc[0]) { memcpy(r0, r1, 3*sizeof(double)); nc[0]=nc[1]; }
+    if(nc[2]>nc[0]) { memcpy(r0, r2, 3*sizeof(double)); nc[0]=nc[2]; }
+    if(nc[0]==0) { v[0]=1; v[1]=0; v[2]=0; return; }
+    if(fabs(r0[0])<=fabs(r0[1]) && fabs(r0[0])<=fabs(r0[2])) { v[0]=0; v[1]=r0[2]; v[2]=-r0[1]; }
+    else if(fabs(r0[1])<=fabs(r0[2])) { v[0]=-r0[2]; v[1]=0; v[2]=r0[0]; }
+    else { v[0]=r0[1]; v[1]=-r0[0]; v[2]=0; }
+    len=sqrt(v[0]*v[0]+v[1]*v[1]+v[2]*v[2]);
+    v[0]/=len; v[1]/=len; v[2]/=len;
+}
+
+static void eig3_invariants(double *a00, double *a01, double *a02, double *a11, double *a12, double *a22, int nb,
+                            double *q, double *p, double *r) {
+    /* Invariants of nb symmetric matrices: the mean eigen value q, the spread p and
+       the cosine r of 3x the angle of the trigonometric solution; branch free so that
+       the loop can be vectorized */
+    double b00, b11, b22, p1, p2, det;
+    int i;
+    for(i=0; i<nb; i++) {
+        q[i]=(a00[i]+a11[i]+a22[i])/3;
+        b00=a00[i]-q[i]; b11=a11[i]-q[i]; b22=a22[i]-q[i];
+        p1=a01[i]*a01[i]+a02[i]*a02[i]+a12[i]*a12[i];
+        p2=b00*b00+b11*b11+b22*b22+2*p1;
+        p[i]=sqrt(p2/6);
+        det=b00*(b11*b22-a12[i]*a12[i])-a01[i]*(a01[i]*b22-a12[i]*a02[i])+a02[i]*(a01[i]*a12[i]-b11*a02[i]);
+        r[i]=det/(2*p[i]*p[i]*p[i]+1e-300);
+        r[i]=(r[i]<-1) ? -1 : ((r[i]>1) ? 1 : r[i]);
+    }
+}
+
+static void eig3_values(double *a00, double *a01, double *a02, double *a11, double *a12, double *a22, int nb,
+                        double *L1, double *L2, double *L3) {
+    /* Eigen values only, sorted by absolute value, directly from the trigonometric
+       roots; without the eigen vector refinement of eig3_block close eigen values
+       have an absolute error of about sqrt(eps)*p. Only the acos, cos and sin loop
+       is scalar, the root and sorting loop is branch free */
+    double q[BLOCK], p[BLOCK], r[BLOCK], c[BLOCK], s[BLOCK];
+    double d0, d1, d2, e0, e1, e2, da0, da1, da2;
+    int i, swap02, swap12;
+
+    eig3_invariants(a00, a01, a02, a11, a12, a22, nb, q, p, r);
+    for(i=0; i<nb; i++) {
+        c[i]=acos(r[i])/3;
+        s[i]=sin(c[i]);
+        c[i]=cos(c[i]);
+    }
+    for(i=0; i<nb; i++) {
+        /* d0 <= d1 <= d2, all q for a multiple of the identity (p==0) */
+        d2=q[i]+2*p[i]*c[i];
+        d0=q[i]-p[i]*(c[i]+1.7320508075688772*s[i]);
+        d1=3*q[i]-d0-d2;
+        /* Sort by abs eigen value, with the same order of ties as eig3_block */
+        da0=fabs(d0); da1=fabs(d1); da2=fabs(d2);
+        swap02=(da0>=da1)&(da0>da2);
+        swap12=(!swap02)&(da1>=da0)&(da1>da2);
+        e0=swap02 ? d2 : d0;
+        e1=swap12 ? d2 : d1;
+        e2=swap02 ? d0 : (swap12 ? d1 : d2);
+        L1[i]=(fabs(e0)>fabs(e1)) ? e1 : e0;
+        L2[i]=(fabs(e0)>fabs(e1)) ? e0 : e1;
+        L3[i]=e2;
     }
-    for (j = 0; j < n; j++) { d[j] = V[n-1][j]; V[n-1][j] = 0.0; }
-    V[n-1][n-1] = 1.0;
-    e[0] = 0.0;
 }
 
-/* Symmetric tridiagonal QL algorithm. */
-static void tql2(double V[n][n], double d[n], double e[n]) {
-    
-/*  This is derived from the Algol procedures tql2, by */
-/*  Bowdler, Martin, Reinsch, and Wilkinson, Handbook for */
-/*  Auto. Comp., Vol.ii-Linear Algebra, and the corresponding */
-/*  Fortran subroutine in EISPACK. */
-    
-    int i, j, k, l, m;
-    double f;
-    double tst1;
-    double eps;
-    int iter;
-    double g, p, r;
-    double dl1, h, c, c2, c3, el1, s, s2;
-    
-    for (i = 1; i < n; i++) { e[i-1] = e[i]; }
-    e[n-1] = 0.0;
-    
-    f = 0.0;
-    tst1 = 0.0;
-    eps = pow(2.0, -52.0);
-    for (l = 0; l < n; l++) {
-        
-        /* Find small subdiagonal element */
-        
-        tst1 = MAX(tst1, fabs(d[l]) + fabs(e[l]));
-        m = l;
-        while (m < n) {
-            if (fabs(e[m]) <= eps*tst1) { break; }
-            m++;
+static void eig3_block(double *a00, double *a01, double *a02, double *a11, double *a12, double *a22, int nb,
+                       double *L1, double *L2, double *L3, double *V0, double *V1, double *V2) {
+    /* Eigen values of nb symmetric matrices, sorted by absolute value, and if V0 is
+       not NULL, the eigen vector of the smallest absolute eigen value */
+    double q[BLOCK], p[BLOCK], r[BLOCK];
+    double phi, c, s, d[3], da[3], t;
+    double vf[3], u[3], w[3], Au[3], Aw[3], ma, mb, mc, x, y, len;
+    int i, k;
+
+    eig3_invariants(a00, a01, a02, a11, a12, a22, nb, q, p, r);
+    for(i=0; i<nb; i++) {
+        if(p[i]==0) {
+            /* A multiple of the identity matrix */
+            L1[i]=q[i]; L2[i]=q[i]; L3[i]=q[i];
+            if(V0!=NULL) { V0[i]=1; V1[i]=0; V2[i]=0; }
+            continue;
         }
-        
-        /* If m == l, d[l] is an eigenvalue, */
-        /* otherwise, iterate. */
-        
-        if (m > l) {
-            iter = 0;
-            do {
-                iter = iter + 1;  /* (Could check iteration count here.) */
-                /* Compute implicit shift */
-                g = d[l];
-                p = (d[l+1] - g) / (2.0 * e[l]);
-                r = hypot2(p, 1.0);
-                if (p < 0) { r = -r; }
-                d[l] = e[l] / (p + r);
-                d[l+1] = e[l] * (p + r);
-                dl1 = d[l+1];
-                h = g - d[l];
-                for (i = l+2; i < n; i++) { d[i] -= h; }
-                f = f + h;
-                /* Implicit QL transformation. */
-                p = d[m]; c = 1.0; c2 = c; c3 = c;
-                el1 = e[l+1]; s = 0.0; s2 = 0.0;
-                for (i = m-1; i >= l; i--) {
-                    c3 = c2;
-                    c2 = c;
-                    s2 = s;
-                    g = c * e[i];
-                    h = c * p;
-                    r = hypot2(p, e[i]);
-                    e[i+1] = s * r;
-                    s = e[i] / r;
-                    c = p / r;
-                    p = c * d[i] - s * g;
-                    d[i+1] = h + s * (c * g + s * d[i]);
-                    /* Accumulate transformation. */
-                    for (k = 0; k < n; k++) {
-                        h = V[k][i+1];
-                        V[k][i+1] = s * V[k][i] + c * h;
-                        V[k][i] = c * V[k][i] - s * h;
-                    }
-                }
-                p = -s * s2 * c3 * el1 * e[l] / dl1;
-                e[l] = s * p;
-                d[l] = c * p;
-                
-                /* Check for convergence. */
-            } while (fabs(e[l]) > eps*tst1);
+        /* Roots of the characteristic polynomial, d[0] <= d[1] <= d[2] */
+        phi=acos(r[i])/3;
+        c=cos(phi); s=sin(phi);
+        d[2]=q[i]+2*p[i]*c;
+        d[0]=q[i]-p[i]*(c+1.7320508075688772*s);
+        d[1]=3*q[i]-d[0]-d[2];
+
+        /* The roots of close eigen values are not accurate, so only the root which is
+           furthest from the other two is used. Its eigen vector vf gives the plane of
+           the other two eigen vectors, in which a 2x2 problem is solved */
+        eigen_vector(a00[i], a01[i], a02[i], a11[i], a12[i], a22[i], ((d[2]-d[1])>=(d[1]-d[0])) ? d[2] : d[0], vf);
+        if(fabs(vf[0])<=fabs(vf[1]) && fabs(vf[0])<=fabs(vf[2])) { u[0]=0; u[1]=vf[2]; u[2]=-vf[1]; }
+        else if(fabs(vf[1])<=fabs(vf[2])) { u[0]=-vf[2]; u[1]=0; u[2]=vf[0]; }
+        else { u[0]=vf[1]; u[1]=-vf[0]; u[2]=0; }
+        len=sqrt(u[0]*u[0]+u[1]*u[1]+u[2]*u[2]);
+        u[0]/=len; u[1]/=len; u[2]/=len;
+        w[0]=vf[1]*u[2]-vf[2]*u[1]; w[1]=vf[2]*u[0]-vf[0]*u[2]; w[2]=vf[0]*u[1]-vf[1]*u[0];
+
+        /* Rayleigh quotient of vf and the 2x2 matrix [ma mb; mb mc] in the (u,w) plane */
+        Au[0]=a00[i]*vf[0]+a01[i]*vf[1]+a02[i]*vf[2];
+        Au[1]=a01[i]*vf[0]+a11[i]*vf[1]+a12[i]*vf[2];
+        Au[2]=a02[i]*vf[0]+a12[i]*vf[1]+a22[i]*vf[2];
+        d[0]=vf[0]*Au[0]+vf[1]*Au[1]+vf[2]*Au[2];
+        Au[0]=a00[i]*u[0]+a01[i]*u[1]+a02[i]*u[2];
+        Au[1]=a01[i]*u[0]+a11[i]*u[1]+a12[i]*u[2];
+        Au[2]=a02[i]*u[0]+a12[i]*u[1]+a22[i]*u[2];
+        Aw[0]=a00[i]*w[0]+a01[i]*w[1]+a02[i]*w[2];
+        Aw[1]=a01[i]*w[0]+a11[i]*w[1]+a12[i]*w[2];
+        Aw[2]=a02[i]*w[0]+a12[i]*w[1]+a22[i]*w[2];
+        ma=u[0]*Au[0]+u[1]*Au[1]+u[2]*Au[2];
+        mb=w[0]*Au[0]+w[1]*Au[1]+w[2]*Au[2];
+        mc=w[0]*Aw[0]+w[1]*Aw[1]+w[2]*Aw[2];
+        t=sqrt(0.25*(ma-mc)*(ma-mc)+mb*mb);
+        d[1]=0.5*(ma+mc)-t;
+        d[2]=0.5*(ma+mc)+t;
+
+        /* Sort ascending, d[0] is the eigen value of vf */
+        k=0;
+        if(d[1]<d[0]) { t=d[1]; d[1]=d[0]; d[0]=t; k=1; }
+        if(d[2]<d[1]) { t=d[2]; d[2]=d[1]; d[1]=t; if(k==1) { k=2; } }
+        if(d[1]<d[0]) { t=d[1]; d[1]=d[0]; d[0]=t; if(k==0) { k=1; } else if(k==1) { k=0; } }
+
+        /* Sort the eigen values by abs eigen value */
+        da[0]=fabs(d[0]); da[1]=fabs(d[1]); da[2]=fabs(d[2]);
+        if((da[0]>=da[1])&&(da[0]>da[2])) {
+            t=d[2]; d[2]=d[0]; d[0]=t;  t=da[2]; da[2]=da[0]; da[0]=t;
+            if(k==0) { k=2; } else if(k==2) { k=0; }
         }
-        d[l] = d[l] + f;
-        e[l] = 0.0;
-    }
-    
-    /* Sort eigenvalues and corresponding vectors. */
-    for (i = 0; i < n-1; i++) {
-        k = i;
-        p = d[i];
-        for (j = i+1; j < n; j++) {
-            if (d[j] < p) {
-                k = j;
-                p = d[j];
-            }
+        else if((da[1]>=da[0])&&(da[1]>da[2])) {
+            t=d[2]; d[2]=d[1]; d[1]=t;  t=da[2]; da[2]=da[1]; da[1]=t;
+            if(k==1) { k=2; } else if(k==2) { k=1; }
+        }
+        if(da[0]>da[1]) {
+            t=d[1]; d[1]=d[0]; d[0]=t;
+            if(k==0) { k=1; } else if(k==1) { k=0; }
         }
-        if (k != i) {
-            d[k] = d[i];
-            d[i] = p;
-            for (j = 0; j < n; j++) {
-                p = V[j][i];
-                V[j][i] = V[j][k];
-                V[j][k] = p;
+        L1[i]=d[0]; L2[i]=d[1]; L3[i]=d[2];
+
+        if(V0!=NULL) {
+            if(k==0) {
+                V0[i]=vf[0]; V1[i]=vf[1]; V2[i]=vf[2];
+            }
+            else {
+                /* Eigen vector of the 2x2 matrix for d[0], mapped back to 3D */
+                x=mb; y=d[0]-ma;
+                if((d[0]-mc)*(d[0]-mc)>y*y) { x=d[0]-mc; y=mb; }
+                len=sqrt(x*x+y*y);
+                if(len==0) { x=1; y=0; } else { x/=len; y/=len; }
+                V0[i]=x*u[0]+y*w[0]; V1[i]=x*u[1]+y*w[1]; V2[i]=x*u[2]+y*w[2];
             }
         }
     }
 }
 
-void eigen_decomposition(double A[n][n], double V[n][n], double d[n]) {
-    double e[n];
-    double da[3];
-    double dt, dat;
-    double vet[3];
-    int i, j;
-    for (i = 0; i < n; i++) {
-        for (j = 0; j < n; j++) {
-            V[i][j] = A[i][j];
+#ifdef _WIN32
+  unsigned __stdcall eig3_thread(EigArgs *Args) {
+#else
+  void eig3_thread(EigArgs *Args) {
+#endif
+    double A[6][BLOCK], L[3][BLOCK], V[3][BLOCK];
+    size_t start, end, i0, i;
+    int nb, k;
+
+    start=(Args->npixels*Args->ThreadID)/Args->Nthreads;
+    end=(Args->npixels*(Args->ThreadID+1))/Args->Nthreads;
+
+    for(i0=start; i0<end; i0+=BLOCK) {
+        nb=(int)(((end-i0)<BLOCK) ? (end-i0) : BLOCK);
+        /* Load a block of Hessian matrices */
+        for(k=0; k<6; k++) {
+            if(Args->isSingle) { for(i=0; i<(size_t)nb; i++) { A[k][i]=(double)((const float *)Args->D[k])[i0+i]; } }
+            else { memcpy(A[k], &((const double *)Args->D[k])[i0], nb*sizeof(double)); }
+        }
+
+        /* Dxx, Dxy, Dxz, Dyy, Dyz, Dzz */
+        if(Args->valuesOnly) {
+            eig3_values(A[0], A[1], A[2], A[3], A[4], A[5], nb, L[0], L[1], L[2]);
+        }
+        else {
+            eig3_block(A[0], A[1], A[2], A[3], A[4], A[5], nb, L[0], L[1], L[2],
+                (Args->V[0]!=NULL) ? V[0] : NULL, V[1], V[2]);
+        }
+
+        /* Store the requested outputs */
+        for(k=0; k<3; k++) {
+            if(Args->Lambda[k]!=NULL) {
+                if(Args->isSingle) { for(i=0; i<(size_t)nb; i++) { ((float *)Args->Lambda[k])[i0+i]=(float)L[k][i]; } }
+                else { memcpy(&((double *)Args->Lambda[k])[i0], L[k], nb*sizeof(double)); }
+            }
+            if(Args->V[k]!=NULL) {
+                if(Args->isSingle) { for(i=0; i<(size_t)nb; i++) { ((float *)Args->V[k])[i0+i]=(float)V[k][i]; } }
+                else { memcpy(&((double *)Args->V[k])[i0], V[k], nb*sizeof(double)); }
+            }
         }
-    }
-    tred2(V, d, e);
-    tql2(V, d, e);
-    
-    /* Sort the eigen values and vectors by abs eigen value */
-    da[0]=absd(d[0]); da[1]=absd(d[1]); da[2]=absd(d[2]);
-    if((da[0]>=da[1])&&(da[0]>da[2]))
-    {
-        dt=d[2];   dat=da[2];    vet[0]=V[0][2];    vet[1]=V[1][2];    vet[2]=V[2][2];
-        d[2]=d[0]; da[2]=da[0];  V[0][2] = V[0][0]; V[1][2] = V[1][0]; V[2][2] = V[2][0];
-        d[0]=dt;   da[0]=dat;    V[0][0] = vet[0];  V[1][0] = vet[1];  V[2][0] = vet[2]; 
-    }
-    else if((da[1]>=da[0])&&(da[1]>da[2]))  
-    {
-        dt=d[2];   dat=da[2];    vet[0]=V[0][2];    vet[1]=V[1][2];    vet[2]=V[2][2];
-        d[2]=d[1]; da[2]=da[1];  V[0][2] = V[0][1]; V[1][2] = V[1][1]; V[2][2] = V[2][1];
-        d[1]=dt;   da[1]=dat;    V[0][1] = vet[0];  V[1][1] = vet[1];  V[2][1] = vet[2]; 
-    }
-    if(da[0]>da[1])
-    {
-        dt=d[1];   dat=da[1];    vet[0]=V[0][1];    vet[1]=V[1][1];    vet[2]=V[2][1];
-        d[1]=d[0]; da[1]=da[0];  V[0][1] = V[0][0]; V[1][1] = V[1][0]; V[2][1] = V[2][0];
-        d[0]=dt;   da[0]=dat;    V[0][0] = vet[0];  V[1][0] = vet[1];  V[2][0] = vet[2]; 
     }
 
-    
+    /*  explicit end thread, helps to ensure proper recovery of resources allocated for the thread */
+    #ifdef _WIN32
+	_endthreadex( 0 );
+    return 0;
+	#else
+	pthread_exit(NULL);
+	#endif
 }
 
-
 void mexFunction( int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[] ) {
-    double *Dxx, *Dxy, *Dxz, *Dyy, *Dyz, *Dzz;
-    double *Dvecx, *Dvecy, *Dvecz, *Deiga, *Deigb, *Deigc;
-
-    float *Dxx_f, *Dxy_f, *Dxz_f, *Dyy_f, *Dyz_f, *Dzz_f;
-    float *Dvecx_f, *Dvecy_f, *Dvecz_f, *Deiga_f, *Deigb_f, *Deigc_f;
-
-    mwSize output_dims[2]={1, 3};
-    double Ma[3][3];
-    double Davec[3][3];
-    double Daeig[3];
-    
     /* Loop variable */
     int i;
-    
+
     /* Size of input */
     const mwSize *idims;
     int nsubs=0;
-    
+
     /* Number of pixels */
-    int npixels=1;
-    
+    size_t npixels=1;
+
+    /* Only return this eigen value (0: all) */
+    int onlyLambda=0;
+
+    mxClassID classD;
+    EigArgs *ThreadArgs;
+    void *Lambda[3]={NULL, NULL, NULL};
+    void *V[3]={NULL, NULL, NULL};
+
+    /* Number of threads, from feature('Numcores') */
+    mxArray *matlabCallOut[1]={0};
+    mxArray *matlabCallIn[1]={0};
+    int Nthreads;
+	/* Handles to the worker threads */
+	#ifdef _WIN32
+		HANDLE *ThreadList;
+    #else
+		pthread_t *ThreadList;
+	#endif
+
     /* Check for proper number of arguments. */
-    if(nrhs!=6) {
+    if(nrhs==7) {
+        onlyLambda=(int)mxGetScalar(prhs[6]);
+        if((onlyLambda<1)||(onlyLambda>3)) { mexErrMsgTxt("K must be 1, 2 or 3."); }
+        if(nlhs>1) { mexErrMsgTxt("One output is returned when K is given."); }
+    }
+    else if(nrhs!=6) {
         mexErrMsgTxt("Six inputs are required.");
-    } else if(nlhs<3) {
+    } else if((nlhs!=3)&&(nlhs!=6)) {
         mexErrMsgTxt("Three or Six outputs are required");
     }
-    
-   
+
     /*  Get the number of dimensions */
     nsubs = mxGetNumberOfDimensions(prhs[0]);
     /* Get the sizes of the inputs */
     idims = mxGetDimensions(prhs[0]);
     for (i=0; i<nsubs; i++) { npixels=npixels*idims[i]; }
-    
-    if(mxGetClassID(prhs[0])==mxDOUBLE_CLASS) {
-       /* Assign pointers to each input. */
-        Dxx = (double *)mxGetPr(prhs[0]);
-        Dxy = (double *)mxGetPr(prhs[1]);
-        Dxz = (double *)mxGetPr(prhs[2]);
-        Dyy = (double *)mxGetPr(prhs[3]);
-        Dyz = (double *)mxGetPr(prhs[4]);
-        Dzz = (double *)mxGetPr(prhs[5]);
-
-        /* Assign pointers to each output. */
-        plhs[0] = mxCreateNumericArray(nsubs, idims, mxDOUBLE_CLASS, mxREAL);
-        plhs[1] = mxCreateNumericArray(nsubs, idims, mxDOUBLE_CLASS, mxREAL);
-        plhs[2] = mxCreateNumericArray(nsubs, idims, mxDOUBLE_CLASS, mxREAL);
-        Deiga = mxGetPr(plhs[0]); Deigb = mxGetPr(plhs[1]); Deigc = mxGetPr(plhs[2]);
-        if(nlhs==6) {
-            /* Main direction (larged eigenvector) */
-            plhs[3] = mxCreateNumericArray(nsubs, idims, mxDOUBLE_CLASS, mxREAL);
-            plhs[4] = mxCreateNumericArray(nsubs, idims, mxDOUBLE_CLASS, mxREAL);
-            plhs[5] = mxCreateNumericArray(nsubs, idims, mxDOUBLE_CLASS, mxREAL);
-            Dvecx = mxGetPr(plhs[3]); Dvecy = mxGetPr(plhs[4]); Dvecz = mxGetPr(plhs[5]);
-        }
-        
-        
-        for(i=0; i<npixels; i++) {
-            Ma[0][0]=Dxx[i]; Ma[0][1]=Dxy[i]; Ma[0][2]=Dxz[i];
-            Ma[1][0]=Dxy[i]; Ma[1][1]=Dyy[i]; Ma[1][2]=Dyz[i];
-            Ma[2][0]=Dxz[i]; Ma[2][1]=Dyz[i]; Ma[2][2]=Dzz[i];
-            eigen_decomposition(Ma, Davec, Daeig);
-            Deiga[i]=Daeig[0]; Deigb[i]=Daeig[1]; Deigc[i]=Daeig[2];
-            if(nlhs==6) {
-                /* Main direction (smallest eigenvector) */
-                Dvecx[i]=Davec[0][0];
-                Dvecy[i]=Davec[1][0];
-                Dvecz[i]=Davec[2][0];
-            }
+
+    classD=mxGetClassID(prhs[0]);
+    if((classD!=mxDOUBLE_CLASS)&&(classD!=mxSINGLE_CLASS)) { mexErrMsgTxt("Inputs must be of type Single or Double"); }
+    for (i=1; i<6; i++) {
+        if((mxGetClassID(prhs[i])!=classD)||(mxGetNumberOfElements(prhs[i])!=npixels)) {
+            mexErrMsgTxt("All inputs must have the same size and class");
         }
     }
-    else if(mxGetClassID(prhs[0])==mxSINGLE_CLASS) {
-       /* Assign pointers to each input. */
-        Dxx_f = (float *)mxGetPr(prhs[0]);
-        Dxy_f = (float *)mxGetPr(prhs[1]);
-        Dxz_f = (float *)mxGetPr(prhs[2]);
-        Dyy_f = (float *)mxGetPr(prhs[3]);
-        Dyz_f = (float *)mxGetPr(prhs[4]);
-        Dzz_f = (float *)mxGetPr(prhs[5]);
-
-        /* Assign pointers to each output. */
-        plhs[0] = mxCreateNumericArray(nsubs, idims, mxSINGLE_CLASS, mxREAL);
-        plhs[1] = mxCreateNumericArray(nsubs, idims, mxSINGLE_CLASS, mxREAL);
-        plhs[2] = mxCreateNumericArray(nsubs, idims, mxSINGLE_CLASS, mxREAL);
-        Deiga_f  = (float *)mxGetPr(plhs[0]); 
-        Deigb_f  = (float *)mxGetPr(plhs[1]); 
-        Deigc_f  = (float *)mxGetPr(plhs[2]);
-        if(nlhs==6) {
-            /* Main direction (smallest eigenvector) */
-            plhs[3] = mxCreateNumericArray(nsubs, idims, mxSINGLE_CLASS, mxREAL);
-            plhs[4] = mxCreateNumericArray(nsubs, idims, mxSINGLE_CLASS, mxREAL);
-            plhs[5] = mxCreateNumericArray(nsubs, idims, mxSINGLE_CLASS, mxREAL);
-            Dvecx_f  = (float *)mxGetPr(plhs[3]); 
-            Dvecy_f  = (float *)mxGetPr(plhs[4]); 
-            Dvecz_f  = (float *)mxGetPr(plhs[5]);
-        }
-        
-        
-        for(i=0; i<npixels; i++) {
-            Ma[0][0]=(double)Dxx_f[i]; Ma[0][1]=(double)Dxy_f[i]; Ma[0][2]=(double)Dxz_f[i];
-            Ma[1][0]=(double)Dxy_f[i]; Ma[1][1]=(double)Dyy_f[i]; Ma[1][2]=(double)Dyz_f[i];
-            Ma[2][0]=(double)Dxz_f[i]; Ma[2][1]=(double)Dyz_f[i]; Ma[2][2]=(double)Dzz_f[i];
-            eigen_decomposition(Ma, Davec, Daeig);
-            Deiga_f[i]=(float)Daeig[0]; 
-            Deigb_f[i]=(float)Daeig[1]; 
-            Deigc_f[i]=(float)Daeig[2];
-            if(nlhs==6) {
-                /* Main direction (smallest eigenvector) */
-                Dvecx_f[i]=(float)Davec[0][0]; 
-                Dvecy_f[i]=(float)Davec[1][0]; 
-                Dvecz_f[i]=(float)Davec[2][0];
-            }
+
+    /* Create the outputs */
+    if(onlyLambda>0) {
+        plhs[0] = mxCreateNumericArray(nsubs, idims, classD, mxREAL);
+        Lambda[onlyLambda-1]=mxGetData(plhs[0]);
+    }
+    else {
+        for (i=0; i<nlhs; i++) {
+            plhs[i] = mxCreateNumericArray(nsubs, idims, classD, mxREAL);
+            if(i<3) { Lambda[i]=mxGetData(plhs[i]); } else { V[i-3]=mxGetData(plhs[i]); }
         }
+    }
+    if(npixels==0) { return; }
 
+    /* Get the number of threads */
+    matlabCallIn[0]=mxCreateString("Numcores");
+    mexCallMATLAB(1, matlabCallOut, 1, matlabCallIn, "feature");
+    Nthreads=(int)mxGetScalar(matlabCallOut[0]);
+    if(Nthreads<1) { Nthreads=1; }
+    if((size_t)Nthreads>npixels) { Nthreads=(int)npixels; }
+    mxDestroyArray(matlabCallIn[0]);
+    mxDestroyArray(matlabCallOut[0]);
+
+	#ifdef _WIN32
+		ThreadList = (HANDLE*)malloc(Nthreads* sizeof( HANDLE ));
+    #else
+		ThreadList = (pthread_t*)malloc(Nthreads* sizeof( pthread_t ));
+	#endif
+    ThreadArgs = (EigArgs *)malloc(Nthreads* sizeof( EigArgs ));
+
+    for (i=0; i<Nthreads; i++) {
+        /* Dxx, Dxy, Dxz, Dyy, Dyz, Dzz */
+        ThreadArgs[i].D[0]=mxGetData(prhs[0]); ThreadArgs[i].D[1]=mxGetData(prhs[1]); ThreadArgs[i].D[2]=mxGetData(prhs[2]);
+        ThreadArgs[i].D[3]=mxGetData(prhs[3]); ThreadArgs[i].D[4]=mxGetData(prhs[4]); ThreadArgs[i].D[5]=mxGetData(prhs[5]);
+        memcpy(ThreadArgs[i].Lambda, Lambda, 3*sizeof(void *));
+        memcpy(ThreadArgs[i].V, V, 3*sizeof(void *));
+        ThreadArgs[i].isSingle=(classD==mxSINGLE_CLASS);
+        ThreadArgs[i].valuesOnly=(onlyLambda>0);
+        ThreadArgs[i].npixels=npixels;
+        ThreadArgs[i].ThreadID=i; ThreadArgs[i].Nthreads=Nthreads;
+        #ifdef _WIN32
+            ThreadList[i] = (HANDLE)_beginthreadex( NULL, 0, &eig3_thread, &ThreadArgs[i] , 0, NULL );
+        #else
+            pthread_create ((pthread_t*)&ThreadList[i], NULL, (void *) &eig3_thread, &ThreadArgs[i]);
+        #endif
     }
+
+	#ifdef _WIN32
+		for (i=0; i<Nthreads; i++) { WaitForSingleObject(ThreadList[i], INFINITE); }
+		for (i=0; i<Nthreads; i++) { CloseHandle( ThreadList[i] ); }
+	#else
+		for (i=0; i<Nthreads; i++) { pthread_join(ThreadList[i],NULL); }
+	#endif
+
+    free(ThreadArgs);
+    free(ThreadList);
 }
@@ -9,380 +9,594 @@
 #endif
 #define clamp(a, b1, b2) min(max(a, b1), b2);
 
+/*   undef needed for LCC compiler  */
+#undef EXTERN_C
+#ifdef _WIN32
+	#include <windows.h>
+	#include <process.h>
+#else
+	#include <pthread.h>
+#endif
 
-void imfilter1D_double(double *I, int lengthI, double *H, int lengthH, double *J) {
-    int x, i, index, offset;
-    int b2, offset2;
-    if(lengthI==1)  
-    { 
-        J[0]=I[0];
-    }
-    else
-    {
-        offset=(lengthH-1)/2;
-        for(x=0; x<min(offset,lengthI); x++) {
-            J[x]=0;
-            b2=lengthI-1; offset2=x-offset;
-            for(i=0; i<lengthH; i++) {
-                index=clamp(i+offset2, 0, b2); J[x]+=I[index]*H[i];
-            }
-        }
-       
-        for(x=offset; x<(lengthI-offset); x++) {
-            J[x]=0;
-            b2=lengthI-1; offset2=x-offset;
-            for(i=0; i<lengthH; i++) {
-                index=i+offset2; J[x]+=I[index]*H[i];
-            }
+/* SIMD versions of the convolution, selected at compile time; SSE2 is always
+   available on 64-bit x86, AVX needs e.g.: mex CFLAGS='$CFLAGS -mavx' imgaussian.c */
+#if defined(__AVX__)
+	#define IMG_USE_AVX
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP>=2))
+	#define IMG_USE_SSE2
+#endif
+#if defined(IMG_USE_AVX)
+	#include <immintrin.h>
+#elif defined(IMG_USE_SSE2)
+	#include <emmintrin.h>
+#endif
+
+/* Number of neighbouring pixels which are filtered together in the y and z direction */
+#define CHUNK 256
+
+/* 
+ The 2D, 2D color and 3D images are filtered with three separable passes (x, y, z).
+ Every pass is split over the threads, the x pass in blocks of rows and the y and z
+ passes in blocks of CHUNK wide pixel runs (of every z-slice for the y pass).
+ The number of threads is obtained with feature('Numcores')
+*/
+typedef struct {
+    void *I;            /* input image */
+    void *J;            /* output image */
+    void *H;            /* 1D gaussian kernel */
+    int lengthH;
+    int *sizeI;         /* image size, sizeI[2] is 1 for 2D images */
+    int pass;           /* 0: x, 1: y, 2: z direction */
+    int recursive;      /* 1: H contains recursive filter coefficients */
+    int ThreadID;
+    int Nthreads;
+} FilterArgs;
+
+/* 
+ Convolution of n neighbouring output values with the symmetric gaussian kernel
+ (H[i]==H[lengthH-1-i]), the taps are folded so that only (lengthH+1)/2 multiplies
+ are needed per output value. Tap i of output j is found at P[j+i*step], step is 1
+ for a padded row (x direction) and the buffer width for the y and z directions.
+ The loop over j is vectorized with AVX or SSE2 if available at compile time
+*/
+void convolve_folded_double(const double *P, size_t step, double *out, int n, const double *H, int lengthH) {
+    int j=0, i, hks;
+    const double *Pl, *Pr;
+    double sum;
+    hks=(lengthH-1)/2;
+#if defined(IMG_USE_AVX)
+    for(; j<=(n-4); j+=4) {
+        __m256d acc=_mm256_mul_pd(_mm256_set1_pd(H[hks]), _mm256_loadu_pd(&P[j+hks*step]));
+        for(i=0; i<hks; i++) {
+            Pl=&P[j+i*step]; Pr=&P[j+(lengthH-1-i)*step];
+            acc=_mm256_add_pd(acc, _mm256_mul_pd(_mm256_set1_pd(H[i]), _mm256_add_pd(_mm256_loadu_pd(Pl), _mm256_loadu_pd(Pr))));
         }
-       
-         b2=lengthI-1; 
-         for(x=max(lengthI-offset,offset); x<lengthI; x++) {
-              J[x]=0;
-              offset2=x-offset;
-              for(i=0; i<lengthH; i++) {
-                  index=clamp(i+offset2, 0, b2); J[x]+=I[index]*H[i];
-             }
-         }
-       
-    }
-}
-
-void imfilter2D_double(double *I, int * sizeI, double *H, int lengthH, double *J) {
-    int y, x, i, y2;
-    double *Irow, *Crow;
-    int index=0, line=0;
-    double *RCache;
-    int *nCache;
-    int hks, offset, offset2;
-    RCache=(double *)malloc(lengthH*sizeI[0]*sizeof(double));
-    for(i=0; i<lengthH*sizeI[0]; i++) { RCache[i]=0; }
-    nCache=(int *)malloc(lengthH*sizeof(int));
-    for(i=0; i<lengthH; i++) { nCache[i]=0; }
-    hks=((lengthH-1)/2);
-    for(y=0; y<min(hks,sizeI[1]); y++) {
-        Irow=&I[index];
-        Crow=&RCache[line*sizeI[0]];
-        imfilter1D_double(Irow, sizeI[0], H, lengthH, Crow);
-        index+=sizeI[0];
-        if(y!=(sizeI[1]-1))
-        {
-            line++; if(line>(lengthH-1)) { line=0; }
+        _mm256_storeu_pd(&out[j], acc);
+    }
+#endif
+#if defined(IMG_USE_SSE2)
+    for(; j<=(n-2); j+=2) {
+        __m128d acc=_mm_mul_pd(_mm_set1_pd(H[hks]), _mm_loadu_pd(&P[j+hks*step]));
+        for(i=0; i<hks; i++) {
+            Pl=&P[j+i*step]; Pr=&P[j+(lengthH-1-i)*step];
+            acc=_mm_add_pd(acc, _mm_mul_pd(_mm_set1_pd(H[i]), _mm_add_pd(_mm_loadu_pd(Pl), _mm_loadu_pd(Pr))));
         }
-        for(i=0; i<(lengthH-1); i++) { nCache[i]=nCache[i+1]; } nCache[lengthH-1]=line;
-    }
-    for(y2=y; y2<hks; y2++) {
-        for(i=0; i<(lengthH-1); i++) { nCache[i]=nCache[i+1]; } nCache[lengthH-1]=line;
-    }
-            
-    for(y=hks; y<(sizeI[1]-1); y++) {
-        Irow=&I[index];
-        Crow=&RCache[line*sizeI[0]];
-        imfilter1D_double(Irow, sizeI[0], H, lengthH, Crow);
-        offset=(y-hks)*sizeI[0]; offset2=nCache[0]*sizeI[0];
-        for(x=0; x<sizeI[0]; x++) { J[offset+x]=RCache[offset2+x]*H[0]; }
-        for(i=1; i<lengthH; i++) {
-            offset2=nCache[i]*sizeI[0];
-            for(x=0; x<sizeI[0]; x++) { J[offset+x]+=RCache[offset2+x]*H[i]; }
+        _mm_storeu_pd(&out[j], acc);
+    }
+#endif
+    for(; j<n; j++) {
+        sum=H[hks]*P[j+hks*step];
+        for(i=0; i<hks; i++) { sum+=H[i]*(P[j+i*step]+P[j+(lengthH-1-i)*step]); }
+        out[j]=sum;
+    }
+}
+
+void convolve_folded_float(const float *P, size_t step, float *out, int n, const float *H, int lengthH) {
+    int j=0, i, hks;
+    const float *Pl, *Pr;
+    float sum;
+    hks=(lengthH-1)/2;
+#if defined(IMG_USE_AVX)
+    for(; j<=(n-8); j+=8) {
+        __m256 acc=_mm256_mul_ps(_mm256_set1_ps(H[hks]), _mm256_loadu_ps(&P[j+hks*step]));
+        for(i=0; i<hks; i++) {
+            Pl=&P[j+i*step]; Pr=&P[j+(lengthH-1-i)*step];
+            acc=_mm256_add_ps(acc, _mm256_mul_ps(_mm256_set1_ps(H[i]), _mm256_add_ps(_mm256_loadu_ps(Pl), _mm256_loadu_ps(Pr))));
         }
-        index+=sizeI[0];
-        line++; if(line>(lengthH-1)) { line=0; }
-        for(i=0; i<(lengthH-1); i++) { nCache[i]=nCache[i+1]; } nCache[lengthH-1]=line;
-    }
-
-    for(y=max(sizeI[1]-1,hks); y<sizeI[1]; y++) {
-        Irow=&I[index];
-        Crow=&RCache[line*sizeI[0]];
-        imfilter1D_double(Irow, sizeI[0], H, lengthH, Crow);
-        offset=(y-hks)*sizeI[0]; offset2=nCache[0]*sizeI[0];
-        for(x=0; x<sizeI[0]; x++) { J[offset+x]=RCache[offset2+x]*H[0]; }
-        for(i=1; i<lengthH; i++) {
-            offset2=nCache[i]*sizeI[0];
-            for(x=0; x<sizeI[0]; x++) { J[offset+x]+=RCache[offset2+x]*H[i]; }
+        _mm256_storeu_ps(&out[j], acc);
+    }
+#endif
+#if defined(IMG_USE_SSE2)
+    for(; j<=(n-4); j+=4) {
+        __m128 acc=_mm_mul_ps(_mm_set1_ps(H[hks]), _mm_loadu_ps(&P[j+hks*step]));
+        for(i=0; i<hks; i++) {
+            Pl=&P[j+i*step]; Pr=&P[j+(lengthH-1-i)*step];
+            acc=_mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(H[i]), _mm_add_ps(_mm_loadu_ps(Pl), _mm_loadu_ps(Pr))));
         }
-        index+=sizeI[0];
-        for(i=0; i<(lengthH-1); i++) { nCache[i]=nCache[i+1]; } nCache[lengthH-1]=line;
+        _mm_storeu_ps(&out[j], acc);
+    }
+#endif
+    for(; j<n; j++) {
+        sum=H[hks]*P[j+hks*step];
+        for(i=0; i<hks; i++) { sum+=H[i]*(P[j+i*step]+P[j+(lengthH-1-i)*step]); }
+        out[j]=sum;
+    }
+}
+
+void imfilter_row_double(double *I, int lengthI, double *H, int lengthH, double *J, double *B) {
+    /* Filter one row, the row is copied into the buffer B (length lengthI+lengthH-1) with 
+       replicated borders, so that the convolution needs no bounds checks */
+    int x, hks;
+    hks=(lengthH-1)/2;
+    for(x=0; x<hks; x++) { B[x]=I[0]; B[lengthI+hks+x]=I[lengthI-1]; }
+    memcpy(&B[hks], I, lengthI*sizeof(double));
+    convolve_folded_double(B, 1, J, lengthI, H, lengthH);
+}
+
+void imfilter1D_double(double *I, int lengthI, double *H, int lengthH, double *J) {
+    double *B;
+    B=(double *)malloc((lengthI+lengthH-1)*sizeof(double));
+    imfilter_row_double(I, lengthI, H, lengthH, J, B);
+    free(B);
+}
+
+void imfilter_axis_double(double *J, int lengthI, size_t stride, int width, double *H, int lengthH, double *B) {
+    /* Filter "width" neighbouring lines along an axis with the given stride, in place.
+       The lines are first copied into the buffer B with replicated borders, so that
+       the convolution below runs over contiguous memory without bounds checks */
+    int k, ks, hks;
+    hks=(lengthH-1)/2;
+    for(k=-hks; k<(lengthI+hks); k++) {
+        ks=clamp(k, 0, lengthI-1);
+        memcpy(&B[(size_t)(k+hks)*width], &J[(size_t)ks*stride], width*sizeof(double));
+    }
+    for(k=0; k<lengthI; k++) {
+        convolve_folded_double(&B[(size_t)k*width], width, &J[(size_t)k*stride], width, H, lengthH);
+    }
+}
+
+void iir_row_double(double *I, int lengthI, double *C, double *J) {
+    /* Recursive gaussian filtering of one row, the causal pass goes from I into J
+       and the anti-causal pass is done in place. C contains the filter coefficients */
+    int n;
+    double b, a1, a2, a3, *M;
+    double w1, w2, w3, u0, u1, u2, xe;
+    b=C[0]; a1=C[1]; a2=C[2]; a3=C[3]; M=&C[4];
+    xe=I[lengthI-1];
+    /* Causal pass, the values before the row are the steady state of the first pixel */
+    w1=I[0]; w2=I[0]; w3=I[0];
+    for(n=0; n<lengthI; n++) {
+        J[n]=b*I[n]+a1*w1+a2*w2+a3*w3;
+        w3=w2; w2=w1; w1=J[n];
+    }
+    /* Triggs and Sdika initialisation of the anti-causal pass for a replicated border */
+    u0=w1-xe; u1=w2-xe; u2=w3-xe;
+    w1=xe+b*(M[0]*u0+M[1]*u1+M[2]*u2);
+    w2=xe+b*(M[3]*u0+M[4]*u1+M[5]*u2);
+    w3=xe+b*(M[6]*u0+M[7]*u1+M[8]*u2);
+    J[lengthI-1]=w1;
+    for(n=lengthI-2; n>=0; n--) {
+        u0=b*J[n]+a1*w1+a2*w2+a3*w3;
+        J[n]=u0; w3=w2; w2=w1; w1=u0;
+    }
+}
+
+void iir_axis_double(double *J, int lengthI, size_t stride, int width, double *C, double *B) {
+    /* Recursive gaussian filtering of "width" neighbouring lines along an axis with the 
+       given stride, in place. The lines are processed together so that the inner loops 
+       run over contiguous memory. B is a buffer of 3*width values */
+    int n, c;
+    double b, a1, a2, a3, *M, u0, u1, u2;
+    double *J0, *J1, *J2, *J3, *Xe, *Y1, *Y2;
+    b=C[0]; a1=C[1]; a2=C[2]; a3=C[3]; M=&C[4];
+    Xe=B; Y1=&B[width]; Y2=&B[2*width];
+    memcpy(Xe, &J[(size_t)(lengthI-1)*stride], width*sizeof(double));
+    /* Causal pass, the first line is its own steady state, so the values before it
+       are taken from the first line */
+    for(n=1; n<lengthI; n++) {
+        J0=&J[(size_t)n*stride];
+        J1=&J[(size_t)(n-1)*stride];
+        J2=&J[(size_t)max(n-2,0)*stride];
+        J3=&J[(size_t)max(n-3,0)*stride];
+        for(c=0; c<width; c++) { J0[c]=b*J0[c]+a1*J1[c]+a2*J2[c]+a3*J3[c]; }
+    }
+    /* Triggs and Sdika initialisation of the anti-causal pass for a replicated border */
+    J0=&J[(size_t)(lengthI-1)*stride];
+    J1=&J[(size_t)max(lengthI-2,0)*stride];
+    J2=&J[(size_t)max(lengthI-3,0)*stride];
+    for(c=0; c<width; c++) {
+        u0=J0[c]-Xe[c]; u1=J1[c]-Xe[c]; u2=J2[c]-Xe[c];
+        Y1[c]=Xe[c]+b*(M[3]*u0+M[4]*u1+M[5]*u2);
+        Y2[c]=Xe[c]+b*(M[6]*u0+M[7]*u1+M[8]*u2);
+        J0[c]=Xe[c]+b*(M[0]*u0+M[1]*u1+M[2]*u2);
+    }
+    /* Anti-causal pass, Y1 and Y2 are the lines after the last line */
+    for(n=lengthI-2; n>=0; n--) {
+        J0=&J[(size_t)n*stride];
+        J1=&J[(size_t)(n+1)*stride];
+        J2=((n+2)<lengthI) ? &J[(size_t)(n+2)*stride] : Y1;
+        J3=((n+3)<lengthI) ? &J[(size_t)(n+3)*stride] : (((n+3)==lengthI) ? Y1 : Y2);
+        for(c=0; c<width; c++) { J0[c]=b*J0[c]+a1*J1[c]+a2*J2[c]+a3*J3[c]; }
     }
+}
 
-    for(y=max(sizeI[1],hks); y<(sizeI[1]+hks); y++) {
-        offset=(y-hks)*sizeI[0]; offset2=nCache[0]*sizeI[0];
-        for(x=0; x<sizeI[0]; x++) { J[offset+x]=RCache[offset2+x]*H[0]; }
-        for(i=1; i<lengthH; i++) {
-            offset2=nCache[i]*sizeI[0];
-            for(x=0; x<sizeI[0]; x++) { J[offset+x]+=RCache[offset2+x]*H[i]; }
+#ifdef _WIN32
+  unsigned __stdcall imfilter_thread_double(FilterArgs *Args) {
+#else
+  void imfilter_thread_double(FilterArgs *Args) {
+#endif
+    double *I, *J, *H, *B;
+    int *sizeI, lengthH, hks;
+    size_t nslice, nitems, item, item_start, item_end;
+    int nchunks, s, x0, width;
+    
+    I=(double *)Args->I; J=(double *)Args->J; H=(double *)Args->H;
+    sizeI=Args->sizeI; lengthH=Args->lengthH;
+    hks=(lengthH-1)/2;
+    nslice=(size_t)sizeI[0]*sizeI[1];
+    
+    if(Args->pass==0) {
+        /* x direction, a contiguous block of rows for every thread */
+        nitems=(size_t)sizeI[1]*sizeI[2];
+        item_start=(nitems*Args->ThreadID)/Args->Nthreads;
+        item_end=(nitems*(Args->ThreadID+1))/Args->Nthreads;
+        B=(double *)malloc((sizeI[0]+lengthH-1)*sizeof(double));
+        for(item=item_start; item<item_end; item++) {
+            if(Args->recursive) {
+                iir_row_double(&I[item*sizeI[0]], sizeI[0], H, &J[item*sizeI[0]]);
+            }
+            else {
+                imfilter_row_double(&I[item*sizeI[0]], sizeI[0], H, lengthH, &J[item*sizeI[0]], B);
+            }
         }
-        index+=sizeI[0];
-        for(i=0; i<(lengthH-1); i++) { nCache[i]=nCache[i+1]; } nCache[lengthH-1]=line;
-    }
-
-    free(RCache);
-}
-
-void imfilter3D_double(double *I, int * sizeI, double *H, int lengthH, double *J) {
-    int z, j, i, z2;
-    double *Islice, *Cslice;
-    int index=0, line=0;
-    double *SCache;
-    int *nCache;
-    int hks, offset, offset2;
-    int nslice;
-    nslice=sizeI[0]*sizeI[1];
-    SCache=(double *)malloc(lengthH*nslice*sizeof(double));
-	for(i=0; i<nslice; i++) { SCache[i]=0; }
-    nCache=(int *)malloc(lengthH*sizeof(int));
-    for(i=0; i<lengthH; i++) { nCache[i]=0; }
-    hks=((lengthH-1)/2);
-    for(z=0; z<min(hks,sizeI[2]); z++) {
-        Islice=&I[index];
-        Cslice=&SCache[line*nslice];
-        imfilter2D_double(Islice, sizeI, H, lengthH, Cslice);
-        index+=nslice;
-        if(z!=(sizeI[2]-1))
-        {
-            line++; if(line>(lengthH-1)) { line=0; }
+        free(B);
+    }
+    else {
+        /* y or z direction, processed as sweeps over contiguous runs of CHUNK pixels */
+        if(Args->pass==1) {
+            nchunks=(sizeI[0]+CHUNK-1)/CHUNK;
+            nitems=(size_t)nchunks*sizeI[2];
+            B=(double *)malloc((size_t)max(sizeI[1]+2*hks, 3)*CHUNK*sizeof(double));
         }
-        for(i=0; i<(lengthH-1); i++) { nCache[i]=nCache[i+1]; } nCache[lengthH-1]=line;
-    }
-    for(z2=z; z2<hks; z2++) {
-        for(i=0; i<(lengthH-1); i++) { nCache[i]=nCache[i+1]; } nCache[lengthH-1]=line;
-    }
-    for(z=hks; z<(sizeI[2]-1); z++) {
-        Islice=&I[index];
-        Cslice=&SCache[line*nslice];
-        imfilter2D_double(Islice, sizeI, H, lengthH, Cslice);
-        offset=(z-hks)*nslice; offset2=nCache[0]*nslice;
-        for(j=0; j<nslice; j++) { J[offset+j]=SCache[offset2+j]*H[0]; }
-        for(i=1; i<lengthH; i++) {
-            offset2=nCache[i]*nslice;
-            for(j=0; j<nslice; j++) { J[offset+j]+=SCache[offset2+j]*H[i]; }
+        else {
+            nchunks=(int)((nslice+CHUNK-1)/CHUNK);
+            nitems=(size_t)nchunks;
+            B=(double *)malloc((size_t)max(sizeI[2]+2*hks, 3)*CHUNK*sizeof(double));
         }
-        index+=nslice;
-        line++; if(line>(lengthH-1)) { line=0; }
-        for(i=0; i<(lengthH-1); i++) { nCache[i]=nCache[i+1]; } nCache[lengthH-1]=line;
-    }
-    for(z=max(sizeI[2]-1,hks); z<sizeI[2]; z++) {
-        Islice=&I[index];
-        Cslice=&SCache[line*nslice];
-        imfilter2D_double(Islice, sizeI, H, lengthH, Cslice);
-        offset=(z-hks)*nslice; offset2=nCache[0]*nslice;
-        for(j=0; j<nslice; j++) { J[offset+j]=SCache[offset2+j]*H[0]; }
-        for(i=1; i<lengthH; i++) {
-            offset2=nCache[i]*nslice;
-            for(j=0; j<nslice; j++) { J[offset+j]+=SCache[offset2+j]*H[i]; }
+        item_start=(nitems*Args->ThreadID)/Args->Nthreads;
+        item_end=(nitems*(Args->ThreadID+1))/Args->Nthreads;
+        for(item=item_start; item<item_end; item++) {
+            if(Args->pass==1) {
+                s=(int)(item/nchunks); x0=(int)(item%nchunks)*CHUNK;
+                width=min(CHUNK, sizeI[0]-x0);
+                if(Args->recursive) {
+                    iir_axis_double(&J[s*nslice+x0], sizeI[1], sizeI[0], width, H, B);
+                }
+                else {
+                    imfilter_axis_double(&J[s*nslice+x0], sizeI[1], sizeI[0], width, H, lengthH, B);
+                }
+            }
+            else {
+                x0=(int)item*CHUNK;
+                width=(int)min(CHUNK, nslice-x0);
+                if(Args->recursive) {
+                    iir_axis_double(&J[x0], sizeI[2], nslice, width, H, B);
+                }
+                else {
+                    imfilter_axis_double(&J[x0], sizeI[2], nslice, width, H, lengthH, B);
+                }
+            }
         }
-        index+=nslice;
-        for(i=0; i<(lengthH-1); i++) { nCache[i]=nCache[i+1]; } nCache[lengthH-1]=line;
-    }
-    for(z=max(sizeI[2],hks); z<(sizeI[2]+hks); z++) {
-        offset=(z-hks)*nslice; offset2=nCache[0]*nslice;
-        for(j=0; j<nslice; j++) { J[offset+j]=SCache[offset2+j]*H[0]; }
-        for(i=1; i<lengthH; i++) {
-            offset2=nCache[i]*nslice;
-            for(j=0; j<nslice; j++) { J[offset+j]+=SCache[offset2+j]*H[i]; }
+        free(B);
+    }
+
+    /*  explicit end thread, helps to ensure proper recovery of resources allocated for the thread */
+    #ifdef _WIN32
+	_endthreadex( 0 );
+    return 0;
+	#else
+	pthread_exit(NULL);
+	#endif
+}
+
+void imfilter_passes_double(double *I, int *sizeI, double *H, int lengthH, double *J, int npasses, int recursive, int Nthreads) {
+    /* Run the x, y and (if npasses==3) z filter passes, each one split over Nthreads threads.
+       If recursive is set, H contains the recursive filter coefficients instead of the kernel */
+    int i, pass;
+    FilterArgs *ThreadArgs;
+	/* Handles to the worker threads */
+	#ifdef _WIN32
+		HANDLE *ThreadList; 
+    #else
+		pthread_t *ThreadList;
+	#endif
+    
+	#ifdef _WIN32
+		ThreadList = (HANDLE*)malloc(Nthreads* sizeof( HANDLE ));
+    #else
+		ThreadList = (pthread_t*)malloc(Nthreads* sizeof( pthread_t ));
+	#endif
+    ThreadArgs = (FilterArgs *)malloc(Nthreads* sizeof( FilterArgs ));
+    
+    for(pass=0; pass<npasses; pass++) {
+        for (i=0; i<Nthreads; i++) {
+            ThreadArgs[i].I=I; ThreadArgs[i].J=J; ThreadArgs[i].H=H;
+            ThreadArgs[i].lengthH=lengthH;
+            ThreadArgs[i].sizeI=sizeI;
+            ThreadArgs[i].pass=pass;
+            ThreadArgs[i].recursive=recursive;
+            ThreadArgs[i].ThreadID=i; ThreadArgs[i].Nthreads=Nthreads;
+            #ifdef _WIN32
+                ThreadList[i] = (HANDLE)_beginthreadex( NULL, 0, &imfilter_thread_double, &ThreadArgs[i] , 0, NULL );
+            #else
+                pthread_create ((pthread_t*)&ThreadList[i], NULL, (void *) &imfilter_thread_double, &ThreadArgs[i]);
+            #endif
         }
-        index+=nslice;
-        for(i=0; i<(lengthH-1); i++) { nCache[i]=nCache[i+1]; } nCache[lengthH-1]=line;
+        #ifdef _WIN32
+            for (i=0; i<Nthreads; i++) { WaitForSingleObject(ThreadList[i], INFINITE); }
+            for (i=0; i<Nthreads; i++) { CloseHandle( ThreadList[i] ); }
+        #else
+            for (i=0; i<Nthreads; i++) { pthread_join(ThreadList[i],NULL); }
+        #endif
     }
+    
+    free(ThreadArgs);
+    free(ThreadList);
+}
+
+void imfilter2D_double(double *I, int * sizeI, double *H, int lengthH, double *J, int Nthreads) {
+    int sizeI3[3];
+    sizeI3[0]=sizeI[0]; sizeI3[1]=sizeI[1]; sizeI3[2]=1;
+    imfilter_passes_double(I, sizeI3, H, lengthH, J, 2, 0, Nthreads);
+}
+
+void imfilter3D_double(double *I, int * sizeI, double *H, int lengthH, double *J, int Nthreads) {
+    imfilter_passes_double(I, sizeI, H, lengthH, J, 3, 0, Nthreads);
+}
 
-    free(SCache);
+void imfilter_row_float(float *I, int lengthI, float *H, int lengthH, float *J, float *B) {
+    /* Filter one row, the row is copied into the buffer B (length lengthI+lengthH-1) with 
+       replicated borders, so that the convolution needs no bounds checks */
+    int x, hks;
+    hks=(lengthH-1)/2;
+    for(x=0; x<hks; x++) { B[x]=I[0]; B[lengthI+hks+x]=I[lengthI-1]; }
+    memcpy(&B[hks], I, lengthI*sizeof(float));
+    convolve_folded_float(B, 1, J, lengthI, H, lengthH);
 }
 
 void imfilter1D_float(float *I, int lengthI, float *H, int lengthH, float *J) {
-    int x, i, index, offset;
-    int b2, offset2;
-    if(lengthI==1)  
-    { 
-        J[0]=I[0];
+    float *B;
+    B=(float *)malloc((lengthI+lengthH-1)*sizeof(float));
+    imfilter_row_float(I, lengthI, H, lengthH, J, B);
+    free(B);
+}
+
+void imfilter_axis_float(float *J, int lengthI, size_t stride, int width, float *H, int lengthH, float *B) {
+    /* Filter "width" neighbouring lines along an axis with the given stride, in place.
+       The lines are first copied into the buffer B with replicated borders, so that
+       the convolution below runs over contiguous memory without bounds checks */
+    int k, ks, hks;
+    hks=(lengthH-1)/2;
+    for(k=-hks; k<(lengthI+hks); k++) {
+        ks=clamp(k, 0, lengthI-1);
+        memcpy(&B[(size_t)(k+hks)*width], &J[(size_t)ks*stride], width*sizeof(float));
+    }
+    for(k=0; k<lengthI; k++) {
+        convolve_folded_float(&B[(size_t)k*width], width, &J[(size_t)k*stride], width, H, lengthH);
     }
-    else
-    {
-        offset=(lengthH-1)/2;
-        for(x=0; x<min(offset,lengthI); x++) {
-            J[x]=0;
-            b2=lengthI-1; offset2=x-offset;
-            for(i=0; i<lengthH; i++) {
-                index=clamp(i+offset2, 0, b2); J[x]+=I[index]*H[i];
+}
+
+void iir_row_float(float *I, int lengthI, float *C, float *J) {
+    /* Recursive gaussian filtering of one row, the causal pass goes from I into J
+       and the anti-causal pass is done in place. C contains the filter coefficients */
+    int n;
+    float b, a1, a2, a3, *M;
+    float w1, w2, w3, u0, u1, u2, xe;
+    b=C[0]; a1=C[1]; a2=C[2]; a3=C[3]; M=&C[4];
+    xe=I[lengthI-1];
+    /* Causal pass, the values before the row are the steady state of the first pixel */
+    w1=I[0]; w2=I[0]; w3=I[0];
+    for(n=0; n<lengthI; n++) {
+        J[n]=b*I[n]+a1*w1+a2*w2+a3*w3;
+        w3=w2; w2=w1; w1=J[n];
+    }
+    /* Triggs and Sdika initialisation of the anti-causal pass for a replicated border */
+    u0=w1-xe; u1=w2-xe; u2=w3-xe;
+    w1=xe+b*(M[0]*u0+M[1]*u1+M[2]*u2);
+    w2=xe+b*(M[3]*u0+M[4]*u1+M[5]*u2);
+    w3=xe+b*(M[6]*u0+M[7]*u1+M[8]*u2);
+    J[lengthI-1]=w1;
+    for(n=lengthI-2; n>=0; n--) {
+        u0=b*J[n]+a1*w1+a2*w2+a3*w3;
+        J[n]=u0; w3=w2; w2=w1; w1=u0;
+    }
+}
+
+void iir_axis_float(float *J, int lengthI, size_t stride, int width, float *C, float *B) {
+    /* Recursive gaussian filtering of "width" neighbouring lines along an axis with the 
+       given stride, in place. The lines are processed together so that the inner loops 
+       run over contiguous memory. B is a buffer of 3*width values */
+    int n, c;
+    float b, a1, a2, a3, *M, u0, u1, u2;
+    float *J0, *J1, *J2, *J3, *Xe, *Y1, *Y2;
+    b=C[0]; a1=C[1]; a2=C[2]; a3=C[3]; M=&C[4];
+    Xe=B; Y1=&B[width]; Y2=&B[2*width];
+    memcpy(Xe, &J[(size_t)(lengthI-1)*stride], width*sizeof(float));
+    /* Causal pass, the first line is its own steady state, so the values before it
+       are taken from the first line */
+    for(n=1; n<lengthI; n++) {
+        J0=&J[(size_t)n*stride];
+        J1=&J[(size_t)(n-1)*stride];
+        J2=&J[(size_t)max(n-2,0)*stride];
+        J3=&J[(size_t)max(n-3,0)*stride];
+        for(c=0; c<width; c++) { J0[c]=b*J0[c]+a1*J1[c]+a2*J2[c]+a3*J3[c]; }
+    }
+    /* Triggs and Sdika initialisation of the anti-causal pass for a replicated border */
+    J0=&J[(size_t)(lengthI-1)*stride];
+    J1=&J[(size_t)max(lengthI-2,0)*stride];
+    J2=&J[(size_t)max(lengthI-3,0)*stride];
+    for(c=0; c<width; c++) {
+        u0=J0[c]-Xe[c]; u1=J1[c]-Xe[c]; u2=J2[c]-Xe[c];
+        Y1[c]=Xe[c]+b*(M[3]*u0+M[4]*u1+M[5]*u2);
+        Y2[c]=Xe[c]+b*(M[6]*u0+M[7]*u1+M[8]*u2);
+        J0[c]=Xe[c]+b*(M[0]*u0+M[1]*u1+M[2]*u2);
+    }
+    /* Anti-causal pass, Y1 and Y2 are the lines after the last line */
+    for(n=lengthI-2; n>=0; n--) {
+        J0=&J[(size_t)n*stride];
+        J1=&J[(size_t)(n+1)*stride];
+        J2=((n+2)<lengthI) ? &J[(size_t)(n+2)*stride] : Y1;
+        J3=((n+3)<lengthI) ? &J[(size_t)(n+3)*stride] : (((n+3)==lengthI) ? Y1 : Y2);
+        for(c=0; c<width; c++) { J0[c]=b*J0[c]+a1*J1[c]+a2*J2[c]+a3*J3[c]; }
+    }
+}
+
+#ifdef _WIN32
+  unsigned __stdcall imfilter_thread_float(FilterArgs *Args) {
+#else
+  void imfilter_thread_float(FilterArgs *Args) {
+#endif
+    float *I, *J, *H, *B;
+    int *sizeI, lengthH, hks;
+    size_t nslice, nitems, item, item_start, item_end;
+    int nchunks, s, x0, width;
+    
+    I=(float *)Args->I; J=(float *)Args->J; H=(float *)Args->H;
+    sizeI=Args->sizeI; lengthH=Args->lengthH;
+    hks=(lengthH-1)/2;
+    nslice=(size_t)sizeI[0]*sizeI[1];
+    
+    if(Args->pass==0) {
+        /* x direction, a contiguous block of rows for every thread */
+        nitems=(size_t)sizeI[1]*sizeI[2];
+        item_start=(nitems*Args->ThreadID)/Args->Nthreads;
+        item_end=(nitems*(Args->ThreadID+1))/Args->Nthreads;
+        B=(float *)malloc((sizeI[0]+lengthH-1)*sizeof(float));
+        for(item=item_start; item<item_end; item++) {
+            if(Args->recursive) {
+                iir_row_float(&I[item*sizeI[0]], sizeI[0], H, &J[item*sizeI[0]]);
             }
-        }
-       
-        for(x=offset; x<(lengthI-offset); x++) {
-            J[x]=0;
-            b2=lengthI-1; offset2=x-offset;
-            for(i=0; i<lengthH; i++) {
-                index=i+offset2; J[x]+=I[index]*H[i];
+            else {
+                imfilter_row_float(&I[item*sizeI[0]], sizeI[0], H, lengthH, &J[item*sizeI[0]], B);
             }
         }
-       
-         b2=lengthI-1; 
-         for(x=max(lengthI-offset,offset); x<lengthI; x++) {
-              J[x]=0;
-              offset2=x-offset;
-              for(i=0; i<lengthH; i++) {
-                  index=clamp(i+offset2, 0, b2); J[x]+=I[index]*H[i];
-             }
-         }
-       
-    }
-}
-
-void imfilter2D_float(float *I, int * sizeI, float *H, int lengthH, float *J) {
-    int y, x, i, y2;
-    float *Irow, *Crow;
-    int index=0, line=0;
-    float *RCache;
-    int *nCache;
-    int hks, offset, offset2;
-    RCache=(float *)malloc(lengthH*sizeI[0]*sizeof(float));
-    for(i=0; i<lengthH*sizeI[0]; i++) { RCache[i]=0; }
-    nCache=(int *)malloc(lengthH*sizeof(int));
-    for(i=0; i<lengthH; i++) { nCache[i]=0; }
-    hks=((lengthH-1)/2);
-    for(y=0; y<min(hks,sizeI[1]); y++) {
-        Irow=&I[index];
-        Crow=&RCache[line*sizeI[0]];
-        imfilter1D_float(Irow, sizeI[0], H, lengthH, Crow);
-        index+=sizeI[0];
-        if(y!=(sizeI[1]-1))
-        {
-            line++; if(line>(lengthH-1)) { line=0; }
+        free(B);
+    }
+    else {
+        /* y or z direction, processed as sweeps over contiguous runs of CHUNK pixels */
+        if(Args->pass==1) {
+            nchunks=(sizeI[0]+CHUNK-1)/CHUNK;
+            nitems=(size_t)nchunks*sizeI[2];
+            B=(float *)malloc((size_t)max(sizeI[1]+2*hks, 3)*CHUNK*sizeof(float));
         }
-        for(i=0; i<(lengthH-1); i++) { nCache[i]=nCache[i+1]; } nCache[lengthH-1]=line;
-    }
-    for(y2=y; y2<hks; y2++) {
-        for(i=0; i<(lengthH-1); i++) { nCache[i]=nCache[i+1]; } nCache[lengthH-1]=line;
-    }
-            
-    for(y=hks; y<(sizeI[1]-1); y++) {
-        Irow=&I[index];
-        Crow=&RCache[line*sizeI[0]];
-        imfilter1D_float(Irow, sizeI[0], H, lengthH, Crow);
-        offset=(y-hks)*sizeI[0]; offset2=nCache[0]*sizeI[0];
-        for(x=0; x<sizeI[0]; x++) { J[offset+x]=RCache[offset2+x]*H[0]; }
-        for(i=1; i<lengthH; i++) {
-            offset2=nCache[i]*sizeI[0];
-            for(x=0; x<sizeI[0]; x++) { J[offset+x]+=RCache[offset2+x]*H[i]; }
+        else {
+            nchunks=(int)((nslice+CHUNK-1)/CHUNK);
+            nitems=(size_t)nchunks;
+            B=(float *)malloc((size_t)max(sizeI[2]+2*hks, 3)*CHUNK*sizeof(float));
         }
-        index+=sizeI[0];
-        line++; if(line>(lengthH-1)) { line=0; }
-        for(i=0; i<(lengthH-1); i++) { nCache[i]=nCache[i+1]; } nCache[lengthH-1]=line;
-    }
-
-    for(y=max(sizeI[1]-1,hks); y<sizeI[1]; y++) {
-        Irow=&I[index];
-        Crow=&RCache[line*sizeI[0]];
-        imfilter1D_float(Irow, sizeI[0], H, lengthH, Crow);
-        offset=(y-hks)*sizeI[0]; offset2=nCache[0]*sizeI[0];
-        for(x=0; x<sizeI[0]; x++) { J[offset+x]=RCache[offset2+x]*H[0]; }
-        for(i=1; i<lengthH; i++) {
-            offset2=nCache[i]*sizeI[0];
-            for(x=0; x<sizeI[0]; x++) { J[offset+x]+=RCache[offset2+x]*H[i]; }
+        item_start=(nitems*Args->ThreadID)/Args->Nthreads;
+        item_end=(nitems*(Args->ThreadID+1))/Args->Nthreads;
+        for(item=item_start; item<item_end; item++) {
+            if(Args->pass==1) {
+                s=(int)(item/nchunks); x0=(int)(item%nchunks)*CHUNK;
+                width=min(CHUNK, sizeI[0]-x0);
+                if(Args->recursive) {
+                    iir_axis_float(&J[s*nslice+x0], sizeI[1], sizeI[0], width, H, B);
+                }
+                else {
+                    imfilter_axis_float(&J[s*nslice+x0], sizeI[1], sizeI[0], width, H, lengthH, B);
+                }
+            }
+            else {
+                x0=(int)item*CHUNK;
+                width=(int)min(CHUNK, nslice-x0);
+                if(Args->recursive) {
+                    iir_axis_float(&J[x0], sizeI[2], nslice, width, H, B);
+                }
+                else {
+                    imfilter_axis_float(&J[x0], sizeI[2], nslice, width, H, lengthH, B);
+                }
+            }
         }
-        index+=sizeI[0];
-        for(i=0; i<(lengthH-1); i++) { nCache[i]=nCache[i+1]; } nCache[lengthH-1]=line;
+        free(B);
     }
 
-    for(y=max(sizeI[1],hks); y<(sizeI[1]+hks); y++) {
-        offset=(y-hks)*sizeI[0]; offset2=nCache[0]*sizeI[0];
-        for(x=0; x<sizeI[0]; x++) { J[offset+x]=RCache[offset2+x]*H[0]; }
-        for(i=1; i<lengthH; i++) {
-            offset2=nCache[i]*sizeI[0];
-            for(x=0; x<sizeI[0]; x++) { J[offset+x]+=RCache[offset2+x]*H[i]; }
-        }
-        index+=sizeI[0];
-        for(i=0; i<(lengthH-1); i++) { nCache[i]=nCache[i+1]; } nCache[lengthH-1]=line;
-    }
-
-    free(RCache);
-}
-
-void imfilter3D_float(float *I, int * sizeI, float *H, int lengthH, float *J) {
-    int z, j, i, z2;
-    float *Islice, *Cslice;
-    int index=0, line=0;
-    float *SCache;
-    int *nCache;
-    int hks, offset, offset2;
-    int nslice;
-    nslice=sizeI[0]*sizeI[1];
-    SCache=(float *)malloc(lengthH*nslice*sizeof(float));
-	for(i=0; i<nslice; i++) { SCache[i]=0; }
-    nCache=(int *)malloc(lengthH*sizeof(int));
-    for(i=0; i<lengthH; i++) { nCache[i]=0; }
-    hks=((lengthH-1)/2);
-    for(z=0; z<min(hks,sizeI[2]); z++) {
-        Islice=&I[index];
-        Cslice=&SCache[line*nslice];
-        imfilter2D_float(Islice, sizeI, H, lengthH, Cslice);
-        index+=nslice;
-        if(z!=(sizeI[2]-1))
-        {
-            line++; if(line>(lengthH-1)) { line=0; }
-        }
-        for(i=0; i<(lengthH-1); i++) { nCache[i]=nCache[i+1]; } nCache[lengthH-1]=line;
-    }
-    for(z2=z; z2<hks; z2++) {
-        for(i=0; i<(lengthH-1); i++) { nCache[i]=nCache[i+1]; } nCache[lengthH-1]=line;
-    }
-    for(z=hks; z<(sizeI[2]-1); z++) {
-        Islice=&I[index];
-        Cslice=&SCache[line*nslice];
-        imfilter2D_float(Islice, sizeI, H, lengthH, Cslice);
-        offset=(z-hks)*nslice; offset2=nCache[0]*nslice;
-        for(j=0; j<nslice; j++) { J[offset+j]=SCache[offset2+j]*H[0]; }
-        for(i=1; i<lengthH; i++) {
-            offset2=nCache[i]*nslice;
-            for(j=0; j<nslice; j++) { J[offset+j]+=SCache[offset2+j]*H[i]; }
-        }
-        index+=nslice;
-        line++; if(line>(lengthH-1)) { line=0; }
-        for(i=0; i<(lengthH-1); i++) { nCache[i]=nCache[i+1]; } nCache[lengthH-1]=line;
-    }
-    for(z=max(sizeI[2]-1,hks); z<sizeI[2]; z++) {
-        Islice=&I[index];
-        Cslice=&SCache[line*nslice];
-        imfilter2D_float(Islice, sizeI, H, lengthH, Cslice);
-        offset=(z-hks)*nslice; offset2=nCache[0]*nslice;
-        for(j=0; j<nslice; j++) { J[offset+j]=SCache[offset2+j]*H[0]; }
-        for(i=1; i<lengthH; i++) {
-            offset2=nCache[i]*nslice;
-            for(j=0; j<nslice; j++) { J[offset+j]+=SCache[offset2+j]*H[i]; }
-        }
-        index+=nslice;
-        for(i=0; i<(lengthH-1); i++) { nCache[i]=nCache[i+1]; } nCache[lengthH-1]=line;
-    }
-    for(z=max(sizeI[2],hks); z<(sizeI[2]+hks); z++) {
-        offset=(z-hks)*nslice; offset2=nCache[0]*nslice;
-        for(j=0; j<nslice; j++) { J[offset+j]=SCache[offset2+j]*H[0]; }
-        for(i=1; i<lengthH; i++) {
-            offset2=nCache[i]*nslice;
-            for(j=0; j<nslice; j++) { J[offset+j]+=SCache[offset2+j]*H[i]; }
+    /*  explicit end thread, helps to ensure proper recovery of resources allocated for the thread */
+    #ifdef _WIN32
+	_endthreadex( 0 );
+    return 0;
+	#else
+	pthread_exit(NULL);
+	#endif
+}
+
+void imfilter_passes_float(float *I, int *sizeI, float *H, int lengthH, float *J, int npasses, int recursive, int Nthreads) {
+    /* Run the x, y and (if npasses==3) z filter passes, each one split over Nthreads threads.
+       If recursive is set, H contains the recursive filter coefficients instead of the kernel */
+    int i, pass;
+    FilterArgs *ThreadArgs;
+	/* Handles to the worker threads */
+	#ifdef _WIN32
+		HANDLE *ThreadList; 
+    #else
+		pthread_t *ThreadList;
+	#endif
+    
+	#ifdef _WIN32
+		ThreadList = (HANDLE*)malloc(Nthreads* sizeof( HANDLE ));
+    #else
+		ThreadList = (pthread_t*)malloc(Nthreads* sizeof( pthread_t ));
+	#endif
+    ThreadArgs = (FilterArgs *)malloc(Nthreads* sizeof( FilterArgs ));
+    
+    for(pass=0; pass<npasses; pass++) {
+        for (i=0; i<Nthreads; i++) {
+            ThreadArgs[i].I=I; ThreadArgs[i].J=J; ThreadArgs[i].H=H;
+            ThreadArgs[i].lengthH=lengthH;
+            ThreadArgs[i].sizeI=sizeI;
+            ThreadArgs[i].pass=pass;
+            ThreadArgs[i].recursive=recursive;
+            ThreadArgs[i].ThreadID=i; ThreadArgs[i].Nthreads=Nthreads;
+            #ifdef _WIN32
+                ThreadList[i] = (HANDLE)_beginthreadex( NULL, 0, &imfilter_thread_float, &ThreadArgs[i] , 0, NULL );
+            #else
+                pthread_create ((pthread_t*)&ThreadList[i], NULL, (void *) &imfilter_thread_float, &ThreadArgs[i]);
+            #endif
         }
-        index+=nslice;
-        for(i=0; i<(lengthH-1); i++) { nCache[i]=nCache[i+1]; } nCache[lengthH-1]=line;
+        #ifdef _WIN32
+            for (i=0; i<Nthreads; i++) { WaitForSingleObject(ThreadList[i], INFINITE); }
+            for (i=0; i<Nthreads; i++) { CloseHandle( ThreadList[i] ); }
+        #else
+            for (i=0; i<Nthreads; i++) { pthread_join(ThreadList[i],NULL); }
+        #endif
     }
+    
+    free(ThreadArgs);
+    free(ThreadList);
+}
 
-    free(SCache);
+void imfilter2D_float(float *I, int * sizeI, float *H, int lengthH, float *J, int Nthreads) {
+    int sizeI3[3];
+    sizeI3[0]=sizeI[0]; sizeI3[1]=sizeI[1]; sizeI3[2]=1;
+    imfilter_passes_float(I, sizeI3, H, lengthH, J, 2, 0, Nthreads);
 }
 
-void imfilter2Dcolor_double(double *I, int * sizeI, double *H, int lengthH, double *J) {
-	int i, index;
-	for(i=0; i<sizeI[2]; i++)
-	{
-		index=i*(sizeI[0]*sizeI[1]);
-		imfilter2D_double(&I[index], sizeI, H, lengthH, &J[index]);
-	}
+void imfilter3D_float(float *I, int * sizeI, float *H, int lengthH, float *J, int Nthreads) {
+    imfilter_passes_float(I, sizeI, H, lengthH, J, 3, 0, Nthreads);
 }
 
-void imfilter2Dcolor_float(float *I, int * sizeI, float *H, int lengthH, float *J) {
-	int i, index;
-	for(i=0; i<sizeI[2]; i++)
-	{
-		index=i*(sizeI[0]*sizeI[1]);
-		imfilter2D_float(&I[index], sizeI, H, lengthH, &J[index]);
-	}
+void imfilter2Dcolor_double(double *I, int * sizeI, double *H, int lengthH, double *J, int Nthreads) {
+    /* the color channels are filtered as a stack of 2D images, the rows of all channels are shared over the threads */
+    imfilter_passes_double(I, sizeI, H, lengthH, J, 2, 0, Nthreads);
+}
+
+void imfilter2Dcolor_float(float *I, int * sizeI, float *H, int lengthH, float *J, int Nthreads) {
+    /* the color channels are filtered as a stack of 2D images, the rows of all channels are shared over the threads */
+    imfilter_passes_float(I, sizeI, H, lengthH, J, 2, 0, Nthreads);
 }
 
-void GaussianFiltering3D_float(float *I, float *J, int *dimsI, double sigma, double kernel_size)
+void GaussianFiltering3D_float(float *I, float *J, int *dimsI, double sigma, double kernel_size, int Nthreads)
 {
 	int kernel_length,i;
     double x;
@@ -397,12 +611,12 @@ void GaussianFiltering3D_float(float *I, float *J, int *dimsI, double sigma, dou
 	for (i=0; i<kernel_length; i++) { H[i]/=totalH; }
 	
 	/* Do the filtering */
-	imfilter3D_float(I, dimsI, H, kernel_length, J);
+	imfilter3D_float(I, dimsI, H, kernel_length, J, Nthreads);
     /* Clear memory gaussian kernel */
 	free(H);
 }
 
-void GaussianFiltering2Dcolor_float(float *I, float *J, int *dimsI, double sigma, double kernel_size)
+void GaussianFiltering2Dcolor_float(float *I, float *J, int *dimsI, double sigma, double kernel_size, int Nthreads)
 {
 	int kernel_length,i;
     double x;
@@ -417,12 +631,12 @@ void GaussianFiltering2Dcolor_float(float *I, float *J, int *dimsI, double sigma
 	for (i=0; i<kernel_length; i++) { H[i]/=totalH; }
 	
 	/* Do the filtering */
-	imfilter2Dcolor_float(I, dimsI, H, kernel_length, J);
+	imfilter2Dcolor_float(I, dimsI, H, kernel_length, J, Nthreads);
     /* Clear memory gaussian kernel */
 	free(H);
 }
 
-void GaussianFiltering2D_float(float *I, float *J, int *dimsI, double sigma, double kernel_size)
+void GaussianFiltering2D_float(float *I, float *J, int *dimsI, double sigma, double kernel_size, int Nthreads)
 {
 	int kernel_length,i;
     double x;
@@ -437,7 +651,7 @@ void GaussianFiltering2D_float(float *I, float *J, int *dimsI, double sigma, dou
 	for (i=0; i<kernel_length; i++) { H[i]/=totalH; }
 	
 	/* Do the filtering */
-	imfilter2D_float(I, dimsI, H, kernel_length, J);
+	imfilter2D_float(I, dimsI, H, kernel_length, J, Nthreads);
     /* Clear memory gaussian kernel */
 	free(H);
 }
@@ -462,7 +676,7 @@ void GaussianFiltering1D_float(float *I, float *J, int lengthI, double sigma, do
 	free(H);
 }
 
-void GaussianFiltering3D_double(double *I, double *J, int *dimsI, double sigma, double kernel_size)
+void GaussianFiltering3D_double(double *I, double *J, int *dimsI, double sigma, double kernel_size, int Nthreads)
 {
 	int kernel_length,i;
     double x, *H, totalH=0;
@@ -476,12 +690,12 @@ void GaussianFiltering3D_double(double *I, double *J, int *dimsI, double sigma,
 	for (i=0; i<kernel_length; i++) { H[i]/=totalH; }
 	
 	/* Do the filtering */
-	imfilter3D_double(I, dimsI, H, kernel_length, J);
+	imfilter3D_double(I, dimsI, H, kernel_length, J, Nthreads);
     /* Clear memory gaussian kernel */
 	free(H);
 }
 
-void GaussianFiltering2Dcolor_double(double *I, double *J, int *dimsI, double sigma, double kernel_size)
+void GaussianFiltering2Dcolor_double(double *I, double *J, int *dimsI, double sigma, double kernel_size, int Nthreads)
 {
 	int kernel_length,i;
     double x, *H, totalH=0;
@@ -495,12 +709,12 @@ void GaussianFiltering2Dcolor_double(double *I, double *J, int *dimsI, double si
 	for (i=0; i<kernel_length; i++) { H[i]/=totalH; }
 	
 	/* Do the filtering */
-	imfilter2Dcolor_double(I, dimsI, H, kernel_length, J);
+	imfilter2Dcolor_double(I, dimsI, H, kernel_length, J, Nthreads);
     /* Clear memory gaussian kernel */
 	free(H);
 }
 
-void GaussianFiltering2D_double(double *I, double *J, int *dimsI, double sigma, double kernel_size)
+void GaussianFiltering2D_double(double *I, double *J, int *dimsI, double sigma, double kernel_size, int Nthreads)
 {
 	int kernel_length,i;
     double x, *H, totalH=0;
@@ -514,7 +728,7 @@ void GaussianFiltering2D_double(double *I, double *J, int *dimsI, double sigma,
 	for (i=0; i<kernel_length; i++) { H[i]/=totalH; }
 	
 	/* Do the filtering */
-	imfilter2D_double(I, dimsI, H, kernel_length, J);
+	imfilter2D_double(I, dimsI, H, kernel_length, J, Nthreads);
     /* Clear memory gaussian kernel */
 	free(H);
 }
@@ -538,6 +752,75 @@ void GaussianFiltering1D_double(double *I, double *J, int lengthI, double sigma,
 	free(H);
 }
             		
+/*
+ Recursive gaussian filter coefficients, Young and van Vliet "Recursive implementation 
+ of the Gaussian filter" (1995), with the boundary matrix of Triggs and Sdika "Boundary 
+ conditions for Young - van Vliet recursive filtering" (2006) for replicated borders.
+ C[0]: B, C[1..3]: a1..a3, C[4..12]: 3x3 boundary matrix M (row major)
+*/
+void RecursiveGaussianCoefficients(double sigma, double *C)
+{
+    double q, b0, b1, b2, b3, a1, a2, a3, scaleM;
+    if(sigma>=2.5) { q=0.98711*sigma-0.96330; }
+    else { q=3.97156-4.14554*sqrt(1-0.26891*sigma); }
+    b0=1.57825+2.44413*q+1.4281*q*q+0.422205*q*q*q;
+    b1=2.44413*q+2.85619*q*q+1.26661*q*q*q;
+    b2=-(1.4281*q*q+1.26661*q*q*q);
+    b3=0.422205*q*q*q;
+    a1=b1/b0; a2=b2/b0; a3=b3/b0;
+    C[0]=1-(a1+a2+a3); C[1]=a1; C[2]=a2; C[3]=a3;
+    scaleM=1/((1+a1-a2+a3)*(1-a1-a2-a3)*(1+a2+(a1-a3)*a3));
+    C[4]=scaleM*(-a3*a1+1-a3*a3-a2);
+    C[5]=scaleM*(a3+a1)*(a2+a3*a1);
+    C[6]=scaleM*a3*(a1+a3*a2);
+    C[7]=scaleM*(a1+a3*a2);
+    C[8]=-scaleM*(a2-1)*(a2+a3*a1);
+    C[9]=-scaleM*a3*(a3*a1+a3*a3+a2-1);
+    C[10]=scaleM*(a3*a1+a2+a1*a1-a2*a2);
+    C[11]=scaleM*(a1*a2+a3*a2*a2-a1*a3*a3-a3*a3*a3-a3*a2+a3);
+    C[12]=scaleM*a3*(a1+a3*a2);
+}
+
+void RecursiveGaussianFiltering_float(float *I, float *J, int ndimsI, int *dimsI, double sigma, int Nthreads)
+{
+    double Cd[13];
+    float C[13];
+    int i, sizeI3[3];
+    
+    RecursiveGaussianCoefficients(sigma, Cd);
+    for (i=0; i<13; i++) { C[i]=(float)Cd[i]; }
+    if(ndimsI==1) {
+        iir_row_float(I, dimsI[0], C, J);
+    }
+    else if(ndimsI==2) {
+        sizeI3[0]=dimsI[0]; sizeI3[1]=dimsI[1]; sizeI3[2]=1;
+        imfilter_passes_float(I, sizeI3, C, 13, J, 2, 1, Nthreads);
+    }
+    else {
+        /* Color image (less than 4 slices) or 3D volume */
+        imfilter_passes_float(I, dimsI, C, 13, J, (dimsI[2]<4) ? 2 : 3, 1, Nthreads);
+    }
+}
+
+void RecursiveGaussianFiltering_double(double *I, double *J, int ndimsI, int *dimsI, double sigma, int Nthreads)
+{
+    double C[13];
+    int sizeI3[3];
+    
+    RecursiveGaussianCoefficients(sigma, C);
+    if(ndimsI==1) {
+        iir_row_double(I, dimsI[0], C, J);
+    }
+    else if(ndimsI==2) {
+        sizeI3[0]=dimsI[0]; sizeI3[1]=dimsI[1]; sizeI3[2]=1;
+        imfilter_passes_double(I, sizeI3, C, 13, J, 2, 1, Nthreads);
+    }
+    else {
+        /* Color image (less than 4 slices) or 3D volume */
+        imfilter_passes_double(I, dimsI, C, 13, J, (dimsI[2]<4) ? 2 : 3, 1, Nthreads);
+    }
+}
+
 void mexFunction( int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[] ) {
     float *I_float, *J_float;
     double *I_double, *J_double;
@@ -550,9 +833,15 @@ void mexFunction( int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[] ) {
     double *SIGMA_double, sigma;
     const mwSize *dimsI_const;
     int dimsI[3];
+    /* Number of threads, from feature('Numcores') */
+    mxArray *matlabCallOut[1]={0};
+    mxArray *matlabCallIn[1]={0};
+    int Nthreads;
+    /* Filter mode, 0: gaussian kernel, 1: recursive */
+    int mode;
     
     /* Check number of inputs */
-    if(nrhs<2) { mexErrMsgTxt("2 input variables are required, 3 optional."); }
+    if(nrhs<2) { mexErrMsgTxt("2 input variables are required, 2 optional."); }
     
     /* Check input image dimensions */
     ndimsI=mxGetNumberOfDimensions(prhs[0]);
@@ -614,7 +903,7 @@ void mexFunction( int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[] ) {
         }
     }
     
-    if(nrhs==2) {
+    if((nrhs==2)||mxIsEmpty(prhs[2])) {
         kernel_size=sigma*6;
     }
     else {
@@ -631,23 +920,51 @@ void mexFunction( int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[] ) {
         }
     }
     
+    /* Get the filter mode, the recursive filter is defined for sigma>=0.5 */
+    mode=0;
+    if(nrhs>3) {
+        if(!mxIsNumeric(prhs[3])||mxIsEmpty(prhs[3])) { mexErrMsgTxt("Mode must be 0 (gaussian kernel) or 1 (recursive)"); }
+        mode=(int)mxGetScalar(prhs[3]);
+        if((mode!=0)&&(mode!=1)) { mexErrMsgTxt("Mode must be 0 (gaussian kernel) or 1 (recursive)"); }
+    }
+    if(sigma<0.5) { mode=0; }
     
-    if(mxIsSingle(prhs[0])) {
+    /* Get the number of threads used for 2D and 3D filtering */
+    Nthreads=1;
+    if(ndimsI>1) {
+        matlabCallIn[0]=mxCreateString("Numcores");
+        mexCallMATLAB(1, matlabCallOut, 1, matlabCallIn, "feature");
+        Nthreads=(int)mxGetScalar(matlabCallOut[0]);
+        if(Nthreads<1) { Nthreads=1; }
+        mxDestroyArray(matlabCallIn[0]);
+        mxDestroyArray(matlabCallOut[0]);
+    }
+    
+    if(mode==1) {
+        /* Do the recursive gaussian filtering */
+        if(mxIsSingle(prhs[0])) {
+            RecursiveGaussianFiltering_float(I_float, J_float, ndimsI, dimsI, sigma, Nthreads);
+        }
+        else {
+            RecursiveGaussianFiltering_double(I_double, J_double, ndimsI, dimsI, sigma, Nthreads);
+        }
+    }
+    else if(mxIsSingle(prhs[0])) {
 		/* Do the gaussian filtering */
         if(ndimsI==1) {
 			GaussianFiltering1D_float(I_float, J_float, dimsI[0], sigma, kernel_size);
 		}
         else if(ndimsI==2) {
-			GaussianFiltering2D_float(I_float, J_float, dimsI, sigma, kernel_size);
+			GaussianFiltering2D_float(I_float, J_float, dimsI, sigma, kernel_size, Nthreads);
 	    }
         else {
 			if(dimsI[2]<4) /* Color image */
 			{
-				GaussianFiltering2Dcolor_float(I_float, J_float, dimsI, sigma, kernel_size);
+				GaussianFiltering2Dcolor_float(I_float, J_float, dimsI, sigma, kernel_size, Nthreads);
 			}
             else
 			{
-				GaussianFiltering3D_float(I_float, J_float, dimsI, sigma, kernel_size);
+				GaussianFiltering3D_float(I_float, J_float, dimsI, sigma, kernel_size, Nthreads);
 			}
         }
     }
@@ -657,16 +974,16 @@ void mexFunction( int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[] ) {
 			GaussianFiltering1D_double(I_double, J_double, dimsI[0], sigma, kernel_size);
 		}
         else if(ndimsI==2) {
-			GaussianFiltering2D_double(I_double, J_double, dimsI, sigma, kernel_size);
+			GaussianFiltering2D_double(I_double, J_double, dimsI, sigma, kernel_size, Nthreads);
 	    }
         else {
 			if(dimsI[2]<4) /* Color image */
 			{
-				GaussianFiltering2Dcolor_double(I_double, J_double, dimsI, sigma, kernel_size);
+				GaussianFiltering2Dcolor_double(I_double, J_double, dimsI, sigma, kernel_size, Nthreads);
 			}
             else
 			{
-				GaussianFiltering3D_double(I_double, J_double, dimsI, sigma, kernel_size);
+				GaussianFiltering3D_double(I_double, J_double, dimsI, sigma, kernel_size, Nthreads);
 			}
         }
 	}
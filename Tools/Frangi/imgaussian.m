@@ -1,17 +1,21 @@
-function I=imgaussian(I,sigma,siz)
+function I=imgaussian(I,sigma,siz,mode)
 % IMGAUSSIAN filters an 1D, 2D color/greyscale or 3D image with an 
 % Gaussian filter. This function uses for filtering IMFILTER or if 
 % compiled the fast  mex code imgaussian.c . Instead of using a 
 % multidimensional gaussian kernel, it uses the fact that a Gaussian 
 % filter can be separated in 1D gaussian kernels.
 %
-% J=IMGAUSSIAN(I,SIGMA,SIZE)
+% J=IMGAUSSIAN(I,SIGMA,SIZE,MODE)
 %
 % inputs,
 %   I: The 1D, 2D greyscale/color, or 3D input image with 
 %           data type Single or Double
 %   SIGMA: The sigma used for the Gaussian kernel
-%   SIZE: Kernel size (single value) (default: sigma*6)
+%   SIZE: Kernel size (single value) (default: sigma*6, also used when empty)
+%   MODE: (optional, mex only) 0: filter with the gaussian kernel (default),
+%         1: recursive Young - van Vliet gaussian filter; the cost per pixel
+%         does not depend on sigma, use it for large sigmas (sigma >= 0.5,
+%         SIZE is ignored)
 % 
 % outputs,
 %   J: The gaussian filtered image
@@ -24,7 +28,7 @@ function I=imgaussian(I,sigma,siz)
 % 
 % Function is written by D.Kroon University of Twente (September 2009)
 
-if(~exist('siz','var')), siz=sigma*6; end
+if(~exist('siz','var') || isempty(siz)), siz=sigma*6; end
 
 if(sigma>0)
     % Make 1D Gaussian kernel
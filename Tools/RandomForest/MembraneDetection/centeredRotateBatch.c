@@ -0,0 +1,212 @@
+#include "mex.h"
+#include "math.h"
+
+/*   undef needed for LCC compiler  */
+#undef EXTERN_C
+#ifdef _WIN32
+  #include <windows.h>
+  #include <process.h>
+#else
+  #include <pthread.h>
+#endif
+
+/*
+ * rot = centeredRotateBatch(im, angles, bilinear)
+ *
+ * Rotate the 2D image im around its center with every angle of angles, the
+ * batched version of centeredRotate. With bilinear=0 (default) the pixels
+ * are the same as
+ *
+ *    rot(:,:,k) = centeredRotate(im, angles(k))
+ *
+ * except for pixels whose rotated corner lands exactly on a pixel border,
+ * there the truncation depends on the round-off of the transformation
+ * matrix of centeredRotate. These are the rotation center of even-sized
+ * images at most angles, the diagonals through the center at angles of
+ * 45+k*90 degrees and all pixels at angles of k*90 degrees. The pixel is
+ * taken at the truncated rotated coordinate of its corner and pixels that
+ * are rotated from outside of the image are zero. With bilinear=1 the rotated pixel centers are sampled
+ * with bilinear interpolation, outside of the image is zero, so the angle
+ * 0 gives the image itself.
+ *
+ * inputs,
+ *   im : 2D image of class single or double
+ *   angles : vector with the rotation angles in rad
+ *   bilinear : [optional] 0 - nearest pixel as centeredRotate, 1 - bilinear
+ * outputs,
+ *   rot : [rows x cols x numel(angles)] single, the rotated images
+ *
+ * The rotated coordinate is the rotated first pixel of the column plus r
+ * times the direction of the column, instead of the 3x3 perspective
+ * transformation of transformImageFast for every pixel, and the angles are
+ * divided over feature('Numcores') threads.
+ */
+
+typedef struct {
+    double *im;
+    double *angles;
+    float *rot;
+    int nangles;
+    int rows;
+    int cols;
+    int bilinear;
+    int ThreadID;
+    int Nthreads;
+} RotateArgs;
+
+/* Pixel (r,c) of the image, zero outside of the image */
+static __inline double pixel_black(double *im, int rows, int cols, int r, int c) {
+    if((r<0)||(c<0)||(r>=rows)||(c>=cols)) { return 0; }
+    return im[r+c*rows];
+}
+
+/* Rotate the image with the angles ThreadID, ThreadID+Nthreads, ... */
+#ifdef _WIN32
+  unsigned __stdcall rotate_angles(RotateArgs *Args) {
+#else
+  void rotate_angles(RotateArgs *Args) {
+#endif
+    int rows=Args->rows, cols=Args->cols, k, r, c, r0, c0;
+    double ca, sa, cy=rows/2.0, cx=cols/2.0, y0, x0, y, x, fy, fx, ty, tx;
+    double *im=Args->im;
+    float *out;
+
+    for(k=Args->ThreadID; k<Args->nangles; k+=Args->Nthreads) {
+        ca=cos(Args->angles[k]);
+        sa=sin(Args->angles[k]);
+        out=Args->rot+(size_t)k*rows*cols;
+        for(c=0; c<cols; c++) {
+            if(!Args->bilinear) {
+                /* Rotated corner of the first pixel of the column, pixel r
+                 * is r*(ca, sa) further, not accumulated, so that the
+                 * round-off does not grow along the column */
+                y0=cy-ca*cy-sa*(c-cx);
+                x0=cx-sa*cy+ca*(c-cx);
+                for(r=0; r<rows; r++) {
+                    y=y0+r*ca; x=x0+r*sa;
+                    if((y>=0)&&(x>=0)&&(y<rows)&&(x<cols)) { out[r+c*rows]=(float)im[(int)y+(int)x*rows]; }
+                }
+                continue;
+            }
+            /* Rotated center of the first pixel of the column, relative to
+             * the pixel centers */
+            y0=cy+ca*(0.5-cy)-sa*(c+0.5-cx)-0.5;
+            x0=cx+sa*(0.5-cy)+ca*(c+0.5-cx)-0.5;
+            for(r=0; r<rows; r++) {
+                y=y0+r*ca; x=x0+r*sa;
+                fy=floor(y); fx=floor(x);
+                ty=y-fy; tx=x-fx;
+                r0=(int)fy; c0=(int)fx;
+                if((r0<-1)||(c0<-1)||(r0>=rows)||(c0>=cols)) { continue; }
+                if((r0>=0)&&(c0>=0)&&(r0+1<rows)&&(c0+1<cols)) {
+                    double *p=im+r0+c0*rows;
+                    out[r+c*rows]=(float)((1-tx)*((1-ty)*p[0]+ty*p[1])+tx*((1-ty)*p[rows]+ty*p[rows+1]));
+                }
+                else {
+                    out[r+c*rows]=(float)((1-tx)*((1-ty)*pixel_black(im, rows, cols, r0, c0)+ty*pixel_black(im, rows, cols, r0+1, c0))
+                                          +tx*((1-ty)*pixel_black(im, rows, cols, r0, c0+1)+ty*pixel_black(im, rows, cols, r0+1, c0+1)));
+                }
+            }
+        }
+    }
+
+    /*  explicit end thread, helps to ensure proper recovery of resources allocated for the thread */
+    #ifdef _WIN32
+    _endthreadex( 0 );
+    return 0;
+    #else
+    pthread_exit(NULL);
+    #endif
+}
+
+/* The gateway routine */
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+    double *im, *angles;
+    int rows, cols, nangles, i, Nthreads, bilinear=0;
+    mwSize dims[3];
+    RotateArgs *ThreadArgs;
+    mxArray *matlabCallOut[1]={0};
+    mxArray *matlabCallIn[1]={0};
+    #ifdef _WIN32
+        HANDLE *ThreadList;
+    #else
+        pthread_t *ThreadList;
+    #endif
+
+    if ((nrhs < 2) || (nrhs > 3))
+        mexErrMsgTxt("Two or three inputs required (image, angles, bilinear).");
+    if (nlhs != 1)
+        mexErrMsgTxt("One output required.");
+    if ((mxGetClassID(prhs[0])!=mxSINGLE_CLASS)&&(mxGetClassID(prhs[0])!=mxDOUBLE_CLASS))
+        mexErrMsgTxt("Image must be of class single or double.");
+    if (mxGetNumberOfDimensions(prhs[0])!=2)
+        mexErrMsgTxt("Image must be 2D.");
+    if (mxGetClassID(prhs[1])!=mxDOUBLE_CLASS)
+        mexErrMsgTxt("Angles must be of class double.");
+    if (nrhs == 3) { bilinear=(mxGetScalar(prhs[2])!=0); }
+
+    rows=mxGetM(prhs[0]);
+    cols=mxGetN(prhs[0]);
+    nangles=mxGetNumberOfElements(prhs[1]);
+    angles=mxGetPr(prhs[1]);
+
+    dims[0]=rows; dims[1]=cols; dims[2]=nangles;
+    plhs[0]=mxCreateNumericArray(3, dims, mxSINGLE_CLASS, mxREAL);
+    if((rows==0)||(cols==0)||(nangles==0)) { return; }
+
+    /* The image in double, as centeredRotate */
+    im=(double*)malloc(rows*cols*sizeof(double));
+    if(mxGetClassID(prhs[0])==mxSINGLE_CLASS) {
+        float *imf=(float*)mxGetData(prhs[0]);
+        for(i=0; i<rows*cols; i++) { im[i]=(double)imf[i]; }
+    }
+    else {
+        double *imd=mxGetPr(prhs[0]);
+        for(i=0; i<rows*cols; i++) { im[i]=imd[i]; }
+    }
+
+    /* Number of threads */
+    matlabCallIn[0]=mxCreateString("Numcores");
+    mexCallMATLAB(1, matlabCallOut, 1, matlabCallIn, "feature");
+    Nthreads=(int)mxGetScalar(matlabCallOut[0]);
+    mxDestroyArray(matlabCallIn[0]);
+    mxDestroyArray(matlabCallOut[0]);
+    if(Nthreads>nangles) { Nthreads=nangles; }
+    if(Nthreads<1) { Nthreads=1; }
+
+    #ifdef _WIN32
+        ThreadList = (HANDLE*)malloc(Nthreads* sizeof( HANDLE ));
+    #else
+        ThreadList = (pthread_t*)malloc(Nthreads* sizeof( pthread_t ));
+    #endif
+    ThreadArgs = (RotateArgs*)malloc(Nthreads* sizeof(RotateArgs));
+
+    for (i=0; i<Nthreads; i++) {
+        ThreadArgs[i].im=im;
+        ThreadArgs[i].angles=angles;
+        ThreadArgs[i].rot=(float*)mxGetData(plhs[0]);
+        ThreadArgs[i].nangles=nangles;
+        ThreadArgs[i].rows=rows;
+        ThreadArgs[i].cols=cols;
+        ThreadArgs[i].bilinear=bilinear;
+        ThreadArgs[i].ThreadID=i;
+        ThreadArgs[i].Nthreads=Nthreads;
+        #ifdef _WIN32
+            ThreadList[i] = (HANDLE)_beginthreadex( NULL, 0, &rotate_angles, &ThreadArgs[i] , 0, NULL );
+        #else
+            pthread_create ((pthread_t*)&ThreadList[i], NULL, (void *) &rotate_angles, &ThreadArgs[i]);
+        #endif
+    }
+
+    #ifdef _WIN32
+        for (i=0; i<Nthreads; i++) { WaitForSingleObject(ThreadList[i], INFINITE); }
+        for (i=0; i<Nthreads; i++) { CloseHandle( ThreadList[i] ); }
+    #else
+        for (i=0; i<Nthreads; i++) { pthread_join(ThreadList[i],NULL); }
+    #endif
+
+    free(ThreadArgs);
+    free(ThreadList);
+    free(im);
+}
@@ -1,5 +1,5 @@
-function rot = filterImageWithMembraneTemplateRotated(im, d, noRotations, cpuParallelLimit)
-% function rot = filterImageWithMembraneTemplateRotated(im, d, noRotations)
+function [rot, rotMax, rotAngle] = filterImageWithMembraneTemplateRotated(im, d, noRotations, cpuParallelLimit)
+% function [rot, rotMax, rotAngle] = filterImageWithMembraneTemplateRotated(im, d, noRotations, cpuParallelLimit)
 % filter image with a rotated template 
 %
 % Paramters:
@@ -10,8 +10,12 @@ function rot = filterImageWithMembraneTemplateRotated(im, d, noRotations, cpuPar
 %
 % Return values: 
 % rot: a matrix with filtered results [size(im,1) size(im,2) noRotations]
+% rotMax: [optional] maximal response over the rotations [size(im,1) size(im,2)]
+% rotAngle: [optional] rotation angle of the maximal response, in rad
 %
 % normxcorr2 was updated in R2014a, should be faster
+% when normxcorr2bank is compiled all rotations are correlated in one call,
+% with the FFT of the image calculated only once
 
 % original function is written by Verena Kaynig, vkaynig [at] seas.harvard.edu
 % modified: Ilya Belevich, ilya.belevich @ helsinki.fi
@@ -23,7 +27,21 @@ a = pi / noRotations;   % calculate rotation angle
 im = double(im);    % convert image to doubles
 rot = zeros([size(im,1), size(im,2), noRotations], 'single');   % memory allocation
 
-parfor (i=1:noRotations, cpuParallelLimit)
-    dt = centeredRotate(d, (i-1)*a);  % rotate template
-    rot(:,:,i) = single(normxcorr2_mex(double(dt), im, 'same'));
+if exist('centeredRotateBatch', 'file') == 3
+    % rotate the template with all angles in one call
+    dts = centeredRotateBatch(double(d), (0:noRotations-1)*a);
+else
+    dts = zeros([size(d,1), size(d,2), noRotations], 'single');
+    for i=1:noRotations
+        dts(:,:,i) = centeredRotate(d, (i-1)*a);  % rotate template
+    end
 end
+if exist('normxcorr2bank', 'file') == 3
+    [rotMax, rotArg, rot] = normxcorr2bank(im, dts);
+else
+    parfor (i=1:noRotations, cpuParallelLimit)
+        rot(:,:,i) = single(normxcorr2_mex(double(dts(:,:,i)), im, 'same'));
+    end
+    if nargout > 1; [rotMax, rotArg] = max(rot, [], 3); end
+end
+if nargout > 2; rotAngle = (double(rotArg)-1)*a; end
@@ -37,9 +37,10 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
   var = mxGetPr(plhs[1]);
   hist = mxGetPr(plhs[2]);
 
-  for(i=0; i<rows; ++i){
-    for(j=0; j<cols; ++j){
-      value = *(list + i*rows + j);
+  /* column-major order, the same order as before for square input */
+  for(j=0; j<cols; ++j){
+    for(i=0; i<rows; ++i){
+      value = *(list + j*rows + i);
       *mean += value;
       *var += value * value;	
       ival = (int) (value/10.0);
@@ -0,0 +1,232 @@
+#include "mex.h"
+#include "math.h"
+
+/*   undef needed for LCC compiler  */
+#undef EXTERN_C
+#ifdef _WIN32
+  #include <windows.h>
+  #include <process.h>
+#else
+  #include <pthread.h>
+#endif
+
+/*
+ * [M, V, H] = meanvarimage(im, windowSize)
+ *
+ * Sliding window version of meanvar, for every pixel of the 2D image im
+ * the window of windowSize x windowSize pixels around it is normalized
+ * to 0..100 as norm01(window)*100, and the mean (M), variance (V) and
+ * 10 bin histogram (H) of the normalized window are returned, the same
+ * values as
+ *
+ *    [m,v,h] = meanvar(norm01(im(r-s:r+s, c-s:c+s))*100), s = floor(windowSize/2)
+ *
+ * inputs,
+ *   im : 2D image of class single or double
+ *   windowSize : size of the window, windowSize=2*s+1 is used
+ * outputs,
+ *   M, V : [rows x cols] single, mean and variance
+ *   H : [rows x cols x 10] single, histogram
+ *   Pixels for which the window does not fit in the image are zero
+ *
+ * The minimum and maximum of all windows are calculated with running
+ * (van Herk / Gil-Werman) min and max filters in O(1) per pixel. The bins
+ * of the histogram depend on the minimum and maximum of every window,
+ * so the window itself is still visited once per pixel, the image
+ * columns are divided over feature('Numcores') threads.
+ */
+
+#define NBINS 10
+
+typedef struct {
+    double *im;
+    double *wmin;
+    double *wmax;
+    float *M;
+    float *V;
+    float *H;
+    int rows;
+    int cols;
+    int s;
+    int ThreadID;
+    int Nthreads;
+} WindowArgs;
+
+/* Running minimum (ismax=0) or maximum (ismax=1) over windows of length w of
+ * a 1D signal with stride, out[i] is the min/max of in[i-s..i+s] for
+ * s<=i<n-s. g and h are buffers of length n */
+void running_extreme(double *in, int n, int stride, int w, double *out, double *g, double *h, int ismax) {
+    int i, s=w/2;
+    double v;
+    for(i=0; i<n; i++) {
+        v=in[i*stride];
+        if((i%w==0)||(ismax ? (v>g[i-1]) : (v<g[i-1]))) { g[i]=v; } else { g[i]=g[i-1]; }
+    }
+    for(i=n-1; i>=0; i--) {
+        v=in[i*stride];
+        if((i==n-1)||((i+1)%w==0)||(ismax ? (v>h[i+1]) : (v<h[i+1]))) { h[i]=v; } else { h[i]=h[i+1]; }
+    }
+    for(i=s; i<n-s; i++) {
+        if(ismax) { out[i*stride]=(h[i-s]>g[i+s]) ? h[i-s] : g[i+s]; }
+        else { out[i*stride]=(h[i-s]<g[i+s]) ? h[i-s] : g[i+s]; }
+    }
+}
+
+/* Statistics of the windows of a range of columns */
+#ifdef _WIN32
+  unsigned __stdcall window_stats(WindowArgs *Args) {
+#else
+  void window_stats(WindowArgs *Args) {
+#endif
+    int rows=Args->rows, cols=Args->cols, s=Args->s, w=2*s+1;
+    int r, c, i, j, ival, c0, c1;
+    double mn, m, value, sum, sum2, n=(double)w*w;
+    double hist[NBINS];
+    double *col;
+    int npix=rows*cols;
+
+    c0=s+((cols-2*s)*Args->ThreadID)/Args->Nthreads;
+    c1=s+((cols-2*s)*(Args->ThreadID+1))/Args->Nthreads;
+    for(c=c0; c<c1; c++) {
+        for(r=s; r<rows-s; r++) {
+            mn=Args->wmin[r+c*rows];
+            m=Args->wmax[r+c*rows]-mn;
+            sum=0; sum2=0;
+            for(i=0; i<NBINS; i++) { hist[i]=0; }
+            /* column-major order, the same order as meanvar */
+            for(j=c-s; j<=c+s; j++) {
+                col=Args->im+j*rows;
+                for(i=r-s; i<=r+s; i++) {
+                    if(m!=0) { value=((col[i]-mn)/m)*100; } else { value=(col[i]-mn)*100; }
+                    sum+=value;
+                    sum2+=value*value;
+                    ival=(int)(value/10.0);
+                    hist[(ival<NBINS) ? ival : NBINS-1]+=1;
+                }
+            }
+            Args->M[r+c*rows]=(float)(sum/n);
+            Args->V[r+c*rows]=(float)((sum2-sum*sum/n)/(n-1));
+            for(i=0; i<NBINS; i++) { Args->H[r+c*rows+i*npix]=(float)hist[i]; }
+        }
+    }
+
+    /*  explicit end thread, helps to ensure proper recovery of resources allocated for the thread */
+    #ifdef _WIN32
+    _endthreadex( 0 );
+    return 0;
+    #else
+    pthread_exit(NULL);
+    #endif
+}
+
+/* The gateway routine */
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+    double *im, *vmin, *vmax, *wmin, *wmax, *g, *h;
+    int rows, cols, s, w, i, r, c, Nthreads;
+    mwSize dims[3];
+    WindowArgs *ThreadArgs;
+    mxArray *matlabCallOut[1]={0};
+    mxArray *matlabCallIn[1]={0};
+    #ifdef _WIN32
+        HANDLE *ThreadList;
+    #else
+        pthread_t *ThreadList;
+    #endif
+
+    if (nrhs != 2)
+        mexErrMsgTxt("Two inputs required (image, windowSize).");
+    if (nlhs != 3)
+        mexErrMsgTxt("Three outputs required (mean, var, hist).");
+    if ((mxGetClassID(prhs[0])!=mxSINGLE_CLASS)&&(mxGetClassID(prhs[0])!=mxDOUBLE_CLASS))
+        mexErrMsgTxt("Image must be of class single or double.");
+    if (mxGetNumberOfDimensions(prhs[0])!=2)
+        mexErrMsgTxt("Image must be 2D.");
+
+    rows=mxGetM(prhs[0]);
+    cols=mxGetN(prhs[0]);
+    s=(int)mxGetScalar(prhs[1])/2;
+    w=2*s+1;
+
+    dims[0]=rows; dims[1]=cols; dims[2]=NBINS;
+    plhs[0]=mxCreateNumericArray(2, dims, mxSINGLE_CLASS, mxREAL);
+    plhs[1]=mxCreateNumericArray(2, dims, mxSINGLE_CLASS, mxREAL);
+    plhs[2]=mxCreateNumericArray(3, dims, mxSINGLE_CLASS, mxREAL);
+    if((rows<w)||(cols<w)) { return; }
+
+    /* The image in double, as norm01 */
+    im=(double*)malloc(rows*cols*sizeof(double));
+    if(mxGetClassID(prhs[0])==mxSINGLE_CLASS) {
+        float *imf=(float*)mxGetData(prhs[0]);
+        for(i=0; i<rows*cols; i++) { im[i]=(double)imf[i]; }
+    }
+    else {
+        double *imd=mxGetPr(prhs[0]);
+        for(i=0; i<rows*cols; i++) { im[i]=imd[i]; }
+    }
+
+    /* Window minimum and maximum, first along the columns then the rows */
+    vmin=(double*)malloc(rows*cols*sizeof(double));
+    vmax=(double*)malloc(rows*cols*sizeof(double));
+    wmin=(double*)malloc(rows*cols*sizeof(double));
+    wmax=(double*)malloc(rows*cols*sizeof(double));
+    g=(double*)malloc(((rows>cols) ? rows : cols)*sizeof(double));
+    h=(double*)malloc(((rows>cols) ? rows : cols)*sizeof(double));
+    for(c=0; c<cols; c++) {
+        running_extreme(im+c*rows, rows, 1, w, vmin+c*rows, g, h, 0);
+        running_extreme(im+c*rows, rows, 1, w, vmax+c*rows, g, h, 1);
+    }
+    for(r=s; r<rows-s; r++) {
+        running_extreme(vmin+r, cols, rows, w, wmin+r, g, h, 0);
+        running_extreme(vmax+r, cols, rows, w, wmax+r, g, h, 1);
+    }
+    free(vmin); free(vmax); free(g); free(h);
+
+    /* Number of threads */
+    matlabCallIn[0]=mxCreateString("Numcores");
+    mexCallMATLAB(1, matlabCallOut, 1, matlabCallIn, "feature");
+    Nthreads=(int)mxGetScalar(matlabCallOut[0]);
+    mxDestroyArray(matlabCallIn[0]);
+    mxDestroyArray(matlabCallOut[0]);
+    if(Nthreads>cols-2*s) { Nthreads=cols-2*s; }
+    if(Nthreads<1) { Nthreads=1; }
+
+    #ifdef _WIN32
+        ThreadList = (HANDLE*)malloc(Nthreads* sizeof( HANDLE ));
+    #else
+        ThreadList = (pthread_t*)malloc(Nthreads* sizeof( pthread_t ));
+    #endif
+    ThreadArgs = (WindowArgs*)malloc(Nthreads* sizeof(WindowArgs));
+
+    for (i=0; i<Nthreads; i++) {
+        ThreadArgs[i].im=im;
+        ThreadArgs[i].wmin=wmin;
+        ThreadArgs[i].wmax=wmax;
+        ThreadArgs[i].M=(float*)mxGetData(plhs[0]);
+        ThreadArgs[i].V=(float*)mxGetData(plhs[1]);
+        ThreadArgs[i].H=(float*)mxGetData(plhs[2]);
+        ThreadArgs[i].rows=rows;
+        ThreadArgs[i].cols=cols;
+        ThreadArgs[i].s=s;
+        ThreadArgs[i].ThreadID=i;
+        ThreadArgs[i].Nthreads=Nthreads;
+        #ifdef _WIN32
+            ThreadList[i] = (HANDLE)_beginthreadex( NULL, 0, &window_stats, &ThreadArgs[i] , 0, NULL );
+        #else
+            pthread_create ((pthread_t*)&ThreadList[i], NULL, (void *) &window_stats, &ThreadArgs[i]);
+        #endif
+    }
+
+    #ifdef _WIN32
+        for (i=0; i<Nthreads; i++) { WaitForSingleObject(ThreadList[i], INFINITE); }
+        for (i=0; i<Nthreads; i++) { CloseHandle( ThreadList[i] ); }
+    #else
+        for (i=0; i<Nthreads; i++) { pthread_join(ThreadList[i],NULL); }
+    #endif
+
+    free(ThreadArgs);
+    free(ThreadList);
+    free(im);
+    free(wmin);
+    free(wmax);
+}
@@ -21,7 +21,7 @@ fm(:,:,1) = im;
 
 im = adapthisteq(im);
 
-rot = filterImageWithMembraneTemplateRotated(im, d, cpuParallelLimit);
+rot = filterImageWithMembraneTemplateRotated(im, d, 8, cpuParallelLimit);
 im = single(im);
 
 fm(:,:,2) = rot(:,:,1);
@@ -42,18 +42,33 @@ fm(:,:,10) = squeeze(median(rot));
 clear rot;
 
 % disp('histogram');
-csHalf = floor(csHist/2);
-for i=1:length(im(:))
-    [r,c] = ind2sub(size(im),i);
-    if r < cs | c < cs | r > size(im,1)-cs | c > size(im,2)-cs % skip points at the border
-        continue;
-    else
-        sub = im(r-csHalf:r+csHalf, c-csHalf:c+csHalf); % get fragment of the image
-        sub = norm01(sub) * 100;
-        [m,v,h] = meanvar(sub);     % get mean value (m), var and histogram
-        fm(r,c,17:26) = h;
-        fm(r,c,27) = m;
-        fm(r,c,28) = v;
+if exist('meanvarimage', 'file') == 3
+    % mean, var and histogram of norm01(sub)*100 for the csHist x csHist
+    % window around every pixel, as meanvar, calculated in one call
+    [m,v,h] = meanvarimage(im, csHist);
+    border = true(size(im,1), size(im,2));
+    border(cs:size(im,1)-cs, cs:size(im,2)-cs) = false;  % skip points at the border
+    h(repmat(border, [1 1 10])) = 0;
+    m(border) = 0;
+    v(border) = 0;
+    fm(:,:,17:26) = h;
+    fm(:,:,27) = m;
+    fm(:,:,28) = v;
+    clear m v h border;
+else
+    csHalf = floor(csHist/2);
+    for i=1:length(im(:))
+        [r,c] = ind2sub(size(im),i);
+        if r < cs | c < cs | r > size(im,1)-cs | c > size(im,2)-cs % skip points at the border
+            continue;
+        else
+            sub = im(r-csHalf:r+csHalf, c-csHalf:c+csHalf); % get fragment of the image
+            sub = norm01(sub) * 100;
+            [m,v,h] = meanvar(sub);     % get mean value (m), var and histogram
+            fm(r,c,17:26) = h;
+            fm(r,c,27) = m;
+            fm(r,c,28) = v;
+        end
     end
 end
 
@@ -0,0 +1,504 @@
+#include "mex.h"
+#include "math.h"
+#include <string.h>
+
+/*   undef needed for LCC compiler  */
+#undef EXTERN_C
+#ifdef _WIN32
+  #include <windows.h>
+  #include <process.h>
+#else
+  #include <pthread.h>
+#endif
+
+/*
+ * [Rmax, Rarg, R] = normxcorr2bank(im, templates)
+ *
+ * Normalized cross-correlation of the 2D image im with a bank of templates,
+ * for example a template rotated with centeredRotateBatch. Every slice of
+ * R is the same as
+ *
+ *    R(:,:,k) = normxcorr2_mex(templates(:,:,k), im, 'same')
+ *
+ * and Rmax and Rarg are the maximum response and the template index of the
+ * maximum for every pixel.
+ *
+ * inputs,
+ *   im : 2D image of class single or double
+ *   templates : [m x n x K] stack of templates of class single or double
+ * outputs,
+ *   Rmax : [rows x cols] single, maximum of R over the templates
+ *   Rarg : [rows x cols] double, index (1..K) of the maximum
+ *   R : [optional] [rows x cols x K] single, the correlation with every
+ *       template
+ *
+ * The FFT of the zero padded image is calculated once. The templates are
+ * taken in pairs, one as the real and one as the imaginary part of a
+ * complex image, so one forward and one inverse FFT give the correlation
+ * with two templates. The FFT is a compact mixed radix (2, 3, 4, 5) FFT in
+ * this file, the image is padded to a size with only these factors. The
+ * local sums of the image for the normalization are taken from integral
+ * images, and the pairs of templates are divided over feature('Numcores')
+ * threads.
+ */
+
+/* Rows of the matrix that are transformed together */
+#define ROWBLOCK 16
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+typedef struct {
+    double r;
+    double i;
+} cpx;
+
+/* The plan of a 1D FFT of length n */
+typedef struct {
+    int n;
+    int factors[64];
+    cpx *tw;
+} FFTPlan;
+
+typedef struct {
+    const cpx *F;
+    const FFTPlan *planP;
+    const FFTPlan *planQ;
+    const double *templates;
+    const double *denomA;
+    float *R;
+    double maxDenomA;
+    int P;
+    int Q;
+    int rows;
+    int cols;
+    int m;
+    int n;
+    int K;
+    int ThreadID;
+    int Nthreads;
+} BankArgs;
+
+/* Factors of n, 4 first, then 2, 3, 5 and larger, as (p, n/p/...) pairs */
+static void fft_plan(FFTPlan *plan, int n) {
+    int k, p=4, m=n, nf=0;
+    double phase;
+    plan->n=n;
+    plan->tw=(cpx*)malloc(n*sizeof(cpx));
+    for(k=0; k<n; k++) {
+        phase=-2*M_PI*k/n;
+        plan->tw[k].r=cos(phase);
+        plan->tw[k].i=sin(phase);
+    }
+    while(m>1) {
+        while(m%p) {
+            switch(p) {
+                case 4: p=2; break;
+                case 2: p=3; break;
+                default: p+=2; break;
+            }
+            if(p*p>m) { p=m; }
+        }
+        m/=p;
+        plan->factors[nf++]=p;
+        plan->factors[nf++]=m;
+    }
+}
+
+static void bfly2(cpx *Fout, size_t fstride, const FFTPlan *plan, int m) {
+    int u;
+    cpx t, *Fout2=Fout+m;
+    const cpx *tw;
+    for(u=0; u<m; u++) {
+        tw=plan->tw+u*fstride;
+        t.r=Fout2[u].r*tw->r-Fout2[u].i*tw->i;
+        t.i=Fout2[u].r*tw->i+Fout2[u].i*tw->r;
+        Fout2[u].r=Fout[u].r-t.r; Fout2[u].i=Fout[u].i-t.i;
+        Fout[u].r+=t.r; Fout[u].i+=t.i;
+    }
+}
+
+static void bfly4(cpx *Fout, size_t fstride, const FFTPlan *plan, int m) {
+    int k;
+    cpx s[6], a;
+    const cpx *tw1, *tw2, *tw3;
+    for(k=0; k<m; k++) {
+        tw1=plan->tw+k*fstride; tw2=plan->tw+2*k*fstride; tw3=plan->tw+3*k*fstride;
+        a=Fout[k+m];   s[0].r=a.r*tw1->r-a.i*tw1->i; s[0].i=a.r*tw1->i+a.i*tw1->r;
+        a=Fout[k+2*m]; s[1].r=a.r*tw2->r-a.i*tw2->i; s[1].i=a.r*tw2->i+a.i*tw2->r;
+        a=Fout[k+3*m]; s[2].r=a.r*tw3->r-a.i*tw3->i; s[2].i=a.r*tw3->i+a.i*tw3->r;
+        s[5].r=Fout[k].r-s[1].r; s[5].i=Fout[k].i-s[1].i;
+        Fout[k].r+=s[1].r; Fout[k].i+=s[1].i;
+        s[3].r=s[0].r+s[2].r; s[3].i=s[0].i+s[2].i;
+        s[4].r=s[0].r-s[2].r; s[4].i=s[0].i-s[2].i;
+        Fout[k+2*m].r=Fout[k].r-s[3].r; Fout[k+2*m].i=Fout[k].i-s[3].i;
+        Fout[k].r+=s[3].r; Fout[k].i+=s[3].i;
+        Fout[k+m].r=s[5].r+s[4].i; Fout[k+m].i=s[5].i-s[4].r;
+        Fout[k+3*m].r=s[5].r-s[4].i; Fout[k+3*m].i=s[5].i+s[4].r;
+    }
+}
+
+static void bfly_generic(cpx *Fout, size_t fstride, const FFTPlan *plan, int m, int p) {
+    int u, k, q1, q;
+    size_t twidx;
+    cpx scratch[64], t;
+    for(u=0; u<m; u++) {
+        for(q1=0, k=u; q1<p; q1++, k+=m) { scratch[q1]=Fout[k]; }
+        for(q1=0, k=u; q1<p; q1++, k+=m) {
+            twidx=0;
+            Fout[k]=scratch[0];
+            for(q=1; q<p; q++) {
+                twidx+=fstride*k;
+                if(twidx>=(size_t)plan->n) { twidx-=plan->n; }
+                t.r=scratch[q].r*plan->tw[twidx].r-scratch[q].i*plan->tw[twidx].i;
+                t.i=scratch[q].r*plan->tw[twidx].i+scratch[q].i*plan->tw[twidx].r;
+                Fout[k].r+=t.r; Fout[k].i+=t.i;
+            }
+        }
+    }
+}
+
+/* Decimation in time, the input f with stride fstride*in_stride */
+static void fft_work(cpx *Fout, const cpx *f, size_t fstride, int in_stride, const int *factors, const FFTPlan *plan) {
+    cpx *Fout_beg=Fout;
+    int p=*factors++, m=*factors++;
+    const cpx *Fout_end=Fout+p*m;
+    if(m==1) {
+        do { *Fout=*f; f+=fstride*in_stride; } while(++Fout!=Fout_end);
+    }
+    else {
+        do { fft_work(Fout, f, fstride*p, in_stride, factors, plan); f+=fstride*in_stride; } while((Fout+=m)!=Fout_end);
+    }
+    Fout=Fout_beg;
+    switch(p) {
+        case 2: bfly2(Fout, fstride, plan, m); break;
+        case 4: bfly4(Fout, fstride, plan, m); break;
+        default: bfly_generic(Fout, fstride, plan, m, p); break;
+    }
+}
+
+/* Forward FFT of the P x Q matrix Z in place, buf has (ROWBLOCK+1)*max(P,Q)
+ * elements; only the columns with nonzero[c]!=0 (all when NULL) are
+ * transformed in the first pass and only the first nrows rows in the second
+ * pass, the rows are copied in blocks of ROWBLOCK rows to read Z along its
+ * columns */
+static void fft2(cpx *Z, int P, int Q, const FFTPlan *planP, const FFTPlan *planQ, cpx *buf, const char *nonzero, int nrows) {
+    int r, r0, nr, c;
+    cpx *out=buf+(size_t)ROWBLOCK*((P>Q) ? P : Q);
+    if(P>1) {
+        for(c=0; c<Q; c++) {
+            if((nonzero!=NULL)&&(!nonzero[c])) { continue; }
+            fft_work(out, Z+(size_t)c*P, 1, 1, planP->factors, planP);
+            memcpy(Z+(size_t)c*P, out, P*sizeof(cpx));
+        }
+    }
+    if(Q>1) {
+        for(r0=0; r0<nrows; r0+=ROWBLOCK) {
+            nr=(nrows-r0<ROWBLOCK) ? nrows-r0 : ROWBLOCK;
+            for(c=0; c<Q; c++) {
+                for(r=0; r<nr; r++) { buf[c+(size_t)r*Q]=Z[r0+r+(size_t)c*P]; }
+            }
+            for(r=0; r<nr; r++) {
+                fft_work(out, buf+(size_t)r*Q, 1, 1, planQ->factors, planQ);
+                memcpy(buf+(size_t)r*Q, out, Q*sizeof(cpx));
+            }
+            for(c=0; c<Q; c++) {
+                for(r=0; r<nr; r++) { Z[r0+r+(size_t)c*P]=buf[c+(size_t)r*Q]; }
+            }
+        }
+    }
+}
+
+/* Smallest size >= n with only the factors 2, 3 and 5 */
+static int fft_size(int n) {
+    int m;
+    if(n<1) { return 1; }
+    for(;; n++) {
+        m=n;
+        while(m%2==0) { m/=2; }
+        while(m%3==0) { m/=3; }
+        while(m%5==0) { m/=5; }
+        if(m==1) { return n; }
+    }
+}
+
+/* eps(x) as in Matlab */
+static double eps_of(double x) {
+    int e;
+    if(x==0) { return pow(2.0, -1074); }
+    frexp(fabs(x), &e);
+    return ldexp(1.0, e-53);
+}
+
+/* Correlation with the template pairs ThreadID, ThreadID+Nthreads, ... */
+#ifdef _WIN32
+  unsigned __stdcall correlate_pairs(BankArgs *Args) {
+#else
+  void correlate_pairs(BankArgs *Args) {
+#endif
+    int P=Args->P, Q=Args->Q, m=Args->m, n=Args->n, rows=Args->rows, cols=Args->cols;
+    int oy=m-(m+1)/2, ox=n-(n+1)/2, pair, k, t, a, b, r, c;
+    size_t PQ=(size_t)P*Q, mn=(size_t)m*n, idx;
+    cpx *Z, *buf, z;
+    char *nonzero;
+    const double *T;
+    double mean, denomT[2], tol[2], scale=1.0/((double)P*Q), v, d;
+    float *out[2];
+
+    Z=(cpx*)malloc(PQ*sizeof(cpx));
+    buf=(cpx*)malloc((size_t)(ROWBLOCK+1)*((P>Q) ? P : Q)*sizeof(cpx));
+
+    /* The columns of the shifted templates */
+    nonzero=(char*)calloc(Q, sizeof(char));
+    for(b=0; b<n; b++) { nonzero[(ox-b+Q)%Q]=1; }
+
+    for(pair=Args->ThreadID; 2*pair<Args->K; pair+=Args->Nthreads) {
+        /* The zero mean templates, flipped and shifted so the convolution
+         * with the image gives the correlation of the centered template,
+         * template 2*pair in the real and 2*pair+1 in the imaginary part */
+        memset(Z, 0, PQ*sizeof(cpx));
+        for(t=0; t<2; t++) {
+            k=2*pair+t;
+            denomT[t]=0;
+            out[t]=NULL;
+            if(k>=Args->K) { continue; }
+            out[t]=Args->R+(size_t)k*rows*cols;
+            T=Args->templates+k*mn;
+            mean=0;
+            for(idx=0; idx<mn; idx++) { mean+=T[idx]; }
+            mean/=mn;
+            for(b=0; b<n; b++) {
+                for(a=0; a<m; a++) {
+                    v=T[a+b*m]-mean;
+                    denomT[t]+=v*v;
+                    idx=(size_t)((oy-a+P)%P)+(size_t)((ox-b+Q)%Q)*P;
+                    if(t==0) { Z[idx].r=v; } else { Z[idx].i=v; }
+                }
+            }
+            denomT[t]=sqrt(denomT[t]);
+            tol[t]=sqrt(eps_of(denomT[t]*Args->maxDenomA));
+        }
+        fft2(Z, P, Q, Args->planP, Args->planQ, buf, nonzero, P);
+
+        /* Multiply with the image spectrum, the inverse FFT as the
+         * conjugate of the forward FFT of the conjugate */
+        for(idx=0; idx<PQ; idx++) {
+            z=Z[idx];
+            Z[idx].r=z.r*Args->F[idx].r-z.i*Args->F[idx].i;
+            Z[idx].i=-(z.r*Args->F[idx].i+z.i*Args->F[idx].r);
+        }
+        fft2(Z, P, Q, Args->planP, Args->planQ, buf, NULL, rows);
+
+        for(t=0; t<2; t++) {
+            if(out[t]==NULL) { continue; }
+            for(c=0; c<cols; c++) {
+                for(r=0; r<rows; r++) {
+                    idx=(size_t)r+(size_t)c*P;
+                    v=(t==0) ? Z[idx].r*scale : -Z[idx].i*scale;
+                    d=denomT[t]*Args->denomA[r+c*rows];
+                    out[t][r+c*rows]=(d>tol[t]) ? (float)(v/d) : 0;
+                }
+            }
+        }
+    }
+    free(Z);
+    free(buf);
+    free(nonzero);
+
+    /*  explicit end thread, helps to ensure proper recovery of resources allocated for the thread */
+    #ifdef _WIN32
+    _endthreadex( 0 );
+    return 0;
+    #else
+    pthread_exit(NULL);
+    #endif
+}
+
+/* Copy an array of class single or double to double */
+static double *get_double(const mxArray *A) {
+    size_t i, n=mxGetNumberOfElements(A);
+    double *out=(double*)malloc(n*sizeof(double));
+    if(mxGetClassID(A)==mxSINGLE_CLASS) {
+        float *Af=(float*)mxGetData(A);
+        for(i=0; i<n; i++) { out[i]=(double)Af[i]; }
+    }
+    else {
+        double *Ad=mxGetPr(A);
+        for(i=0; i<n; i++) { out[i]=Ad[i]; }
+    }
+    return out;
+}
+
+/* The gateway routine */
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+    double *im, *templates, *S, *S2, *denomA, *Rarg, maxDenomA=0, s, s2;
+    int rows, cols, m, n, K, P, Q, oy, ox, i, r, c, k, r0, r1, c0, c1, Nthreads, npairs;
+    size_t PQ;
+    mwSize dims[3];
+    const mwSize *tdims;
+    cpx *F, *buf;
+    FFTPlan planP, planQ;
+    float *R, *Rmax;
+    mxArray *Rarray;
+    BankArgs *ThreadArgs;
+    mxArray *matlabCallOut[1]={0};
+    mxArray *matlabCallIn[1]={0};
+    #ifdef _WIN32
+        HANDLE *ThreadList;
+    #else
+        pthread_t *ThreadList;
+    #endif
+
+    if (nrhs != 2)
+        mexErrMsgTxt("Two inputs required (image, templates).");
+    if (nlhs < 1)
+        mexErrMsgTxt("At least one output required.");
+    for (i=0; i<2; i++) {
+        if ((mxGetClassID(prhs[i])!=mxSINGLE_CLASS)&&(mxGetClassID(prhs[i])!=mxDOUBLE_CLASS))
+            mexErrMsgTxt("Image and templates must be of class single or double.");
+    }
+    if (mxGetNumberOfDimensions(prhs[0])!=2)
+        mexErrMsgTxt("Image must be 2D.");
+    if (mxGetNumberOfDimensions(prhs[1])>3)
+        mexErrMsgTxt("Templates must be a [m x n x K] stack.");
+
+    rows=mxGetM(prhs[0]);
+    cols=mxGetN(prhs[0]);
+    tdims=mxGetDimensions(prhs[1]);
+    m=(int)tdims[0];
+    n=(int)tdims[1];
+    K=(mxGetNumberOfDimensions(prhs[1])>2) ? (int)tdims[2] : 1;
+
+    dims[0]=rows; dims[1]=cols; dims[2]=K;
+    plhs[0]=mxCreateNumericArray(2, dims, mxSINGLE_CLASS, mxREAL);
+    if (nlhs>1) { plhs[1]=mxCreateNumericArray(2, dims, mxDOUBLE_CLASS, mxREAL); }
+    Rarray=mxCreateNumericArray(3, dims, mxSINGLE_CLASS, mxREAL);
+    if (nlhs>2) { plhs[2]=Rarray; }
+    if ((rows==0)||(cols==0)||(m==0)||(n==0)||(K==0)) {
+        if (nlhs<3) { mxDestroyArray(Rarray); }
+        return;
+    }
+    R=(float*)mxGetData(Rarray);
+
+    im=get_double(prhs[0]);
+    templates=get_double(prhs[1]);
+
+    /* Local sums of the image and the image squared for every position of
+     * the template, from integral images, zero outside of the image as
+     * normxcorr2 */
+    oy=m-(m+1)/2; ox=n-(n+1)/2;
+    S=(double*)calloc((size_t)(rows+1)*(cols+1), sizeof(double));
+    S2=(double*)calloc((size_t)(rows+1)*(cols+1), sizeof(double));
+    for (c=0; c<cols; c++) {
+        s=0; s2=0;
+        for (r=0; r<rows; r++) {
+            s+=im[r+c*rows];
+            s2+=im[r+c*rows]*im[r+c*rows];
+            S[(r+1)+(size_t)(c+1)*(rows+1)]=S[(r+1)+(size_t)c*(rows+1)]+s;
+            S2[(r+1)+(size_t)(c+1)*(rows+1)]=S2[(r+1)+(size_t)c*(rows+1)]+s2;
+        }
+    }
+    denomA=(double*)malloc((size_t)rows*cols*sizeof(double));
+    for (c=0; c<cols; c++) {
+        c0=c-ox; c1=c0+n;
+        if(c0<0) { c0=0; } if(c1>cols) { c1=cols; }
+        for (r=0; r<rows; r++) {
+            r0=r-oy; r1=r0+m;
+            if(r0<0) { r0=0; } if(r1>rows) { r1=rows; }
+            s=S[r1+(size_t)c1*(rows+1)]-S[r0+(size_t)c1*(rows+1)]-S[r1+(size_t)c0*(rows+1)]+S[r0+(size_t)c0*(rows+1)];
+            s2=S2[r1+(size_t)c1*(rows+1)]-S2[r0+(size_t)c1*(rows+1)]-S2[r1+(size_t)c0*(rows+1)]+S2[r0+(size_t)c0*(rows+1)];
+            s2-=s*s/((double)m*n);
+            denomA[r+c*rows]=(s2>0) ? sqrt(s2) : 0;
+            if(denomA[r+c*rows]>maxDenomA) { maxDenomA=denomA[r+c*rows]; }
+        }
+    }
+    free(S); free(S2);
+
+    /* Spectrum of the zero padded image */
+    P=fft_size(rows+m-1);
+    Q=fft_size(cols+n-1);
+    PQ=(size_t)P*Q;
+    fft_plan(&planP, P);
+    fft_plan(&planQ, Q);
+    F=(cpx*)calloc(PQ, sizeof(cpx));
+    buf=(cpx*)malloc((size_t)(ROWBLOCK+1)*((P>Q) ? P : Q)*sizeof(cpx));
+    for (c=0; c<cols; c++) {
+        for (r=0; r<rows; r++) { F[r+(size_t)c*P].r=im[r+c*rows]; }
+    }
+    fft2(F, P, Q, &planP, &planQ, buf, NULL, P);
+    free(buf);
+
+    /* Number of threads */
+    npairs=(K+1)/2;
+    matlabCallIn[0]=mxCreateString("Numcores");
+    mexCallMATLAB(1, matlabCallOut, 1, matlabCallIn, "feature");
+    Nthreads=(int)mxGetScalar(matlabCallOut[0]);
+    mxDestroyArray(matlabCallIn[0]);
+    mxDestroyArray(matlabCallOut[0]);
+    if(Nthreads>npairs) { Nthreads=npairs; }
+    if(Nthreads<1) { Nthreads=1; }
+
+    #ifdef _WIN32
+        ThreadList = (HANDLE*)malloc(Nthreads* sizeof( HANDLE ));
+    #else
+        ThreadList = (pthread_t*)malloc(Nthreads* sizeof( pthread_t ));
+    #endif
+    ThreadArgs = (BankArgs*)malloc(Nthreads* sizeof(BankArgs));
+
+    for (i=0; i<Nthreads; i++) {
+        ThreadArgs[i].F=F;
+        ThreadArgs[i].planP=&planP;
+        ThreadArgs[i].planQ=&planQ;
+        ThreadArgs[i].templates=templates;
+        ThreadArgs[i].denomA=denomA;
+        ThreadArgs[i].R=R;
+        ThreadArgs[i].maxDenomA=maxDenomA;
+        ThreadArgs[i].P=P;
+        ThreadArgs[i].Q=Q;
+        ThreadArgs[i].rows=rows;
+        ThreadArgs[i].cols=cols;
+        ThreadArgs[i].m=m;
+        ThreadArgs[i].n=n;
+        ThreadArgs[i].K=K;
+        ThreadArgs[i].ThreadID=i;
+        ThreadArgs[i].Nthreads=Nthreads;
+        #ifdef _WIN32
+            ThreadList[i] = (HANDLE)_beginthreadex( NULL, 0, &correlate_pairs, &ThreadArgs[i] , 0, NULL );
+        #else
+            pthread_create ((pthread_t*)&ThreadList[i], NULL, (void *) &correlate_pairs, &ThreadArgs[i]);
+        #endif
+    }
+
+    #ifdef _WIN32
+        for (i=0; i<Nthreads; i++) { WaitForSingleObject(ThreadList[i], INFINITE); }
+        for (i=0; i<Nthreads; i++) { CloseHandle( ThreadList[i] ); }
+    #else
+        for (i=0; i<Nthreads; i++) { pthread_join(ThreadList[i],NULL); }
+    #endif
+
+    /* Maximum response and its template */
+    Rmax=(float*)mxGetData(plhs[0]);
+    Rarg=(nlhs>1) ? mxGetPr(plhs[1]) : NULL;
+    for (i=0; i<rows*cols; i++) {
+        Rmax[i]=R[i];
+        if(Rarg!=NULL) { Rarg[i]=1; }
+        for (k=1; k<K; k++) {
+            if(R[i+(size_t)k*rows*cols]>Rmax[i]) {
+                Rmax[i]=R[i+(size_t)k*rows*cols];
+                if(Rarg!=NULL) { Rarg[i]=k+1; }
+            }
+        }
+    }
+
+    free(ThreadArgs);
+    free(ThreadList);
+    free(planP.tw);
+    free(planQ.tw);
+    free(F);
+    free(denomA);
+    free(im);
+    free(templates);
+    if (nlhs<3) { mxDestroyArray(Rarray); }
+}
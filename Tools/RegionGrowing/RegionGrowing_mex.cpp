@@ -6,12 +6,29 @@
 // *** wrapper file 'RegionGrowing.m' for details on its usage.
 // ***
 // *** Compile this file by making the directiory containing this file
-// *** your current Matlab working directory and typing 
+// *** your current Matlab working directory and typing
 // ***
 // *** >> mex RegionGrowing_mex.cpp
 // ***
 // *** in the Matlab console.
 // ***
+// *** The growing state is kept in a cRegionGrower object instead of
+// *** globals, so that the function is reentrant (e.g. in parfor). The
+// *** candidates are kept in a bucket priority queue keyed on the
+// *** quantized intensity difference to the region mean, the visited
+// *** voxels in a bitset, and 32 bit indices are used when the image has
+// *** less than 2^32 voxels.
+// ***
+// *** The image can be double, single, uint8 or uint16 and is read in its
+// *** own class. With the optional output mode 'list' or 'crop' only the
+// *** region is returned, as linear indices or as a mask of its bounding
+// *** box, so no output of the image size is allocated.
+// ***
+// *** The output mode 'labels' grows the regions of many seeds in parallel
+// *** threads and returns a label volume. Every seed grows as if it was
+// *** alone, a voxel which is reached by several regions gets the lowest
+// *** seed number, so the result does not depend on the thread timing.
+// ***
 // *** Copyright 2013 Christian Wuerslin, University of Tuebingen and
 // *** University of Stuttgart, Germany.
 // *** Contact: christian.wuerslin@med.uni-tuebingen.de
@@ -19,19 +36,26 @@
 // ========================================================================
 
 #include "mex.h"
-#include <queue>
+#include <vector>
 #include <cmath>
+#include <cstring>
+
+//   undef needed for LCC compiler
+#undef EXTERN_C
+#ifdef _WIN32
+	#include <windows.h>
+	#include <process.h>
+#else
+	#include <pthread.h>
+#endif
 
 #define UPDATECYCLE3D     50000
 #define UPDATECYCLE2D      1000
-#define NQUEUES             100	// number of FIFO queues
+#define NQUEUES             100	// number of priority buckets
 
 using namespace std;
 
-long             lNZ, lNX, lNY;     // The image dimensions;
-double           dMaxDif, dRegMean;
-double          *pdImg;             // pointer to the image
-queue<long>     *aqQueue;			// vector of FIFO queues
+typedef unsigned int uint32;
 
 // ========================================================================
 // Inline function to determin minimum of two numbers
@@ -53,6 +77,115 @@ inline double ifMax(double a, double b)
 
 
 
+// ========================================================================
+// ***
+// *** CLASS cBucketQueue
+// ***
+// *** Priority queue of NQUEUES FIFO buckets, bucket 0 has the highest
+// *** priority. Every bucket is a vector with a read position, which is
+// *** reset when the bucket runs empty, and the lowest bucket which may
+// *** be non-empty is tracked, so a pop does not scan all buckets.
+// ***
+// ========================================================================
+template <typename T>
+class cBucketQueue {
+public:
+    cBucketQueue() : iLowest(NQUEUES) {
+        for (int iI = 0; iI < NQUEUES; iI++) alHead[iI] = 0;
+    }
+
+    void fClear() {
+        for (int iI = 0; iI < NQUEUES; iI++) {
+            avBucket[iI].clear();
+            alHead[iI] = 0;
+        }
+        iLowest = NQUEUES;
+    }
+
+    void fPush(int iBucket, T lInd) {
+        avBucket[iBucket].push_back(lInd);
+        if (iBucket < iLowest) iLowest = iBucket;
+    }
+
+    // Pops the oldest entry of the highest priority non-empty bucket,
+    // returns false if all buckets are empty
+    bool fPop(T &lInd) {
+        while (iLowest < NQUEUES) {
+            vector<T> &vBucket = avBucket[iLowest];
+            size_t    &lHead   = alHead[iLowest];
+            if (lHead < vBucket.size()) {
+                lInd = vBucket[lHead++];
+                if (lHead == vBucket.size()) {
+                    vBucket.clear();
+                    lHead = 0;
+                }
+                return true;
+            }
+            iLowest++;
+        }
+        return false;
+    }
+
+private:
+    vector<T> avBucket[NQUEUES];
+    size_t    alHead[NQUEUES];
+    int       iLowest;
+};
+// ========================================================================
+// *** END OF CLASS cBucketQueue
+// ========================================================================
+
+
+
+// ========================================================================
+// ***
+// *** CLASS cRegionGrower
+// ***
+// *** The region growing state of one call, T is the voxel index type and
+// *** P the class of the image. With bReuse the visited voxels are kept in
+// *** a list, so that fReset can prepare the grower for the next seed
+// *** without clearing the whole bitset.
+// ***
+// ========================================================================
+template <typename T, typename P>
+class cRegionGrower {
+public:
+    cRegionGrower(const P *pImage, T lSizeY, T lSizeX, T lSizeZ, double dRange, bool bReuse = false)
+        : pdImg(pImage), lNY(lSizeY), lNX(lSizeX), lNZ(lSizeZ), dDynamicRange(dRange), bTrack(bReuse),
+          aiVisited((size_t(lSizeY)*lSizeX*lSizeZ + 31)/32, 0) {}
+
+    void fGrow(T lLinInd, double dMaxDifference, bool *pbMask, vector<T> *pvRegion, mxArray **pParams, bool bDraw, long lUpdateCycle);
+
+    void fReset() {
+        for (size_t lI = 0; lI < vTouched.size(); lI++) aiVisited[size_t(vTouched[lI]) >> 5] = 0;
+        vTouched.clear();
+        cQueue.fClear();
+    }
+
+private:
+    const P            *pdImg;             // pointer to the image
+    T                   lNY, lNX, lNZ;     // The image dimensions
+    double              dDynamicRange;     // max - min of the image
+    double              dMaxDif, dRegMean;
+    bool                bTrack;
+    cBucketQueue<T>     cQueue;            // candidates of the region
+    vector<uint32>      aiVisited;         // bitset of the voxels which were candidates
+    vector<T>           vTouched;          // visited voxels, if bTrack
+
+    bool fIsVisited(T lInd) const { return (aiVisited[size_t(lInd) >> 5] >> (lInd & 31)) & 1; }
+    void fSetVisited(T lInd) {
+        aiVisited[size_t(lInd) >> 5] |= uint32(1) << (lInd & 31);
+        if (bTrack) vTouched.push_back(lInd);
+    }
+    bool fPop(T &lInd);
+    int  fGetNHood(const T lLinInd, T* lNHood) const;
+};
+// ========================================================================
+// *** END OF CLASS cRegionGrower
+// ========================================================================
+
+
+
 // ========================================================================
 // ***
 // *** FUNCTION fPop
@@ -61,25 +194,18 @@ inline double ifMax(double a, double b)
 // *** non-empty queue which fulfills the region growing criterion.
 // ***
 // ========================================================================
-long fPop() {
-	long lInd; // Index of the voxel
-    
+template <typename T, typename P>
+bool cRegionGrower<T, P>::fPop(T &lInd) {
+
     // --------------------------------------------------------------------
-    // Loop over the queues, start with highest priority (0)
-    for (int iQueueInd = 0; iQueueInd < NQUEUES; iQueueInd++) {
-        
-        // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
-        // While there are still entries in the queue, pop and determine
-        // whether it fullfills the region growing criterion.
-        while (!aqQueue[iQueueInd].empty()) {
-            lInd = aqQueue[iQueueInd].front();aqQueue[iQueueInd].pop();
-            if (fabs(dRegMean - pdImg[lInd]) < dMaxDif) return lInd;// Return if valid entry found
-        }
-        // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // While there are still entries in the queue, pop and determine
+    // whether it fullfills the region growing criterion.
+    while (cQueue.fPop(lInd)) {
+        if (fabs(dRegMean - double(pdImg[lInd])) < dMaxDif) return true;// Return if valid entry found
     }
     // --------------------------------------------------------------------
-    
-	return -1; // if all queues are empty
+
+	return false; // if all queues are empty
 }
 // ========================================================================
 // *** END OF FUNCTION fPop
@@ -91,28 +217,29 @@ long fPop() {
 // ***
 // *** FUNCTION fGetNHood
 // ***
-// *** Get the 4-/6-neighbourhood of voxel lLinInd
+// *** Get the 4-/6-neighbourhood of voxel lLinInd, returns its size
 // ***
 // ========================================================================
-void fGetNHood(const long lLinInd, long& lNHoodSize, long* lNHood) {
-	long lX, lY, lZ, lTemp;
-    
-    lNHoodSize = 0;
-    
+template <typename T, typename P>
+int cRegionGrower<T, P>::fGetNHood(const T lLinInd, T* lNHood) const {
+	T   lX, lY, lZ, lTemp;
+    int lNHoodSize = 0;
+
     lY = lLinInd % lNY; // get y coordinate, add +/-1 if in image range
 	if (lY >       0) lNHood[lNHoodSize++] = lLinInd - 1;
 	if (lY < lNY - 1) lNHood[lNHoodSize++] = lLinInd + 1;
-    
+
 	lTemp = lLinInd/lNY; // That is a floor() operation in c
 	lX = lTemp % lNX; // get x coordinate, add +/-1 if in image range. X increment is lNY
 	if (lX >       0) lNHood[lNHoodSize++] = lLinInd - lNY;
 	if (lX < lNX - 1) lNHood[lNHoodSize++] = lLinInd + lNY;
-    
+
     if (lNZ > 1) { // 3D case
         lZ = lTemp/lNX; // z coordinate, add +/-1 if in image range. Z increment is lNX*lNY
         if (lZ >       0) lNHood[lNHoodSize++] = lLinInd - lNX*lNY;
         if (lZ < lNZ - 1) lNHood[lNHoodSize++] = lLinInd + lNX*lNY;
     }
+    return lNHoodSize;
 }
 // ========================================================================
 // *** END OF FUNCTION fGetNHood
@@ -127,14 +254,15 @@ void fGetNHood(const long lLinInd, long& lNHoodSize, long* lNHood) {
 // *** Get the minimum and maximum value of an array
 // ***
 // ========================================================================
-void fGetMinMax(double *pdArray, long lLength, double &dMin, double &dMax)
+template <typename P>
+void fGetMinMax(const P *pdArray, size_t lLength, double &dMin, double &dMax)
 {
     dMax   = 0.0;
     dMin   = double(1e15);
 
-    for (long lI = 0; lI < lLength; lI++) {
-        dMin = ifMin(dMin, pdArray[lI]);
-        dMax = ifMax(dMax, pdArray[lI]);
+    for (size_t lI = 0; lI < lLength; lI++) {
+        dMin = ifMin(dMin, double(pdArray[lI]));
+        dMax = ifMax(dMax, double(pdArray[lI]));
     }
 }
 // ========================================================================
@@ -145,122 +273,54 @@ void fGetMinMax(double *pdArray, long lLength, double &dMin, double &dMax)
 
 // ========================================================================
 // ***
-// *** MAIN MEX FUNCTION RegionGrowing_mex
+// *** FUNCTION fGrow
 // ***
-// *** See m-file for description
+// *** Grow the region from seed lLinInd into the mask pbMask and/or the
+// *** list of voxel indices pvRegion (either can be NULL)
 // ***
 // ========================================================================
-void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[] )
+template <typename T, typename P>
+void cRegionGrower<T, P>::fGrow(T lLinInd, double dMaxDifference, bool *pbMask, vector<T> *pvRegion, mxArray **pParams, bool bDraw, long lUpdateCycle)
 {
-    // --------------------------------------------------------------------
-    // Check the number of the input and output arguments.
-    if(nrhs < 3)  mexErrMsgTxt("At least 3 input arguments required.");
-    if(nlhs != 1) mexErrMsgTxt("Exactly one ouput argument required.");
-    // --------------------------------------------------------------------
-    
-    // --------------------------------------------------------------------
-    // Get pointer/values to/of the input and outputs objects
-    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
-    // 1st input: Image (get dimensions as well)
-    if (!mxIsDouble(prhs[0])) mexErrMsgTxt("First input argument must be of type double.");
-    pdImg = (double*) mxGetData(prhs[0]);
-    const mwSize *pSize;
-    //const int* pSize = mxGetDimensions(prhs[0]);
-    pSize = mxGetDimensions(prhs[0]);
-    
-    long lNDims = mxGetNumberOfDimensions(prhs[0]);
-    lNY = long(pSize[0]);
-	lNX = long(pSize[1]);
-    long lUpdateCycle;
-    if (lNDims == 3) {
-        lNZ = long(pSize[2]);
-        lUpdateCycle = UPDATECYCLE3D;
-    } else {
-        lNZ = 1;
-        lUpdateCycle = UPDATECYCLE2D;
-    }
-    
-    long    lImSize = lNX*lNY*lNZ;
-    
-    double  dMax, dMin;
-    fGetMinMax(pdImg, lImSize, dMin, dMax);
-    double  dDynamicRange = dMax - dMin;
-    
-    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
-    // 2nd input: Seed point coordinates.
-    short *pSeed = (short*) mxGetPr(prhs[1]);
-    long lLinInd;
-    if (lNZ > 1)
-        lLinInd = long(pSeed[0]) - 1 + (long(pSeed[1]) - 1)*lNY + (long(pSeed[2]) - 1)*lNX*lNY;
-    else
-        lLinInd = long(pSeed[0]) - 1 + (long(pSeed[1]) - 1)*lNY;
-    
-    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
-    // 3rd input: RG stoping difference.
-    dMaxDif = double(*mxGetPr(prhs[2]));
-    
-    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
-    // Get pointer to output arguments and allocate memory for the corresponding objects
-    plhs[0] = mxCreateNumericArray(lNDims, pSize, mxLOGICAL_CLASS, mxREAL);	// create output array
-    bool *pbMask = (bool*) mxGetData(plhs[0]);						// get data pointer to mask
-        
-    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
-    // Create a parameter array for the call of the drawing function
-    mxArray *pParams[2];
-    bool bDraw = false;
-    if (nrhs > 3) {
-        pParams[0] = const_cast<mxArray *>(prhs[3]);
-        pParams[1] = const_cast<mxArray *>(plhs[0]);
-        bDraw = true;
-    }
+    size_t  lImSize = size_t(lNX)*lNY*lNZ;
 
-    // --------------------------------------------------------------------
-    // Start of the real functionality
-    
-    bool *pbCandidate = new bool [lNX * lNY * lNZ]();
-    aqQueue = new queue<long>[NQUEUES];
-    
-    long    lNHoodSize;
-    long    alNHood[6];
-    long    lInd;
-    long    lRegSize = 1;
+    int     iNHoodSize;
+    T       alNHood[6];
+    size_t  lRegSize = 1;
     long    lIterations = 0;
     long    lQueueInd;
-    
-    double  dDist;
+
     double  dLastDif = 0.0;
-    
-    dRegMean = pdImg[lLinInd];
-    
-    pbMask[lLinInd] = true;
-    pbCandidate[lLinInd] = true;
-    
+
+    dMaxDif  = dMaxDifference;
+    dRegMean = double(pdImg[lLinInd]);
+
+    if (pbMask) pbMask[lLinInd] = true;
+    if (pvRegion) pvRegion->push_back(lLinInd);
+    fSetVisited(lLinInd);
+
     // --------------------------------------------------------------------
     while ((lRegSize < lImSize) && (dLastDif < dMaxDif)){
 
-        fGetNHood(lLinInd, lNHoodSize, alNHood);
-        for (int iI = 0; iI < lNHoodSize; iI++) {
+        iNHoodSize = fGetNHood(lLinInd, alNHood);
+        for (int iI = 0; iI < iNHoodSize; iI++) {
             lLinInd = alNHood[iI];
-            if (pbCandidate[lLinInd]) continue;
-            
-            pbCandidate[lLinInd] = true;
-            lQueueInd = long(fabs(pdImg[lLinInd] - dRegMean) / dDynamicRange * NQUEUES * 2);
+            if (fIsVisited(lLinInd)) continue;
+
+            fSetVisited(lLinInd);
+            lQueueInd = long(fabs(double(pdImg[lLinInd]) - dRegMean) / dDynamicRange * NQUEUES * 2);
             if (lQueueInd > NQUEUES - 1) lQueueInd = NQUEUES - 1;
-            aqQueue[lQueueInd].push(lLinInd);
-        }
-        
-        lLinInd = fPop();
-        if (lLinInd < 0) {
-            delete [] aqQueue;
-            delete [] pbCandidate;
-            return;
+            cQueue.fPush(int(lQueueInd), lLinInd);
         }
-        
-        pbMask[lLinInd] = true;
-        dRegMean = (dRegMean*double(lRegSize) + pdImg[lLinInd]);
+
+        if (!fPop(lLinInd)) return;
+
+        if (pbMask) pbMask[lLinInd] = true;
+        if (pvRegion) pvRegion->push_back(lLinInd);
+        dRegMean = (dRegMean*double(lRegSize) + double(pdImg[lLinInd]));
         lRegSize++;
         dRegMean = dRegMean/double(lRegSize);
-        
+
         if (!(lIterations % lUpdateCycle) && bDraw) {
             mexCallMATLAB(0, 0, 2, pParams, "feval");
         }
@@ -268,10 +328,375 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[] )
     }
     // End of while loop
     // --------------------------------------------------------------------
-    
-    delete [] aqQueue;
-    delete [] pbCandidate;
+}
+// ========================================================================
+// *** END OF FUNCTION fGrow
+// ========================================================================
+
+
+
+// ========================================================================
+// ***
+// *** FUNCTIONS fAtomicNext and fAtomicMinLabel
+// ***
+// *** Thread safe fetch of the next seed number, and thread safe update of
+// *** a label to the lowest non-zero label
+// ***
+// ========================================================================
+inline long fAtomicNext(volatile long *plNext)
+{
+#ifdef _WIN32
+    return InterlockedIncrement(plNext) - 1;
+#else
+    return __sync_fetch_and_add(plNext, 1);
+#endif
+}
+
+inline void fAtomicMinLabel(volatile uint32 *piLabel, uint32 iLabel)
+{
+    uint32 iOld = *piLabel;
+    uint32 iPrev;
+    while (iOld == 0 || iLabel < iOld) {
+#ifdef _WIN32
+        iPrev = uint32(InterlockedCompareExchange((volatile LONG*) piLabel, LONG(iLabel), LONG(iOld)));
+#else
+        iPrev = __sync_val_compare_and_swap(piLabel, iOld, iLabel);
+#endif
+        if (iPrev == iOld) return;
+        iOld = iPrev;
+    }
+}
+// ========================================================================
+
+
+
+// ========================================================================
+// ***
+// *** FUNCTION fLabelThread
+// ***
+// *** Thread which takes the next seed until all seeds are grown, and
+// *** writes the region of every seed into the label volume
+// ***
+// ========================================================================
+template <typename T, typename P>
+struct sLabelArgs {
+    const P        *pImg;
+    T               lNY, lNX, lNZ;
+    double          dDynamicRange;
+    const size_t   *plSeeds;
+    const double   *pdMaxDif;
+    long            lNSeeds;
+    uint32         *piLabels;
+    volatile long  *plNext;
+};
+
+template <typename T, typename P>
+#ifdef _WIN32
+unsigned __stdcall fLabelThread(void *pArgs)
+#else
+void *fLabelThread(void *pArgs)
+#endif
+{
+    sLabelArgs<T, P> *pA = (sLabelArgs<T, P>*) pArgs;
+    cRegionGrower<T, P> cGrower(pA->pImg, pA->lNY, pA->lNX, pA->lNZ, pA->dDynamicRange, true);
+    vector<T> vRegion;
+    long lS;
+
+    while ((lS = fAtomicNext(pA->plNext)) < pA->lNSeeds) {
+        vRegion.clear();
+        cGrower.fGrow(T(pA->plSeeds[lS]), pA->pdMaxDif[lS], NULL, &vRegion, NULL, false, 1);
+        for (size_t lI = 0; lI < vRegion.size(); lI++) fAtomicMinLabel(&pA->piLabels[vRegion[lI]], uint32(lS + 1));
+        cGrower.fReset();
+    }
+    // plain return, so that the destructors of cGrower and vRegion run
+    // (_beginthreadex and pthread_create end the thread after it)
+    return 0;
+}
+// ========================================================================
+// *** END OF FUNCTION fLabelThread
+// ========================================================================
+
+
+
+// ========================================================================
+// ***
+// *** FUNCTION fGrowLabels
+// ***
+// *** Grow the regions of all seeds in feature('Numcores') threads into a
+// *** uint32 label volume
+// ***
+// ========================================================================
+template <typename T, typename P>
+void fGrowLabels(const mxArray *pImg, T lNY, T lNX, T lNZ, double dDynamicRange,
+                 const vector<size_t> &vSeeds, const vector<double> &vMaxDif, mxArray *plhs[])
+{
+    plhs[0] = mxCreateNumericArray(mxGetNumberOfDimensions(pImg), mxGetDimensions(pImg), mxUINT32_CLASS, mxREAL);
+
+    // Number of threads
+    mxArray *matlabCallOut[1] = {0};
+    mxArray *matlabCallIn[1] = {0};
+    matlabCallIn[0] = mxCreateString("Numcores");
+    mexCallMATLAB(1, matlabCallOut, 1, matlabCallIn, "feature");
+    int iNThreads = int(mxGetScalar(matlabCallOut[0]));
+    mxDestroyArray(matlabCallIn[0]);
+    mxDestroyArray(matlabCallOut[0]);
+    if (iNThreads > long(vSeeds.size())) iNThreads = int(vSeeds.size());
+    if (iNThreads < 1) iNThreads = 1;
+
+    volatile long lNext = 0;
+    sLabelArgs<T, P> sArgs;
+    sArgs.pImg          = (const P*) mxGetData(pImg);
+    sArgs.lNY           = lNY;
+    sArgs.lNX           = lNX;
+    sArgs.lNZ           = lNZ;
+    sArgs.dDynamicRange = dDynamicRange;
+    sArgs.plSeeds       = &vSeeds[0];
+    sArgs.pdMaxDif      = &vMaxDif[0];
+    sArgs.lNSeeds       = long(vSeeds.size());
+    sArgs.piLabels      = (uint32*) mxGetData(plhs[0]);
+    sArgs.plNext        = &lNext;
+
+#ifdef _WIN32
+    vector<HANDLE> vThreads(iNThreads);
+    for (int iI = 0; iI < iNThreads; iI++) vThreads[iI] = (HANDLE)_beginthreadex(NULL, 0, &fLabelThread<T, P>, &sArgs, 0, NULL);
+    for (int iI = 0; iI < iNThreads; iI++) WaitForSingleObject(vThreads[iI], INFINITE);
+    for (int iI = 0; iI < iNThreads; iI++) CloseHandle(vThreads[iI]);
+#else
+    vector<pthread_t> vThreads(iNThreads);
+    for (int iI = 0; iI < iNThreads; iI++) pthread_create(&vThreads[iI], NULL, &fLabelThread<T, P>, &sArgs);
+    for (int iI = 0; iI < iNThreads; iI++) pthread_join(vThreads[iI], NULL);
+#endif
+}
+// ========================================================================
+// *** END OF FUNCTION fGrowLabels
+// ========================================================================
+
+
+
+// ========================================================================
+// ***
+// *** FUNCTION fRegionGrowing
+// ***
+// *** Grow the region in an image of class P with index type T and
+// *** create the output of the requested mode (0 mask, 1 list, 2 crop,
+// *** 3 labels)
+// ***
+// ========================================================================
+template <typename T, typename P>
+void fRegionGrowing(const mxArray *pImg, const vector<size_t> &vSeeds, const vector<double> &vMaxDif, int iMode,
+                    int nlhs, mxArray *plhs[], mxArray *pDrawFcn)
+{
+    const mwSize *pSize = mxGetDimensions(pImg);
+    mwSize lNDims = mxGetNumberOfDimensions(pImg);
+    T lNY = T(pSize[0]);
+    T lNX = T(pSize[1]);
+    T lNZ = (lNDims == 3) ? T(pSize[2]) : 1;
+    long lUpdateCycle = (lNDims == 3) ? UPDATECYCLE3D : UPDATECYCLE2D;
+
+    double dMax, dMin;
+    fGetMinMax((const P*) mxGetData(pImg), mxGetNumberOfElements(pImg), dMin, dMax);
+
+    if (iMode == 3) {
+        fGrowLabels<T, P>(pImg, lNY, lNX, lNZ, dMax - dMin, vSeeds, vMaxDif, plhs);
+        return;
+    }
+
+    cRegionGrower<T, P> cGrower((const P*) mxGetData(pImg), lNY, lNX, lNZ, dMax - dMin);
+
+    // --------------------------------------------------------------------
+    // Full size mask, which is also passed to the drawing function
+    if (iMode == 0) {
+        plhs[0] = mxCreateNumericArray(lNDims, pSize, mxLOGICAL_CLASS, mxREAL);	// create output array
+        bool *pbMask = (bool*) mxGetData(plhs[0]);						// get data pointer to mask
+        mxArray *pParams[2];
+        pParams[0] = pDrawFcn;
+        pParams[1] = plhs[0];
+        cGrower.fGrow(T(vSeeds[0]), vMaxDif[0], pbMask, NULL, pParams, pDrawFcn != NULL, lUpdateCycle);
+        return;
+    }
+
+    vector<T> vRegion;
+    cGrower.fGrow(T(vSeeds[0]), vMaxDif[0], NULL, &vRegion, NULL, false, lUpdateCycle);
+    size_t lN = vRegion.size();
+
+    // --------------------------------------------------------------------
+    // 1-based linear indices of the region voxels, in the order of growing
+    if (iMode == 1) {
+        if (sizeof(T) == 4) {
+            plhs[0] = mxCreateNumericMatrix(lN, 1, mxUINT32_CLASS, mxREAL);
+            uint32 *piList = (uint32*) mxGetData(plhs[0]);
+            for (size_t lI = 0; lI < lN; lI++) piList[lI] = uint32(vRegion[lI]) + 1;
+        } else {
+            plhs[0] = mxCreateNumericMatrix(lN, 1, mxDOUBLE_CLASS, mxREAL);
+            double *pdList = mxGetPr(plhs[0]);
+            for (size_t lI = 0; lI < lN; lI++) pdList[lI] = double(vRegion[lI]) + 1.0;
+        }
+        return;
+    }
+
+    // --------------------------------------------------------------------
+    // Mask of the bounding box of the region and the 1-based position of
+    // its first voxel
+    T   alMin[3] = {lNY, lNX, lNZ}, alMax[3] = {0, 0, 0}, alPos[3];
+    for (size_t lI = 0; lI < lN; lI++) {
+        alPos[0] = vRegion[lI] % lNY;
+        alPos[1] = (vRegion[lI]/lNY) % lNX;
+        alPos[2] = vRegion[lI]/lNY/lNX;
+        for (int iD = 0; iD < 3; iD++) {
+            if (alPos[iD] < alMin[iD]) alMin[iD] = alPos[iD];
+            if (alPos[iD] > alMax[iD]) alMax[iD] = alPos[iD];
+        }
+    }
+    mwSize alCropSize[3];
+    for (int iD = 0; iD < 3; iD++) alCropSize[iD] = mwSize(alMax[iD] - alMin[iD] + 1);
+    plhs[0] = mxCreateNumericArray(lNDims, alCropSize, mxLOGICAL_CLASS, mxREAL);
+    bool *pbCrop = (bool*) mxGetData(plhs[0]);
+    for (size_t lI = 0; lI < lN; lI++) {
+        alPos[0] = vRegion[lI] % lNY - alMin[0];
+        alPos[1] = (vRegion[lI]/lNY) % lNX - alMin[1];
+        alPos[2] = vRegion[lI]/lNY/lNX - alMin[2];
+        pbCrop[alPos[0] + size_t(alCropSize[0])*(alPos[1] + size_t(alCropSize[1])*alPos[2])] = true;
+    }
+    if (nlhs > 1) {
+        plhs[1] = mxCreateDoubleMatrix(1, lNDims, mxREAL);
+        double *pdOffset = mxGetPr(plhs[1]);
+        for (mwSize iD = 0; iD < lNDims; iD++) pdOffset[iD] = double(alMin[iD]) + 1.0;
+    }
+}
+// ========================================================================
+// *** END OF FUNCTION fRegionGrowing
+// ========================================================================
+
+
+
+// ========================================================================
+// Select the index type, 32 bit indices if possible
+template <typename P>
+void fRegionGrowingIndex(const mxArray *pImg, const vector<size_t> &vSeeds, const vector<double> &vMaxDif, int iMode,
+                         int nlhs, mxArray *plhs[], mxArray *pDrawFcn)
+{
+    if (mxGetNumberOfElements(pImg) < size_t(0xFFFFFFFF))
+        fRegionGrowing<uint32, P>(pImg, vSeeds, vMaxDif, iMode, nlhs, plhs, pDrawFcn);
+    else
+        fRegionGrowing<size_t, P>(pImg, vSeeds, vMaxDif, iMode, nlhs, plhs, pDrawFcn);
+}
+// ========================================================================
+
+
+
+// ========================================================================
+// ***
+// *** MAIN MEX FUNCTION RegionGrowing_mex
+// ***
+// *** See m-file for description
+// ***
+// *** lMask = RegionGrowing_mex(Img, iSeed, dMaxDif, hDrawFcn)
+// *** lList = RegionGrowing_mex(Img, iSeed, dMaxDif, [], 'list')
+// *** [lCrop, dOffset] = RegionGrowing_mex(Img, iSeed, dMaxDif, [], 'crop')
+// *** iLabels = RegionGrowing_mex(Img, dSeeds, dMaxDif, [], 'labels')
+// ***    dSeeds: [N x ndims] double seed coordinates, dMaxDif: scalar or
+// ***    one per seed, iLabels: uint32 volume with the seed number
+// *** dInterface = RegionGrowing_mex('interface')
+// ***    returns 2 for this interface (native classes and output modes),
+// ***    older builds of the mex file error out
+// ***
+// ========================================================================
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[] )
+{
+    // --------------------------------------------------------------------
+    // Report the interface, so that the m-file can detect an older build
+    if (nrhs == 1 && mxIsChar(prhs[0])) {
+        plhs[0] = mxCreateDoubleScalar(2);
+        return;
+    }
+
+    // Check the number of the input and output arguments.
+    if(nrhs < 3)  mexErrMsgTxt("At least 3 input arguments required.");
+    if(nlhs > 2) mexErrMsgTxt("One or two ouput arguments required.");
+    // --------------------------------------------------------------------
+
+    // --------------------------------------------------------------------
+    // Get pointer/values to/of the input and outputs objects
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // 1st input: Image (get dimensions as well)
+    mxClassID iClass = mxGetClassID(prhs[0]);
+    if (iClass != mxDOUBLE_CLASS && iClass != mxSINGLE_CLASS && iClass != mxUINT8_CLASS && iClass != mxUINT16_CLASS)
+        mexErrMsgTxt("First input argument must be of type double, single, uint8 or uint16.");
+    const mwSize *pSize = mxGetDimensions(prhs[0]);
+    long lNDims = mxGetNumberOfDimensions(prhs[0]);
+    if (lNDims > 3) mexErrMsgTxt("Input image must be either 2D or 3D.");
+    size_t lNY = size_t(pSize[0]);
+	size_t lNX = size_t(pSize[1]);
+
+    size_t lNZ = (lNDims == 3) ? size_t(pSize[2]) : 1;
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // 4th input: the drawing function, only used with the mask output
+    mxArray *pDrawFcn = NULL;
+    if (nrhs > 3 && !mxIsEmpty(prhs[3])) pDrawFcn = const_cast<mxArray *>(prhs[3]);
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // 5th input: output mode
+    int iMode = 0;
+    if (nrhs > 4) {
+        char acMode[8];
+        if (!mxIsChar(prhs[4]) || mxGetString(prhs[4], acMode, 8)) mexErrMsgTxt("Output mode must be 'mask', 'list', 'crop' or 'labels'.");
+        if (strcmp(acMode, "list") == 0) iMode = 1;
+        else if (strcmp(acMode, "crop") == 0) iMode = 2;
+        else if (strcmp(acMode, "labels") == 0) iMode = 3;
+        else if (strcmp(acMode, "mask") != 0) mexErrMsgTxt("Output mode must be 'mask', 'list', 'crop' or 'labels'.");
+    }
+    if (iMode != 2 && nlhs > 1) mexErrMsgTxt("Only the 'crop' output mode has two outputs.");
+    if (iMode != 0 && pDrawFcn != NULL) mexErrMsgTxt("The drawing function needs the 'mask' output mode.");
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // 2nd input: Seed point coordinates.
+    vector<size_t> vSeeds;
+    if (iMode == 3) {
+        if (!mxIsDouble(prhs[1]) || mxGetN(prhs[1]) != size_t(lNDims)) mexErrMsgTxt("Seeds must be a double [N x ndims] matrix.");
+        size_t lNSeeds = mxGetM(prhs[1]);
+        if (lNSeeds == 0 || lNSeeds > size_t(0xFFFFFFFE)) mexErrMsgTxt("Invalid number of seeds.");
+        double *pdSeeds = mxGetPr(prhs[1]);
+        size_t alPos[3], alDims[3] = {lNY, lNX, lNZ};
+        for (size_t lS = 0; lS < lNSeeds; lS++) {
+            alPos[2] = 0;
+            for (long lD = 0; lD < lNDims; lD++) {
+                double dPos = pdSeeds[lS + lD*lNSeeds];
+                if (dPos < 1 || dPos > double(alDims[lD])) mexErrMsgTxt("Seeds must be inside the image.");
+                alPos[lD] = size_t(dPos) - 1;
+            }
+            vSeeds.push_back(alPos[0] + alPos[1]*lNY + alPos[2]*lNX*lNY);
+        }
+    } else {
+        short *pSeed = (short*) mxGetPr(prhs[1]);
+        if (lNDims == 3)
+            vSeeds.push_back(size_t(pSeed[0]) - 1 + (size_t(pSeed[1]) - 1)*lNY + (size_t(pSeed[2]) - 1)*lNX*lNY);
+        else
+            vSeeds.push_back(size_t(pSeed[0]) - 1 + (size_t(pSeed[1]) - 1)*lNY);
+    }
+
+    // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+    // 3rd input: RG stoping difference, one for all seeds or one per seed
+    vector<double> vMaxDif(vSeeds.size(), double(*mxGetPr(prhs[2])));
+    if (mxGetNumberOfElements(prhs[2]) == vSeeds.size()) {
+        for (size_t lS = 0; lS < vSeeds.size(); lS++) vMaxDif[lS] = mxGetPr(prhs[2])[lS];
+    } else if (mxGetNumberOfElements(prhs[2]) != 1) {
+        mexErrMsgTxt("MaxDif must be a scalar or have one value per seed.");
+    }
+
+    // --------------------------------------------------------------------
+    // Start of the real functionality in the class of the image
+    switch (iClass) {
+        case mxDOUBLE_CLASS:
+            fRegionGrowingIndex<double>(prhs[0], vSeeds, vMaxDif, iMode, nlhs, plhs, pDrawFcn); break;
+        case mxSINGLE_CLASS:
+            fRegionGrowingIndex<float>(prhs[0], vSeeds, vMaxDif, iMode, nlhs, plhs, pDrawFcn); break;
+        case mxUINT8_CLASS:
+            fRegionGrowingIndex<unsigned char>(prhs[0], vSeeds, vMaxDif, iMode, nlhs, plhs, pDrawFcn); break;
+        default:
+            fRegionGrowingIndex<unsigned short>(prhs[0], vSeeds, vMaxDif, iMode, nlhs, plhs, pDrawFcn); break;
+    }
 }
 // ========================================================================
 // *** END OF MAIN MEX FUNCTION RegionGrowing_mex
-// ========================================================================
\ No newline at end of file
+// ========================================================================
@@ -1,4 +1,4 @@
-function lMask = RegionGrowing(dImg, dMaxDif, iSeed)
+function [lMask, iOffset] = RegionGrowing(dImg, dMaxDif, iSeed, sOutput)
 %REGIONGROWING A MEXed 2D/3D region growing algorithm.
 %
 %   lMASK = REGIONGROWING(dIMG, dMAXDIF, iSEED) Returns a binary mask
@@ -7,6 +7,25 @@ function lMask = RegionGrowing(dImg, dMaxDif, iSeed)
 %   4-neighbourhood have an intensity difference smaller than dMAXDIF to
 %   the region's mean intensity.
 %
+%   lLIST = REGIONGROWING(dIMG, dMAXDIF, iSEED, 'list') Returns the linear
+%   indices of the region voxels instead of a mask of the image size.
+%
+%   [lCROP, iOFFSET] = REGIONGROWING(dIMG, dMAXDIF, iSEED, 'crop') Returns
+%   the mask of the bounding box of the region, iOFFSET is the position of
+%   its first voxel in the image, i.e. lMask(iOFFSET(1)+(0:size(lCROP,1)-1),
+%   iOFFSET(2)+(0:size(lCROP,2)-1), ...) = lCROP
+%
+%   iLABELS = REGIONGROWING(dIMG, dMAXDIF, dSEEDS, 'labels') Grows a region
+%   from every row of the [N x ndims] seed matrix dSEEDS in parallel, with
+%   dMAXDIF a scalar or one value per seed. Returns a uint32 label image,
+%   a voxel reached by several regions gets the lowest seed number.
+%
+%   Images of class double, single, uint8 and uint16 are processed without
+%   conversion, other classes are converted to double. An older build of
+%   the mex file only takes double images and returns the mask, the image
+%   is then converted to double and the other outputs are made from the
+%   mask.
+%
 %   If the seed point is not supplied, a GUI lets you select it. If no
 %   output is requested, the result of the region growing is visualized
 %
@@ -41,13 +60,22 @@ dOPACITY = 0.6;
 % Parse the input arguments
 if nargin < 2, error('At least two input arguments required!'); end
 if ndims(dImg) > 3, error('Input image must be either 2D or 3D!'); end
-dImg = double(dImg);
-if ~isscalar(dMaxDif), error('Second input argument (MaxDif) must be a scalar!'); end
+if ~isa(dImg, 'double') && ~isa(dImg, 'single') && ~isa(dImg, 'uint8') && ~isa(dImg, 'uint16')
+    dImg = double(dImg);
+end
+if nargin < 4, sOutput = 'mask'; end
+iOffset = ones(1, ndims(dImg));
+if strcmp(sOutput, 'labels')
+    if size(iSeed, 2) ~= ndims(dImg), error('Invalid seed points! Must be a [N x ndims(dImg)] matrix!'); end
+    if ~isscalar(dMaxDif) && numel(dMaxDif) ~= size(iSeed, 1), error('MaxDif must be a scalar or have one value per seed!'); end
+    iSeed = double(iSeed);
+    dMaxDif = double(dMaxDif(:));
+elseif ~isscalar(dMaxDif), error('Second input argument (MaxDif) must be a scalar!'); end
     
 if nargin < 3
-    iSeed = uint16(fGetSeed(dImg));
+    iSeed = uint16(fGetSeed(double(dImg)));
     if isempty(iSeed), return; end
-else
+elseif ~strcmp(sOutput, 'labels')
     if numel(iSeed) ~= ndims(dImg), error('Invalid seed point! Must have ndims(dImg) elements!'); end
     iSeed = uint16(iSeed(:));
 end
@@ -68,22 +96,43 @@ if exist('RegionGrowing_mex', 'file') ~= 3
     end
     cd(sCurrentPath);
 end
+
+% An older build of the mex file does not know the interface query
+try
+    lNative = RegionGrowing_mex('interface') >= 2;
+catch
+    lNative = false;
+end
+if ~lNative, dImg = double(dImg); end
 % -------------------------------------------------------------------------
 
 % -------------------------------------------------------------------------
 % Start the region growing process by calling the mex function
 if max(dImg(:)) == min(dImg(:))
-    lMask = true(size(dImg));
+    if strcmp(sOutput, 'list')
+        lMask = (1:numel(dImg))';
+    elseif strcmp(sOutput, 'labels')
+        lMask = ones(size(dImg), 'uint32');
+    else
+        lMask = true(size(dImg));
+    end
     warning('All image elements have the same value!');
-else
+elseif ~lNative
+    [lMask, iOffset] = fRegionGrowingMask(dImg, dMaxDif, iSeed, sOutput);
+elseif strcmp(sOutput, 'mask')
     lMask = RegionGrowing_mex(dImg, iSeed, dMaxDif);
+elseif strcmp(sOutput, 'crop')
+    [lMask, iOffset] = RegionGrowing_mex(dImg, iSeed, dMaxDif, [], sOutput);
+else
+    lMask = RegionGrowing_mex(dImg, iSeed, dMaxDif, [], sOutput);
 end
 % -------------------------------------------------------------------------
 
 
 % -------------------------------------------------------------------------
 % If no output requested, visualize the result
-if ~nargout
+if ~nargout && strcmp(sOutput, 'mask')
+    dImg = double(dImg);
     dImg = dImg - min(dImg(:)); % Normalize the image
     dImg = dImg./max(dImg(:));
     dImg = permute(dImg, [1 2 4 3]); % Change to RGB-mode
@@ -106,6 +155,43 @@ end
 
 
 
+% =========================================================================
+% *** FUNCTION fRegionGrowingMask
+% ***
+% *** The output modes with a mex file which only returns the mask
+% ***
+% =========================================================================
+function [lMask, iOffset] = fRegionGrowingMask(dImg, dMaxDif, iSeed, sOutput)
+iOffset = ones(1, ndims(dImg));
+if strcmp(sOutput, 'labels')
+    lMask = zeros(size(dImg), 'uint32');
+    for iS = size(iSeed, 1):-1:1     % the lowest seed number is written last
+        lRegion = RegionGrowing_mex(dImg, uint16(floor(iSeed(iS, :)')), dMaxDif(min(iS, numel(dMaxDif))));
+        lMask(lRegion) = iS;
+    end
+    return;
+end
+
+lMask = RegionGrowing_mex(dImg, iSeed, dMaxDif);
+if strcmp(sOutput, 'list')
+    lMask = find(lMask);
+elseif strcmp(sOutput, 'crop')
+    cPos = cell(1, ndims(lMask));
+    [cPos{:}] = ind2sub(size(lMask), find(lMask));
+    cRange = cell(1, ndims(lMask));
+    for iD = 1:ndims(lMask)
+        iOffset(iD) = min(cPos{iD});
+        cRange{iD} = iOffset(iD):max(cPos{iD});
+    end
+    lMask = lMask(cRange{:});
+end
+end
+% =========================================================================
+% *** END FUNCTION fRegionGrowingMask
+% =========================================================================
+
+
+
 % =========================================================================
 % *** FUNCTION fGetSeed
 % ***
@@ -42,12 +42,16 @@ function imgOut = mibResize3d(img, scale, options)
 % @note Resizing algorithms:
 % @li 'imresize' - [@em default] (fastest) for R2017a and later uses imresize3 function, otherwise use imresize to resize XY dimension after resize the Z-dimension, gives somewhat softer images than other methods;
 % @li 'interpn' - interpolation for 1-D, 2-D, 3-D, and N-D gridded data in
-% ndgrid format, quite fast but requires more memory that other methods
+% ndgrid format, quite fast but requires more memory that other methods;
+% the 'linear', 'cubic' and 'nearest' methods are done with the
+% affine_transform_3d_double mex file when it is compiled, in the class of
+% the dataset and in slabs of slices, which needs much less memory
 % @li 'tformarray' - resize using a spatial transformation to N-D array,
 % quite slow but more memory friendly comparing to 'interpn'
 
 % Updates
 % 11.04.2017, IB added imresize3 if it is available
+% 19.10.2026, 'interpn' with affine_transform_3d_double, when it is compiled
 
 imgOut = [];
 if nargin < 3; options = struct(); end
@@ -151,6 +155,33 @@ if strcmp(options.algorithm, 'imresize')
             imgOut = imgOut2;
         end
     end
+elseif strcmp(options.algorithm, 'interpn') && exist('affine_transform_3d_double', 'file') == 3 && ...
+        ismember(options.method, {'linear', 'nearest', 'cubic'}) && ismember(class(img), {'uint8', 'uint16', 'single', 'double'})
+    % the same grid as interpn, resampled with the mex file in the class of
+    % the dataset and in slabs of output slices, so only the input slices
+    % of one slab are copied and no coordinate grids are needed
+    imgOut = zeros([newH, newW, colors, newZ], class(img));   %#ok<ZEROLIKE> % allocate space
+    mode = find(strcmp(options.method, {'linear', 'cubic', 'nearest'}))*2-2;
+    % linspace(1, n, newN) as scaleVec.*(1:newN)+shiftVec for y, x, z
+    oldSize = [height, width, depth];
+    newSize = [newH, newW, newZ];
+    scaleVec = (oldSize-1)./max(1, newSize-1);
+    shiftVec = 1-scaleVec;
+    scaleVec(newSize==1) = 0;
+    shiftVec(newSize==1) = oldSize(newSize==1);
+    slabDepth = max(1, min(newZ, floor(2^26/(newH*newW))));  % about 64M voxels per slab
+    for z1 = 1:slabDepth:newZ
+        z2 = min(newZ, z1+slabDepth-1);
+        % input slices of the slab, with the cubic neighbors
+        zIn1 = max(1, floor(scaleVec(3)*z1+shiftVec(3))-1);
+        zIn2 = min(depth, ceil(scaleVec(3)*z2+shiftVec(3))+2);
+        M = [scaleVec(1) 0 0 shiftVec(1); 0 scaleVec(2) 0 shiftVec(2); 0 0 scaleVec(3) shiftVec(3)-zIn1+1; 0 0 0 1];
+        for colId=1:colors
+            slab = reshape(img(:,:,colId,zIn1:zIn2), [height, width, zIn2-zIn1+1]);
+            imgOut(:,:,colId,z1:z2) = reshape(affine_transform_3d_double(slab, M, mode, [1 newH; 1 newW; z1 z2]), [newH, newW, 1, z2-z1+1]);
+        end
+        if options.showWaitbar; waitbar(z2/newZ, wb); end
+    end
 elseif strcmp(options.algorithm, 'interpn')
     imgOut = zeros([newH, newW, colors, newZ], class(img));   %#ok<ZEROLIKE> % allocate space
     [xi,yi,zi] = ndgrid(linspace(1, height, newH), linspace(1, width, newW), linspace(1, depth, newZ));
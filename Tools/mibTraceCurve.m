@@ -72,7 +72,13 @@ img(pointsVec) = maxIntensity;
 %img(img > min([val1 val2])-abs(val1-val2)*options.scaleFactor & img < max([val1 val2])+abs(val1-val2)*options.scaleFactor) = maxIntensity;
 %img(img~=maxIntensity) = img(img~=maxIntensity)/50;
 
-DistanceMap = msfm(double(img)*1000+1, options.p2);
+% the speed image is passed in its own class, the marching stops as soon as
+% the starting point is reached
+if ~ismember(class(img), {'uint8', 'uint16', 'single', 'double'}); img = double(img); end
+msfmOptions.StopPoints = double(options.p1(:));
+msfmOptions.SpeedScale = 1000;
+msfmOptions.SpeedOffset = 1;
+DistanceMap = msfm(img, double(options.p2(:)), false, false, msfmOptions);
 ShortestLine=round(shortestpath(DistanceMap,options.p1,options.p2));
 for i=1:size(ShortestLine,1)
     mask(ShortestLine(i,1),ShortestLine(i,2)) = 1;
@@ -8,6 +8,9 @@ wb = waitbar(0, sprintf('Compiling Volume rendering\nPlease wait...'), 'Name', '
 currDir = fullfile(mibDir, 'GuiTools','volren');
 cd(currDir);
 mex -compatibleArrayDims -v affine_transform_2d_double.c image_interpolation.c;
+mex -compatibleArrayDims -v affine_transform_3d_double.c image_interpolation.c;
+mex -compatibleArrayDims -v oblique_slice.c image_interpolation.c;
+mex -compatibleArrayDims -v render_shearwarp.c image_interpolation.c;
 
 %% Compiling fast marching
 waitbar(0.05, wb, sprintf('Compiling Fast Marching\nPlease wait...'));
@@ -22,6 +25,7 @@ currDir = fullfile(mibDir, 'Tools','FastMarching','shortestpath');
 cd(currDir);
 %mex('rk4.c' ,'-v');
 mex -compatibleArrayDims -v rk4.c
+mex -compatibleArrayDims -v rk4path.c
 
 %% Compiling Frangi
 waitbar(0.1, wb, sprintf('Compiling Frangi\nPlease wait...'));
@@ -29,13 +33,17 @@ currDir = fullfile(mibDir, 'Tools','Frangi');
 cd(currDir);
 mex -compatibleArrayDims -v eig3volume.c
 mex -compatibleArrayDims -v imgaussian.c
+mex -compatibleArrayDims -v Hessian3D_mex.c
 
 %% Compiling Membrane Detection 
 waitbar(0.15, wb, sprintf('Compiling Membrane Detection\nPlease wait...'));
 currDir = fullfile(mibDir, 'Tools','RandomForest','MembraneDetection');
 cd(currDir);
 mex('meanvar.c' ,'-v');
+mex('meanvarimage.c' ,'-v');
 mex('transformImageFast.c' ,'-v');
+mex('centeredRotateBatch.c' ,'-v');
+mex('normxcorr2bank.c' ,'-v');
 
 %% Compiling SLIC superpixels
 waitbar(0.2, wb, sprintf('Compiling SLIC and Maxflow\nPlease wait...'));